@@ -244,4 +244,28 @@ uint sandbox_pci_read_bar(u32 barval, int type, uint size);
  */
 void sandbox_set_enable_memio(bool enable);
 
+/**
+ * sandbox_mmc_get_cmd_counts() - Get the multiple-block framing commands
+ *
+ * This returns the number of SET_BLOCK_COUNT and STOP_TRANSMISSION commands
+ * received since the last call, then resets both counts.
+ *
+ * @dev: MMC device to check
+ * @set_block_countp: Returns the number of SET_BLOCK_COUNT commands
+ * @stopp: Returns the number of STOP_TRANSMISSION commands
+ */
+void sandbox_mmc_get_cmd_counts(struct udevice *dev, uint *set_block_countp,
+				uint *stopp);
+
+/**
+ * sandbox_hash_get_count() - Get the number of hashes started on an engine
+ *
+ * This returns the number of hashes started since the last call, then
+ * resets the count.
+ *
+ * @dev: Sandbox hash engine
+ * @return number of hashes started
+ */
+uint sandbox_hash_get_count(struct udevice *dev);
+
 #endif
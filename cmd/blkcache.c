@@ -13,37 +13,80 @@
 static int blkc_show(struct cmd_tbl *cmdtp, int flag,
 		     int argc, char *const argv[])
 {
+	struct block_cache_dev_stats devs[8];
 	struct block_cache_stats stats;
+	int count, i;
+
 	blkcache_stats(&stats);
+	count = blkcache_dev_stats(devs, ARRAY_SIZE(devs));
 
 	printf("hits: %u\n"
 	       "misses: %u\n"
+	       "readaheads: %u\n"
 	       "entries: %u\n"
+	       "bytes: %lu\n"
 	       "max blocks/entry: %u\n"
-	       "max cache entries: %u\n",
-	       stats.hits, stats.misses, stats.entries,
-	       stats.max_blocks_per_entry, stats.max_entries);
+	       "max cache entries: %u\n"
+	       "max cache bytes: %lu\n"
+	       "max readahead blocks: %u\n",
+	       stats.hits, stats.misses, stats.readaheads, stats.entries,
+	       stats.bytes, stats.max_blocks_per_entry, stats.max_entries,
+	       stats.max_bytes, stats.max_readahead);
+
+	for (i = 0; i < min(count, (int)ARRAY_SIZE(devs)); i++)
+		printf("%s %d: hits %u, misses %u, readaheads %u, "
+		       "writes %u, flushes %u\n",
+		       blk_get_if_type_name(devs[i].iftype), devs[i].devnum,
+		       devs[i].hits, devs[i].misses, devs[i].readaheads,
+		       devs[i].writes, devs[i].flushes);
+
 	return 0;
 }
 
 static int blkc_configure(struct cmd_tbl *cmdtp, int flag,
 			  int argc, char *const argv[])
 {
-	unsigned blocks_per_entry, max_entries;
-	if (argc != 3)
+	struct block_cache_stats stats;
+	unsigned blocks_per_entry, max_entries, readahead;
+	unsigned long max_bytes;
+
+	if (argc < 3 || argc > 5)
 		return CMD_RET_USAGE;
 
+	blkcache_stats(&stats);
+	max_bytes = stats.max_bytes;
+	readahead = stats.max_readahead;
+
 	blocks_per_entry = simple_strtoul(argv[1], 0, 0);
 	max_entries = simple_strtoul(argv[2], 0, 0);
+	if (argc > 3)
+		max_bytes = simple_strtoul(argv[3], 0, 0) * 1024;
+	if (argc > 4)
+		readahead = simple_strtoul(argv[4], 0, 0);
 	blkcache_configure(blocks_per_entry, max_entries);
+	blkcache_configure_size(max_bytes, readahead);
 	printf("changed to max of %u entries of %u blocks each\n",
 	       max_entries, blocks_per_entry);
+	printf("using up to %lu KiB, readahead up to %u blocks\n",
+	       max_bytes / 1024, readahead);
+	return 0;
+}
+
+static int blkc_flush(struct cmd_tbl *cmdtp, int flag,
+		      int argc, char *const argv[])
+{
+	if (blkcache_flush_all()) {
+		printf("write-back failed\n");
+		return CMD_RET_FAILURE;
+	}
+
 	return 0;
 }
 
 static struct cmd_tbl cmd_blkc_sub[] = {
 	U_BOOT_CMD_MKENT(show, 0, 0, blkc_show, "", ""),
-	U_BOOT_CMD_MKENT(configure, 3, 0, blkc_configure, "", ""),
+	U_BOOT_CMD_MKENT(configure, 5, 0, blkc_configure, "", ""),
+	U_BOOT_CMD_MKENT(flush, 0, 0, blkc_flush, "", ""),
 };
 
 static __maybe_unused void blkc_reloc(void)
@@ -80,8 +123,9 @@ static int do_blkcache(struct cmd_tbl *cmdtp, int flag,
 }
 
 U_BOOT_CMD(
-	blkcache, 4, 0, do_blkcache,
+	blkcache, 6, 0, do_blkcache,
 	"block cache diagnostics and control",
 	"show - show and reset statistics\n"
-	"blkcache configure blocks entries\n"
+	"blkcache configure blocks entries [kbytes [readahead]]\n"
+	"blkcache flush - write back dirty blocks\n"
 );
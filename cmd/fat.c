@@ -129,7 +129,10 @@ static int do_fat_fswrite(struct cmd_tbl *cmdtp, int flag, int argc,
 	offset = (argc <= 6) ? 0 : simple_strtol(argv[6], NULL, 16);
 
 	buf = map_sysmem(addr, count);
+	blkcache_set_writeback(dev_desc->if_type, dev, true);
 	ret = file_fat_write(argv[4], buf, offset, count, &size);
+	if (blkcache_set_writeback(dev_desc->if_type, dev, false))
+		ret = -EIO;
 	unmap_sysmem(buf);
 	if (ret < 0) {
 		printf("\n** Unable to write \"%s\" from %s %d:%d **\n",
@@ -8,6 +8,7 @@
 #include <blk.h>
 #include <command.h>
 #include <console.h>
+#include <fs.h>
 #include <memalign.h>
 #include <mmc.h>
 #include <part.h>
@@ -141,6 +142,7 @@ static struct mmc *init_mmc_device(int dev, bool force_init)
 	struct blk_desc *bd = mmc_get_blk_desc(mmc);
 	blkcache_invalidate(bd->if_type, bd->devnum);
 #endif
+	fs_mount_invalidate(mmc_get_blk_desc(mmc));
 
 	return mmc;
 }
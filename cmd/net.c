@@ -11,8 +11,10 @@
 #include <bootstage.h>
 #include <command.h>
 #include <env.h>
+#include <fs.h>
 #include <image.h>
 #include <net.h>
+#include <net/wget.h>
 
 static int netboot_common(enum proto_t, struct cmd_tbl *, int, char * const []);
 
@@ -283,6 +285,53 @@ static int netboot_common(enum proto_t proto, struct cmd_tbl *cmdtp, int argc,
 	return rcode;
 }
 
+#if defined(CONFIG_CMD_WGET)
+static int do_wget(struct cmd_tbl *cmdtp, int flag, int argc,
+		   char *const argv[])
+{
+	int ret, type;
+
+	if (argc <= 3)
+		return netboot_common(WGET, cmdtp, argc, argv);
+	if (argc != 6)
+		return CMD_RET_USAGE;
+
+	/*
+	 * The file is written in pieces at growing offsets, which only FAT
+	 * and the sandbox host filesystem support, so fail before fetching
+	 */
+	if (fs_set_blk_dev(argv[3], argv[4], FS_TYPE_ANY))
+		return CMD_RET_FAILURE;
+	type = fs_get_type();
+	if (type != FS_TYPE_FAT && type != FS_TYPE_SANDBOX) {
+		printf("** Cannot write a file in pieces to %s **\n",
+		       fs_get_type_name());
+		fs_close();
+		return CMD_RET_FAILURE;
+	}
+	fs_close();
+
+	/* Stream into a file: nothing ends up in memory to boot */
+	image_load_addr = simple_strtoul(argv[1], NULL, 16);
+	net_boot_file_name_explicit = true;
+	copy_filename(net_boot_file_name, argv[2], sizeof(net_boot_file_name));
+	wget_set_file(argv[3], argv[4], argv[5]);
+	ret = net_loop(WGET);
+	wget_set_file(NULL, NULL, NULL);
+
+	return ret < 0 ? CMD_RET_FAILURE : CMD_RET_SUCCESS;
+}
+
+U_BOOT_CMD(
+	wget,	6,	1,	do_wget,
+	"load a file via network using HTTP",
+	"[loadAddress] [[hostIPaddr:]path]\n"
+	"wget loadAddress [hostIPaddr:]path interface dev[:part] filename\n"
+	"    - write the file to 'filename' on the FAT filesystem of the\n"
+	"      given device, using the memory at loadAddress as buffer"
+);
+#endif
+
 #if defined(CONFIG_CMD_PING)
 static int do_ping(struct cmd_tbl *cmdtp, int flag, int argc,
 		   char *const argv[])
@@ -21,6 +21,7 @@
 #include <asm/io.h>
 #include <linux/errno.h>
 #include <u-boot/crc.h>
+#include <u-boot/hash.h>
 #else
 #include "mkimage.h"
 #include <time.h>
@@ -38,6 +39,12 @@
 DECLARE_GLOBAL_DATA_PTR;
 #endif
 
+#ifndef USE_HOSTCC
+#define HASH_ENABLE_DM	CONFIG_IS_ENABLED(DM_HASH)
+#else
+#define HASH_ENABLE_DM	0
+#endif
+
 static void reloc_update(void);
 
 #if defined(CONFIG_SHA1) && !defined(CONFIG_SHA_PROG_HW_ACCEL)
@@ -296,6 +303,200 @@ static struct hash_algo hash_algo[] = {
 	},
 };
 
+#if HASH_ENABLE_DM
+/*
+ * Entries used instead of the ones above when a hash engine supports the
+ * algorithm. The software entry is still used if the engine fails.
+ */
+struct hash_dm_ctx {
+	struct udevice *dev;
+	void *ctx;
+};
+
+static struct hash_algo *hash_find_sw(const char *algo_name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(hash_algo); i++) {
+		if (!strcmp(algo_name, hash_algo[i].name))
+			return &hash_algo[i];
+	}
+
+	return NULL;
+}
+
+static void hash_dm_func_ws(const char *algo_name, const unsigned char *input,
+			    unsigned int ilen, unsigned char *output,
+			    unsigned int chunk_sz)
+{
+	struct udevice *dev;
+	int id;
+
+	id = hash_algo_id_by_name(algo_name);
+	if (id >= 0 && !dm_hash_get_engine(id, &dev) &&
+	    !dm_hash_digest_wd(dev, id, input, ilen, output, chunk_sz))
+		return;
+
+	hash_find_sw(algo_name)->hash_func_ws(input, ilen, output, chunk_sz);
+}
+
+#define HASH_DM_FUNC_WS(_name)						\
+static void hash_dm_##_name(const unsigned char *input,			\
+			    unsigned int ilen, unsigned char *output,	\
+			    unsigned int chunk_sz)			\
+{									\
+	hash_dm_func_ws(#_name, input, ilen, output, chunk_sz);	\
+}
+
+HASH_DM_FUNC_WS(crc32)
+#ifdef CONFIG_SHA1
+HASH_DM_FUNC_WS(sha1)
+#endif
+#ifdef CONFIG_SHA256
+HASH_DM_FUNC_WS(sha256)
+#endif
+#ifdef CONFIG_SHA384
+HASH_DM_FUNC_WS(sha384)
+#endif
+#ifdef CONFIG_SHA512
+HASH_DM_FUNC_WS(sha512)
+#endif
+
+static int hash_init_dm(struct hash_algo *algo, void **ctxp)
+{
+	struct hash_dm_ctx *ctx;
+	int id, ret;
+
+	id = hash_algo_id_by_name(algo->name);
+	if (id < 0)
+		return -1;
+	ctx = malloc(sizeof(*ctx));
+	if (!ctx)
+		return -1;
+	ret = dm_hash_get_engine(id, &ctx->dev);
+	if (!ret)
+		ret = dm_hash_init(ctx->dev, id, &ctx->ctx);
+	if (ret) {
+		free(ctx);
+		return -1;
+	}
+	*ctxp = ctx;
+
+	return 0;
+}
+
+static int hash_update_dm(struct hash_algo *algo, void *ctx, const void *buf,
+			  unsigned int size, int is_last)
+{
+	struct hash_dm_ctx *dm_ctx = ctx;
+
+	if (dm_hash_update(dm_ctx->dev, dm_ctx->ctx, buf, size)) {
+		free(dm_ctx);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int hash_finish_dm(struct hash_algo *algo, void *ctx, void *dest_buf,
+			  int size)
+{
+	struct hash_dm_ctx *dm_ctx = ctx;
+	int ret;
+
+	if (size < algo->digest_size)
+		return -1;
+
+	ret = dm_hash_finish(dm_ctx->dev, dm_ctx->ctx, dest_buf);
+	free(dm_ctx);
+
+	return ret ? -1 : 0;
+}
+
+/*
+ * crc32 keeps the software progressive functions since callers such as
+ * dfu read the running value straight out of the context.
+ */
+static struct hash_algo hash_algo_dm[] = {
+#ifdef CONFIG_SHA1
+	{
+		.name		= "sha1",
+		.digest_size	= SHA1_SUM_LEN,
+		.chunk_size	= CHUNKSZ_SHA1,
+		.hash_func_ws	= hash_dm_sha1,
+		.hash_init	= hash_init_dm,
+		.hash_update	= hash_update_dm,
+		.hash_finish	= hash_finish_dm,
+	},
+#endif
+#ifdef CONFIG_SHA256
+	{
+		.name		= "sha256",
+		.digest_size	= SHA256_SUM_LEN,
+		.chunk_size	= CHUNKSZ_SHA256,
+		.hash_func_ws	= hash_dm_sha256,
+		.hash_init	= hash_init_dm,
+		.hash_update	= hash_update_dm,
+		.hash_finish	= hash_finish_dm,
+	},
+#endif
+#ifdef CONFIG_SHA384
+	{
+		.name		= "sha384",
+		.digest_size	= SHA384_SUM_LEN,
+		.chunk_size	= CHUNKSZ_SHA384,
+		.hash_func_ws	= hash_dm_sha384,
+		.hash_init	= hash_init_dm,
+		.hash_update	= hash_update_dm,
+		.hash_finish	= hash_finish_dm,
+	},
+#endif
+#ifdef CONFIG_SHA512
+	{
+		.name		= "sha512",
+		.digest_size	= SHA512_SUM_LEN,
+		.chunk_size	= CHUNKSZ_SHA512,
+		.hash_func_ws	= hash_dm_sha512,
+		.hash_init	= hash_init_dm,
+		.hash_update	= hash_update_dm,
+		.hash_finish	= hash_finish_dm,
+	},
+#endif
+	{
+		.name		= "crc32",
+		.digest_size	= 4,
+		.chunk_size	= CHUNKSZ_CRC32,
+		.hash_func_ws	= hash_dm_crc32,
+		.hash_init	= hash_init_crc32,
+		.hash_update	= hash_update_crc32,
+		.hash_finish	= hash_finish_crc32,
+	},
+};
+
+/* Return the engine-backed entry for @algo if an engine supports it */
+static struct hash_algo *hash_lookup_dm(struct hash_algo *algo)
+{
+	struct udevice *dev;
+	int i, id;
+
+	id = hash_algo_id_by_name(algo->name);
+	if (id < 0 || dm_hash_get_engine(id, &dev))
+		return algo;
+
+	for (i = 0; i < ARRAY_SIZE(hash_algo_dm); i++) {
+		if (!strcmp(algo->name, hash_algo_dm[i].name))
+			return &hash_algo_dm[i];
+	}
+
+	return algo;
+}
+#else
+static struct hash_algo *hash_lookup_dm(struct hash_algo *algo)
+{
+	return algo;
+}
+#endif
+
 /* Try to minimize code size for boards that don't want much hashing */
 #if defined(CONFIG_SHA256) || defined(CONFIG_CMD_SHA1SUM) || \
 	defined(CONFIG_CRC32_VERIFY) || defined(CONFIG_CMD_HASH) || \
@@ -305,21 +506,32 @@ static struct hash_algo hash_algo[] = {
 #define multi_hash()	0
 #endif
 
+#if !defined(USE_HOSTCC) && defined(CONFIG_NEEDS_MANUAL_RELOC)
+static void reloc_table(struct hash_algo *table, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		table[i].name += gd->reloc_off;
+		table[i].hash_func_ws += gd->reloc_off;
+		table[i].hash_init += gd->reloc_off;
+		table[i].hash_update += gd->reloc_off;
+		table[i].hash_finish += gd->reloc_off;
+	}
+}
+#endif
+
 static void reloc_update(void)
 {
 #if !defined(USE_HOSTCC) && defined(CONFIG_NEEDS_MANUAL_RELOC)
-	int i;
 	static bool done;
 
 	if (!done) {
 		done = true;
-		for (i = 0; i < ARRAY_SIZE(hash_algo); i++) {
-			hash_algo[i].name += gd->reloc_off;
-			hash_algo[i].hash_func_ws += gd->reloc_off;
-			hash_algo[i].hash_init += gd->reloc_off;
-			hash_algo[i].hash_update += gd->reloc_off;
-			hash_algo[i].hash_finish += gd->reloc_off;
-		}
+		reloc_table(hash_algo, ARRAY_SIZE(hash_algo));
+#if HASH_ENABLE_DM
+		reloc_table(hash_algo_dm, ARRAY_SIZE(hash_algo_dm));
+#endif
 	}
 #endif
 }
@@ -332,7 +544,7 @@ int hash_lookup_algo(const char *algo_name, struct hash_algo **algop)
 
 	for (i = 0; i < ARRAY_SIZE(hash_algo); i++) {
 		if (!strcmp(algo_name, hash_algo[i].name)) {
-			*algop = &hash_algo[i];
+			*algop = hash_lookup_dm(&hash_algo[i]);
 			return 0;
 		}
 	}
@@ -351,7 +563,7 @@ int hash_progressive_lookup_algo(const char *algo_name,
 	for (i = 0; i < ARRAY_SIZE(hash_algo); i++) {
 		if (!strcmp(algo_name, hash_algo[i].name)) {
 			if (hash_algo[i].hash_init) {
-				*algop = &hash_algo[i];
+				*algop = hash_lookup_dm(&hash_algo[i]);
 				return 0;
 			}
 		}
@@ -22,6 +22,8 @@
 #include <mapmem.h>
 #include <asm/io.h>
 #include <malloc.h>
+#include <watchdog.h>
+#include <u-boot/hash.h>
 DECLARE_GLOBAL_DATA_PTR;
 #endif /* !USE_HOSTCC*/
 
@@ -1194,6 +1196,16 @@ int fit_set_timestamp(void *fit, int noffset, time_t timestamp)
 int calculate_hash(const void *data, int data_len, const char *algo,
 			uint8_t *value, int *value_len)
 {
+#ifndef USE_HOSTCC
+#if CONFIG_IS_ENABLED(DM_HASH)
+	/* Use a hash engine for the algorithms the uclass knows about */
+	if (hash_algo_id_by_name(algo) >= 0) {
+		*value_len = FIT_MAX_HASH_LEN;
+		if (!hash_block(algo, data, data_len, value, value_len))
+			return 0;
+	}
+#endif
+#endif
 	if (IMAGE_ENABLE_CRC32 && strcmp(algo, "crc32") == 0) {
 		*((uint32_t *)value) = crc32_wd(0, data, data_len,
 							CHUNKSZ_CRC32);
@@ -1337,6 +1349,179 @@ error:
 	return 0;
 }
 
+#if IMAGE_ENABLE_HASH_STREAM
+void fit_image_hash_stream_abort(struct fit_hash_stream *st)
+{
+	uint8_t value[FIT_MAX_HASH_LEN];
+	int i;
+
+	/* hash_finish() is the only way to free a context */
+	for (i = 0; i < st->count; i++) {
+		if (st->node[i].ctx)
+			st->node[i].algo->hash_finish(st->node[i].algo,
+						      st->node[i].ctx, value,
+						      sizeof(value));
+		st->node[i].ctx = NULL;
+	}
+	st->count = 0;
+}
+
+int fit_image_hash_stream_start(struct fit_hash_stream *st, const void *fit,
+				int image_noffset)
+{
+	const void *sig_blob = gd_fdt_blob();
+	int noffset, ignore;
+	char *algo;
+
+	st->fit = fit;
+	st->image_noffset = image_noffset;
+	st->count = 0;
+
+	/* Signatures are checked over the whole image by the RSA code */
+	if (FIT_IMAGE_ENABLE_VERIFY && sig_blob &&
+	    fdt_subnode_offset(sig_blob, 0, FIT_SIG_NODENAME) >= 0)
+		return -ENOTSUPP;
+
+	fdt_for_each_subnode(noffset, fit, image_noffset) {
+		const char *name = fit_get_name(fit, noffset, NULL);
+
+		if (FIT_IMAGE_ENABLE_VERIFY &&
+		    !strncmp(name, FIT_SIG_NODENAME,
+			     strlen(FIT_SIG_NODENAME)))
+			goto unsupported;
+		if (strncmp(name, FIT_HASH_NODENAME,
+			    strlen(FIT_HASH_NODENAME)))
+			continue;
+		if (st->count == FIT_HASH_STREAM_MAX ||
+		    fit_image_hash_get_algo(fit, noffset, &algo))
+			goto unsupported;
+
+		st->node[st->count].noffset = noffset;
+		st->node[st->count].ctx = NULL;
+		ignore = 0;
+		if (IMAGE_ENABLE_IGNORE)
+			fit_image_hash_get_ignore(fit, noffset, &ignore);
+		if (!ignore) {
+			struct hash_algo *hash;
+
+			if (hash_progressive_lookup_algo(algo, &hash) ||
+			    hash->hash_init(hash, &st->node[st->count].ctx))
+				goto unsupported;
+			st->node[st->count].algo = hash;
+		}
+		st->count++;
+	}
+	if (noffset == -FDT_ERR_TRUNCATED || noffset == -FDT_ERR_BADSTRUCTURE)
+		goto unsupported;
+
+	return 0;
+
+unsupported:
+	fit_image_hash_stream_abort(st);
+	return -ENOTSUPP;
+}
+
+int fit_image_hash_stream_update(struct fit_hash_stream *st, const void *buf,
+				 size_t size)
+{
+	int i;
+
+	for (i = 0; i < st->count; i++) {
+		struct hash_algo *algo = st->node[i].algo;
+
+		if (!st->node[i].ctx)
+			continue;
+		if (algo->hash_update(algo, st->node[i].ctx, buf, size, 0)) {
+			/* The failing context has already been freed */
+			st->node[i].ctx = NULL;
+			fit_image_hash_stream_abort(st);
+			return -EIO;
+		}
+	}
+
+	return 0;
+}
+
+int fit_image_hash_stream_finish(struct fit_hash_stream *st)
+{
+	uint8_t value[FIT_MAX_HASH_LEN];
+	uint8_t *fit_value;
+	int fit_value_len;
+	char *err_msg = "";
+	int noffset = 0;
+	char *algo;
+	int i;
+
+	for (i = 0; i < st->count; i++) {
+		struct hash_algo *hash = st->node[i].algo;
+
+		noffset = st->node[i].noffset;
+		fit_image_hash_get_algo(st->fit, noffset, &algo);
+		printf("%s", algo);
+		if (!st->node[i].ctx) {
+			printf("-skipped ");
+			continue;
+		}
+
+		if (hash->hash_finish(hash, st->node[i].ctx, value,
+				      sizeof(value))) {
+			st->node[i].ctx = NULL;
+			err_msg = "Unsupported hash algorithm";
+			goto error;
+		}
+		st->node[i].ctx = NULL;
+		/* The progressive crc32 is in CPU order, FIT stores it in BE */
+		if (!strcmp(hash->name, "crc32"))
+			*(uint32_t *)value = cpu_to_uimage(*(uint32_t *)value);
+
+		if (fit_image_hash_get_value(st->fit, noffset, &fit_value,
+					     &fit_value_len)) {
+			err_msg = "Can't get hash value property";
+			goto error;
+		}
+		if (hash->digest_size != fit_value_len) {
+			err_msg = "Bad hash value len";
+			goto error;
+		} else if (memcmp(value, fit_value, fit_value_len)) {
+			err_msg = "Bad hash value";
+			goto error;
+		}
+		puts("+ ");
+	}
+	st->count = 0;
+
+	return 1;
+
+error:
+	fit_image_hash_stream_abort(st);
+	printf(" error!\n%s for '%s' hash node in '%s' image node\n",
+	       err_msg, fit_get_name(st->fit, noffset, NULL),
+	       fit_get_name(st->fit, st->image_noffset, NULL));
+	return 0;
+}
+
+int fit_image_copy_verify(struct fit_hash_stream *st, void *dst,
+			  const void *src, size_t size)
+{
+	size_t chunk;
+
+	while (size) {
+		chunk = min_t(size_t, size, FIT_HASH_STREAM_CHUNK);
+		memcpy(dst, src, chunk);
+		if (fit_image_hash_stream_update(st, dst, chunk)) {
+			puts(" error!\nHashing failed\n");
+			return 0;
+		}
+		dst += chunk;
+		src += chunk;
+		size -= chunk;
+		WATCHDOG_RESET();
+	}
+
+	return fit_image_hash_stream_finish(st);
+}
+#endif
+
 /**
  * fit_image_verify - verify data integrity
  * @fit: pointer to the FIT format image header
@@ -1818,6 +2003,41 @@ static int fit_image_select(const void *fit, int rd_noffset, int verify)
 	return 0;
 }
 
+#if IMAGE_ENABLE_HASH_STREAM
+/*
+ * Verify an image whose check was put off until it is loaded. If @dst is
+ * not NULL the image is copied there, hashing it as it goes when possible.
+ */
+static int fit_image_load_verify(const void *fit, int noffset, void *dst,
+				 const void *src, size_t len)
+{
+	struct fit_hash_stream st;
+	int ok;
+
+	puts("   Verifying Hash Integrity ... ");
+	if (dst && !fit_image_hash_stream_start(&st, fit, noffset)) {
+		ok = fit_image_copy_verify(&st, dst, src, len);
+	} else {
+		ok = fit_image_verify(fit, noffset);
+		if (ok && dst)
+			memcpy(dst, src, len);
+	}
+	if (!ok) {
+		puts("Bad Data Hash\n");
+		return -EACCES;
+	}
+	puts("OK\n");
+
+	return 0;
+}
+#else
+static int fit_image_load_verify(const void *fit, int noffset, void *dst,
+				 const void *src, size_t len)
+{
+	return 0;
+}
+#endif
+
 int fit_get_node_from_config(bootm_headers_t *images, const char *prop_name,
 			ulong addr)
 {
@@ -1898,6 +2118,7 @@ int fit_image_load(bootm_headers_t *images, ulong addr,
 	uint8_t os_arch;
 #endif
 	const char *prop_name;
+	bool verify_on_load;
 	int ret;
 
 	fit = map_sysmem(addr, 0);
@@ -1969,7 +2190,15 @@ int fit_image_load(bootm_headers_t *images, ulong addr,
 
 	printf("   Trying '%s' %s subimage\n", fit_uname, prop_name);
 
-	ret = fit_image_select(fit, noffset, images->verify);
+	/*
+	 * Images copied to a load address are verified during the copy,
+	 * unless they are decrypted first
+	 */
+	verify_on_load = IMAGE_ENABLE_HASH_STREAM && images->verify &&
+			 load_op != FIT_LOAD_IGNORED &&
+			 fdt_subnode_offset(fit, noffset,
+					    FIT_CIPHER_NODENAME) < 0;
+	ret = fit_image_select(fit, noffset, images->verify && !verify_on_load);
 	if (ret) {
 		bootstage_error(bootstage_id + BOOTSTAGE_SUB_HASH);
 		return ret;
@@ -2092,6 +2321,12 @@ int fit_image_load(bootm_headers_t *images, ulong addr,
 	      image_type == IH_TYPE_KERNEL_NOLOAD ||
 	      image_type == IH_TYPE_RAMDISK)) {
 		ulong max_decomp_len = len * 20;
+
+		if (verify_on_load &&
+		    fit_image_load_verify(fit, noffset, NULL, buf, len)) {
+			bootstage_error(bootstage_id + BOOTSTAGE_SUB_HASH);
+			return -EACCES;
+		}
 		if (load == data) {
 			loadbuf = malloc(max_decomp_len);
 			load = map_to_sysmem(loadbuf);
@@ -2107,7 +2342,17 @@ int fit_image_load(bootm_headers_t *images, ulong addr,
 		len = load_end - load;
 	} else if (load != data) {
 		loadbuf = map_sysmem(load, len);
-		memcpy(loadbuf, buf, len);
+		if (!verify_on_load) {
+			memcpy(loadbuf, buf, len);
+		} else if (fit_image_load_verify(fit, noffset, loadbuf, buf,
+						 len)) {
+			bootstage_error(bootstage_id + BOOTSTAGE_SUB_HASH);
+			return -EACCES;
+		}
+	} else if (verify_on_load &&
+		   fit_image_load_verify(fit, noffset, NULL, buf, len)) {
+		bootstage_error(bootstage_id + BOOTSTAGE_SUB_HASH);
+		return -EACCES;
 	}
 
 	if (image_type == IH_TYPE_RAMDISK && comp != IH_COMP_NONE)
@@ -551,7 +551,11 @@ int image_decomp(int comp, ulong load, ulong image_start, int type,
 				return ZSTD_getErrorCode(ret);
 			}
 
-			if (in_buf.pos >= image_len || !ret)
+			if (in_buf.pos >= image_len)
+				break;
+			/* Carry on into the next frame, if there is one */
+			if (!ret && !ZSTD_isFrame(image_buf + in_buf.pos,
+						  image_len - in_buf.pos))
 				break;
 		}
 
@@ -219,6 +219,43 @@ static int get_aligned_image_size(struct spl_load_info *info, int data_size,
 	return (data_size + info->bl_len - 1) / info->bl_len;
 }
 
+/*
+ * Read an image in chunks, feeding the image data in each chunk to the
+ * hashes as soon as it has arrived
+ */
+static int spl_fit_read_hashed(struct spl_load_info *info, ulong sector,
+			       int nr_sectors, void *buf, ulong overhead,
+			       size_t length, struct fit_hash_stream *st)
+{
+	ulong unit = info->filename ? 1 : info->bl_len;
+	int chunk = max_t(int, FIT_HASH_STREAM_CHUNK / unit, 1);
+	size_t skip = overhead;
+	size_t start, size;
+	int count;
+
+	while (nr_sectors) {
+		count = min(chunk, nr_sectors);
+		if (info->read(info, sector, count, buf) != count) {
+			fit_image_hash_stream_abort(st);
+			return -EIO;
+		}
+
+		/* Leave out the alignment before and padding after the data */
+		start = min_t(size_t, skip, count * unit);
+		size = min_t(size_t, count * unit - start, length);
+		if (fit_image_hash_stream_update(st, buf + start, size))
+			return -EIO;
+		skip -= start;
+		length -= size;
+
+		buf += count * unit;
+		sector += count;
+		nr_sectors -= count;
+	}
+
+	return 0;
+}
+
 /**
  * spl_load_fit_image(): load the image described in a certain FIT node
  * @info:	points to information about the device to load data from
@@ -252,6 +289,9 @@ static int spl_load_fit_image(struct spl_load_info *info, ulong sector,
 	uint8_t image_comp = -1, type = -1;
 	const void *data;
 	bool external_data = false;
+	struct fit_hash_stream hash_stream;
+	bool hashed = false;
+	int ret;
 
 	if (IS_ENABLED(CONFIG_SPL_FPGA_SUPPORT) ||
 	    (IS_ENABLED(CONFIG_SPL_OS_BOOT) && IS_ENABLED(CONFIG_SPL_GZIP))) {
@@ -287,10 +327,20 @@ static int spl_load_fit_image(struct spl_load_info *info, ulong sector,
 		overhead = get_aligned_image_overhead(info, offset);
 		nr_sectors = get_aligned_image_size(info, length, offset);
 
-		if (info->read(info,
-			       sector + get_aligned_image_offset(info, offset),
-			       nr_sectors, (void *)load_ptr) != nr_sectors)
+		sector += get_aligned_image_offset(info, offset);
+
+		if (IS_ENABLED(CONFIG_SPL_FIT_HASH_STREAM) &&
+		    !fit_image_hash_stream_start(&hash_stream, fit, node)) {
+			ret = spl_fit_read_hashed(info, sector, nr_sectors,
+						  (void *)load_ptr, overhead,
+						  length, &hash_stream);
+			if (ret)
+				return ret;
+			hashed = true;
+		} else if (info->read(info, sector, nr_sectors,
+				      (void *)load_ptr) != nr_sectors) {
 			return -EIO;
+		}
 
 		debug("External data: dst=%lx, offset=%x, size=%lx\n",
 		      load_ptr, offset, (unsigned long)length);
@@ -309,9 +359,12 @@ static int spl_load_fit_image(struct spl_load_info *info, ulong sector,
 #ifdef CONFIG_SPL_FIT_SIGNATURE
 	printf("## Checking hash(es) for Image %s ... ",
 	       fit_get_name(fit, node, NULL));
-	if (!fit_image_verify_with_data(fit, node,
-					 src, length))
+	if (hashed) {
+		if (!fit_image_hash_stream_finish(&hash_stream))
+			return -EPERM;
+	} else if (!fit_image_verify_with_data(fit, node, src, length)) {
 		return -EPERM;
+	}
 	puts("OK\n");
 #endif
 
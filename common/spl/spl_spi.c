@@ -118,7 +118,7 @@ static int spl_spi_load_image(struct spl_image_info *spl_image,
 		if (err) {
 			debug("%s: Failed to read from SPI flash (err=%d)\n",
 			      __func__, err);
-			return err;
+			goto out;
 		}
 
 		if (IS_ENABLED(CONFIG_SPL_LOAD_FIT_FULL) &&
@@ -127,7 +127,7 @@ static int spl_spi_load_image(struct spl_image_info *spl_image,
 					     roundup(fdt_totalsize(header), 4),
 					     (void *)CONFIG_SYS_LOAD_ADDR);
 			if (err)
-				return err;
+				goto out;
 			err = spl_parse_image_header(spl_image,
 					(struct image_header *)CONFIG_SYS_LOAD_ADDR);
 		} else if (IS_ENABLED(CONFIG_SPL_LOAD_FIT) &&
@@ -157,13 +157,21 @@ static int spl_spi_load_image(struct spl_image_info *spl_image,
 		} else {
 			err = spl_parse_image_header(spl_image, header);
 			if (err)
-				return err;
+				goto out;
 			err = spi_flash_read(flash, payload_offs,
 					     spl_image->size,
 					     (void *)spl_image->load_addr);
 		}
 	}
 
+out:
+	/*
+	 * SPL does not remove its devices before jumping to the next stage,
+	 * so put the flash back in its power-on mode here (e.g. leave octal
+	 * DTR) for the next stage to probe it.
+	 */
+	spi_flash_free(flash);
+
 	return err;
 }
 /* Use priorty 1 so that boards can override this */
@@ -9,6 +9,7 @@
 #include <command.h>
 #include <env.h>
 #include <errno.h>
+#include <fs.h>
 #include <ide.h>
 #include <log.h>
 #include <malloc.h>
@@ -231,15 +232,14 @@ void dev_print (struct blk_desc *dev_desc)
 
 #ifdef CONFIG_HAVE_BLOCK_DEVICE
 
-void part_init(struct blk_desc *dev_desc)
+/* Detect the type of the partition table on the device */
+static void part_detect(struct blk_desc *dev_desc)
 {
 	struct part_driver *drv =
 		ll_entry_start(struct part_driver, part_driver);
 	const int n_ents = ll_entry_count(struct part_driver, part_driver);
 	struct part_driver *entry;
 
-	blkcache_invalidate(dev_desc->if_type, dev_desc->devnum);
-
 	dev_desc->part_type = PART_TYPE_UNKNOWN;
 	for (entry = drv; entry != drv + n_ents; entry++) {
 		int ret;
@@ -253,6 +253,14 @@ void part_init(struct blk_desc *dev_desc)
 	}
 }
 
+void part_init(struct blk_desc *dev_desc)
+{
+	blkcache_invalidate(dev_desc->if_type, dev_desc->devnum);
+	fs_mount_invalidate(dev_desc);
+
+	part_detect(dev_desc);
+}
+
 static void print_part_header(const char *type, struct blk_desc *dev_desc)
 {
 #if CONFIG_IS_ENABLED(MAC_PARTITION) || \
@@ -425,8 +433,13 @@ int blk_get_device_by_str(const char *ifname, const char *dev_hwpart_str,
 	 * Updates the partition table for the specified hw partition.
 	 * Always should be done, otherwise hw partition 0 will return stale
 	 * data after displaying a non-zero hw partition.
+	 *
+	 * This runs for every command, so the filesystem kept mounted is not
+	 * dropped here: the medium did not change, and a switch of hw
+	 * partition already drops it in the driver.
 	 */
-	part_init(*dev_desc);
+	blkcache_invalidate((*dev_desc)->if_type, (*dev_desc)->devnum);
+	part_detect(*dev_desc);
 #endif
 
 cleanup:
@@ -7,9 +7,11 @@
 #include <common.h>
 #include <blk.h>
 #include <dm.h>
+#include <fs.h>
 #include <log.h>
 #include <malloc.h>
 #include <part.h>
+#include <watchdog.h>
 #include <dm/device-internal.h>
 #include <dm/lists.h>
 #include <dm/uclass-internal.h>
@@ -432,25 +434,32 @@ int blk_get_device(int if_type, int devnum, struct udevice **devp)
 	return device_probe(*devp);
 }
 
+static ulong blk_dread_raw(struct blk_desc *block_dev, lbaint_t start,
+			   lbaint_t blkcnt, void *buffer)
+{
+	struct udevice *dev = block_dev->bdev;
+
+	return blk_get_ops(dev)->read(dev, start, blkcnt, buffer);
+}
+
 unsigned long blk_dread(struct blk_desc *block_dev, lbaint_t start,
 			lbaint_t blkcnt, void *buffer)
 {
 	struct udevice *dev = block_dev->bdev;
 	const struct blk_ops *ops = blk_get_ops(dev);
-	ulong blks_read;
 
 	if (!ops->read)
 		return -ENOSYS;
 
-	if (blkcache_read(block_dev->if_type, block_dev->devnum,
-			  start, blkcnt, block_dev->blksz, buffer))
-		return blkcnt;
-	blks_read = ops->read(dev, start, blkcnt, buffer);
-	if (blks_read == blkcnt)
-		blkcache_fill(block_dev->if_type, block_dev->devnum,
-			      start, blkcnt, block_dev->blksz, buffer);
+	return blkcache_dread(block_dev, start, blkcnt, buffer, blk_dread_raw);
+}
+
+static ulong blk_dwrite_raw(struct blk_desc *block_dev, lbaint_t start,
+			    lbaint_t blkcnt, const void *buffer)
+{
+	struct udevice *dev = block_dev->bdev;
 
-	return blks_read;
+	return blk_get_ops(dev)->write(dev, start, blkcnt, buffer);
 }
 
 unsigned long blk_dwrite(struct blk_desc *block_dev, lbaint_t start,
@@ -462,8 +471,9 @@ unsigned long blk_dwrite(struct blk_desc *block_dev, lbaint_t start,
 	if (!ops->write)
 		return -ENOSYS;
 
-	blkcache_invalidate(block_dev->if_type, block_dev->devnum);
-	return ops->write(dev, start, blkcnt, buffer);
+	fs_mount_invalidate(block_dev);
+	return blkcache_dwrite(block_dev, start, blkcnt, buffer,
+			       blk_dwrite_raw);
 }
 
 unsigned long blk_derase(struct blk_desc *block_dev, lbaint_t start,
@@ -475,10 +485,178 @@ unsigned long blk_derase(struct blk_desc *block_dev, lbaint_t start,
 	if (!ops->erase)
 		return -ENOSYS;
 
+	fs_mount_invalidate(block_dev);
 	blkcache_invalidate(block_dev->if_type, block_dev->devnum);
 	return ops->erase(dev, start, blkcnt);
 }
 
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+/**
+ * struct blk_queue - Queued requests of a block device
+ *
+ * @pending:	Requests not yet handed to the driver, oldest first
+ * @inflight:	Number of requests handed to the driver and not completed
+ */
+struct blk_queue {
+	struct list_head pending;
+	int inflight;
+};
+
+static void blk_req_finish(struct blk_req *req, int status)
+{
+	struct blk_req *merged, *next;
+	LIST_HEAD(list);
+
+	list_splice_init(&req->merged, &list);
+	req->blkcnt = req->orig_blkcnt;
+	req->status = status;
+	if (req->complete)
+		req->complete(req);
+
+	list_for_each_entry_safe(merged, next, &list, node) {
+		list_del(&merged->node);
+		merged->status = status;
+		if (merged->complete)
+			merged->complete(merged);
+	}
+}
+
+void blk_req_done(struct udevice *dev, struct blk_req *req, int status)
+{
+	struct blk_queue *queue = dev_get_uclass_priv(dev);
+
+	queue->inflight--;
+	blk_req_finish(req, status);
+}
+
+/* Hand waiting requests to the driver, or carry them out with read/write */
+static void blk_dispatch(struct udevice *dev, bool sync)
+{
+	struct blk_queue *queue = dev_get_uclass_priv(dev);
+	const struct blk_ops *ops = blk_get_ops(dev);
+	struct blk_req *req;
+	ulong blks;
+	int ret;
+
+	while (!list_empty(&queue->pending)) {
+		if (!ops->submit && !sync)
+			break;
+		req = list_first_entry(&queue->pending, struct blk_req, node);
+		list_del(&req->node);
+		queue->inflight++;
+
+		if (ops->submit) {
+			ret = ops->submit(dev, req);
+			if (ret == -EBUSY) {
+				queue->inflight--;
+				list_add(&req->node, &queue->pending);
+				break;
+			}
+			if (ret)
+				blk_req_done(dev, req, ret);
+			continue;
+		}
+
+		if (req->op == BLK_REQ_WRITE)
+			blks = ops->write(dev, req->start, req->blkcnt,
+					  req->buffer);
+		else
+			blks = ops->read(dev, req->start, req->blkcnt,
+					 req->buffer);
+		blk_req_done(dev, req, blks == req->blkcnt ? 0 : -EIO);
+	}
+}
+
+static bool blk_req_can_merge(struct blk_desc *desc, struct blk_req *prev,
+			      struct blk_req *req)
+{
+	return prev->op == req->op &&
+	       prev->start + prev->blkcnt == req->start &&
+	       prev->buffer + prev->blkcnt * desc->blksz == req->buffer;
+}
+
+int blk_dsubmit(struct blk_desc *block_dev, struct blk_req *req)
+{
+	struct udevice *dev = block_dev->bdev;
+	const struct blk_ops *ops = blk_get_ops(dev);
+	struct blk_queue *queue;
+	struct blk_req *prev;
+	int ret;
+
+	if (req->op == BLK_REQ_WRITE ? !ops->write : !ops->read)
+		return -ENOSYS;
+	ret = device_probe(dev);
+	if (ret)
+		return ret;
+	queue = dev_get_uclass_priv(dev);
+
+	/* Queued requests bypass the cache, so it must not hold newer data */
+	if (req->op == BLK_REQ_WRITE) {
+		fs_mount_invalidate(block_dev);
+		blkcache_invalidate(block_dev->if_type, block_dev->devnum);
+	} else {
+		blkcache_flush(block_dev->if_type, block_dev->devnum);
+	}
+
+	req->status = -EINPROGRESS;
+	req->orig_blkcnt = req->blkcnt;
+	INIT_LIST_HEAD(&req->merged);
+
+	if (!list_empty(&queue->pending)) {
+		prev = list_last_entry(&queue->pending, struct blk_req, node);
+		if (blk_req_can_merge(block_dev, prev, req)) {
+			prev->blkcnt += req->blkcnt;
+			list_add_tail(&req->node, &prev->merged);
+			return 0;
+		}
+	}
+	list_add_tail(&req->node, &queue->pending);
+	blk_dispatch(dev, false);
+
+	return 0;
+}
+
+int blk_dpoll(struct blk_desc *block_dev)
+{
+	struct udevice *dev = block_dev->bdev;
+	const struct blk_ops *ops = blk_get_ops(dev);
+	struct blk_queue *queue = dev_get_uclass_priv(dev);
+	struct blk_req *req;
+	int count, ret;
+
+	if (!queue)
+		return 0;
+	if (ops->poll && queue->inflight) {
+		ret = ops->poll(dev);
+		if (ret)
+			return ret;
+	}
+	blk_dispatch(dev, true);
+
+	count = queue->inflight;
+	list_for_each_entry(req, &queue->pending, node)
+		count++;
+
+	return count;
+}
+
+int blk_dwait(struct blk_desc *block_dev, struct blk_req *req)
+{
+	int ret;
+
+	while (req->status == -EINPROGRESS) {
+		WATCHDOG_RESET();
+		ret = blk_dpoll(block_dev);
+		if (ret < 0)
+			return ret;
+		if (!ret && req->status == -EINPROGRESS)
+			return -ENOENT;
+	}
+
+	return req->status;
+}
+#endif
+
 int blk_get_from_parent(struct udevice *parent, struct udevice **devp)
 {
 	struct udevice *dev;
@@ -646,6 +824,11 @@ int blk_unbind_all(int if_type)
 
 static int blk_post_probe(struct udevice *dev)
 {
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	struct blk_queue *queue = dev_get_uclass_priv(dev);
+
+	INIT_LIST_HEAD(&queue->pending);
+#endif
 	if (IS_ENABLED(CONFIG_PARTITIONS) &&
 	    IS_ENABLED(CONFIG_HAVE_BLOCK_DEVICE)) {
 		struct blk_desc *desc = dev_get_uclass_platdata(dev);
@@ -656,9 +839,30 @@ static int blk_post_probe(struct udevice *dev)
 	return 0;
 }
 
+static int blk_pre_remove(struct udevice *dev)
+{
+	struct blk_desc *desc = dev_get_uclass_platdata(dev);
+
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	/* finish the queued requests while the device is still there */
+	while (blk_dpoll(desc) > 0)
+		;
+#endif
+
+	/* write back anything still held in the cache */
+	blkcache_invalidate(desc->if_type, desc->devnum);
+	fs_mount_invalidate(desc);
+
+	return 0;
+}
+
 UCLASS_DRIVER(blk) = {
 	.id		= UCLASS_BLK,
 	.name		= "blk",
 	.post_probe	= blk_post_probe,
+	.pre_remove	= blk_pre_remove,
 	.per_device_platdata_auto_alloc_size = sizeof(struct blk_desc),
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	.per_device_auto_alloc_size = sizeof(struct blk_queue),
+#endif
 };
@@ -8,29 +8,72 @@
 #include <blk.h>
 #include <log.h>
 #include <malloc.h>
+#include <memalign.h>
 #include <part.h>
+#include <sort.h>
 #include <linux/ctype.h>
 #include <linux/list.h>
+#include <linux/log2.h>
+#include <linux/sizes.h>
 
 #ifdef CONFIG_NEEDS_MANUAL_RELOC
 DECLARE_GLOBAL_DATA_PTR;
 #endif
 
+#define BLKCACHE_HASH_BITS	7
+#define BLKCACHE_HASH_SIZE	(1 << BLKCACHE_HASH_BITS)
+
+/* largest single write issued when flushing merged dirty entries */
+#define BLKCACHE_FLUSH_MAX	SZ_1M
+
+/*
+ * Each entry holds at most (1 << region_shift) blocks and is hashed on the
+ * region containing its first block. A block can therefore only be found in
+ * an entry hashed on its own region or on the region just before it.
+ */
 struct block_cache_node {
-	struct list_head lh;
+	struct list_head lh;		/* LRU list, most recently used first */
+	struct hlist_node hash;		/* hash bucket of (iftype, devnum, start) */
 	int iftype;
 	int devnum;
 	lbaint_t start;
 	lbaint_t blkcnt;
 	unsigned long blksz;
+	lbaint_t dirty_start;		/* blocks not yet written back, */
+	lbaint_t dirty_end;		/* empty when start == end */
 	char *cache;
 };
 
+/*
+ * Per-device state: sequential-read detection, write-back and statistics
+ */
+struct block_cache_dev {
+	struct list_head lh;
+	int iftype;
+	int devnum;
+	lbaint_t next;		/* block following the last read */
+	lbaint_t ra_blocks;	/* current readahead window */
+	bool writeback;		/* hold writes in the cache */
+	unsigned dirty;		/* number of dirty entries */
+	struct blk_desc *desc;	/* used to write back dirty entries */
+	blkcache_write_fn write;
+	unsigned hits;
+	unsigned misses;
+	unsigned readaheads;
+	unsigned writes;	/* writes absorbed by the cache */
+	unsigned flushes;	/* writes issued to write back dirty entries */
+};
+
 static LIST_HEAD(block_cache);
+static LIST_HEAD(block_cache_devs);
+static struct hlist_head block_cache_hash[BLKCACHE_HASH_SIZE];
+static unsigned int region_shift;
 
 static struct block_cache_stats _stats = {
-	.max_blocks_per_entry = 8,
-	.max_entries = 32
+	.max_blocks_per_entry = 64,
+	.max_entries = 512,
+	.max_bytes = CONFIG_BLOCK_CACHE_SIZE * 1024UL,
+	.max_readahead = CONFIG_BLOCK_CACHE_READAHEAD,
 };
 
 #ifdef CONFIG_NEEDS_MANUAL_RELOC
@@ -41,50 +84,263 @@ int blkcache_init(void)
 	head->next = (uintptr_t)head->next + gd->reloc_off;
 	head->prev = (uintptr_t)head->prev + gd->reloc_off;
 
+	head = &block_cache_devs;
+	head->next = (uintptr_t)head->next + gd->reloc_off;
+	head->prev = (uintptr_t)head->prev + gd->reloc_off;
+
 	return 0;
 }
 #endif
 
-static struct block_cache_node *cache_find(int iftype, int devnum,
-					   lbaint_t start, lbaint_t blkcnt,
-					   unsigned long blksz)
+static void cache_update_region(void)
+{
+	unsigned long max = max(_stats.max_blocks_per_entry,
+				_stats.max_readahead);
+
+	region_shift = max ? ilog2(roundup_pow_of_two(max)) : 0;
+}
+
+static struct hlist_head *cache_bucket(int iftype, int devnum,
+				       lbaint_t region)
+{
+	u32 key = (u32)region ^ (u32)((u64)region >> 32);
+
+	key ^= ((u32)devnum << 16) ^ ((u32)iftype << 24);
+
+	return &block_cache_hash[(key * 0x9e3779b9) >>
+				 (32 - BLKCACHE_HASH_BITS)];
+}
+
+static struct block_cache_node *cache_find_in(struct hlist_head *bucket,
+					      int iftype, int devnum,
+					      lbaint_t blk,
+					      unsigned long blksz)
 {
 	struct block_cache_node *node;
+	struct hlist_node *pos;
 
-	list_for_each_entry(node, &block_cache, lh)
+	hlist_for_each_entry(node, pos, bucket, hash)
 		if ((node->iftype == iftype) &&
 		    (node->devnum == devnum) &&
 		    (node->blksz == blksz) &&
-		    (node->start <= start) &&
-		    (node->start + node->blkcnt >= start + blkcnt)) {
-			if (block_cache.next != &node->lh) {
-				/* maintain MRU ordering */
-				list_del(&node->lh);
-				list_add(&node->lh, &block_cache);
-			}
+		    (node->start <= blk) &&
+		    (node->start + node->blkcnt > blk))
 			return node;
-		}
+
+	return NULL;
+}
+
+/* Find the entry holding block @blk, if any */
+static struct block_cache_node *cache_find(int iftype, int devnum,
+					   lbaint_t blk, unsigned long blksz)
+{
+	struct block_cache_node *node;
+	lbaint_t region = blk >> region_shift;
+
+	node = cache_find_in(cache_bucket(iftype, devnum, region),
+			     iftype, devnum, blk, blksz);
+	if (!node && region)
+		node = cache_find_in(cache_bucket(iftype, devnum, region - 1),
+				     iftype, devnum, blk, blksz);
+	if (node && block_cache.next != &node->lh) {
+		/* maintain MRU ordering */
+		list_del(&node->lh);
+		list_add(&node->lh, &block_cache);
+	}
+
+	return node;
+}
+
+static struct block_cache_dev *cache_dev(int iftype, int devnum, bool create)
+{
+	struct block_cache_dev *bdev;
+
+	list_for_each_entry(bdev, &block_cache_devs, lh)
+		if (bdev->iftype == iftype && bdev->devnum == devnum)
+			return bdev;
+
+	if (!create)
+		return NULL;
+
+	bdev = calloc(1, sizeof(*bdev));
+	if (!bdev)
+		return NULL;
+	bdev->iftype = iftype;
+	bdev->devnum = devnum;
+	list_add_tail(&bdev->lh, &block_cache_devs);
+
+	return bdev;
+}
+
+static bool node_dirty(struct block_cache_node *node)
+{
+	return node->dirty_end > node->dirty_start;
+}
+
+static void node_clean(struct block_cache_dev *bdev,
+		       struct block_cache_node *node)
+{
+	node->dirty_start = node->dirty_end = 0;
+	bdev->dirty--;
+}
+
+/* Write back the dirty part of a single entry */
+static int cache_write_node(struct block_cache_dev *bdev,
+			    struct block_cache_node *node)
+{
+	lbaint_t cnt = node->dirty_end - node->dirty_start;
+	const char *src = node->cache +
+			  (node->dirty_start - node->start) * node->blksz;
+
+	bdev->flushes++;
+	if (bdev->write(bdev->desc, node->dirty_start, cnt, src) != cnt) {
+		log_err("blkcache: write-back of " LBAFU " blocks at " LBAF
+			" failed\n", cnt, node->dirty_start);
+		return -EIO;
+	}
+	node_clean(bdev, node);
+
+	return 0;
+}
+
+/*
+ * Write back and free an entry. If the write-back fails the entry is kept,
+ * unless @force is set, in which case its dirty data is lost.
+ */
+static int cache_drop(struct block_cache_node *node, bool force)
+{
+	int ret = 0;
+
+	if (node_dirty(node)) {
+		ret = cache_write_node(cache_dev(node->iftype, node->devnum,
+						 false), node);
+		if (ret && !force)
+			return ret;
+	}
+
+	debug("drop: start " LBAF ", count " LBAFU "\n",
+	      node->start, node->blkcnt);
+	list_del(&node->lh);
+	hlist_del(&node->hash);
+	_stats.entries--;
+	_stats.bytes -= node->blkcnt * node->blksz;
+	free(node->cache);
+	free(node);
+
+	return ret;
+}
+
+static void cache_drop_all(void)
+{
+	while (!list_empty(&block_cache))
+		cache_drop(list_first_entry(&block_cache,
+					    struct block_cache_node, lh), true);
+}
+
+/*
+ * Pop LRU entries until @bytes more fit into the cache. This stops at an
+ * entry which cannot be written back, so that its data is not lost.
+ */
+static int cache_make_room(unsigned long bytes)
+{
+	int ret;
+
+	while (!list_empty(&block_cache) &&
+	       (_stats.entries >= _stats.max_entries ||
+		_stats.bytes + bytes > _stats.max_bytes)) {
+		ret = cache_drop(list_last_entry(&block_cache,
+						 struct block_cache_node, lh),
+				 false);
+		if (ret)
+			return ret;
+	}
+
 	return 0;
 }
 
+static struct block_cache_node *cache_alloc(lbaint_t blkcnt,
+					    unsigned long blksz)
+{
+	struct block_cache_node *node;
+	unsigned long bytes = blkcnt * blksz;
+
+	if (_stats.max_entries == 0 || bytes > _stats.max_bytes)
+		return NULL;
+
+	if (cache_make_room(bytes))
+		return NULL;
+
+	node = malloc(sizeof(*node));
+	if (!node)
+		return NULL;
+
+	/* readahead reads straight into this buffer, so keep it DMA-safe */
+	node->cache = malloc_cache_aligned(bytes);
+	if (!node->cache) {
+		free(node);
+		return NULL;
+	}
+	node->blkcnt = blkcnt;
+	node->blksz = blksz;
+	node->dirty_start = node->dirty_end = 0;
+
+	return node;
+}
+
+static void cache_insert(struct block_cache_node *node, int iftype,
+			 int devnum, lbaint_t start)
+{
+	debug("fill: start " LBAF ", count " LBAFU "\n",
+	      start, node->blkcnt);
+
+	node->iftype = iftype;
+	node->devnum = devnum;
+	node->start = start;
+	list_add(&node->lh, &block_cache);
+	hlist_add_head(&node->hash, cache_bucket(iftype, devnum,
+						 start >> region_shift));
+	_stats.entries++;
+	_stats.bytes += node->blkcnt * node->blksz;
+}
+
 int blkcache_read(int iftype, int devnum,
 		  lbaint_t start, lbaint_t blkcnt,
 		  unsigned long blksz, void *buffer)
 {
-	struct block_cache_node *node = cache_find(iftype, devnum, start,
-						   blkcnt, blksz);
-	if (node) {
-		const char *src = node->cache + (start - node->start) * blksz;
-		memcpy(buffer, src, blksz * blkcnt);
+	struct block_cache_dev *bdev = cache_dev(iftype, devnum, true);
+	struct block_cache_node *node;
+	lbaint_t blk = start, end = start + blkcnt, cnt;
+	char *dst = buffer;
+
+	if (!region_shift)
+		cache_update_region();
+
+	/* the range may be spread over several entries */
+	while (blk < end) {
+		node = cache_find(iftype, devnum, blk, blksz);
+		if (!node)
+			break;
+		cnt = min(node->start + node->blkcnt, end) - blk;
+		memcpy(dst, node->cache + (blk - node->start) * blksz,
+		       cnt * blksz);
+		dst += cnt * blksz;
+		blk += cnt;
+	}
+
+	if (blk == end) {
 		debug("hit: start " LBAF ", count " LBAFU "\n",
 		      start, blkcnt);
 		++_stats.hits;
+		if (bdev)
+			++bdev->hits;
 		return 1;
 	}
 
 	debug("miss: start " LBAF ", count " LBAFU "\n",
 	      start, blkcnt);
 	++_stats.misses;
+	if (bdev)
+		++bdev->misses;
 	return 0;
 }
 
@@ -92,93 +348,421 @@ void blkcache_fill(int iftype, int devnum,
 		   lbaint_t start, lbaint_t blkcnt,
 		   unsigned long blksz, void const *buffer)
 {
-	lbaint_t bytes;
 	struct block_cache_node *node;
 
 	/* don't cache big stuff */
 	if (blkcnt > _stats.max_blocks_per_entry)
 		return;
 
-	if (_stats.max_entries == 0)
+	if (!region_shift)
+		cache_update_region();
+
+	node = cache_alloc(blkcnt, blksz);
+	if (!node)
 		return;
 
-	bytes = blksz * blkcnt;
-	if (_stats.max_entries <= _stats.entries) {
-		/* pop LRU */
-		node = (struct block_cache_node *)block_cache.prev;
-		list_del(&node->lh);
-		_stats.entries--;
-		debug("drop: start " LBAF ", count " LBAFU "\n",
-		      node->start, node->blkcnt);
-		if (node->blkcnt * node->blksz < bytes) {
+	memcpy(node->cache, buffer, blkcnt * blksz);
+	cache_insert(node, iftype, devnum, start);
+}
+
+/*
+ * Work out how many blocks to read for a missed request, growing the window
+ * while the device is being read sequentially. Returns 0 for no readahead.
+ */
+static lbaint_t cache_readahead(struct block_cache_dev *bdev,
+				struct blk_desc *block_dev,
+				lbaint_t start, lbaint_t blkcnt)
+{
+	lbaint_t window;
+
+	if (!bdev || start != bdev->next ||
+	    blkcnt > _stats.max_blocks_per_entry) {
+		if (bdev)
+			bdev->ra_blocks = 0;
+		return 0;
+	}
+
+	window = max(bdev->ra_blocks * 2, blkcnt * 4);
+	window = min(window, (lbaint_t)_stats.max_readahead);
+	if (block_dev->lba && start + window > block_dev->lba)
+		window = block_dev->lba > start ? block_dev->lba - start : 0;
+	bdev->ra_blocks = window;
+
+	return window > blkcnt ? window : 0;
+}
+
+/*
+ * Device reads return stale data for blocks that are dirty in the cache, so
+ * patch the dirty blocks into freshly read data.
+ */
+static void cache_overlay_dirty(struct block_cache_dev *bdev, lbaint_t start,
+				lbaint_t blkcnt, unsigned long blksz,
+				void *buffer)
+{
+	struct block_cache_node *node;
+	lbaint_t from, to;
+
+	if (!bdev || !bdev->dirty)
+		return;
+
+	list_for_each_entry(node, &block_cache, lh) {
+		if (node->iftype != bdev->iftype ||
+		    node->devnum != bdev->devnum || !node_dirty(node))
+			continue;
+		from = max(node->dirty_start, start);
+		to = min(node->dirty_end, start + blkcnt);
+		if (from < to)
+			memcpy(buffer + (from - start) * blksz,
+			       node->cache + (from - node->start) * blksz,
+			       (to - from) * blksz);
+	}
+}
+
+ulong blkcache_dread(struct blk_desc *block_dev, lbaint_t start,
+		     lbaint_t blkcnt, void *buffer, blkcache_read_fn read)
+{
+	int iftype = block_dev->if_type, devnum = block_dev->devnum;
+	unsigned long blksz = block_dev->blksz;
+	struct block_cache_node *node;
+	struct block_cache_dev *bdev;
+	lbaint_t window;
+	ulong blks_read;
+
+	if (blkcache_read(iftype, devnum, start, blkcnt, blksz, buffer)) {
+		bdev = cache_dev(iftype, devnum, false);
+		if (bdev)
+			bdev->next = start + blkcnt;
+		return blkcnt;
+	}
+
+	bdev = cache_dev(iftype, devnum, false);
+	window = cache_readahead(bdev, block_dev, start, blkcnt);
+	if (bdev)
+		bdev->next = start + blkcnt;
+
+	if (window) {
+		node = cache_alloc(window, blksz);
+		if (node) {
+			if (read(block_dev, start, window, node->cache) ==
+			    window) {
+				debug("readahead: start " LBAF ", count "
+				      LBAFU "\n", start, window);
+				cache_overlay_dirty(bdev, start, window, blksz,
+						    node->cache);
+				memcpy(buffer, node->cache, blkcnt * blksz);
+				cache_insert(node, iftype, devnum, start);
+				++_stats.readaheads;
+				++bdev->readaheads;
+				return blkcnt;
+			}
+			/* e.g. past the end of the medium, retry plainly */
 			free(node->cache);
-			node->cache = 0;
+			free(node);
+			bdev->ra_blocks = 0;
 		}
+	}
+
+	blks_read = read(block_dev, start, blkcnt, buffer);
+	if (blks_read == blkcnt) {
+		cache_overlay_dirty(bdev, start, blkcnt, blksz, buffer);
+		blkcache_fill(iftype, devnum, start, blkcnt, blksz, buffer);
+	}
+
+	return blks_read;
+}
+
+/*
+ * Copy written data into every entry that overlaps it, so that all cached
+ * copies of a block stay identical. With @dirty, the overlapping blocks are
+ * also marked for write-back.
+ */
+static void cache_update(struct block_cache_dev *bdev, lbaint_t start,
+			 lbaint_t blkcnt, unsigned long blksz,
+			 const void *buffer, bool dirty)
+{
+	struct block_cache_node *node;
+	lbaint_t from, to;
+
+	list_for_each_entry(node, &block_cache, lh) {
+		if (node->iftype != bdev->iftype ||
+		    node->devnum != bdev->devnum || node->blksz != blksz)
+			continue;
+		from = max(node->start, start);
+		to = min(node->start + node->blkcnt, start + blkcnt);
+		if (from >= to)
+			continue;
+		memcpy(node->cache + (from - node->start) * blksz,
+		       buffer + (from - start) * blksz, (to - from) * blksz);
+		if (!dirty)
+			continue;
+		if (!node_dirty(node)) {
+			node->dirty_start = from;
+			node->dirty_end = to;
+			bdev->dirty++;
+		} else {
+			node->dirty_start = min(node->dirty_start, from);
+			node->dirty_end = max(node->dirty_end, to);
+		}
+	}
+}
+
+static ulong cache_write_back(struct block_cache_dev *bdev,
+			      struct blk_desc *block_dev, lbaint_t start,
+			      lbaint_t blkcnt, const void *buffer,
+			      blkcache_write_fn write)
+{
+	unsigned long blksz = block_dev->blksz;
+	struct block_cache_node *node;
+	lbaint_t blk = start, end = start + blkcnt, gap;
+
+	bdev->desc = block_dev;
+	bdev->write = write;
+	bdev->writes++;
+	cache_update(bdev, start, blkcnt, blksz, buffer, true);
+
+	/* add dirty entries for blocks that are not cached yet */
+	while (blk < end) {
+		node = cache_find(bdev->iftype, bdev->devnum, blk, blksz);
+		if (node) {
+			blk = node->start + node->blkcnt;
+			continue;
+		}
+		for (gap = 1; blk + gap < end; gap++)
+			if (cache_find(bdev->iftype, bdev->devnum, blk + gap,
+				       blksz))
+				break;
+
+		node = cache_alloc(gap, blksz);
+		if (!node) {
+			/* no room, so write through */
+			if (write(block_dev, blk, gap,
+				  buffer + (blk - start) * blksz) != gap)
+				return blk - start;
+		} else {
+			memcpy(node->cache, buffer + (blk - start) * blksz,
+			       gap * blksz);
+			node->dirty_start = blk;
+			node->dirty_end = blk + gap;
+			bdev->dirty++;
+			cache_insert(node, bdev->iftype, bdev->devnum, blk);
+		}
+		blk += gap;
+	}
+
+	return blkcnt;
+}
+
+ulong blkcache_dwrite(struct blk_desc *block_dev, lbaint_t start,
+		      lbaint_t blkcnt, const void *buffer,
+		      blkcache_write_fn write)
+{
+	int iftype = block_dev->if_type, devnum = block_dev->devnum;
+	struct block_cache_dev *bdev;
+	ulong blks_written;
+
+	if (!region_shift)
+		cache_update_region();
+
+	bdev = cache_dev(iftype, devnum, true);
+	if (!bdev) {
+		blkcache_invalidate(iftype, devnum);
+		return write(block_dev, start, blkcnt, buffer);
+	}
+
+	if (bdev->writeback && blkcnt <= _stats.max_blocks_per_entry)
+		return cache_write_back(bdev, block_dev, start, blkcnt, buffer,
+					write);
+
+	blks_written = write(block_dev, start, blkcnt, buffer);
+	if (blks_written == blkcnt)
+		cache_update(bdev, start, blkcnt, block_dev->blksz, buffer,
+			     false);
+	else
+		blkcache_invalidate(iftype, devnum);
+
+	return blks_written;
+}
+
+static int cache_cmp_dirty(const void *a, const void *b)
+{
+	const struct block_cache_node *na = *(struct block_cache_node **)a;
+	const struct block_cache_node *nb = *(struct block_cache_node **)b;
+
+	if (na->dirty_start == nb->dirty_start)
+		return 0;
+
+	return na->dirty_start < nb->dirty_start ? -1 : 1;
+}
+
+/* Write back entries @nodes[0..@count), which form one contiguous run */
+static int cache_write_run(struct block_cache_dev *bdev,
+			   struct block_cache_node **nodes, int count,
+			   lbaint_t start, lbaint_t end)
+{
+	unsigned long blksz = nodes[0]->blksz;
+	struct block_cache_node *node;
+	char *buf;
+	int i, ret = 0;
+
+	if (count == 1)
+		return cache_write_node(bdev, nodes[0]);
+
+	buf = malloc_cache_aligned((end - start) * blksz);
+	if (!buf) {
+		for (i = 0; i < count; i++)
+			if (cache_write_node(bdev, nodes[i]))
+				ret = -EIO;
+		return ret;
+	}
+
+	for (i = 0; i < count; i++) {
+		node = nodes[i];
+		memcpy(buf + (node->dirty_start - start) * blksz,
+		       node->cache + (node->dirty_start - node->start) * blksz,
+		       (node->dirty_end - node->dirty_start) * blksz);
+	}
+
+	debug("flush: start " LBAF ", count " LBAFU ", entries %d\n",
+	      start, end - start, count);
+	bdev->flushes++;
+	if (bdev->write(bdev->desc, start, end - start, buf) != end - start) {
+		log_err("blkcache: write-back of " LBAFU " blocks at " LBAF
+			" failed\n", end - start, start);
+		ret = -EIO;
 	} else {
-		node = malloc(sizeof(*node));
-		if (!node)
-			return;
-		node->cache = 0;
+		for (i = 0; i < count; i++)
+			node_clean(bdev, nodes[i]);
 	}
+	free(buf);
 
-	if (!node->cache) {
-		node->cache = malloc(bytes);
-		if (!node->cache) {
-			free(node);
-			return;
+	return ret;
+}
+
+static int cache_flush_dev(struct block_cache_dev *bdev)
+{
+	struct block_cache_node *node, *n, **nodes;
+	lbaint_t start, end, max_blocks;
+	int count = 0, first, i, ret = 0;
+
+	if (!bdev->dirty)
+		return 0;
+
+	nodes = malloc(bdev->dirty * sizeof(*nodes));
+	if (!nodes) {
+		list_for_each_entry_safe(node, n, &block_cache, lh)
+			if (node->iftype == bdev->iftype &&
+			    node->devnum == bdev->devnum && node_dirty(node) &&
+			    cache_write_node(bdev, node))
+				ret = -EIO;
+		return ret;
+	}
+
+	list_for_each_entry(node, &block_cache, lh)
+		if (node->iftype == bdev->iftype &&
+		    node->devnum == bdev->devnum && node_dirty(node))
+			nodes[count++] = node;
+	qsort(nodes, count, sizeof(*nodes), cache_cmp_dirty);
+
+	/* merge entries that touch or overlap into single writes */
+	max_blocks = max(BLKCACHE_FLUSH_MAX / nodes[0]->blksz, 1UL);
+	for (first = 0; first < count; first = i) {
+		start = nodes[first]->dirty_start;
+		end = nodes[first]->dirty_end;
+		for (i = first + 1; i < count; i++) {
+			if (nodes[i]->dirty_start > end ||
+			    max(end, nodes[i]->dirty_end) - start > max_blocks)
+				break;
+			end = max(end, nodes[i]->dirty_end);
 		}
+		if (cache_write_run(bdev, nodes + first, i - first, start, end))
+			ret = -EIO;
 	}
+	free(nodes);
 
-	debug("fill: start " LBAF ", count " LBAFU "\n",
-	      start, blkcnt);
+	return ret;
+}
 
-	node->iftype = iftype;
-	node->devnum = devnum;
-	node->start = start;
-	node->blkcnt = blkcnt;
-	node->blksz = blksz;
-	memcpy(node->cache, buffer, bytes);
-	list_add(&node->lh, &block_cache);
-	_stats.entries++;
+int blkcache_flush(int iftype, int devnum)
+{
+	struct block_cache_dev *bdev = cache_dev(iftype, devnum, false);
+
+	return bdev ? cache_flush_dev(bdev) : 0;
+}
+
+int blkcache_flush_all(void)
+{
+	struct block_cache_dev *bdev;
+	int ret = 0;
+
+	list_for_each_entry(bdev, &block_cache_devs, lh)
+		if (cache_flush_dev(bdev))
+			ret = -EIO;
+
+	return ret;
+}
+
+int blkcache_set_writeback(int iftype, int devnum, bool enable)
+{
+	struct block_cache_dev *bdev;
+
+	if (!CONFIG_IS_ENABLED(BLOCK_CACHE_WRITEBACK))
+		return 0;
+
+	bdev = cache_dev(iftype, devnum, enable);
+	if (!bdev)
+		return enable ? -ENOMEM : 0;
+	bdev->writeback = enable;
+
+	return enable ? 0 : cache_flush_dev(bdev);
 }
 
 void blkcache_invalidate(int iftype, int devnum)
 {
-	struct list_head *entry, *n;
-	struct block_cache_node *node;
+	struct block_cache_node *node, *n;
+	struct block_cache_dev *bdev;
 
-	list_for_each_safe(entry, n, &block_cache) {
-		node = (struct block_cache_node *)entry;
+	bdev = cache_dev(iftype, devnum, false);
+	if (bdev)
+		cache_flush_dev(bdev);
+
+	list_for_each_entry_safe(node, n, &block_cache, lh) {
 		if ((node->iftype == iftype) &&
-		    (node->devnum == devnum)) {
-			list_del(entry);
-			free(node->cache);
-			free(node);
-			--_stats.entries;
-		}
+		    (node->devnum == devnum))
+			cache_drop(node, true);
+	}
+
+	if (bdev) {
+		bdev->next = 0;
+		bdev->ra_blocks = 0;
+		bdev->writeback = false;
+		bdev->desc = NULL;
 	}
 }
 
 void blkcache_configure(unsigned blocks, unsigned entries)
 {
-	struct block_cache_node *node;
 	if ((blocks != _stats.max_blocks_per_entry) ||
-	    (entries != _stats.max_entries)) {
-		/* invalidate cache */
-		while (!list_empty(&block_cache)) {
-			node = (struct block_cache_node *)block_cache.next;
-			list_del(&node->lh);
-			free(node->cache);
-			free(node);
-		}
-		_stats.entries = 0;
-	}
+	    (entries != _stats.max_entries))
+		cache_drop_all();
 
 	_stats.max_blocks_per_entry = blocks;
 	_stats.max_entries = entries;
+	cache_update_region();
 
 	_stats.hits = 0;
 	_stats.misses = 0;
+	_stats.readaheads = 0;
+}
+
+void blkcache_configure_size(unsigned long bytes, unsigned readahead)
+{
+	if (readahead != _stats.max_readahead)
+		cache_drop_all();
+
+	_stats.max_bytes = bytes;
+	_stats.max_readahead = readahead;
+	cache_update_region();
+	cache_make_room(0);
 }
 
 void blkcache_stats(struct block_cache_stats *stats)
@@ -186,4 +770,31 @@ void blkcache_stats(struct block_cache_stats *stats)
 	memcpy(stats, &_stats, sizeof(*stats));
 	_stats.hits = 0;
 	_stats.misses = 0;
+	_stats.readaheads = 0;
+}
+
+int blkcache_dev_stats(struct block_cache_dev_stats *stats, int count)
+{
+	struct block_cache_dev *bdev;
+	int i = 0;
+
+	list_for_each_entry(bdev, &block_cache_devs, lh) {
+		if (i < count) {
+			stats[i].iftype = bdev->iftype;
+			stats[i].devnum = bdev->devnum;
+			stats[i].hits = bdev->hits;
+			stats[i].misses = bdev->misses;
+			stats[i].readaheads = bdev->readaheads;
+			stats[i].writes = bdev->writes;
+			stats[i].flushes = bdev->flushes;
+		}
+		bdev->hits = 0;
+		bdev->misses = 0;
+		bdev->readaheads = 0;
+		bdev->writes = 0;
+		bdev->flushes = 0;
+		i++;
+	}
+
+	return i;
 }
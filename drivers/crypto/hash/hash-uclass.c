@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Driver model for hash engines
+ */
+
+#include <common.h>
+#include <dm.h>
+#include <errno.h>
+#include <watchdog.h>
+#include <u-boot/hash.h>
+
+static const char *const hash_algo_names[HASH_ALGO_COUNT] = {
+	[HASH_ALGO_CRC32]	= "crc32",
+	[HASH_ALGO_SHA1]	= "sha1",
+	[HASH_ALGO_SHA256]	= "sha256",
+	[HASH_ALGO_SHA384]	= "sha384",
+	[HASH_ALGO_SHA512]	= "sha512",
+};
+
+int hash_algo_id_by_name(const char *name)
+{
+	int i;
+
+	for (i = 0; i < HASH_ALGO_COUNT; i++) {
+		if (!strcmp(name, hash_algo_names[i]))
+			return i;
+	}
+
+	return -EPROTONOSUPPORT;
+}
+
+int dm_hash_get_engine(enum hash_algo_id algo, struct udevice **devp)
+{
+	struct udevice *dev, *best = NULL;
+
+	for (uclass_first_device(UCLASS_HASH, &dev); dev;
+	     uclass_next_device(&dev)) {
+		struct hash_ops *ops = hash_get_ops(dev);
+
+		if (!ops->supports || !ops->supports(dev, algo))
+			continue;
+		if (!best || ops->priority > hash_get_ops(best)->priority)
+			best = dev;
+	}
+	if (!best)
+		return -ENODEV;
+	*devp = best;
+
+	return 0;
+}
+
+int dm_hash_init(struct udevice *dev, enum hash_algo_id algo, void **ctxp)
+{
+	struct hash_ops *ops = hash_get_ops(dev);
+
+	if (!ops->init)
+		return -ENOSYS;
+
+	return ops->init(dev, algo, ctxp);
+}
+
+int dm_hash_update(struct udevice *dev, void *ctx, const void *buf,
+		   unsigned int size)
+{
+	struct hash_ops *ops = hash_get_ops(dev);
+
+	if (!ops->update)
+		return -ENOSYS;
+
+	return ops->update(dev, ctx, buf, size);
+}
+
+int dm_hash_finish(struct udevice *dev, void *ctx, void *digest)
+{
+	struct hash_ops *ops = hash_get_ops(dev);
+
+	if (!ops->finish)
+		return -ENOSYS;
+
+	return ops->finish(dev, ctx, digest);
+}
+
+int dm_hash_digest_wd(struct udevice *dev, enum hash_algo_id algo,
+		      const void *buf, unsigned int size, void *digest,
+		      unsigned int chunk_sz)
+{
+	unsigned int chunk;
+	void *ctx;
+	int ret;
+
+	ret = dm_hash_init(dev, algo, &ctx);
+	if (ret)
+		return ret;
+
+	while (size) {
+		chunk = chunk_sz ? min(size, chunk_sz) : size;
+		ret = dm_hash_update(dev, ctx, buf, chunk);
+		if (ret)
+			return ret;
+		buf += chunk;
+		size -= chunk;
+		WATCHDOG_RESET();
+	}
+
+	return dm_hash_finish(dev, ctx, digest);
+}
+
+UCLASS_DRIVER(hash) = {
+	.id	= UCLASS_HASH,
+	.name	= "hash",
+};
@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Hash engine using the ARMv8 Crypto Extensions
+ *
+ * SHA-1 and SHA-256 use the SHA1* and SHA256* instructions, CRC32 uses the
+ * CRC32 instructions. Which of them are present is read from
+ * ID_AA64ISAR0_EL1 at probe time; anything else is left to the next engine.
+ */
+
+#include <common.h>
+#include <dm.h>
+#include <errno.h>
+#include <malloc.h>
+#include <asm/unaligned.h>
+#include <u-boot/hash.h>
+
+#define ID_AA64ISAR0_SHA1_SHIFT		8
+#define ID_AA64ISAR0_SHA2_SHIFT		12
+#define ID_AA64ISAR0_CRC32_SHIFT	16
+
+#define HASH_CE_BLOCK_SIZE		64
+
+void hash_ce_sha1_blocks(u32 state[5], const u8 *src, int blocks);
+void hash_ce_sha256_blocks(u32 state[8], const u8 *src, int blocks);
+u32 hash_ce_crc32(u32 crc, const u8 *src, size_t len);
+
+struct hash_ce_priv {
+	bool sha1;
+	bool sha256;
+	bool crc32;
+};
+
+struct hash_ce_ctx {
+	enum hash_algo_id algo;
+	u32 state[8];
+	u64 count;
+	u8 buf[HASH_CE_BLOCK_SIZE];
+};
+
+static const u32 sha1_iv[5] = {
+	0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+};
+
+static const u32 sha256_iv[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static void hash_ce_blocks(struct hash_ce_ctx *ctx, const u8 *src, int blocks)
+{
+	if (ctx->algo == HASH_ALGO_SHA1)
+		hash_ce_sha1_blocks(ctx->state, src, blocks);
+	else
+		hash_ce_sha256_blocks(ctx->state, src, blocks);
+}
+
+static bool hash_ce_supports(struct udevice *dev, enum hash_algo_id algo)
+{
+	struct hash_ce_priv *priv = dev_get_priv(dev);
+
+	switch (algo) {
+	case HASH_ALGO_CRC32:
+		return priv->crc32;
+	case HASH_ALGO_SHA1:
+		return priv->sha1;
+	case HASH_ALGO_SHA256:
+		return priv->sha256;
+	default:
+		return false;
+	}
+}
+
+static int hash_ce_init(struct udevice *dev, enum hash_algo_id algo,
+			void **ctxp)
+{
+	struct hash_ce_ctx *ctx;
+
+	if (!hash_ce_supports(dev, algo))
+		return -EPROTONOSUPPORT;
+
+	ctx = malloc(sizeof(*ctx));
+	if (!ctx)
+		return -ENOMEM;
+	ctx->algo = algo;
+	ctx->count = 0;
+	if (algo == HASH_ALGO_SHA1)
+		memcpy(ctx->state, sha1_iv, sizeof(sha1_iv));
+	else if (algo == HASH_ALGO_SHA256)
+		memcpy(ctx->state, sha256_iv, sizeof(sha256_iv));
+	else
+		ctx->state[0] = 0;
+	*ctxp = ctx;
+
+	return 0;
+}
+
+static int hash_ce_update(struct udevice *dev, void *priv, const void *buf,
+			  unsigned int size)
+{
+	struct hash_ce_ctx *ctx = priv;
+	unsigned int partial, fill;
+	const u8 *src = buf;
+
+	if (ctx->algo == HASH_ALGO_CRC32) {
+		ctx->state[0] = hash_ce_crc32(ctx->state[0], src, size);
+		return 0;
+	}
+
+	partial = ctx->count % HASH_CE_BLOCK_SIZE;
+	ctx->count += size;
+
+	if (partial) {
+		fill = min(size, HASH_CE_BLOCK_SIZE - partial);
+		memcpy(ctx->buf + partial, src, fill);
+		src += fill;
+		size -= fill;
+		if (partial + fill < HASH_CE_BLOCK_SIZE)
+			return 0;
+		hash_ce_blocks(ctx, ctx->buf, 1);
+	}
+
+	/* Whole blocks are hashed in place, whatever their alignment */
+	if (size >= HASH_CE_BLOCK_SIZE) {
+		hash_ce_blocks(ctx, src, size / HASH_CE_BLOCK_SIZE);
+		src += size & ~(HASH_CE_BLOCK_SIZE - 1);
+		size %= HASH_CE_BLOCK_SIZE;
+	}
+	memcpy(ctx->buf, src, size);
+
+	return 0;
+}
+
+static int hash_ce_finish(struct udevice *dev, void *priv, void *digest)
+{
+	struct hash_ce_ctx *ctx = priv;
+	unsigned int partial, words, i;
+
+	if (ctx->algo == HASH_ALGO_CRC32) {
+		put_unaligned_be32(ctx->state[0], digest);
+		free(ctx);
+		return 0;
+	}
+
+	partial = ctx->count % HASH_CE_BLOCK_SIZE;
+	ctx->buf[partial++] = 0x80;
+	if (partial > HASH_CE_BLOCK_SIZE - 8) {
+		memset(ctx->buf + partial, 0, HASH_CE_BLOCK_SIZE - partial);
+		hash_ce_blocks(ctx, ctx->buf, 1);
+		partial = 0;
+	}
+	memset(ctx->buf + partial, 0, HASH_CE_BLOCK_SIZE - 8 - partial);
+	put_unaligned_be64(ctx->count << 3,
+			   ctx->buf + HASH_CE_BLOCK_SIZE - 8);
+	hash_ce_blocks(ctx, ctx->buf, 1);
+
+	words = ctx->algo == HASH_ALGO_SHA1 ? 5 : 8;
+	for (i = 0; i < words; i++)
+		put_unaligned_be32(ctx->state[i], digest + i * 4);
+	free(ctx);
+
+	return 0;
+}
+
+static int hash_ce_probe(struct udevice *dev)
+{
+	struct hash_ce_priv *priv = dev_get_priv(dev);
+	u64 isar0;
+
+	asm volatile("mrs %0, id_aa64isar0_el1" : "=r" (isar0));
+
+	priv->sha1 = (isar0 >> ID_AA64ISAR0_SHA1_SHIFT) & 0xf;
+	priv->sha256 = (isar0 >> ID_AA64ISAR0_SHA2_SHIFT) & 0xf;
+	priv->crc32 = (isar0 >> ID_AA64ISAR0_CRC32_SHIFT) & 0xf;
+	debug("%s: sha1 %d sha256 %d crc32 %d\n", __func__, priv->sha1,
+	      priv->sha256, priv->crc32);
+
+	return 0;
+}
+
+static const struct hash_ops hash_ops_ce = {
+	.supports	= hash_ce_supports,
+	.init		= hash_ce_init,
+	.update		= hash_ce_update,
+	.finish		= hash_ce_finish,
+};
+
+U_BOOT_DRIVER(hash_armv8_ce) = {
+	.name		= "hash_armv8_ce",
+	.id		= UCLASS_HASH,
+	.ops		= &hash_ops_ce,
+	.probe		= hash_ce_probe,
+	.priv_auto_alloc_size = sizeof(struct hash_ce_priv),
+	.flags		= DM_FLAG_PRE_RELOC,
+};
+
+U_BOOT_DEVICE(hash_armv8_ce) = {
+	.name = "hash_armv8_ce",
+};
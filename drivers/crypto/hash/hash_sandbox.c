@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Sandbox hash engine, computing SHA-256 in software
+ */
+
+#include <common.h>
+#include <dm.h>
+#include <errno.h>
+#include <malloc.h>
+#include <asm/test.h>
+#include <u-boot/hash.h>
+#include <u-boot/sha256.h>
+
+struct hash_sandbox_priv {
+	uint count;	/* hashes started since sandbox_hash_get_count() */
+};
+
+uint sandbox_hash_get_count(struct udevice *dev)
+{
+	struct hash_sandbox_priv *priv = dev_get_priv(dev);
+	uint count = priv->count;
+
+	priv->count = 0;
+
+	return count;
+}
+
+static bool hash_sandbox_supports(struct udevice *dev, enum hash_algo_id algo)
+{
+	return algo == HASH_ALGO_SHA256;
+}
+
+static int hash_sandbox_init(struct udevice *dev, enum hash_algo_id algo,
+			     void **ctxp)
+{
+	struct hash_sandbox_priv *priv = dev_get_priv(dev);
+	sha256_context *ctx;
+
+	if (!hash_sandbox_supports(dev, algo))
+		return -EPROTONOSUPPORT;
+
+	ctx = malloc(sizeof(*ctx));
+	if (!ctx)
+		return -ENOMEM;
+	sha256_starts(ctx);
+	priv->count++;
+	*ctxp = ctx;
+
+	return 0;
+}
+
+static int hash_sandbox_update(struct udevice *dev, void *ctx,
+			       const void *buf, unsigned int size)
+{
+	sha256_update(ctx, buf, size);
+
+	return 0;
+}
+
+static int hash_sandbox_finish(struct udevice *dev, void *ctx, void *digest)
+{
+	sha256_finish(ctx, digest);
+	free(ctx);
+
+	return 0;
+}
+
+static const struct hash_ops hash_ops_sandbox = {
+	.supports	= hash_sandbox_supports,
+	.init		= hash_sandbox_init,
+	.update		= hash_sandbox_update,
+	.finish		= hash_sandbox_finish,
+};
+
+static const struct udevice_id hash_sandbox_ids[] = {
+	{ .compatible = "sandbox,hash" },
+	{ }
+};
+
+U_BOOT_DRIVER(hash_sandbox) = {
+	.name		= "hash_sandbox",
+	.id		= UCLASS_HASH,
+	.of_match	= hash_sandbox_ids,
+	.ops		= &hash_ops_sandbox,
+	.priv_auto_alloc_size = sizeof(struct hash_sandbox_priv),
+};
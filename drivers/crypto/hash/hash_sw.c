@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Software hash engine, using the implementations in lib/
+ */
+
+#include <common.h>
+#include <dm.h>
+#include <errno.h>
+#include <malloc.h>
+#include <asm/unaligned.h>
+#include <u-boot/crc.h>
+#include <u-boot/hash.h>
+#include <u-boot/sha1.h>
+#include <u-boot/sha256.h>
+#include <u-boot/sha512.h>
+
+struct hash_sw_ctx {
+	enum hash_algo_id algo;
+	union {
+		u32 crc;
+#ifdef CONFIG_SHA1
+		sha1_context sha1;
+#endif
+#ifdef CONFIG_SHA256
+		sha256_context sha256;
+#endif
+#if defined(CONFIG_SHA384) || defined(CONFIG_SHA512)
+		sha512_context sha512;
+#endif
+	};
+};
+
+static bool hash_sw_supports(struct udevice *dev, enum hash_algo_id algo)
+{
+	switch (algo) {
+	case HASH_ALGO_CRC32:
+		return true;
+	case HASH_ALGO_SHA1:
+		return IS_ENABLED(CONFIG_SHA1);
+	case HASH_ALGO_SHA256:
+		return IS_ENABLED(CONFIG_SHA256);
+	case HASH_ALGO_SHA384:
+		return IS_ENABLED(CONFIG_SHA384);
+	case HASH_ALGO_SHA512:
+		return IS_ENABLED(CONFIG_SHA512);
+	default:
+		return false;
+	}
+}
+
+static int hash_sw_init(struct udevice *dev, enum hash_algo_id algo,
+			void **ctxp)
+{
+	struct hash_sw_ctx *ctx;
+
+	if (!hash_sw_supports(dev, algo))
+		return -EPROTONOSUPPORT;
+
+	ctx = malloc(sizeof(*ctx));
+	if (!ctx)
+		return -ENOMEM;
+	ctx->algo = algo;
+
+	switch (algo) {
+	case HASH_ALGO_CRC32:
+		ctx->crc = 0;
+		break;
+#ifdef CONFIG_SHA1
+	case HASH_ALGO_SHA1:
+		sha1_starts(&ctx->sha1);
+		break;
+#endif
+#ifdef CONFIG_SHA256
+	case HASH_ALGO_SHA256:
+		sha256_starts(&ctx->sha256);
+		break;
+#endif
+#ifdef CONFIG_SHA384
+	case HASH_ALGO_SHA384:
+		sha384_starts(&ctx->sha512);
+		break;
+#endif
+#ifdef CONFIG_SHA512
+	case HASH_ALGO_SHA512:
+		sha512_starts(&ctx->sha512);
+		break;
+#endif
+	default:
+		break;
+	}
+	*ctxp = ctx;
+
+	return 0;
+}
+
+static int hash_sw_update(struct udevice *dev, void *priv, const void *buf,
+			  unsigned int size)
+{
+	struct hash_sw_ctx *ctx = priv;
+
+	switch (ctx->algo) {
+	case HASH_ALGO_CRC32:
+		ctx->crc = crc32(ctx->crc, buf, size);
+		break;
+#ifdef CONFIG_SHA1
+	case HASH_ALGO_SHA1:
+		sha1_update(&ctx->sha1, buf, size);
+		break;
+#endif
+#ifdef CONFIG_SHA256
+	case HASH_ALGO_SHA256:
+		sha256_update(&ctx->sha256, buf, size);
+		break;
+#endif
+#ifdef CONFIG_SHA384
+	case HASH_ALGO_SHA384:
+		sha384_update(&ctx->sha512, buf, size);
+		break;
+#endif
+#ifdef CONFIG_SHA512
+	case HASH_ALGO_SHA512:
+		sha512_update(&ctx->sha512, buf, size);
+		break;
+#endif
+	default:
+		free(ctx);
+		return -EPROTONOSUPPORT;
+	}
+
+	return 0;
+}
+
+static int hash_sw_finish(struct udevice *dev, void *priv, void *digest)
+{
+	struct hash_sw_ctx *ctx = priv;
+
+	switch (ctx->algo) {
+	case HASH_ALGO_CRC32:
+		put_unaligned_be32(ctx->crc, digest);
+		break;
+#ifdef CONFIG_SHA1
+	case HASH_ALGO_SHA1:
+		sha1_finish(&ctx->sha1, digest);
+		break;
+#endif
+#ifdef CONFIG_SHA256
+	case HASH_ALGO_SHA256:
+		sha256_finish(&ctx->sha256, digest);
+		break;
+#endif
+#ifdef CONFIG_SHA384
+	case HASH_ALGO_SHA384:
+		sha384_finish(&ctx->sha512, digest);
+		break;
+#endif
+#ifdef CONFIG_SHA512
+	case HASH_ALGO_SHA512:
+		sha512_finish(&ctx->sha512, digest);
+		break;
+#endif
+	default:
+		free(ctx);
+		return -EPROTONOSUPPORT;
+	}
+	free(ctx);
+
+	return 0;
+}
+
+static const struct hash_ops hash_ops_sw = {
+	.priority	= HASH_PRIO_SOFTWARE,
+	.supports	= hash_sw_supports,
+	.init		= hash_sw_init,
+	.update		= hash_sw_update,
+	.finish		= hash_sw_finish,
+};
+
+U_BOOT_DRIVER(hash_sw) = {
+	.name	= "hash_sw",
+	.id	= UCLASS_HASH,
+	.ops	= &hash_ops_sw,
+	.flags	= DM_FLAG_PRE_RELOC,
+};
+
+U_BOOT_DEVICE(hash_sw) = {
+	.name = "hash_sw",
+};
@@ -6,6 +6,7 @@
  */
 
 #include <common.h>
+#include <fs.h>
 #include <log.h>
 #include <mmc.h>
 #include <dm.h>
@@ -415,8 +416,10 @@ static int mmc_select_hwpart(struct udevice *bdev, int hwpart)
 		return -EMEDIUMTYPE;
 
 	ret = mmc_switch_part(mmc, hwpart);
-	if (!ret)
+	if (!ret) {
 		blkcache_invalidate(desc->if_type, desc->devnum);
+		fs_mount_invalidate(desc);
+	}
 
 	return ret;
 }
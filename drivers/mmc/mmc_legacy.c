@@ -6,6 +6,7 @@
  */
 
 #include <common.h>
+#include <fs.h>
 #include <log.h>
 #include <malloc.h>
 #include <mmc.h>
@@ -232,6 +233,7 @@ static int mmc_select_hwpartp(struct blk_desc *desc, int hwpart)
 	ret = mmc_switch_part(mmc, hwpart);
 	if (ret)
 		return ret;
+	fs_mount_invalidate(desc);
 
 	return 0;
 }
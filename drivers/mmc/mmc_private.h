@@ -17,6 +17,18 @@ int mmc_send_status(struct mmc *mmc, unsigned int *status);
 int mmc_poll_for_busy(struct mmc *mmc, int timeout);
 
 int mmc_set_blocklen(struct mmc *mmc, int len);
+int mmc_set_blockcount(struct mmc *mmc, unsigned int blockcount,
+		       bool is_rel_write);
+
+/*
+ * Whether a transfer of @blkcnt blocks can be announced with SET_BLOCK_COUNT
+ * rather than ended with STOP_TRANSMISSION
+ */
+static inline bool mmc_can_set_blockcount(struct mmc *mmc, lbaint_t blkcnt)
+{
+	return blkcnt > 1 && blkcnt <= 0xffff &&
+	       (mmc->card_caps & mmc->host_caps & MMC_CAP_CMD23);
+}
 
 #if CONFIG_IS_ENABLED(BLK)
 ulong mmc_bread(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
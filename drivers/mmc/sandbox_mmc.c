@@ -15,17 +15,23 @@
 struct sandbox_mmc_plat {
 	struct mmc_config cfg;
 	struct mmc mmc;
+	uint blockcount;
+	uint set_block_counts;
+	uint stops;
 };
 
 /**
  * sandbox_mmc_send_cmd() - Emulate SD commands
  *
  * This emulate an SD card version 2. Single-block reads result in zero data.
- * Multiple-block reads return a test string.
+ * Multiple-block reads return a test string. A block count set beforehand
+ * must match the next multiple-block read.
  */
 static int sandbox_mmc_send_cmd(struct udevice *dev, struct mmc_cmd *cmd,
 				struct mmc_data *data)
 {
+	struct sandbox_mmc_plat *plat = dev_get_platdata(dev);
+
 	switch (cmd->cmdidx) {
 	case MMC_CMD_ALL_SEND_CID:
 		memset(cmd->response, '\0', sizeof(cmd->response));
@@ -62,9 +68,17 @@ static int sandbox_mmc_send_cmd(struct udevice *dev, struct mmc_cmd *cmd,
 		memset(data->dest, '\0', data->blocksize);
 		break;
 	case MMC_CMD_READ_MULTIPLE_BLOCK:
+		if (plat->blockcount && plat->blockcount != data->blocks)
+			return -EIO;
+		plat->blockcount = 0;
 		strcpy(data->dest, "this is a test");
 		break;
+	case MMC_CMD_SET_BLOCK_COUNT:
+		plat->blockcount = cmd->cmdarg & 0xffff;
+		plat->set_block_counts++;
+		break;
 	case MMC_CMD_STOP_TRANSMISSION:
+		plat->stops++;
 		break;
 	case SD_CMD_APP_SEND_OP_COND:
 		cmd->response[0] = OCR_BUSY | OCR_HCS;
@@ -79,7 +93,8 @@ static int sandbox_mmc_send_cmd(struct udevice *dev, struct mmc_cmd *cmd,
 	case SD_CMD_APP_SEND_SCR: {
 		u32 *scr = (u32 *)data->dest;
 
-		scr[0] = cpu_to_be32(2 << 24 | 1 << 15);  /* SD version 3 */
+		/* SD version 3, with CMD23 */
+		scr[0] = cpu_to_be32(2 << 24 | 1 << 15 | SD_CMD23_SUPPORT);
 		break;
 	}
 	default:
@@ -90,6 +105,17 @@ static int sandbox_mmc_send_cmd(struct udevice *dev, struct mmc_cmd *cmd,
 	return 0;
 }
 
+void sandbox_mmc_get_cmd_counts(struct udevice *dev, uint *set_block_countp,
+				uint *stopp)
+{
+	struct sandbox_mmc_plat *plat = dev_get_platdata(dev);
+
+	*set_block_countp = plat->set_block_counts;
+	*stopp = plat->stops;
+	plat->set_block_counts = 0;
+	plat->stops = 0;
+}
+
 static int sandbox_mmc_set_ios(struct udevice *dev)
 {
 	return 0;
@@ -119,7 +145,8 @@ int sandbox_mmc_bind(struct udevice *dev)
 	struct mmc_config *cfg = &plat->cfg;
 
 	cfg->name = dev->name;
-	cfg->host_caps = MMC_MODE_HS_52MHz | MMC_MODE_HS | MMC_MODE_8BIT;
+	cfg->host_caps = MMC_MODE_HS_52MHz | MMC_MODE_HS | MMC_MODE_8BIT |
+			 MMC_CAP_CMD23;
 	cfg->voltages = MMC_VDD_165_195 | MMC_VDD_32_33 | MMC_VDD_33_34;
 	cfg->f_min = 1000000;
 	cfg->f_max = 52000000;
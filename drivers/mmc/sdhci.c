@@ -846,7 +846,7 @@ int sdhci_setup_cfg(struct mmc_config *cfg, struct sdhci_host *host,
 	if (caps & SDHCI_CAN_DO_HISPD)
 		cfg->host_caps |= MMC_MODE_HS | MMC_MODE_HS_52MHz;
 
-	cfg->host_caps |= MMC_MODE_4BIT;
+	cfg->host_caps |= MMC_MODE_4BIT | MMC_CAP_CMD23;
 
 	/* Since Host Controller Version3.0 */
 	if (SDHCI_GET_VERSION(host) >= SDHCI_SPEC_300) {
@@ -68,6 +68,8 @@ struct flash_info {
 #define USE_CLSR		BIT(14)	/* use CLSR command */
 #define SPI_NOR_HAS_SST26LOCK	BIT(15)	/* Flash supports lock/unlock via BPR */
 #define SPI_NOR_OCTAL_READ      BIT(16) /* Flash supports Octal Read */
+#define SPI_NOR_OCTAL_DTR_READ	BIT(17)	/* Flash supports octal DTR Read */
+#define SPI_NOR_OCTAL_DTR_PP	BIT(18)	/* Flash supports octal DTR Page Program */
 };
 
 extern const struct flash_info spi_nor_ids[];
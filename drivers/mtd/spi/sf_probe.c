@@ -86,6 +86,7 @@ void spi_flash_free(struct spi_flash *flash)
 	if (CONFIG_IS_ENABLED(SPI_FLASH_MTD))
 		spi_flash_mtd_unregister();
 
+	spi_nor_remove(flash);
 	spi_free_slave(flash->spi);
 	free(flash);
 }
@@ -143,10 +144,12 @@ int spi_flash_std_probe(struct udevice *dev)
 
 static int spi_flash_std_remove(struct udevice *dev)
 {
+	struct spi_flash *flash = dev_get_uclass_priv(dev);
+
 	if (CONFIG_IS_ENABLED(SPI_FLASH_MTD))
 		spi_flash_mtd_unregister();
 
-	return 0;
+	return spi_nor_remove(flash);
 }
 
 static const struct dm_spi_flash_ops spi_flash_std_ops = {
@@ -168,6 +171,7 @@ U_BOOT_DRIVER(jedec_spi_nor) = {
 	.remove		= spi_flash_std_remove,
 	.priv_auto_alloc_size = sizeof(struct spi_flash),
 	.ops		= &spi_flash_std_ops,
+	.flags		= DM_FLAG_OS_PREPARE,
 };
 
 U_BOOT_DRIVER_ALIAS(jedec_spi_nor, spansion_m25p16)
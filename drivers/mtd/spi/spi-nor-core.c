@@ -13,7 +13,9 @@
 #include <log.h>
 #include <dm/device_compat.h>
 #include <dm/devres.h>
+#include <linux/bitfield.h>
 #include <linux/bitops.h>
+#include <linux/delay.h>
 #include <linux/err.h>
 #include <linux/errno.h>
 #include <linux/log2.h>
@@ -38,6 +40,75 @@
 
 #define DEFAULT_READY_WAIT_JIFFIES		(40UL * HZ)
 
+/*
+ * Software Reset is not instant, and the delay varies from flash to flash.
+ * Looking at a few flashes, most range somewhere below 100 microseconds.
+ */
+#define SPI_NOR_SRST_SLEEP_LEN			200
+
+static u8 spi_nor_get_cmd_ext(const struct spi_nor *nor,
+			      const struct spi_mem_op *op)
+{
+	switch (nor->cmd_ext_type) {
+	case SPI_NOR_EXT_INVERT:
+		return ~op->cmd.opcode;
+
+	case SPI_NOR_EXT_REPEAT:
+		return op->cmd.opcode;
+
+	default:
+		dev_dbg(nor->dev, "Unknown command extension type\n");
+		return 0;
+	}
+}
+
+/**
+ * spi_nor_setup_op() - Set up common properties of a spi-mem op.
+ * @nor:	pointer to a 'struct spi_nor'
+ * @op:		pointer to the 'struct spi_mem_op' whose properties need to
+ *		be initialized. On entry, @op->dummy.nbytes holds the number
+ *		of dummy clock cycles, which is converted to bytes here.
+ * @proto:	the protocol from which the properties need to be set.
+ */
+static void spi_nor_setup_op(const struct spi_nor *nor,
+			     struct spi_mem_op *op,
+			     const enum spi_nor_protocol proto)
+{
+	u8 ext;
+
+	op->cmd.buswidth = spi_nor_get_protocol_inst_nbits(proto);
+
+	if (op->addr.nbytes)
+		op->addr.buswidth = spi_nor_get_protocol_addr_nbits(proto);
+
+	if (op->dummy.nbytes) {
+		op->dummy.buswidth = spi_nor_get_protocol_addr_nbits(proto);
+		op->dummy.nbytes = (op->dummy.nbytes * op->dummy.buswidth) / 8;
+	}
+
+	if (op->data.dir != SPI_MEM_NO_DATA)
+		op->data.buswidth = spi_nor_get_protocol_data_nbits(proto);
+
+	if (spi_nor_protocol_is_dtr(proto)) {
+		/*
+		 * spi-mem supports mixed DTR modes, but right now we can only
+		 * have all phases either DTR or STR. IOW, spi-mem can have
+		 * something like 4S-4D-4D, but spi-nor can't.
+		 */
+		op->cmd.dtr = true;
+		op->addr.dtr = true;
+		op->dummy.dtr = true;
+		op->data.dtr = true;
+
+		/* 2 bytes per clock cycle in DTR mode. */
+		op->dummy.nbytes *= 2;
+
+		ext = spi_nor_get_cmd_ext(nor, op);
+		op->cmd.opcode = (op->cmd.opcode << 8) | ext;
+		op->cmd.nbytes = 2;
+	}
+}
+
 static int spi_nor_read_write_reg(struct spi_nor *nor, struct spi_mem_op
 		*op, void *buf)
 {
@@ -50,25 +121,46 @@ static int spi_nor_read_write_reg(struct spi_nor *nor, struct spi_mem_op
 
 static int spi_nor_read_reg(struct spi_nor *nor, u8 code, u8 *val, int len)
 {
-	struct spi_mem_op op = SPI_MEM_OP(SPI_MEM_OP_CMD(code, 1),
+	struct spi_mem_op op = SPI_MEM_OP(SPI_MEM_OP_CMD(code, 0),
 					  SPI_MEM_OP_NO_ADDR,
 					  SPI_MEM_OP_NO_DUMMY,
-					  SPI_MEM_OP_DATA_IN(len, NULL, 1));
+					  SPI_MEM_OP_DATA_IN(len, NULL, 0));
+	u8 *buf = val;
 	int ret;
 
-	ret = spi_nor_read_write_reg(nor, &op, val);
+	/*
+	 * In octal DTR mode register reads take an address and dummy cycles,
+	 * and data comes in pairs of bytes, one per clock cycle.
+	 */
+	if (spi_nor_protocol_is_dtr(nor->reg_proto)) {
+		op.addr.nbytes = nor->rdsr_addr_nbytes;
+		op.dummy.nbytes = nor->rdsr_dummy;
+		if (len % 2) {
+			if (len + 1 > sizeof(nor->cmd_buf))
+				return -EINVAL;
+			op.data.nbytes = len + 1;
+			buf = nor->cmd_buf;
+		}
+	}
+	spi_nor_setup_op(nor, &op, nor->reg_proto);
+
+	ret = spi_nor_read_write_reg(nor, &op, buf);
 	if (ret < 0)
 		dev_dbg(nor->dev, "error %d reading %x\n", ret, code);
+	else if (buf != val)
+		memcpy(val, buf, len);
 
 	return ret;
 }
 
 static int spi_nor_write_reg(struct spi_nor *nor, u8 opcode, u8 *buf, int len)
 {
-	struct spi_mem_op op = SPI_MEM_OP(SPI_MEM_OP_CMD(opcode, 1),
+	struct spi_mem_op op = SPI_MEM_OP(SPI_MEM_OP_CMD(opcode, 0),
 					  SPI_MEM_OP_NO_ADDR,
 					  SPI_MEM_OP_NO_DUMMY,
-					  SPI_MEM_OP_DATA_OUT(len, NULL, 1));
+					  SPI_MEM_OP_DATA_OUT(len, NULL, 0));
+
+	spi_nor_setup_op(nor, &op, nor->reg_proto);
 
 	return spi_nor_read_write_reg(nor, &op, buf);
 }
@@ -77,21 +169,23 @@ static ssize_t spi_nor_read_data(struct spi_nor *nor, loff_t from, size_t len,
 				 u_char *buf)
 {
 	struct spi_mem_op op =
-			SPI_MEM_OP(SPI_MEM_OP_CMD(nor->read_opcode, 1),
-				   SPI_MEM_OP_ADDR(nor->addr_width, from, 1),
-				   SPI_MEM_OP_DUMMY(nor->read_dummy, 1),
-				   SPI_MEM_OP_DATA_IN(len, buf, 1));
+			SPI_MEM_OP(SPI_MEM_OP_CMD(nor->read_opcode, 0),
+				   SPI_MEM_OP_ADDR(nor->addr_width, from, 0),
+				   SPI_MEM_OP_DUMMY(nor->read_dummy, 0),
+				   SPI_MEM_OP_DATA_IN(len, buf, 0));
 	size_t remaining = len;
 	int ret;
 
-	/* get transfer protocols. */
-	op.cmd.buswidth = spi_nor_get_protocol_inst_nbits(nor->read_proto);
-	op.addr.buswidth = spi_nor_get_protocol_addr_nbits(nor->read_proto);
-	op.dummy.buswidth = op.addr.buswidth;
-	op.data.buswidth = spi_nor_get_protocol_data_nbits(nor->read_proto);
+	/*
+	 * Once set up, reads go through the direct mapping. Controllers with
+	 * a memory-mapped window (ti_qspi) read straight from it; the others
+	 * fall back to the same regular ops as below.
+	 */
+	if (nor->dirmap.rdesc)
+		return spi_mem_dirmap_read(nor->dirmap.rdesc, from, len, buf);
 
-	/* convert the dummy cycles to the number of bytes */
-	op.dummy.nbytes = (nor->read_dummy * op.dummy.buswidth) / 8;
+	/* get transfer protocols. */
+	spi_nor_setup_op(nor, &op, nor->read_proto);
 
 	while (remaining) {
 		op.data.nbytes = remaining < UINT_MAX ? remaining : UINT_MAX;
@@ -115,16 +209,14 @@ static ssize_t spi_nor_write_data(struct spi_nor *nor, loff_t to, size_t len,
 				  const u_char *buf)
 {
 	struct spi_mem_op op =
-			SPI_MEM_OP(SPI_MEM_OP_CMD(nor->program_opcode, 1),
-				   SPI_MEM_OP_ADDR(nor->addr_width, to, 1),
+			SPI_MEM_OP(SPI_MEM_OP_CMD(nor->program_opcode, 0),
+				   SPI_MEM_OP_ADDR(nor->addr_width, to, 0),
 				   SPI_MEM_OP_NO_DUMMY,
-				   SPI_MEM_OP_DATA_OUT(len, buf, 1));
+				   SPI_MEM_OP_DATA_OUT(len, buf, 0));
 	int ret;
 
 	/* get transfer protocols. */
-	op.cmd.buswidth = spi_nor_get_protocol_inst_nbits(nor->write_proto);
-	op.addr.buswidth = spi_nor_get_protocol_addr_nbits(nor->write_proto);
-	op.data.buswidth = spi_nor_get_protocol_data_nbits(nor->write_proto);
+	spi_nor_setup_op(nor, &op, nor->write_proto);
 
 	if (nor->program_opcode == SPINOR_OP_AAI_WP && nor->sst_write_second)
 		op.addr.nbytes = 0;
@@ -526,14 +618,16 @@ static int read_bar(struct spi_nor *nor, const struct flash_info *info)
 static int spi_nor_erase_sector(struct spi_nor *nor, u32 addr)
 {
 	struct spi_mem_op op =
-		SPI_MEM_OP(SPI_MEM_OP_CMD(nor->erase_opcode, 1),
-			   SPI_MEM_OP_ADDR(nor->addr_width, addr, 1),
+		SPI_MEM_OP(SPI_MEM_OP_CMD(nor->erase_opcode, 0),
+			   SPI_MEM_OP_ADDR(nor->addr_width, addr, 0),
 			   SPI_MEM_OP_NO_DUMMY,
 			   SPI_MEM_OP_NO_DATA);
 
 	if (nor->erase)
 		return nor->erase(nor, addr);
 
+	spi_nor_setup_op(nor, &op, nor->reg_proto);
+
 	/*
 	 * Default implementation, if driver doesn't have a specialized HW
 	 * control
@@ -1223,6 +1317,26 @@ sst_write_err:
 	return ret;
 }
 #endif
+/*
+ * Program the two bytes at the even address @to. Used for the ends of
+ * 8D-8D-8D writes, which move a pair of bytes per clock cycle.
+ */
+static int spi_nor_write_pair(struct spi_nor *nor, loff_t to, u8 first,
+			      u8 second)
+{
+	u8 pair[2] = { first, second };
+	ssize_t ret;
+
+	write_enable(nor);
+	ret = nor->write(nor, to, sizeof(pair), pair);
+	if (ret < 0)
+		return ret;
+	if (ret != sizeof(pair))
+		return -EIO;
+
+	return spi_nor_wait_till_ready(nor);
+}
+
 /*
  * Write an address range to the nor chip.  Data must be written in
  * FLASH_PAGESIZE chunks.  The address range may be any size provided
@@ -1233,7 +1347,8 @@ static int spi_nor_write(struct mtd_info *mtd, loff_t to, size_t len,
 {
 	struct spi_nor *nor = mtd_to_spi_nor(mtd);
 	size_t page_offset, page_remain, i;
-	ssize_t ret;
+	size_t tail = 0;
+	ssize_t ret = 0;
 
 #ifdef CONFIG_SPI_FLASH_SST
 	/* sst nor chips use AAI word program */
@@ -1246,6 +1361,25 @@ static int spi_nor_write(struct mtd_info *mtd, loff_t to, size_t len,
 	if (!len)
 		return 0;
 
+	/*
+	 * 8D-8D-8D programs cannot start or end on an odd byte. Pad the odd
+	 * ends to a full pair with 0xff, which leaves those NOR cells as they
+	 * are, and write the even middle below.
+	 */
+	if (spi_nor_protocol_is_dtr(nor->write_proto)) {
+		if (to & 1) {
+			ret = spi_nor_write_pair(nor, to - 1, 0xff, buf[0]);
+			if (ret)
+				return ret;
+			*retlen += 1;
+			to++;
+			buf++;
+			len--;
+		}
+		tail = len & 1;
+		len -= tail;
+	}
+
 	for (i = 0; i < len; ) {
 		ssize_t written;
 		loff_t addr = to + i;
@@ -1284,6 +1418,12 @@ static int spi_nor_write(struct mtd_info *mtd, loff_t to, size_t len,
 		i += written;
 	}
 
+	if (tail) {
+		ret = spi_nor_write_pair(nor, to + len, buf[len], 0xff);
+		if (!ret)
+			*retlen += 1;
+	}
+
 write_err:
 #ifdef CONFIG_SPI_FLASH_BAR
 	ret = clean_bar(nor);
@@ -1447,6 +1587,76 @@ static int spansion_no_read_cr_quad_enable(struct spi_nor *nor)
 #endif /* CONFIG_SPI_FLASH_SFDP_SUPPORT */
 #endif /* CONFIG_SPI_FLASH_SPANSION */
 
+#ifdef CONFIG_SPI_FLASH_STMICRO
+/**
+ * micron_octal_dtr_enable() - switch a Micron xSPI flash to octal DTR mode
+ * @nor:	pointer to a 'struct spi_nor'
+ *
+ * The memory array reads are set up for 20 dummy cycles, which is enough up
+ * to the highest clock rate of these flashes, before the volatile
+ * configuration register moves the flash to 8D-8D-8D. The ID is then read
+ * back in the new mode to check that the switch worked.
+ *
+ * Return: 0 on success, -errno otherwise.
+ */
+static int micron_octal_dtr_enable(struct spi_nor *nor)
+{
+	struct spi_mem_op op;
+	u8 *buf = nor->cmd_buf;
+	int ret;
+
+	/* Use 20 dummy cycles for memory array reads. */
+	ret = write_enable(nor);
+	if (ret)
+		return ret;
+
+	*buf = 20;
+	op = (struct spi_mem_op)
+		SPI_MEM_OP(SPI_MEM_OP_CMD(SPINOR_OP_MT_WR_ANY_REG, 1),
+			   SPI_MEM_OP_ADDR(3, SPINOR_REG_MT_CFR1V, 1),
+			   SPI_MEM_OP_NO_DUMMY,
+			   SPI_MEM_OP_DATA_OUT(1, buf, 1));
+	ret = spi_mem_exec_op(nor->spi, &op);
+	if (ret)
+		return ret;
+
+	ret = spi_nor_wait_till_ready(nor);
+	if (ret)
+		return ret;
+
+	ret = write_enable(nor);
+	if (ret)
+		return ret;
+
+	*buf = SPINOR_MT_OCT_DTR;
+	op = (struct spi_mem_op)
+		SPI_MEM_OP(SPI_MEM_OP_CMD(SPINOR_OP_MT_WR_ANY_REG, 1),
+			   SPI_MEM_OP_ADDR(3, SPINOR_REG_MT_CFR0V, 1),
+			   SPI_MEM_OP_NO_DUMMY,
+			   SPI_MEM_OP_DATA_OUT(1, buf, 1));
+	ret = spi_mem_exec_op(nor->spi, &op);
+	if (ret)
+		return ret;
+
+	/* Read flash ID to make sure the switch was successful. */
+	op = (struct spi_mem_op)
+		SPI_MEM_OP(SPI_MEM_OP_CMD(SPINOR_OP_RDID, 0),
+			   SPI_MEM_OP_NO_ADDR,
+			   SPI_MEM_OP_DUMMY(8, 0),
+			   SPI_MEM_OP_DATA_IN(round_up(nor->info->id_len, 2),
+					      buf, 0));
+	spi_nor_setup_op(nor, &op, SNOR_PROTO_8_8_8_DTR);
+	ret = spi_mem_exec_op(nor->spi, &op);
+	if (ret)
+		return ret;
+
+	if (memcmp(buf, nor->info->id, nor->info->id_len))
+		return -EINVAL;
+
+	return 0;
+}
+#endif /* CONFIG_SPI_FLASH_STMICRO */
+
 struct spi_nor_read_command {
 	u8			num_mode_clocks;
 	u8			num_wait_states;
@@ -1481,6 +1691,7 @@ enum spi_nor_read_command_index {
 	SNOR_CMD_READ_1_8_8,
 	SNOR_CMD_READ_8_8_8,
 	SNOR_CMD_READ_1_8_8_DTR,
+	SNOR_CMD_READ_8_8_8_DTR,
 
 	SNOR_CMD_READ_MAX
 };
@@ -1497,6 +1708,7 @@ enum spi_nor_pp_command_index {
 	SNOR_CMD_PP_1_1_8,
 	SNOR_CMD_PP_1_8_8,
 	SNOR_CMD_PP_8_8_8,
+	SNOR_CMD_PP_8_8_8_DTR,
 
 	SNOR_CMD_PP_MAX
 };
@@ -1509,7 +1721,13 @@ struct spi_nor_flash_parameter {
 	struct spi_nor_read_command	reads[SNOR_CMD_READ_MAX];
 	struct spi_nor_pp_command	page_programs[SNOR_CMD_PP_MAX];
 
+	enum spi_nor_cmd_ext		cmd_ext_type;
+	u8				rdsr_dummy;
+	u8				rdsr_addr_nbytes;
+	bool				soft_reset;
+
 	int (*quad_enable)(struct spi_nor *nor);
+	int (*octal_dtr_enable)(struct spi_nor *nor);
 };
 
 static void
@@ -1606,6 +1824,7 @@ struct sfdp_parameter_header {
 
 #define SFDP_BFPT_ID		0xff00	/* Basic Flash Parameter Table */
 #define SFDP_SECTOR_MAP_ID	0xff81	/* Sector Map Table */
+#define SFDP_PROFILE1_ID	0xff05	/* xSPI Profile 1.0 Table */
 #define SFDP_SST_ID		0x01bf	/* Manufacturer specific Table */
 
 #define SFDP_SIGNATURE		0x50444653U
@@ -1628,14 +1847,15 @@ struct sfdp_header {
 /* Basic Flash Parameter Table */
 
 /*
- * JESD216 rev B defines a Basic Flash Parameter Table of 16 DWORDs.
+ * JESD216 rev D defines a Basic Flash Parameter Table of 20 DWORDs.
  * They are indexed from 1 but C arrays are indexed from 0.
  */
 #define BFPT_DWORD(i)		((i) - 1)
-#define BFPT_DWORD_MAX		16
+#define BFPT_DWORD_MAX		20
 
 /* The first version of JESB216 defined only 9 DWORDs. */
 #define BFPT_DWORD_MAX_JESD216			9
+#define BFPT_DWORD_MAX_JESD216B			16
 
 /* 1st DWORD. */
 #define BFPT_DWORD1_FAST_READ_1_1_2		BIT(16)
@@ -1697,6 +1917,16 @@ struct sfdp_header {
 #define BFPT_DWORD15_QER_SR2_BIT1_NO_RD		(0x4UL << 20)
 #define BFPT_DWORD15_QER_SR2_BIT1		(0x5UL << 20) /* Spansion */
 
+/* 16th DWORD. */
+#define BFPT_DWORD16_SWRST_EN_RST		BIT(12)
+
+/* 18th DWORD. */
+#define BFPT_DWORD18_CMD_EXT_MASK		GENMASK(30, 29)
+#define BFPT_DWORD18_CMD_EXT_REP		(0x0UL << 29) /* Repeat */
+#define BFPT_DWORD18_CMD_EXT_INV		(0x1UL << 29) /* Invert */
+#define BFPT_DWORD18_CMD_EXT_RES		(0x2UL << 29) /* Reserved */
+#define BFPT_DWORD18_CMD_EXT_16B		(0x3UL << 29) /* 16-bit opcode */
+
 struct sfdp_bfpt {
 	u32	dwords[BFPT_DWORD_MAX];
 };
@@ -1949,7 +2179,7 @@ static int spi_nor_parse_bfpt(struct spi_nor *nor,
 	}
 
 	/* Stop here if not JESD216 rev A or later. */
-	if (bfpt_header->length < BFPT_DWORD_MAX)
+	if (bfpt_header->length < BFPT_DWORD_MAX_JESD216B)
 		return 0;
 
 	/* Page size: this field specifies 'N' so the page size = 2^N bytes. */
@@ -1983,9 +2213,130 @@ static int spi_nor_parse_bfpt(struct spi_nor *nor,
 		return -EINVAL;
 	}
 
+	/* Soft Reset support. */
+	if (bfpt.dwords[BFPT_DWORD(16)] & BFPT_DWORD16_SWRST_EN_RST)
+		params->soft_reset = true;
+
+	/* Stop here if not JESD216 rev D or later. */
+	if (bfpt_header->length < BFPT_DWORD_MAX)
+		return 0;
+
+	/* 8D-8D-8D command extension. */
+	switch (bfpt.dwords[BFPT_DWORD(18)] & BFPT_DWORD18_CMD_EXT_MASK) {
+	case BFPT_DWORD18_CMD_EXT_REP:
+		params->cmd_ext_type = SPI_NOR_EXT_REPEAT;
+		break;
+
+	case BFPT_DWORD18_CMD_EXT_INV:
+		params->cmd_ext_type = SPI_NOR_EXT_INVERT;
+		break;
+
+	case BFPT_DWORD18_CMD_EXT_RES:
+		dev_dbg(nor->dev, "Reserved command extension used\n");
+		break;
+
+	case BFPT_DWORD18_CMD_EXT_16B:
+		dev_dbg(nor->dev, "16-bit opcodes not supported\n");
+		return -ENOTSUPP;
+	}
+
 	return 0;
 }
 
+/* xSPI Profile 1.0 table (from JESD216D.01). */
+#define PROFILE1_DWORD1_RD_FAST_CMD		GENMASK(15, 8)
+#define PROFILE1_DWORD1_RDSR_DUMMY		BIT(28)
+#define PROFILE1_DWORD1_RDSR_ADDR_BYTES		BIT(29)
+#define PROFILE1_DWORD4_DUMMY_200MHZ		GENMASK(11, 7)
+#define PROFILE1_DWORD5_DUMMY_166MHZ		GENMASK(31, 27)
+#define PROFILE1_DWORD5_DUMMY_133MHZ		GENMASK(21, 17)
+#define PROFILE1_DWORD5_DUMMY_100MHZ		GENMASK(11, 7)
+#define PROFILE1_DUMMY_DEFAULT			20
+
+/**
+ * spi_nor_parse_profile1() - parse the xSPI Profile 1.0 table
+ * @nor:		pointer to a 'struct spi_nor'
+ * @profile1_header:	pointer to the 'struct sfdp_parameter_header' describing
+ *			the Profile 1.0 Table length and version.
+ * @params:		pointer to the 'struct spi_nor_flash_parameter' to be
+ *			filled
+ *
+ * The xSPI Profile 1.0 table gives the 8D-8D-8D Fast Read opcode, the dummy
+ * cycles it needs at the supported clock rates and how the Read Status
+ * Register command is sent in that mode.
+ *
+ * Return: 0 on success, -errno otherwise.
+ */
+static int
+spi_nor_parse_profile1(struct spi_nor *nor,
+		       const struct sfdp_parameter_header *profile1_header,
+		       struct spi_nor_flash_parameter *params)
+{
+	u32 *dwords, addr;
+	size_t len;
+	int ret, i;
+	u8 dummy, opcode;
+
+	len = profile1_header->length * sizeof(*dwords);
+	if (len < 5 * sizeof(*dwords))
+		return -EINVAL;
+
+	dwords = kmalloc(len, GFP_KERNEL);
+	if (!dwords)
+		return -ENOMEM;
+
+	addr = SFDP_PARAM_HEADER_PTP(profile1_header);
+	ret = spi_nor_read_sfdp(nor, addr, len, dwords);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < profile1_header->length; i++)
+		dwords[i] = le32_to_cpu(dwords[i]);
+
+	/* Get 8D-8D-8D fast read opcode and dummy cycles. */
+	opcode = FIELD_GET(PROFILE1_DWORD1_RD_FAST_CMD, dwords[0]);
+
+	/* Set the Read Status Register dummy cycles and dummy address bytes. */
+	if (dwords[0] & PROFILE1_DWORD1_RDSR_DUMMY)
+		params->rdsr_dummy = 8;
+	else
+		params->rdsr_dummy = 4;
+
+	if (dwords[0] & PROFILE1_DWORD1_RDSR_ADDR_BYTES)
+		params->rdsr_addr_nbytes = 4;
+	else
+		params->rdsr_addr_nbytes = 0;
+
+	/*
+	 * We don't know what speed the controller is running at. Find the
+	 * dummy cycles for the fastest frequency the flash can run at to be
+	 * sure we are never short of dummy cycles. A value of 0 means the
+	 * frequency is not supported.
+	 */
+	dummy = FIELD_GET(PROFILE1_DWORD4_DUMMY_200MHZ, dwords[3]);
+	if (!dummy)
+		dummy = FIELD_GET(PROFILE1_DWORD5_DUMMY_166MHZ, dwords[4]);
+	if (!dummy)
+		dummy = FIELD_GET(PROFILE1_DWORD5_DUMMY_133MHZ, dwords[4]);
+	if (!dummy)
+		dummy = FIELD_GET(PROFILE1_DWORD5_DUMMY_100MHZ, dwords[4]);
+	if (!dummy)
+		dummy = PROFILE1_DUMMY_DEFAULT;
+
+	/* Round up to an even value to avoid tripping controllers up. */
+	dummy = round_up(dummy, 2);
+
+	/* Update the fast read settings. */
+	params->hwcaps.mask |= SNOR_HWCAPS_READ_8_8_8_DTR;
+	spi_nor_set_read_settings(&params->reads[SNOR_CMD_READ_8_8_8_DTR],
+				  0, dummy, opcode,
+				  SNOR_PROTO_8_8_8_DTR);
+
+out:
+	kfree(dwords);
+	return ret;
+}
+
 /**
  * spi_nor_parse_microchip_sfdp() - parse the Microchip manufacturer specific
  * SFDP table.
@@ -2116,6 +2467,10 @@ static int spi_nor_parse_sfdp(struct spi_nor *nor,
 			err = spi_nor_parse_microchip_sfdp(nor, param_header);
 			break;
 
+		case SFDP_PROFILE1_ID:
+			err = spi_nor_parse_profile1(nor, param_header, params);
+			break;
+
 		default:
 			break;
 		}
@@ -2191,6 +2546,21 @@ static int spi_nor_init_params(struct spi_nor *nor,
 					  SNOR_PROTO_1_1_8);
 	}
 
+#ifdef CONFIG_SPI_FLASH_STMICRO
+	if (info->flags & SPI_NOR_OCTAL_DTR_READ &&
+	    JEDEC_MFR(info) == SNOR_MFR_MICRON) {
+		params->hwcaps.mask |= SNOR_HWCAPS_READ_8_8_8_DTR;
+		spi_nor_set_read_settings(&params->reads[SNOR_CMD_READ_8_8_8_DTR],
+					  0, 20, SPINOR_OP_MT_DTR_RD,
+					  SNOR_PROTO_8_8_8_DTR);
+		params->cmd_ext_type = SPI_NOR_EXT_REPEAT;
+		params->rdsr_dummy = 8;
+		params->rdsr_addr_nbytes = 0;
+		params->soft_reset = true;
+		params->octal_dtr_enable = micron_octal_dtr_enable;
+	}
+#endif
+
 	/* Page Program settings. */
 	params->hwcaps.mask |= SNOR_HWCAPS_PP;
 	spi_nor_set_pp_settings(&params->page_programs[SNOR_CMD_PP],
@@ -2202,6 +2572,12 @@ static int spi_nor_init_params(struct spi_nor *nor,
 					SPINOR_OP_PP_1_1_4, SNOR_PROTO_1_1_4);
 	}
 
+	if (info->flags & SPI_NOR_OCTAL_DTR_PP) {
+		params->hwcaps.mask |= SNOR_HWCAPS_PP_8_8_8_DTR;
+		spi_nor_set_pp_settings(&params->page_programs[SNOR_CMD_PP_8_8_8_DTR],
+					SPINOR_OP_PP, SNOR_PROTO_8_8_8_DTR);
+	}
+
 	/* Select the procedure to set the Quad Enable bit. */
 	if (params->hwcaps.mask & (SNOR_HWCAPS_READ_QUAD |
 				   SNOR_HWCAPS_PP_QUAD)) {
@@ -2228,7 +2604,8 @@ static int spi_nor_init_params(struct spi_nor *nor,
 	/* Override the parameters with data read from SFDP tables. */
 	nor->addr_width = 0;
 	nor->mtd.erasesize = 0;
-	if ((info->flags & (SPI_NOR_DUAL_READ | SPI_NOR_QUAD_READ)) &&
+	if ((info->flags & (SPI_NOR_DUAL_READ | SPI_NOR_QUAD_READ |
+			    SPI_NOR_OCTAL_DTR_READ)) &&
 	    !(info->flags & SPI_NOR_SKIP_SFDP)) {
 		struct spi_nor_flash_parameter sfdp_params;
 
@@ -2273,6 +2650,7 @@ static int spi_nor_hwcaps_read2cmd(u32 hwcaps)
 		{ SNOR_HWCAPS_READ_1_8_8,	SNOR_CMD_READ_1_8_8 },
 		{ SNOR_HWCAPS_READ_8_8_8,	SNOR_CMD_READ_8_8_8 },
 		{ SNOR_HWCAPS_READ_1_8_8_DTR,	SNOR_CMD_READ_1_8_8_DTR },
+		{ SNOR_HWCAPS_READ_8_8_8_DTR,	SNOR_CMD_READ_8_8_8_DTR },
 	};
 
 	return spi_nor_hwcaps2cmd(hwcaps, hwcaps_read2cmd,
@@ -2289,6 +2667,7 @@ static int spi_nor_hwcaps_pp2cmd(u32 hwcaps)
 		{ SNOR_HWCAPS_PP_1_1_8,		SNOR_CMD_PP_1_1_8 },
 		{ SNOR_HWCAPS_PP_1_8_8,		SNOR_CMD_PP_1_8_8 },
 		{ SNOR_HWCAPS_PP_8_8_8,		SNOR_CMD_PP_8_8_8 },
+		{ SNOR_HWCAPS_PP_8_8_8_DTR,	SNOR_CMD_PP_8_8_8_DTR },
 	};
 
 	return spi_nor_hwcaps2cmd(hwcaps, hwcaps_pp2cmd,
@@ -2373,6 +2752,40 @@ static int spi_nor_select_erase(struct spi_nor *nor,
 	return 0;
 }
 
+/*
+ * Check that the controller takes the 8D-8D-8D read and page program ops of
+ * @params, so the flash is not switched to a mode that cannot be used.
+ */
+static bool spi_nor_spimem_supports_8d(struct spi_nor *nor,
+				       const struct spi_nor_flash_parameter *params)
+{
+	const struct spi_nor_read_command *read =
+		&params->reads[SNOR_CMD_READ_8_8_8_DTR];
+	const struct spi_nor_pp_command *pp =
+		&params->page_programs[SNOR_CMD_PP_8_8_8_DTR];
+	struct spi_mem_op op;
+
+	/* 4 address bytes and an even length, as used in 8D-8D-8D. */
+	op = (struct spi_mem_op)
+		SPI_MEM_OP(SPI_MEM_OP_CMD(read->opcode, 0),
+			   SPI_MEM_OP_ADDR(4, 0, 0),
+			   SPI_MEM_OP_DUMMY(read->num_mode_clocks +
+					    read->num_wait_states, 0),
+			   SPI_MEM_OP_DATA_IN(2, NULL, 0));
+	spi_nor_setup_op(nor, &op, read->proto);
+	if (!spi_mem_supports_op(nor->spi, &op))
+		return false;
+
+	op = (struct spi_mem_op)
+		SPI_MEM_OP(SPI_MEM_OP_CMD(pp->opcode, 0),
+			   SPI_MEM_OP_ADDR(4, 0, 0),
+			   SPI_MEM_OP_NO_DUMMY,
+			   SPI_MEM_OP_DATA_OUT(2, NULL, 0));
+	spi_nor_setup_op(nor, &op, pp->proto);
+
+	return spi_mem_supports_op(nor->spi, &op);
+}
+
 static int spi_nor_setup(struct spi_nor *nor, const struct flash_info *info,
 			 const struct spi_nor_flash_parameter *params,
 			 const struct spi_nor_hwcaps *hwcaps)
@@ -2399,6 +2812,22 @@ static int spi_nor_setup(struct spi_nor *nor, const struct flash_info *info,
 		shared_mask &= ~ignored_mask;
 	}
 
+	/*
+	 * 8D-8D-8D is used for both reads and writes or not at all, and
+	 * only when the flash can be switched to it and the controller
+	 * takes the ops in that mode.
+	 */
+	nor->cmd_ext_type = params->cmd_ext_type;
+	ignored_mask = SNOR_HWCAPS_READ_8_8_8_DTR | SNOR_HWCAPS_PP_8_8_8_DTR;
+	if ((shared_mask & ignored_mask) &&
+	    ((shared_mask & ignored_mask) != ignored_mask ||
+	     !params->octal_dtr_enable ||
+	     nor->flags & SNOR_F_BROKEN_RESET ||
+	     !spi_nor_spimem_supports_8d(nor, params))) {
+		dev_dbg(nor->dev, "8D-8D-8D protocol not usable\n");
+		shared_mask &= ~ignored_mask;
+	}
+
 	/* Select the (Fast) Read command. */
 	err = spi_nor_select_read(nor, params, shared_mask);
 	if (err) {
@@ -2431,6 +2860,18 @@ static int spi_nor_setup(struct spi_nor *nor, const struct flash_info *info,
 	else
 		nor->quad_enable = NULL;
 
+	/* Enable octal DTR if needed. */
+	if (nor->read_proto == SNOR_PROTO_8_8_8_DTR) {
+		nor->octal_dtr_enable = params->octal_dtr_enable;
+		nor->rdsr_dummy = params->rdsr_dummy;
+		nor->rdsr_addr_nbytes = params->rdsr_addr_nbytes;
+	} else {
+		nor->octal_dtr_enable = NULL;
+	}
+
+	if (params->soft_reset)
+		nor->flags |= SNOR_F_SOFT_RESET;
+
 	return 0;
 }
 
@@ -2451,6 +2892,15 @@ static int spi_nor_init(struct spi_nor *nor)
 		spi_nor_wait_till_ready(nor);
 	}
 
+	if (nor->octal_dtr_enable) {
+		err = nor->octal_dtr_enable(nor);
+		if (err) {
+			dev_dbg(nor->dev, "octal DTR mode not supported\n");
+			return err;
+		}
+		nor->reg_proto = SNOR_PROTO_8_8_8_DTR;
+	}
+
 	if (nor->quad_enable) {
 		err = nor->quad_enable(nor);
 		if (err) {
@@ -2477,6 +2927,95 @@ static int spi_nor_init(struct spi_nor *nor)
 	return 0;
 }
 
+/**
+ * spi_nor_soft_reset() - perform a software reset
+ * @nor:	pointer to 'struct spi_nor'
+ *
+ * Performs a "Soft Reset and Enter Default Protocol Mode" sequence which
+ * resets the device to its power-on state, in the protocol given by
+ * @nor->reg_proto.
+ *
+ * Return: 0 for success, -errno for failure.
+ */
+static int spi_nor_soft_reset(struct spi_nor *nor)
+{
+	struct spi_mem_op op;
+	int ret;
+
+	op = (struct spi_mem_op)SPI_MEM_OP(SPI_MEM_OP_CMD(SPINOR_OP_SRSTEN, 0),
+					   SPI_MEM_OP_NO_ADDR,
+					   SPI_MEM_OP_NO_DUMMY,
+					   SPI_MEM_OP_NO_DATA);
+	spi_nor_setup_op(nor, &op, nor->reg_proto);
+	ret = spi_mem_exec_op(nor->spi, &op);
+	if (ret) {
+		dev_dbg(nor->dev, "Software reset enable failed: %d\n", ret);
+		return ret;
+	}
+
+	op = (struct spi_mem_op)SPI_MEM_OP(SPI_MEM_OP_CMD(SPINOR_OP_SRST, 0),
+					   SPI_MEM_OP_NO_ADDR,
+					   SPI_MEM_OP_NO_DUMMY,
+					   SPI_MEM_OP_NO_DATA);
+	spi_nor_setup_op(nor, &op, nor->reg_proto);
+	ret = spi_mem_exec_op(nor->spi, &op);
+	if (ret) {
+		dev_dbg(nor->dev, "Software reset failed: %d\n", ret);
+		return ret;
+	}
+
+	udelay(SPI_NOR_SRST_SLEEP_LEN);
+
+	return 0;
+}
+
+int spi_nor_remove(struct spi_nor *nor)
+{
+	int ret = 0;
+
+	if (nor->dirmap.rdesc) {
+		spi_mem_dirmap_destroy(nor->dirmap.rdesc);
+		nor->dirmap.rdesc = NULL;
+	}
+
+	/* Put the flash back in the mode the next stage expects. */
+	if (spi_nor_protocol_is_dtr(nor->reg_proto) &&
+	    nor->flags & SNOR_F_SOFT_RESET) {
+		ret = spi_nor_soft_reset(nor);
+		nor->reg_proto = SNOR_PROTO_1_1_1;
+	}
+
+	return ret;
+}
+
+#ifndef CONFIG_SPI_FLASH_BAR
+/*
+ * Set up a direct mapping of the whole flash for reads. This is optional:
+ * on failure reads are sent as regular ops.
+ */
+static void spi_nor_create_read_dirmap(struct spi_nor *nor)
+{
+	struct spi_mem_dirmap_info info = {
+		.op_tmpl = SPI_MEM_OP(SPI_MEM_OP_CMD(nor->read_opcode, 0),
+				      SPI_MEM_OP_ADDR(nor->addr_width, 0, 0),
+				      SPI_MEM_OP_DUMMY(nor->read_dummy, 0),
+				      SPI_MEM_OP_DATA_IN(0, NULL, 0)),
+		.offset = 0,
+		.length = nor->mtd.size,
+	};
+	struct spi_mem_dirmap_desc *desc;
+
+	spi_nor_setup_op(nor, &info.op_tmpl, nor->read_proto);
+
+	desc = spi_mem_dirmap_create(nor->spi, &info);
+	if (IS_ERR(desc)) {
+		dev_dbg(nor->dev, "no read mapping: %ld\n", PTR_ERR(desc));
+		return;
+	}
+	nor->dirmap.rdesc = desc;
+}
+#endif
+
 int spi_nor_scan(struct spi_nor *nor)
 {
 	struct spi_nor_flash_parameter params;
@@ -2505,7 +3044,9 @@ int spi_nor_scan(struct spi_nor *nor)
 		if (spi->mode & SPI_TX_OCTAL)
 			hwcaps.mask |= (SNOR_HWCAPS_READ_1_8_8 |
 					SNOR_HWCAPS_PP_1_1_8 |
-					SNOR_HWCAPS_PP_1_8_8);
+					SNOR_HWCAPS_PP_1_8_8 |
+					SNOR_HWCAPS_READ_8_8_8_DTR |
+					SNOR_HWCAPS_PP_8_8_8_DTR);
 	} else if (spi->mode & SPI_RX_QUAD) {
 		hwcaps.mask |= SNOR_HWCAPS_READ_1_1_4;
 
@@ -2520,6 +3061,20 @@ int spi_nor_scan(struct spi_nor *nor)
 			hwcaps.mask |= SNOR_HWCAPS_READ_1_2_2;
 	}
 
+	/*
+	 * The flash may have been left in octal DTR mode by an earlier stage
+	 * or a reset which did not reach it. Bring it back to 1-1-1 before
+	 * reading the ID.
+	 */
+	if (IS_ENABLED(CONFIG_SPI_FLASH_SOFT_RESET_ON_BOOT)) {
+		nor->reg_proto = SNOR_PROTO_8_8_8_DTR;
+		nor->cmd_ext_type = SPI_NOR_EXT_REPEAT;
+		ret = spi_nor_soft_reset(nor);
+		nor->reg_proto = SNOR_PROTO_1_1_1;
+		if (ret)
+			return ret;
+	}
+
 	info = spi_nor_read_id(nor);
 	if (IS_ERR_OR_NULL(info))
 		return -ENOENT;
@@ -2595,6 +3150,16 @@ int spi_nor_scan(struct spi_nor *nor)
 
 	if (nor->addr_width) {
 		/* already configured from SFDP */
+	} else if (nor->read_proto == SNOR_PROTO_8_8_8_DTR) {
+		/*
+		 * In 8D-8D-8D a byte takes half a cycle, so an odd address
+		 * width would leave the following phases starting mid-cycle.
+		 */
+		nor->addr_width = 4;
+#ifndef CONFIG_SPI_FLASH_BAR
+		if (info->flags & SPI_NOR_4B_OPCODES)
+			spi_nor_set_4byte_opcodes(nor, info);
+#endif
 	} else if (info->addr_width) {
 		nor->addr_width = info->addr_width;
 	} else if (mtd->size > SZ_16M) {
@@ -2627,6 +3192,10 @@ int spi_nor_scan(struct spi_nor *nor)
 	if (ret)
 		return ret;
 
+#ifndef CONFIG_SPI_FLASH_BAR
+	spi_nor_create_read_dirmap(nor);
+#endif
+
 	nor->name = mtd->name;
 	nor->size = mtd->size;
 	nor->erase_size = mtd->erasesize;
@@ -18,40 +18,11 @@
 #include <linux/compat.h>
 #include "nvme.h"
 
-#define NVME_Q_DEPTH		2
+#define NVME_Q_DEPTH		CONFIG_NVME_QUEUE_DEPTH
 #define NVME_AQ_DEPTH		2
 #define NVME_SQ_SIZE(depth)	(depth * sizeof(struct nvme_command))
 #define NVME_CQ_SIZE(depth)	(depth * sizeof(struct nvme_completion))
 #define ADMIN_TIMEOUT		60
-#define IO_TIMEOUT		30
-#define MAX_PRP_POOL		512
-
-enum nvme_queue_id {
-	NVME_ADMIN_Q,
-	NVME_IO_Q,
-	NVME_Q_NUM,
-};
-
-/*
- * An NVM Express queue. Each device has at least two (one for admin
- * commands and one for I/O commands).
- */
-struct nvme_queue {
-	struct nvme_dev *dev;
-	struct nvme_command *sq_cmds;
-	struct nvme_completion *cqes;
-	wait_queue_head_t sq_full;
-	u32 __iomem *q_db;
-	u16 q_depth;
-	s16 cq_vector;
-	u16 sq_head;
-	u16 sq_tail;
-	u16 cq_head;
-	u16 qid;
-	u8 cq_phase;
-	u8 cqe_seen;
-	unsigned long cmdid_data[];
-};
 
 static int nvme_wait_ready(struct nvme_dev *dev, bool enabled)
 {
@@ -71,68 +42,42 @@ static int nvme_wait_ready(struct nvme_dev *dev, bool enabled)
 	return -ETIME;
 }
 
-static int nvme_setup_prps(struct nvme_dev *dev, u64 *prp2,
-			   int total_len, u64 dma_addr)
+/*
+ * Fill in the PRP entries for a transfer, using @prp_list for the list if the
+ * transfer covers more than two pages. A list of one page maps transfers of
+ * up to page_size / 8 pages at any offset.
+ */
+static void nvme_setup_prps(struct nvme_dev *dev, u64 *prp_list, u64 *prp2,
+			    int total_len, u64 dma_addr)
 {
 	u32 page_size = dev->page_size;
 	int offset = dma_addr & (page_size - 1);
-	u64 *prp_pool;
 	int length = total_len;
 	int i, nprps;
-	u32 prps_per_page = (page_size >> 3) - 1;
-	u32 num_pages;
 
 	length -= (page_size - offset);
 
 	if (length <= 0) {
 		*prp2 = 0;
-		return 0;
+		return;
 	}
 
-	if (length)
-		dma_addr += (page_size - offset);
+	dma_addr += (page_size - offset);
 
 	if (length <= page_size) {
 		*prp2 = dma_addr;
-		return 0;
+		return;
 	}
 
 	nprps = DIV_ROUND_UP(length, page_size);
-	num_pages = DIV_ROUND_UP(nprps, prps_per_page);
-
-	if (nprps > dev->prp_entry_num) {
-		free(dev->prp_pool);
-		/*
-		 * Always increase in increments of pages.  It doesn't waste
-		 * much memory and reduces the number of allocations.
-		 */
-		dev->prp_pool = memalign(page_size, num_pages * page_size);
-		if (!dev->prp_pool) {
-			printf("Error: malloc prp_pool fail\n");
-			return -ENOMEM;
-		}
-		dev->prp_entry_num = prps_per_page * num_pages;
-	}
-
-	prp_pool = dev->prp_pool;
-	i = 0;
-	while (nprps) {
-		if (i == ((page_size >> 3) - 1)) {
-			*(prp_pool + i) = cpu_to_le64((ulong)prp_pool +
-					page_size);
-			i = 0;
-			prp_pool += page_size;
-		}
-		*(prp_pool + i++) = cpu_to_le64(dma_addr);
+	for (i = 0; i < nprps; i++) {
+		prp_list[i] = cpu_to_le64(dma_addr);
 		dma_addr += page_size;
-		nprps--;
 	}
-	*prp2 = (ulong)dev->prp_pool;
+	*prp2 = (ulong)prp_list;
 
-	flush_dcache_range((ulong)dev->prp_pool, (ulong)dev->prp_pool +
-			   dev->prp_entry_num * sizeof(u64));
-
-	return 0;
+	flush_dcache_range((ulong)prp_list, (ulong)prp_list +
+			   roundup(nprps * sizeof(u64), ARCH_DMA_MINALIGN));
 }
 
 static __le16 nvme_get_cmd_id(void)
@@ -153,12 +98,12 @@ static u16 nvme_read_completion_status(struct nvme_queue *nvmeq, u16 index)
 }
 
 /**
- * nvme_submit_cmd() - copy a command into a queue and ring the doorbell
+ * nvme_queue_cmd() - copy a command into a queue without ringing the doorbell
  *
  * @nvmeq:	The queue to use
  * @cmd:	The command to send
  */
-static void nvme_submit_cmd(struct nvme_queue *nvmeq, struct nvme_command *cmd)
+static void nvme_queue_cmd(struct nvme_queue *nvmeq, struct nvme_command *cmd)
 {
 	u16 tail = nvmeq->sq_tail;
 
@@ -168,10 +113,21 @@ static void nvme_submit_cmd(struct nvme_queue *nvmeq, struct nvme_command *cmd)
 
 	if (++tail == nvmeq->q_depth)
 		tail = 0;
-	writel(tail, nvmeq->q_db);
 	nvmeq->sq_tail = tail;
 }
 
+/**
+ * nvme_submit_cmd() - copy a command into a queue and ring the doorbell
+ *
+ * @nvmeq:	The queue to use
+ * @cmd:	The command to send
+ */
+static void nvme_submit_cmd(struct nvme_queue *nvmeq, struct nvme_command *cmd)
+{
+	nvme_queue_cmd(nvmeq, cmd);
+	writel(nvmeq->sq_tail, nvmeq->q_db);
+}
+
 static int nvme_submit_sync_cmd(struct nvme_queue *nvmeq,
 				struct nvme_command *cmd,
 				u32 *result, unsigned timeout)
@@ -312,6 +268,9 @@ static int nvme_disable_ctrl(struct nvme_dev *dev)
 
 static void nvme_free_queue(struct nvme_queue *nvmeq)
 {
+	free(nvmeq->prp_pool);
+	free(nvmeq->ios);
+	free(nvmeq->cmds);
 	free((void *)nvmeq->cqes);
 	free(nvmeq->sq_cmds);
 	free(nvmeq);
@@ -590,6 +549,26 @@ static int nvme_setup_io_queues(struct nvme_dev *dev)
 	return 0;
 }
 
+int nvme_alloc_io_cmds(struct nvme_dev *dev, struct nvme_queue *nvmeq)
+{
+	int i;
+
+	nvmeq->nr_cmds = nvmeq->q_depth - 1;
+	nvmeq->cmds = calloc(nvmeq->nr_cmds, sizeof(*nvmeq->cmds));
+	nvmeq->ios = calloc(nvmeq->nr_cmds, sizeof(*nvmeq->ios));
+	nvmeq->prp_pool = memalign(dev->page_size,
+				   nvmeq->nr_cmds * dev->page_size);
+	if (!nvmeq->cmds || !nvmeq->ios || !nvmeq->prp_pool)
+		return -ENOMEM;
+
+	for (i = 0; i < nvmeq->nr_cmds; i++)
+		nvmeq->cmds[i].prp_list = nvmeq->prp_pool +
+					  i * (dev->page_size >> 3);
+	INIT_LIST_HEAD(&nvmeq->io_list);
+
+	return 0;
+}
+
 static int nvme_get_info_from_identify(struct nvme_dev *dev)
 {
 	struct nvme_id_ctrl *ctrl;
@@ -713,64 +692,251 @@ static int nvme_blk_probe(struct udevice *udev)
 	return 0;
 }
 
-static ulong nvme_blk_rw(struct udevice *udev, lbaint_t blknr,
-			 lbaint_t blkcnt, void *buffer, bool read)
+/* Largest number of blocks a command may transfer on @ns */
+static lbaint_t nvme_max_blks(struct nvme_ns *ns)
 {
-	struct nvme_ns *ns = dev_get_priv(udev);
 	struct nvme_dev *dev = ns->dev;
-	struct nvme_command c;
-	struct blk_desc *desc = dev_get_uclass_platdata(udev);
-	int status;
-	u64 prp2;
-	u64 total_len = blkcnt << desc->log2blksz;
-	u64 temp_len = total_len;
+	u64 max_len;
 
-	u64 slba = blknr;
-	u16 lbas = 1 << (dev->max_transfer_shift - ns->lba_shift);
-	u64 total_lbas = blkcnt;
+	/* The PRP list of each command fills at most one page */
+	max_len = min_t(u64, 1ULL << dev->max_transfer_shift,
+			(u64)(dev->page_size >> 3) * dev->page_size);
 
-	flush_dcache_range((unsigned long)buffer,
-			   (unsigned long)buffer + total_len);
+	return min_t(u64, max_len >> ns->lba_shift, 0x10000);
+}
 
-	c.rw.opcode = read ? nvme_cmd_read : nvme_cmd_write;
-	c.rw.flags = 0;
+/* Queue commands for @io until it is all issued or the queue is full */
+static int nvme_io_issue(struct nvme_queue *nvmeq, struct nvme_io *io)
+{
+	struct nvme_ns *ns = io->ns;
+	lbaint_t max_blks = nvme_max_blks(ns);
+	struct nvme_io_cmd *cmd;
+	struct nvme_command c;
+	int id = 0, count = 0;
+	void *buffer;
+	lbaint_t lbas;
+	u64 prp2;
+
+	memset(&c, 0, sizeof(c));
+	c.rw.opcode = io->read ? nvme_cmd_read : nvme_cmd_write;
 	c.rw.nsid = cpu_to_le32(ns->ns_id);
-	c.rw.control = 0;
-	c.rw.dsmgmt = 0;
-	c.rw.reftag = 0;
-	c.rw.apptag = 0;
-	c.rw.appmask = 0;
-	c.rw.metadata = 0;
-
-	while (total_lbas) {
-		if (total_lbas < lbas) {
-			lbas = (u16)total_lbas;
-			total_lbas = 0;
-		} else {
-			total_lbas -= lbas;
-		}
 
-		if (nvme_setup_prps(dev, &prp2,
-				    lbas << ns->lba_shift, (ulong)buffer))
-			return -EIO;
-		c.rw.slba = cpu_to_le64(slba);
-		slba += lbas;
+	while (io->issued < io->blkcnt && nvmeq->inflight < nvmeq->nr_cmds) {
+		while (nvmeq->cmds[id].io || nvmeq->cmds[id].abandoned)
+			id++;
+		cmd = &nvmeq->cmds[id];
+
+		lbas = min(io->blkcnt - io->issued, max_blks);
+		buffer = io->buffer + (io->issued << ns->lba_shift);
+		nvme_setup_prps(ns->dev, cmd->prp_list, &prp2,
+				lbas << ns->lba_shift, (ulong)buffer);
+		c.rw.command_id = cpu_to_le16(id);
+		c.rw.slba = cpu_to_le64(io->blknr + io->issued);
 		c.rw.length = cpu_to_le16(lbas - 1);
 		c.rw.prp1 = cpu_to_le64((ulong)buffer);
 		c.rw.prp2 = cpu_to_le64(prp2);
-		status = nvme_submit_sync_cmd(dev->queues[NVME_IO_Q],
-				&c, NULL, IO_TIMEOUT);
-		if (status)
+		nvme_queue_cmd(nvmeq, &c);
+
+		/* The timeout runs from the last completion while busy */
+		if (!nvmeq->inflight)
+			nvmeq->last_us = timer_get_us();
+		cmd->io = io;
+		cmd->offset = io->issued;
+		io->issued += lbas;
+		io->inflight++;
+		nvmeq->inflight++;
+		count++;
+	}
+
+	return count;
+}
+
+/*
+ * Handle every completion posted to the I/O queue, writing the completion
+ * queue doorbell once for the lot. Returns the number handled.
+ */
+static int nvme_io_reap(struct nvme_queue *nvmeq)
+{
+	u16 head = nvmeq->cq_head;
+	u16 phase = nvmeq->cq_phase;
+	struct nvme_io_cmd *cmd;
+	int count = 0;
+	u16 status, id;
+
+	for (;;) {
+		status = nvme_read_completion_status(nvmeq, head);
+		if ((status & 0x01) != phase)
 			break;
-		temp_len -= (u32)lbas << ns->lba_shift;
-		buffer += lbas << ns->lba_shift;
+		id = le16_to_cpu(readw(&nvmeq->cqes[head].command_id));
+		if (++head == nvmeq->q_depth) {
+			head = 0;
+			phase = !phase;
+		}
+		count++;
+
+		if (id >= nvmeq->nr_cmds)
+			continue;
+		cmd = &nvmeq->cmds[id];
+		/* The controller is done with a timed out command at last */
+		if (cmd->abandoned) {
+			cmd->abandoned = false;
+			nvmeq->inflight--;
+			continue;
+		}
+		if (!cmd->io)
+			continue;
+		status >>= 1;
+		if (status) {
+			printf("ERROR: status = %x, lba = " LBAF "\n", status,
+			       cmd->io->blknr + cmd->offset);
+			cmd->io->failed = min(cmd->io->failed, cmd->offset);
+		}
+		cmd->io->inflight--;
+		cmd->io = NULL;
+		nvmeq->inflight--;
+	}
+
+	if (count) {
+		writel(head, nvmeq->q_db + nvmeq->dev->db_stride);
+		nvmeq->cq_head = head;
+		nvmeq->cq_phase = phase;
 	}
 
-	if (read)
-		invalidate_dcache_range((unsigned long)buffer,
-					(unsigned long)buffer + total_len);
+	return count;
+}
 
-	return (total_len - temp_len) >> desc->log2blksz;
+static void nvme_io_finish(struct nvme_io *io)
+{
+	struct nvme_ns *ns = io->ns;
+
+	if (io->read)
+		invalidate_dcache_range((ulong)io->buffer, (ulong)io->buffer +
+					(io->blkcnt << ns->lba_shift));
+	io->status = io->failed == io->blkcnt ? 0 : -EIO;
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	if (io->req)
+		blk_req_done(io->udev, io->req, io->status);
+#endif
+}
+
+/* Delete and recreate the I/O queue, which aborts the commands in it */
+static int nvme_io_reset_queue(struct nvme_queue *nvmeq)
+{
+	struct nvme_dev *dev = nvmeq->dev;
+	int ret;
+
+	ret = nvme_delete_sq(dev, nvmeq->qid);
+	if (!ret)
+		ret = nvme_delete_cq(dev, nvmeq->qid);
+	if (ret)
+		return ret;
+	dev->online_queues--;
+
+	return nvme_create_queue(nvmeq, nvmeq->qid);
+}
+
+/*
+ * Fail the commands in flight after a timeout. The controller may still
+ * complete them and access their buffers and PRP lists, so their slots are
+ * not reused until the queue is reset or, if that fails, until their
+ * completions turn up.
+ */
+static void nvme_io_abandon(struct nvme_queue *nvmeq)
+{
+	struct nvme_io_cmd *cmd;
+	int i;
+
+	for (i = 0; i < nvmeq->nr_cmds; i++) {
+		cmd = &nvmeq->cmds[i];
+		if (!cmd->io)
+			continue;
+		cmd->io->failed = min(cmd->io->failed, cmd->offset);
+		cmd->io->inflight--;
+		cmd->io = NULL;
+		cmd->abandoned = true;
+	}
+
+	if (nvme_io_reset_queue(nvmeq)) {
+		printf("Error: cannot reset the I/O queue\n");
+		nvmeq->last_us = timer_get_us();
+		return;
+	}
+	for (i = 0; i < nvmeq->nr_cmds; i++)
+		nvmeq->cmds[i].abandoned = false;
+	nvmeq->inflight = 0;
+}
+
+int nvme_io_progress(struct nvme_queue *nvmeq)
+{
+	struct nvme_io *io, *next;
+	LIST_HEAD(done);
+	int queued = 0, ret = 0;
+
+	if (nvme_io_reap(nvmeq)) {
+		nvmeq->last_us = timer_get_us();
+	} else if (nvmeq->inflight &&
+		   timer_get_us() - nvmeq->last_us >= IO_TIMEOUT * 1000000) {
+		printf("Error: I/O timed out with %d commands in flight\n",
+		       nvmeq->inflight);
+		nvme_io_abandon(nvmeq);
+		ret = -ETIMEDOUT;
+	}
+
+	list_for_each_entry_safe(io, next, &nvmeq->io_list, node) {
+		if (io->failed == io->blkcnt)
+			queued += nvme_io_issue(nvmeq, io);
+		if (!io->inflight &&
+		    (io->issued == io->blkcnt || io->failed != io->blkcnt))
+			list_move_tail(&io->node, &done);
+	}
+	if (queued)
+		writel(nvmeq->sq_tail, nvmeq->q_db);
+
+	/* Completion callbacks may queue more, so run them last */
+	list_for_each_entry_safe(io, next, &done, node) {
+		list_del(&io->node);
+		nvme_io_finish(io);
+	}
+
+	return ret;
+}
+
+void nvme_io_start(struct nvme_queue *nvmeq, struct nvme_io *io)
+{
+	struct nvme_ns *ns = io->ns;
+
+	flush_dcache_range((ulong)io->buffer, (ulong)io->buffer +
+			   (io->blkcnt << ns->lba_shift));
+
+	io->issued = 0;
+	io->failed = io->blkcnt;
+	io->inflight = 0;
+	io->status = -EINPROGRESS;
+	list_add_tail(&io->node, &nvmeq->io_list);
+
+	if (nvme_io_issue(nvmeq, io))
+		writel(nvmeq->sq_tail, nvmeq->q_db);
+}
+
+static ulong nvme_blk_rw(struct udevice *udev, lbaint_t blknr,
+			 lbaint_t blkcnt, void *buffer, bool read)
+{
+	struct nvme_ns *ns = dev_get_priv(udev);
+	struct nvme_queue *nvmeq = ns->dev->queues[NVME_IO_Q];
+	struct nvme_io io = {
+		.udev = udev,
+		.ns = ns,
+		.blknr = blknr,
+		.blkcnt = blkcnt,
+		.buffer = buffer,
+		.read = read,
+	};
+
+	nvme_io_start(nvmeq, &io);
+	while (io.status == -EINPROGRESS)
+		nvme_io_progress(nvmeq);
+
+	return io.failed;
 }
 
 static ulong nvme_blk_read(struct udevice *udev, lbaint_t blknr,
@@ -785,9 +951,51 @@ static ulong nvme_blk_write(struct udevice *udev, lbaint_t blknr,
 	return nvme_blk_rw(udev, blknr, blkcnt, (void *)buffer, false);
 }
 
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+static int nvme_blk_submit(struct udevice *udev, struct blk_req *req)
+{
+	struct nvme_ns *ns = dev_get_priv(udev);
+	struct nvme_queue *nvmeq = ns->dev->queues[NVME_IO_Q];
+	struct nvme_io *io;
+	int i;
+
+	if (nvmeq->inflight == nvmeq->nr_cmds)
+		return -EBUSY;
+	for (i = 0; i < nvmeq->nr_cmds; i++) {
+		io = &nvmeq->ios[i];
+		if (io->status != -EINPROGRESS)
+			break;
+	}
+	if (i == nvmeq->nr_cmds)
+		return -EBUSY;
+
+	io->udev = udev;
+	io->ns = ns;
+	io->req = req;
+	io->blknr = req->start;
+	io->blkcnt = req->blkcnt;
+	io->buffer = req->buffer;
+	io->read = req->op == BLK_REQ_READ;
+	nvme_io_start(nvmeq, io);
+
+	return 0;
+}
+
+static int nvme_blk_poll(struct udevice *udev)
+{
+	struct nvme_ns *ns = dev_get_priv(udev);
+
+	return nvme_io_progress(ns->dev->queues[NVME_IO_Q]);
+}
+#endif
+
 static const struct blk_ops nvme_blk_ops = {
 	.read	= nvme_blk_read,
 	.write	= nvme_blk_write,
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	.submit	= nvme_blk_submit,
+	.poll	= nvme_blk_poll,
+#endif
 };
 
 U_BOOT_DRIVER(nvme_blk) = {
@@ -841,19 +1049,18 @@ static int nvme_probe(struct udevice *udev)
 	if (ret)
 		goto free_queue;
 
-	/* Allocate after the page size is known */
-	ndev->prp_pool = memalign(ndev->page_size, MAX_PRP_POOL);
-	if (!ndev->prp_pool) {
-		ret = -ENOMEM;
-		printf("Error: %s: Out of memory!\n", udev->name);
-		goto free_nvme;
-	}
-	ndev->prp_entry_num = MAX_PRP_POOL >> 3;
-
 	ret = nvme_setup_io_queues(ndev);
 	if (ret)
 		goto free_queue;
 
+	if (ndev->queues[NVME_IO_Q]) {
+		ret = nvme_alloc_io_cmds(ndev, ndev->queues[NVME_IO_Q]);
+		if (ret) {
+			printf("Error: %s: Out of memory!\n", udev->name);
+			goto free_queue;
+		}
+	}
+
 	nvme_get_info_from_identify(ndev);
 
 	return 0;
@@ -7,7 +7,9 @@
 #ifndef __DRIVER_NVME_H__
 #define __DRIVER_NVME_H__
 
+#include <blk.h>
 #include <asm/io.h>
+#include <linux/compat.h>
 
 struct nvme_id_power_state {
 	__le16			max_power;	/* centiwatts */
@@ -624,8 +626,6 @@ struct nvme_dev {
 	u32 stripe_size;
 	u32 page_size;
 	u8 vwc;
-	u64 *prp_pool;
-	u32 prp_entry_num;
 	u32 nn;
 };
 
@@ -645,4 +645,106 @@ struct nvme_ns {
 	u32 mode_select_block_len;
 };
 
+#define IO_TIMEOUT		30
+
+enum nvme_queue_id {
+	NVME_ADMIN_Q,
+	NVME_IO_Q,
+	NVME_Q_NUM,
+};
+
+/*
+ * A read or write on a namespace. It is split into commands of at most
+ * nvme_max_blks() blocks, as many of which are in flight as the I/O queue
+ * allows. @failed is the offset of the first block not transferred, or
+ * @blkcnt if all went well.
+ */
+struct nvme_io {
+	struct list_head node;
+	struct udevice *udev;
+	struct nvme_ns *ns;
+	struct blk_req *req;
+	lbaint_t blknr;
+	lbaint_t blkcnt;
+	void *buffer;
+	bool read;
+	lbaint_t issued;
+	lbaint_t failed;
+	int inflight;
+	int status;
+};
+
+/*
+ * A slot for an I/O command, whose ID is the index of the slot. A command
+ * which timed out is @abandoned: the slot stays in use until the controller
+ * completes it or the queue is reset.
+ */
+struct nvme_io_cmd {
+	struct nvme_io *io;
+	lbaint_t offset;
+	u64 *prp_list;
+	bool abandoned;
+};
+
+/*
+ * An NVM Express queue. Each device has at least two (one for admin
+ * commands and one for I/O commands).
+ */
+struct nvme_queue {
+	struct nvme_dev *dev;
+	struct nvme_command *sq_cmds;
+	struct nvme_completion *cqes;
+	wait_queue_head_t sq_full;
+	u32 __iomem *q_db;
+	u16 q_depth;
+	s16 cq_vector;
+	u16 sq_head;
+	u16 sq_tail;
+	u16 cq_head;
+	u16 qid;
+	u8 cq_phase;
+	u8 cqe_seen;
+	/* Used by the I/O queue only */
+	struct nvme_io_cmd *cmds;
+	struct nvme_io *ios;
+	u64 *prp_pool;
+	struct list_head io_list;
+	u16 nr_cmds;
+	u16 inflight;
+	ulong last_us;
+	unsigned long cmdid_data[];
+};
+
+/**
+ * nvme_alloc_io_cmds() - Set up the command slots of the I/O queue
+ *
+ * Each slot gets a page for its PRP list. They are kept for the life of the
+ * device.
+ *
+ * @dev:	NVMe device
+ * @nvmeq:	I/O queue
+ * @return 0 if OK, -ENOMEM if out of memory
+ */
+int nvme_alloc_io_cmds(struct nvme_dev *dev, struct nvme_queue *nvmeq);
+
+/**
+ * nvme_io_start() - Start a transfer on the I/O queue
+ *
+ * @nvmeq:	I/O queue
+ * @io:		Transfer, whose namespace, blocks, buffer and direction are set
+ */
+void nvme_io_start(struct nvme_queue *nvmeq, struct nvme_io *io);
+
+/**
+ * nvme_io_progress() - Move the transfers on the I/O queue along
+ *
+ * This reaps completions, keeps the I/O queue full and finishes the
+ * transfers which are done. If nothing completes for IO_TIMEOUT seconds,
+ * the commands in flight are abandoned and count as failed.
+ *
+ * @nvmeq:	I/O queue
+ * @return 0 if OK, -ETIMEDOUT if the commands in flight timed out
+ */
+int nvme_io_progress(struct nvme_queue *nvmeq);
+
 #endif /* __DRIVER_NVME_H__ */
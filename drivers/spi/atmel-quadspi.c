@@ -275,6 +275,10 @@ static int atmel_qspi_find_mode(const struct spi_mem_op *op)
 static bool atmel_qspi_supports_op(struct spi_slave *slave,
 				   const struct spi_mem_op *op)
 {
+	if (op->cmd.nbytes != 1 || op->cmd.dtr || op->addr.dtr ||
+	    op->dummy.dtr || op->data.dtr)
+		return false;
+
 	if (atmel_qspi_find_mode(op) < 0)
 		return false;
 
@@ -64,8 +64,7 @@ static int mtk_snfi_adjust_op_size(struct spi_slave *slave,
 	 * or the output+input data must not exceed the GPRAM size.
 	 */
 
-	nbytes = sizeof(op->cmd.opcode) + op->addr.nbytes +
-		op->dummy.nbytes;
+	nbytes = op->cmd.nbytes + op->addr.nbytes + op->dummy.nbytes;
 
 	if (nbytes + op->data.nbytes <= SNFI_GPRAM_SIZE)
 		return 0;
@@ -85,6 +84,10 @@ static bool mtk_snfi_supports_op(struct spi_slave *slave,
 	    op->dummy.buswidth > 1 || op->data.buswidth > 1)
 		return false;
 
+	if (op->cmd.nbytes != 1 || op->cmd.dtr || op->addr.dtr ||
+	    op->dummy.dtr || op->data.dtr)
+		return false;
+
 	return true;
 }
 
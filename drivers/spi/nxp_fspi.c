@@ -389,6 +389,11 @@ static bool nxp_fspi_supports_op(struct spi_slave *slave,
 	if (ret)
 		return false;
 
+	/* DTR operations and 2-byte opcodes are not supported yet. */
+	if (op->cmd.nbytes != 1 || op->cmd.dtr || op->addr.dtr ||
+	    op->dummy.dtr || op->data.dtr)
+		return false;
+
 	/*
 	 * The number of address bytes should be equal to or less than 4 bytes.
 	 */
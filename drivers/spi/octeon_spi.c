@@ -426,7 +426,9 @@ static bool octeon_spi_supports_op(struct spi_slave *slave,
 	 * 1-1-2 1-2-2
 	 * 1-1-4 1-4-4
 	 */
-	if (op->cmd.buswidth != 1)
+	if (op->cmd.buswidth != 1 || op->cmd.nbytes != 1)
+		return false;
+	if (op->cmd.dtr || op->addr.dtr || op->dummy.dtr || op->data.dtr)
 		return false;
 	return true;
 }
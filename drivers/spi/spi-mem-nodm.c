@@ -7,6 +7,7 @@
 #include <malloc.h>
 #include <spi.h>
 #include <spi-mem.h>
+#include <linux/err.h>
 
 int spi_mem_exec_op(struct spi_slave *slave,
 		    const struct spi_mem_op *op)
@@ -27,14 +28,16 @@ int spi_mem_exec_op(struct spi_slave *slave,
 			tx_buf = op->data.buf.out;
 	}
 
-	op_len = sizeof(op->cmd.opcode) + op->addr.nbytes + op->dummy.nbytes;
+	op_len = op->cmd.nbytes + op->addr.nbytes + op->dummy.nbytes;
 	op_buf = calloc(1, op_len);
 
 	ret = spi_claim_bus(slave);
 	if (ret < 0)
 		return ret;
 
-	op_buf[pos++] = op->cmd.opcode;
+	for (i = 0; i < op->cmd.nbytes; i++)
+		op_buf[pos++] = op->cmd.opcode >>
+			(8 * (op->cmd.nbytes - i - 1));
 
 	if (op->addr.nbytes) {
 		for (i = 0; i < op->addr.nbytes; i++)
@@ -89,7 +92,7 @@ int spi_mem_adjust_op_size(struct spi_slave *slave,
 {
 	unsigned int len;
 
-	len = sizeof(op->cmd.opcode) + op->addr.nbytes + op->dummy.nbytes;
+	len = op->cmd.nbytes + op->addr.nbytes + op->dummy.nbytes;
 	if (slave->max_write_size && len > slave->max_write_size)
 		return -EINVAL;
 
@@ -105,3 +108,69 @@ int spi_mem_adjust_op_size(struct spi_slave *slave,
 
 	return 0;
 }
+
+bool spi_mem_supports_op(struct spi_slave *slave,
+			 const struct spi_mem_op *op)
+{
+	/* spi_xfer() can only send single-byte opcodes, in STR mode */
+	if (op->cmd.dtr || op->addr.dtr || op->dummy.dtr || op->data.dtr)
+		return false;
+
+	return op->cmd.nbytes == 1;
+}
+
+/* Without driver model there is no controller to map anything */
+struct spi_mem_dirmap_desc *
+spi_mem_dirmap_create(struct spi_slave *slave,
+		      const struct spi_mem_dirmap_info *info)
+{
+	struct spi_mem_dirmap_desc *desc;
+
+	if (!info->op_tmpl.addr.nbytes || info->op_tmpl.addr.nbytes > 8 ||
+	    info->op_tmpl.data.dir != SPI_MEM_DATA_IN)
+		return ERR_PTR(-EINVAL);
+
+	if (!spi_mem_supports_op(slave, &info->op_tmpl))
+		return ERR_PTR(-ENOTSUPP);
+
+	desc = calloc(1, sizeof(*desc));
+	if (!desc)
+		return ERR_PTR(-ENOMEM);
+
+	desc->slave = slave;
+	desc->info = *info;
+	desc->nodirmap = true;
+
+	return desc;
+}
+
+void spi_mem_dirmap_destroy(struct spi_mem_dirmap_desc *desc)
+{
+	free(desc);
+}
+
+ssize_t spi_mem_dirmap_read(struct spi_mem_dirmap_desc *desc,
+			    u64 offs, size_t len, void *buf)
+{
+	struct spi_mem_op op = desc->info.op_tmpl;
+	int ret;
+
+	if (!len)
+		return 0;
+
+	if (offs >= desc->info.length || len > desc->info.length - offs)
+		return -EINVAL;
+
+	op.addr.val = desc->info.offset + offs;
+	op.data.buf.in = buf;
+	op.data.nbytes = len;
+	ret = spi_mem_adjust_op_size(desc->slave, &op);
+	if (ret)
+		return ret;
+
+	ret = spi_mem_exec_op(desc->slave, &op);
+	if (ret)
+		return ret;
+
+	return op.data.nbytes;
+}
@@ -353,6 +353,40 @@ static int ti_qspi_exec_mem_op(struct spi_slave *slave,
 	return ret;
 }
 
+static int ti_qspi_dirmap_create(struct spi_mem_dirmap_desc *desc)
+{
+	struct ti_qspi_priv *priv = dev_get_priv(desc->slave->dev->parent);
+	const struct spi_mem_op *op = &desc->info.op_tmpl;
+
+	/* The whole mapping must fit in the MMIO window */
+	if (!spi_mem_default_supports_op(desc->slave, op) ||
+	    op->addr.nbytes > 4 ||
+	    desc->info.offset + desc->info.length > priv->mmap_size)
+		return -ENOTSUPP;
+
+	return 0;
+}
+
+static ssize_t ti_qspi_dirmap_read(struct spi_mem_dirmap_desc *desc,
+				   u64 offs, size_t len, void *buf)
+{
+	struct dm_spi_slave_platdata *slave_plat;
+	const struct spi_mem_op *op = &desc->info.op_tmpl;
+	struct ti_qspi_priv *priv;
+
+	priv = dev_get_priv(desc->slave->dev->parent);
+	slave_plat = dev_get_parent_platdata(desc->slave->dev);
+
+	ti_qspi_setup_mmap_read(priv, slave_plat->cs, op->cmd.opcode,
+				op->data.buswidth, op->addr.nbytes,
+				op->dummy.nbytes);
+
+	ti_qspi_copy_mmap(buf, (void *)priv->memory_map + desc->info.offset +
+			  offs, len);
+
+	return len;
+}
+
 static int ti_qspi_claim_bus(struct udevice *dev)
 {
 	struct dm_spi_slave_platdata *slave_plat = dev_get_parent_platdata(dev);
@@ -482,6 +516,8 @@ static int ti_qspi_ofdata_to_platdata(struct udevice *bus)
 
 static const struct spi_controller_mem_ops ti_qspi_mem_ops = {
 	.exec_op = ti_qspi_exec_mem_op,
+	.dirmap_create = ti_qspi_dirmap_create,
+	.dirmap_read = ti_qspi_dirmap_read,
 };
 
 static const struct dm_spi_ops ti_qspi_ops = {
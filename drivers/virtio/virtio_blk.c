@@ -11,48 +11,197 @@
 #include <virtio_types.h>
 #include <virtio.h>
 #include <virtio_ring.h>
+#include <dm/devres.h>
 #include "virtio_blk.h"
 
+/*
+ * A read or write, split into virtio requests of at most max_blks blocks
+ * which are queued together as far as the ring allows. @failed is the
+ * offset of the first block not transferred, or @blkcnt if all went well.
+ */
+struct virtio_blk_io {
+	struct list_head node;
+	struct blk_req *req;
+	u64 sector;
+	lbaint_t blkcnt;
+	void *buffer;
+	u32 type;
+	lbaint_t issued;
+	lbaint_t failed;
+	int inflight;
+	int status;
+};
+
+/* A virtio request in flight, found again from the address of its header */
+struct virtio_blk_vreq {
+	struct virtio_blk_outhdr out_hdr;
+	u8 status;
+	struct virtio_blk_io *io;
+	lbaint_t offset;
+};
+
 struct virtio_blk_priv {
 	struct virtqueue *vq;
+	/* Largest data segment and number of segments of a request */
+	u32 seg_size;
+	u32 max_segs;
+	lbaint_t max_blks;
+	struct virtio_blk_vreq *vreqs;
+	struct virtio_blk_io *ios;
+	int nr_vreqs;
+	struct list_head io_list;
+	/* Scratch scatterlist of max_segs + 2 entries */
+	struct virtio_sg *sg;
+	struct virtio_sg **sgs;
 };
 
-static ulong virtio_blk_do_req(struct udevice *dev, u64 sector,
-			       lbaint_t blkcnt, void *buffer, u32 type)
+static const u32 feature[] = {
+	VIRTIO_BLK_F_SIZE_MAX,
+	VIRTIO_BLK_F_SEG_MAX,
+	VIRTIO_RING_F_INDIRECT_DESC,
+};
+
+/* Add requests for @io until it is all issued or the ring is full */
+static int virtio_blk_issue(struct udevice *dev, struct virtio_blk_io *io)
 {
 	struct virtio_blk_priv *priv = dev_get_priv(dev);
-	unsigned int num_out = 0, num_in = 0;
-	struct virtio_sg *sgs[3];
-	u8 status;
-	int ret;
+	unsigned int num_out, num_in, n;
+	struct virtio_blk_vreq *vreq;
+	lbaint_t blkcnt;
+	int i, count = 0;
+	u64 len, seg;
+	void *buffer;
 
-	struct virtio_blk_outhdr out_hdr = {
-		.type = cpu_to_virtio32(dev, type),
-		.sector = cpu_to_virtio64(dev, sector),
-	};
-	struct virtio_sg hdr_sg = { &out_hdr, sizeof(out_hdr) };
-	struct virtio_sg data_sg = { buffer, blkcnt * 512 };
-	struct virtio_sg status_sg = { &status, sizeof(status) };
+	while (io->issued < io->blkcnt) {
+		for (i = 0; i < priv->nr_vreqs && priv->vreqs[i].io; i++)
+			;
+		if (i == priv->nr_vreqs)
+			break;
+		vreq = &priv->vreqs[i];
 
-	sgs[num_out++] = &hdr_sg;
+		blkcnt = min(io->blkcnt - io->issued, priv->max_blks);
+		buffer = io->buffer + io->issued * 512;
+		vreq->out_hdr.type = cpu_to_virtio32(dev, io->type);
+		vreq->out_hdr.ioprio = 0;
+		vreq->out_hdr.sector = cpu_to_virtio64(dev,
+						       io->sector + io->issued);
 
-	if (type & VIRTIO_BLK_T_OUT)
-		sgs[num_out++] = &data_sg;
-	else
-		sgs[num_out + num_in++] = &data_sg;
+		n = 0;
+		priv->sg[n].addr = &vreq->out_hdr;
+		priv->sg[n++].length = sizeof(vreq->out_hdr);
+		for (len = blkcnt * 512; len; len -= seg) {
+			seg = min_t(u64, len, priv->seg_size);
+			priv->sg[n].addr = buffer;
+			priv->sg[n++].length = seg;
+			buffer += seg;
+		}
+		priv->sg[n].addr = &vreq->status;
+		priv->sg[n++].length = sizeof(vreq->status);
+		for (i = 0; i < n; i++)
+			priv->sgs[i] = &priv->sg[i];
 
-	sgs[num_out + num_in++] = &status_sg;
+		/*
+		 * virtqueue_add() notifies the device when the ring is full,
+		 * so stop here instead of ringing it on every poll
+		 */
+		if (priv->vq->num_free < (priv->vq->indirect ? 1 : n))
+			break;
 
-	ret = virtqueue_add(priv->vq, sgs, num_out, num_in);
-	if (ret)
-		return ret;
+		num_out = io->type & VIRTIO_BLK_T_OUT ? n - 1 : 1;
+		num_in = n - num_out;
+		if (virtqueue_add(priv->vq, priv->sgs, num_out, num_in))
+			break;
+
+		vreq->io = io;
+		vreq->offset = io->issued;
+		io->issued += blkcnt;
+		io->inflight++;
+		count++;
+	}
 
-	virtqueue_kick(priv->vq);
+	return count;
+}
 
-	while (!virtqueue_get_buf(priv->vq, NULL))
-		;
+/* Take every request the device has finished off the ring */
+static void virtio_blk_reap(struct udevice *dev)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	struct virtio_blk_vreq *vreq;
+	void *hdr;
 
-	return status == VIRTIO_BLK_S_OK ? blkcnt : -EIO;
+	while ((hdr = virtqueue_get_buf(priv->vq, NULL))) {
+		vreq = container_of(hdr, struct virtio_blk_vreq, out_hdr);
+		if (vreq->status != VIRTIO_BLK_S_OK)
+			vreq->io->failed = min(vreq->io->failed, vreq->offset);
+		vreq->io->inflight--;
+		vreq->io = NULL;
+	}
+}
+
+/*
+ * Reap finished requests, keep the ring full with one kick for everything
+ * added and finish the transfers which are done
+ */
+static void virtio_blk_progress(struct udevice *dev)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	struct virtio_blk_io *io, *next;
+	LIST_HEAD(done);
+	int queued = 0;
+
+	virtio_blk_reap(dev);
+
+	list_for_each_entry_safe(io, next, &priv->io_list, node) {
+		if (io->failed == io->blkcnt)
+			queued += virtio_blk_issue(dev, io);
+		if (!io->inflight &&
+		    (io->issued == io->blkcnt || io->failed != io->blkcnt))
+			list_move_tail(&io->node, &done);
+	}
+	if (queued)
+		virtqueue_kick(priv->vq);
+
+	/* Completion callbacks may queue more, so run them last */
+	list_for_each_entry_safe(io, next, &done, node) {
+		list_del(&io->node);
+		io->status = io->failed == io->blkcnt ? 0 : -EIO;
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+		if (io->req)
+			blk_req_done(dev, io->req, io->status);
+#endif
+	}
+}
+
+/* Start a transfer whose sectors, buffer and type are set */
+static void virtio_blk_start(struct udevice *dev, struct virtio_blk_io *io)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+
+	io->issued = 0;
+	io->failed = io->blkcnt;
+	io->inflight = 0;
+	io->status = -EINPROGRESS;
+	list_add_tail(&io->node, &priv->io_list);
+
+	if (virtio_blk_issue(dev, io))
+		virtqueue_kick(priv->vq);
+}
+
+static ulong virtio_blk_do_req(struct udevice *dev, u64 sector,
+			       lbaint_t blkcnt, void *buffer, u32 type)
+{
+	struct virtio_blk_io io = {
+		.sector = sector,
+		.blkcnt = blkcnt,
+		.buffer = buffer,
+		.type = type,
+	};
+
+	virtio_blk_start(dev, &io);
+	while (io.status == -EINPROGRESS)
+		virtio_blk_progress(dev);
+
+	return io.failed;
 }
 
 static ulong virtio_blk_read(struct udevice *dev, lbaint_t start,
@@ -69,6 +218,40 @@ static ulong virtio_blk_write(struct udevice *dev, lbaint_t start,
 				 VIRTIO_BLK_T_OUT);
 }
 
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+static int virtio_blk_submit(struct udevice *dev, struct blk_req *req)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	struct virtio_blk_io *io;
+	int i;
+
+	for (i = 0; i < priv->nr_vreqs; i++) {
+		io = &priv->ios[i];
+		if (io->status != -EINPROGRESS)
+			break;
+	}
+	if (i == priv->nr_vreqs)
+		return -EBUSY;
+
+	io->req = req;
+	io->sector = req->start;
+	io->blkcnt = req->blkcnt;
+	io->buffer = req->buffer;
+	io->type = req->op == BLK_REQ_WRITE ? VIRTIO_BLK_T_OUT :
+					      VIRTIO_BLK_T_IN;
+	virtio_blk_start(dev, io);
+
+	return 0;
+}
+
+static int virtio_blk_poll(struct udevice *dev)
+{
+	virtio_blk_progress(dev);
+
+	return 0;
+}
+#endif
+
 static int virtio_blk_bind(struct udevice *dev)
 {
 	struct virtio_dev_priv *uc_priv = dev_get_uclass_priv(dev->parent);
@@ -98,7 +281,8 @@ static int virtio_blk_bind(struct udevice *dev)
 	desc->bdev = dev;
 
 	/* Indicate what driver features we support */
-	virtio_driver_features_init(uc_priv, NULL, 0, NULL, 0);
+	virtio_driver_features_init(uc_priv, feature, ARRAY_SIZE(feature),
+				    NULL, 0);
 
 	return 0;
 }
@@ -107,6 +291,7 @@ static int virtio_blk_probe(struct udevice *dev)
 {
 	struct virtio_blk_priv *priv = dev_get_priv(dev);
 	struct blk_desc *desc = dev_get_uclass_platdata(dev);
+	u32 seg_max, size_max;
 	u64 cap;
 	int ret;
 
@@ -119,12 +304,47 @@ static int virtio_blk_probe(struct udevice *dev)
 	virtio_cread(dev, struct virtio_blk_config, capacity, &cap);
 	desc->lba = cap;
 
+	/*
+	 * Without SEG_MAX a request has one data segment. Each segment takes
+	 * a descriptor, as do the header and status, and a chain may be no
+	 * longer than the ring even when it is indirect.
+	 */
+	priv->nr_vreqs = virtqueue_get_vring_size(priv->vq);
+	if (virtio_cread_feature(dev, VIRTIO_BLK_F_SEG_MAX,
+				 struct virtio_blk_config, seg_max, &seg_max) ||
+	    !seg_max)
+		seg_max = 1;
+	priv->max_segs = min_t(u32, seg_max, max(priv->nr_vreqs - 2, 1));
+	if (virtio_cread_feature(dev, VIRTIO_BLK_F_SIZE_MAX,
+				 struct virtio_blk_config, size_max, &size_max) ||
+	    size_max < 512)
+		size_max = U32_MAX;
+	priv->seg_size = size_max & ~511;
+	priv->max_blks = min_t(u64, (u64)priv->seg_size * priv->max_segs / 512,
+			       (lbaint_t)-1);
+
+	priv->vreqs = devm_kcalloc(dev, priv->nr_vreqs, sizeof(*priv->vreqs),
+				   GFP_KERNEL);
+	priv->ios = devm_kcalloc(dev, priv->nr_vreqs, sizeof(*priv->ios),
+				 GFP_KERNEL);
+	priv->sg = devm_kcalloc(dev, priv->max_segs + 2, sizeof(*priv->sg),
+				GFP_KERNEL);
+	priv->sgs = devm_kcalloc(dev, priv->max_segs + 2, sizeof(*priv->sgs),
+				 GFP_KERNEL);
+	if (!priv->vreqs || !priv->ios || !priv->sg || !priv->sgs)
+		return -ENOMEM;
+	INIT_LIST_HEAD(&priv->io_list);
+
 	return 0;
 }
 
 static const struct blk_ops virtio_blk_ops = {
 	.read	= virtio_blk_read,
 	.write	= virtio_blk_write,
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	.submit	= virtio_blk_submit,
+	.poll	= virtio_blk_poll,
+#endif
 };
 
 U_BOOT_DRIVER(virtio_blk) = {
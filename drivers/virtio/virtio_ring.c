@@ -16,21 +16,51 @@
 #include <linux/bug.h>
 #include <linux/compat.h>
 
+static struct vring_desc *alloc_indirect(struct virtqueue *vq,
+					 unsigned int total_sg)
+{
+	struct vring_desc *desc;
+	unsigned int i;
+
+	desc = malloc(total_sg * sizeof(struct vring_desc));
+	if (!desc)
+		return NULL;
+
+	for (i = 0; i < total_sg; i++)
+		desc[i].next = cpu_to_virtio16(vq->vdev, i + 1);
+
+	return desc;
+}
+
 int virtqueue_add(struct virtqueue *vq, struct virtio_sg *sgs[],
 		  unsigned int out_sgs, unsigned int in_sgs)
 {
 	struct vring_desc *desc;
 	unsigned int total_sg = out_sgs + in_sgs;
 	unsigned int i, n, avail, descs_used, uninitialized_var(prev);
+	bool indirect;
 	int head;
 
 	WARN_ON(total_sg == 0);
 
 	head = vq->free_head;
 
-	desc = vq->vring.desc;
-	i = head;
-	descs_used = total_sg;
+	/* A chain of several buffers takes one ring entry if it is indirect */
+	if (vq->indirect && total_sg > 1 && vq->num_free)
+		desc = alloc_indirect(vq, total_sg);
+	else
+		desc = NULL;
+
+	if (desc) {
+		indirect = true;
+		i = 0;
+		descs_used = 1;
+	} else {
+		indirect = false;
+		desc = vq->vring.desc;
+		i = head;
+		descs_used = total_sg;
+	}
 
 	if (vq->num_free < descs_used) {
 		debug("Can't add buf len %i - avail = %i\n",
@@ -70,6 +100,18 @@ int virtqueue_add(struct virtqueue *vq, struct virtio_sg *sgs[],
 	/* Last one doesn't continue */
 	desc[prev].flags &= cpu_to_virtio16(vq->vdev, ~VRING_DESC_F_NEXT);
 
+	if (indirect) {
+		/* Now that the indirect table is filled in, point to it */
+		vq->vring.desc[head].flags = cpu_to_virtio16(vq->vdev,
+						VRING_DESC_F_INDIRECT);
+		vq->vring.desc[head].addr = cpu_to_virtio64(vq->vdev,
+						(u64)(uintptr_t)desc);
+		vq->vring.desc[head].len = cpu_to_virtio32(vq->vdev,
+						total_sg * sizeof(struct vring_desc));
+
+		i = virtio16_to_cpu(vq->vdev, vq->vring.desc[head].next);
+	}
+
 	/* We're using some buffers from the free list. */
 	vq->num_free -= descs_used;
 
@@ -152,6 +194,11 @@ static void detach_buf(struct virtqueue *vq, unsigned int head)
 
 	/* Plus final descriptor */
 	vq->num_free++;
+
+	if (vq->vring.desc[head].flags &
+	    cpu_to_virtio16(vq->vdev, VRING_DESC_F_INDIRECT))
+		free((void *)(uintptr_t)virtio64_to_cpu(vq->vdev,
+						vq->vring.desc[head].addr));
 }
 
 static inline bool more_used(const struct virtqueue *vq)
@@ -162,8 +209,10 @@ static inline bool more_used(const struct virtqueue *vq)
 
 void *virtqueue_get_buf(struct virtqueue *vq, unsigned int *len)
 {
+	struct vring_desc *desc;
 	unsigned int i;
 	u16 last_used;
+	u64 addr;
 
 	if (!more_used(vq)) {
 		debug("(%s.%d): No more buffers in queue\n",
@@ -189,6 +238,13 @@ void *virtqueue_get_buf(struct virtqueue *vq, unsigned int *len)
 		return NULL;
 	}
 
+	/* Return the first buffer, which an indirect table no longer holds */
+	desc = &vq->vring.desc[i];
+	if (desc->flags & cpu_to_virtio16(vq->vdev, VRING_DESC_F_INDIRECT))
+		desc = (struct vring_desc *)(uintptr_t)virtio64_to_cpu(vq->vdev,
+								desc->addr);
+	addr = virtio64_to_cpu(vq->vdev, desc->addr);
+
 	detach_buf(vq, i);
 	vq->last_used_idx++;
 	/*
@@ -200,8 +256,7 @@ void *virtqueue_get_buf(struct virtqueue *vq, unsigned int *len)
 		virtio_store_mb(&vring_used_event(&vq->vring),
 				cpu_to_virtio16(vq->vdev, vq->last_used_idx));
 
-	return (void *)(uintptr_t)virtio64_to_cpu(vq->vdev,
-						  vq->vring.desc[i].addr);
+	return (void *)(uintptr_t)addr;
 }
 
 static struct virtqueue *__vring_new_virtqueue(unsigned int index,
@@ -227,6 +282,7 @@ static struct virtqueue *__vring_new_virtqueue(unsigned int index,
 	vq->num_added = 0;
 	list_add_tail(&vq->list, &uc_priv->vqs);
 
+	vq->indirect = virtio_has_feature(vdev, VIRTIO_RING_F_INDIRECT_DESC);
 	vq->event = virtio_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX);
 
 	/* Tell other side not to bother us */
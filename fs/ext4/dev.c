@@ -25,6 +25,7 @@
 #include <common.h>
 #include <blk.h>
 #include <config.h>
+#include <fs.h>
 #include <fs_internal.h>
 #include <ext4fs.h>
 #include <ext_common.h>
@@ -39,6 +40,10 @@ static struct disk_partition *part_info;
 void ext4fs_set_blk_dev(struct blk_desc *rbdd, struct disk_partition *info)
 {
 	assert(rbdd->blksz == (1 << rbdd->log2blksz));
+
+	/* Anything kept mounted through the fs layer is now out of date */
+	fs_mount_invalidate(NULL);
+
 	ext4fs_blk_desc = rbdd;
 	get_fs()->dev_desc = rbdd;
 	part_info = info;
@@ -22,6 +22,7 @@
 #include <blk.h>
 #include <ext_common.h>
 #include <ext4fs.h>
+#include <fs.h>
 #include <log.h>
 #include <malloc.h>
 #include <memalign.h>
@@ -641,6 +642,20 @@ static int search_dir(struct ext2_inode *parent_inode, char *dirname)
 	uint32_t directory_blocks;
 	char *direntname;
 
+	struct ext2fs_node diro = {
+		.data = ext4fs_root,
+		.inode = *parent_inode,
+		.inode_read = 1,
+	};
+	struct ext2_dirent dirent;
+
+	/* Use the hash tree index of the directory if there is one */
+	status = ext4fs_dx_lookup(&diro, dirname, &dirent);
+	if (status > 0)
+		return le32_to_cpu(dirent.inode);
+	if (status == 0)
+		return -1;
+
 	directory_blocks = le32_to_cpu(parent_inode->size) >>
 		LOG2_BLOCK_SIZE(ext4fs_root);
 
@@ -1995,6 +2010,178 @@ long int read_allocated_block(struct ext2_inode *inode, int fileblock,
 	return blknr;
 }
 
+/* Decoded extent tree of the file being read, see ext4fs_get_extents() */
+static struct {
+	struct ext2_data *data;
+	int ino;
+	struct ext2_inode inode;	/* inode the extents were decoded from */
+	int count;
+	int size;
+	struct ext4_file_extent *ext;
+} ext4fs_extents;
+
+static void ext4fs_free_extents(void)
+{
+	free(ext4fs_extents.ext);
+	memset(&ext4fs_extents, 0, sizeof(ext4fs_extents));
+}
+
+static int ext4fs_add_extent(uint32_t lblock, uint32_t len, uint64_t pblock)
+{
+	struct ext4_file_extent *ext;
+
+	if (ext4fs_extents.count) {
+		ext = &ext4fs_extents.ext[ext4fs_extents.count - 1];
+		if (lblock < ext->lblock + ext->len)
+			return -EINVAL;
+		/* merge with the previous run if contiguous on disk */
+		if (ext->lblock + ext->len == lblock && ext->pblock && pblock &&
+		    ext->pblock + ext->len == pblock) {
+			ext->len += len;
+			return 0;
+		}
+	}
+
+	if (ext4fs_extents.count == ext4fs_extents.size) {
+		int size = ext4fs_extents.size ? ext4fs_extents.size * 2 : 16;
+
+		ext = realloc(ext4fs_extents.ext, size * sizeof(*ext));
+		if (!ext)
+			return -ENOMEM;
+		ext4fs_extents.ext = ext;
+		ext4fs_extents.size = size;
+	}
+
+	ext = &ext4fs_extents.ext[ext4fs_extents.count++];
+	ext->lblock = lblock;
+	ext->len = len;
+	ext->pblock = pblock;
+
+	return 0;
+}
+
+/*
+ * Add the runs of the extent tree node @ext_block, which sits in a buffer of
+ * @size bytes, to the list. The header, being read from disk, is checked so
+ * that a corrupt tree cannot make us read past the buffer or recurse without
+ * end.
+ */
+static int ext4fs_walk_extents(struct ext4_extent_header *ext_block,
+			       int size, int depth, int log2_blksz)
+{
+	int entries = le16_to_cpu(ext_block->eh_entries);
+	int blksz = EXT2_BLOCK_SIZE(ext4fs_root);
+	struct ext4_extent_header *child;
+	unsigned long long block;
+	int i, ret = 0;
+
+	/* The header and each entry or index take 12 bytes */
+	if (le16_to_cpu(ext_block->eh_magic) != EXT4_EXT_MAGIC ||
+	    le16_to_cpu(ext_block->eh_depth) != depth ||
+	    depth > EXT4_EXT_MAX_DEPTH ||
+	    entries > le16_to_cpu(ext_block->eh_max) ||
+	    (entries + 1) * sizeof(struct ext4_extent) > size)
+		return -EINVAL;
+
+	if (!depth) {
+		struct ext4_extent *extent;
+
+		extent = (struct ext4_extent *)(ext_block + 1);
+		for (i = 0; i < entries; i++) {
+			uint32_t len = le16_to_cpu(extent[i].ee_len);
+
+			block = le16_to_cpu(extent[i].ee_start_hi);
+			block = (block << 32) +
+				le32_to_cpu(extent[i].ee_start_lo);
+			/* uninitialized extents read back as zeroes */
+			if (len > EXT4_EXT_INIT_MAX_LEN) {
+				len -= EXT4_EXT_INIT_MAX_LEN;
+				block = 0;
+			}
+			ret = ext4fs_add_extent(le32_to_cpu(extent[i].ee_block),
+						len, block);
+			if (ret)
+				return ret;
+		}
+
+		return 0;
+	}
+
+	child = memalign(ARCH_DMA_MINALIGN, blksz);
+	if (!child)
+		return -ENOMEM;
+
+	for (i = 0; i < entries; i++) {
+		struct ext4_extent_idx *index;
+
+		index = (struct ext4_extent_idx *)(ext_block + 1) + i;
+		block = le16_to_cpu(index->ei_leaf_hi);
+		block = (block << 32) + le32_to_cpu(index->ei_leaf_lo);
+		if (!ext4fs_devread((lbaint_t)block << log2_blksz, 0, blksz,
+				    (char *)child)) {
+			ret = -EIO;
+			break;
+		}
+		ret = ext4fs_walk_extents(child, blksz, depth - 1,
+					  log2_blksz);
+		if (ret)
+			break;
+	}
+	free(child);
+
+	return ret;
+}
+
+/*
+ * Decode the whole extent tree of an extent-mapped file into a sorted list
+ * of runs, so that reads do not need to walk the tree for every block. The
+ * list is kept until the file or the filesystem is closed.
+ *
+ * Returns the number of runs, or a negative error code.
+ */
+int ext4fs_get_extents(struct ext2fs_node *node,
+		       struct ext4_file_extent **extp)
+{
+	struct ext4_extent_header *ext_block;
+	int log2_blksz;
+	int ret;
+
+	if (ext4fs_extents.ext && ext4fs_extents.data == node->data &&
+	    ext4fs_extents.ino == node->ino &&
+	    !memcmp(&ext4fs_extents.inode, &node->inode, sizeof(node->inode))) {
+		*extp = ext4fs_extents.ext;
+		return ext4fs_extents.count;
+	}
+
+	ext4fs_free_extents();
+
+	ext_block = (struct ext4_extent_header *)node->inode.b.blocks.dir_blocks;
+	log2_blksz = LOG2_BLOCK_SIZE(ext4fs_root) -
+		get_fs()->dev_desc->log2blksz;
+	ret = ext4fs_walk_extents(ext_block,
+				  sizeof(node->inode.b.blocks),
+				  le16_to_cpu(ext_block->eh_depth), log2_blksz);
+	if (ret) {
+		printf("invalid extent block\n");
+		ext4fs_free_extents();
+		return ret;
+	}
+
+	/* an empty list is kept as an allocated, zero-length array */
+	if (!ext4fs_extents.ext) {
+		ext4fs_extents.ext = malloc(sizeof(struct ext4_file_extent));
+		if (!ext4fs_extents.ext)
+			return -ENOMEM;
+		ext4fs_extents.size = 1;
+	}
+	ext4fs_extents.data = node->data;
+	ext4fs_extents.ino = node->ino;
+	ext4fs_extents.inode = node->inode;
+	*extp = ext4fs_extents.ext;
+
+	return ext4fs_extents.count;
+}
+
 /**
  * ext4fs_reinit_global() - Reinitialize values of ext4 write implementation's
  *			    global pointers
@@ -2028,18 +2215,81 @@ void ext4fs_reinit_global(void)
 		ext4fs_indir3_blkno = -1;
 	}
 }
-void ext4fs_close(void)
+
+/* Close the current file but keep the filesystem mounted */
+void ext4fs_release(void)
 {
 	if ((ext4fs_file != NULL) && (ext4fs_root != NULL)) {
 		ext4fs_free_node(ext4fs_file, &ext4fs_root->diropen);
 		ext4fs_file = NULL;
 	}
+
+	ext4fs_free_extents();
+	ext4fs_reinit_global();
+}
+
+void ext4fs_close(void)
+{
+	ext4fs_release();
+
 	if (ext4fs_root != NULL) {
 		free(ext4fs_root);
 		ext4fs_root = NULL;
 	}
+}
 
-	ext4fs_reinit_global();
+/*
+ * Allocate the node of the directory entry 'dirent' of 'diro', and return its
+ * type in 'ftype'. The inode is only read if the entry has no file type.
+ */
+static struct ext2fs_node *ext4fs_dirent_node(struct ext2fs_node *diro,
+					      struct ext2_dirent *dirent,
+					      int *ftype)
+{
+	struct ext2fs_node *fdiro;
+	int type = FILETYPE_UNKNOWN;
+	int status;
+
+	fdiro = zalloc(sizeof(struct ext2fs_node));
+	if (!fdiro)
+		return NULL;
+
+	fdiro->data = diro->data;
+	fdiro->ino = le32_to_cpu(dirent->inode);
+
+	if (dirent->filetype != FILETYPE_UNKNOWN) {
+		fdiro->inode_read = 0;
+
+		if (dirent->filetype == FILETYPE_DIRECTORY)
+			type = FILETYPE_DIRECTORY;
+		else if (dirent->filetype == FILETYPE_SYMLINK)
+			type = FILETYPE_SYMLINK;
+		else if (dirent->filetype == FILETYPE_REG)
+			type = FILETYPE_REG;
+	} else {
+		status = ext4fs_read_inode(diro->data,
+					   le32_to_cpu(dirent->inode),
+					   &fdiro->inode);
+		if (status == 0) {
+			free(fdiro);
+			return NULL;
+		}
+		fdiro->inode_read = 1;
+
+		if ((le16_to_cpu(fdiro->inode.mode) &
+		     FILETYPE_INO_MASK) == FILETYPE_INO_DIRECTORY) {
+			type = FILETYPE_DIRECTORY;
+		} else if ((le16_to_cpu(fdiro->inode.mode) &
+			    FILETYPE_INO_MASK) == FILETYPE_INO_SYMLINK) {
+			type = FILETYPE_SYMLINK;
+		} else if ((le16_to_cpu(fdiro->inode.mode) &
+			    FILETYPE_INO_MASK) == FILETYPE_INO_REG) {
+			type = FILETYPE_REG;
+		}
+	}
+	*ftype = type;
+
+	return fdiro;
 }
 
 int ext4fs_iterate_dir(struct ext2fs_node *dir, char *name,
@@ -2059,6 +2309,18 @@ int ext4fs_iterate_dir(struct ext2fs_node *dir, char *name,
 		if (status == 0)
 			return 0;
 	}
+	/* Use the hash tree index of the directory if there is one */
+	if (name && fnode && ftype) {
+		struct ext2_dirent dirent;
+
+		status = ext4fs_dx_lookup(diro, name, &dirent);
+		if (status == 0)
+			return 0;
+		if (status > 0) {
+			*fnode = ext4fs_dirent_node(diro, &dirent, ftype);
+			return *fnode != NULL;
+		}
+	}
 	/* Search the file.  */
 	while (fpos < le32_to_cpu(diro->inode.size)) {
 		struct ext2_dirent dirent;
@@ -2087,49 +2349,12 @@ int ext4fs_iterate_dir(struct ext2fs_node *dir, char *name,
 			if (status < 0)
 				return 0;
 
-			fdiro = zalloc(sizeof(struct ext2fs_node));
+			fdiro = ext4fs_dirent_node(diro, &dirent, &type);
 			if (!fdiro)
 				return 0;
 
-			fdiro->data = diro->data;
-			fdiro->ino = le32_to_cpu(dirent.inode);
-
 			filename[dirent.namelen] = '\0';
 
-			if (dirent.filetype != FILETYPE_UNKNOWN) {
-				fdiro->inode_read = 0;
-
-				if (dirent.filetype == FILETYPE_DIRECTORY)
-					type = FILETYPE_DIRECTORY;
-				else if (dirent.filetype == FILETYPE_SYMLINK)
-					type = FILETYPE_SYMLINK;
-				else if (dirent.filetype == FILETYPE_REG)
-					type = FILETYPE_REG;
-			} else {
-				status = ext4fs_read_inode(diro->data,
-							   le32_to_cpu
-							   (dirent.inode),
-							   &fdiro->inode);
-				if (status == 0) {
-					free(fdiro);
-					return 0;
-				}
-				fdiro->inode_read = 1;
-
-				if ((le16_to_cpu(fdiro->inode.mode) &
-				     FILETYPE_INO_MASK) ==
-				    FILETYPE_INO_DIRECTORY) {
-					type = FILETYPE_DIRECTORY;
-				} else if ((le16_to_cpu(fdiro->inode.mode)
-					    & FILETYPE_INO_MASK) ==
-					   FILETYPE_INO_SYMLINK) {
-					type = FILETYPE_SYMLINK;
-				} else if ((le16_to_cpu(fdiro->inode.mode)
-					    & FILETYPE_INO_MASK) ==
-					   FILETYPE_INO_REG) {
-					type = FILETYPE_REG;
-				}
-			}
 #ifdef DEBUG
 			printf("iterate >%s<\n", filename);
 #endif /* of DEBUG */
@@ -2336,22 +2561,33 @@ int ext4fs_find_file(const char *path, struct ext2fs_node *rootnode,
 int ext4fs_open(const char *filename, loff_t *len)
 {
 	struct ext2fs_node *fdiro = NULL;
+	struct ext2fs_node cached;
 	int status;
 
 	if (ext4fs_root == NULL)
 		return -1;
 
 	ext4fs_file = NULL;
-	status = ext4fs_find_file(filename, &ext4fs_root->diropen, &fdiro,
-				  FILETYPE_REG);
-	if (status == 0)
-		goto fail;
-
-	if (!fdiro->inode_read) {
-		status = ext4fs_read_inode(fdiro->data, fdiro->ino,
-				&fdiro->inode);
+	if (!fs_dcache_lookup(filename, &cached, sizeof(cached))) {
+		fdiro = malloc(sizeof(*fdiro));
+		if (!fdiro)
+			return -1;
+		*fdiro = cached;
+		fdiro->data = ext4fs_root;
+	} else {
+		status = ext4fs_find_file(filename, &ext4fs_root->diropen,
+					  &fdiro, FILETYPE_REG);
 		if (status == 0)
 			goto fail;
+
+		if (!fdiro->inode_read) {
+			status = ext4fs_read_inode(fdiro->data, fdiro->ino,
+						   &fdiro->inode);
+			if (status == 0)
+				goto fail;
+			fdiro->inode_read = 1;
+		}
+		fs_dcache_add(filename, fdiro, sizeof(*fdiro));
 	}
 	*len = le32_to_cpu(fdiro->inode.size);
 	ext4fs_file = fdiro;
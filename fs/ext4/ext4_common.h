@@ -50,12 +50,23 @@ static inline void *zalloc(size_t size)
 
 int ext4fs_read_inode(struct ext2_data *data, int ino,
 		      struct ext2_inode *inode);
+/* Run of consecutive blocks of an extent-mapped file */
+struct ext4_file_extent {
+	uint32_t lblock;	/* First logical block */
+	uint32_t len;		/* Number of blocks */
+	uint64_t pblock;	/* First physical block, 0 if not initialized */
+};
+
+int ext4fs_get_extents(struct ext2fs_node *node,
+		       struct ext4_file_extent **extp);
 int ext4fs_read_file(struct ext2fs_node *node, loff_t pos, loff_t len,
 		     char *buf, loff_t *actread);
 int ext4fs_find_file(const char *path, struct ext2fs_node *rootnode,
 			struct ext2fs_node **foundnode, int expecttype);
 int ext4fs_iterate_dir(struct ext2fs_node *dir, char *name,
 			struct ext2fs_node **fnode, int *ftype);
+int ext4fs_dx_lookup(struct ext2fs_node *dir, const char *name,
+		     struct ext2_dirent *dirent);
 
 #if defined(CONFIG_EXT4_WRITE)
 uint32_t ext4fs_div_roundup(uint32_t size, uint32_t n);
@@ -0,0 +1,467 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Lookup in ext4 hash tree (htree) indexed directories
+ *
+ * The directory hash functions are taken from the Linux kernel,
+ * fs/ext4/hash.c:
+ * Copyright (C) 2002 by Theodore Ts'o
+ */
+
+#include <common.h>
+#include <blk.h>
+#include <ext_common.h>
+#include <ext4fs.h>
+#include "ext4_common.h"
+#include <malloc.h>
+#include <memalign.h>
+
+#define DX_HASH_LEGACY			0
+#define DX_HASH_HALF_MD4		1
+#define DX_HASH_TEA			2
+#define DX_HASH_LEGACY_UNSIGNED		3
+#define DX_HASH_HALF_MD4_UNSIGNED	4
+#define DX_HASH_TEA_UNSIGNED		5
+
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002
+#define EXT4_HTREE_EOF_32BIT		0x7fffffff
+/* Maximum depth of the index, with the large directory feature */
+#define EXT4_HTREE_LEVEL		3
+
+/* The "." and ".." entries in front of dx_root_info */
+#define DX_ROOT_INFO_OFFSET		24
+/* The empty directory entry in front of the entries of a dx_node */
+#define DX_NODE_OFFSET			8
+
+struct dx_root_info {
+	__le32 reserved_zero;
+	u8 hash_version;
+	u8 info_length;
+	u8 indirect_levels;
+	u8 unused_flags;
+};
+
+struct dx_entry {
+	__le32 hash;
+	__le32 block;
+};
+
+/* Overlays the hash of the first dx_entry of a block */
+struct dx_countlimit {
+	__le16 limit;
+	__le16 count;
+};
+
+struct dx_frame {
+	char *buf;
+	struct dx_entry *entries;
+	struct dx_entry *at;
+	unsigned int count;
+};
+
+#define DELTA 0x9E3779B9
+
+static inline u32 rol32(u32 word, unsigned int shift)
+{
+	return (word << shift) | (word >> ((-shift) & 31));
+}
+
+static void tea_transform(u32 buf[4], u32 const in[])
+{
+	u32 sum = 0;
+	u32 b0 = buf[0], b1 = buf[1];
+	u32 a = in[0], b = in[1], c = in[2], d = in[3];
+	int n = 16;
+
+	do {
+		sum += DELTA;
+		b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+		b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+	} while (--n);
+
+	buf[0] += b0;
+	buf[1] += b1;
+}
+
+/* F, G and H are basic MD4 functions: selection, majority, parity */
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+
+#define MD4_ROUND(f, a, b, c, d, x, s)	\
+	(a += f(b, c, d) + x, a = rol32(a, s))
+#define K1 0
+#define K2 013240474631UL
+#define K3 015666365641UL
+
+static void half_md4_transform(u32 buf[4], u32 const in[8])
+{
+	u32 a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+	/* Round 1 */
+	MD4_ROUND(F, a, b, c, d, in[0] + K1,  3);
+	MD4_ROUND(F, d, a, b, c, in[1] + K1,  7);
+	MD4_ROUND(F, c, d, a, b, in[2] + K1, 11);
+	MD4_ROUND(F, b, c, d, a, in[3] + K1, 19);
+	MD4_ROUND(F, a, b, c, d, in[4] + K1,  3);
+	MD4_ROUND(F, d, a, b, c, in[5] + K1,  7);
+	MD4_ROUND(F, c, d, a, b, in[6] + K1, 11);
+	MD4_ROUND(F, b, c, d, a, in[7] + K1, 19);
+
+	/* Round 2 */
+	MD4_ROUND(G, a, b, c, d, in[1] + K2,  3);
+	MD4_ROUND(G, d, a, b, c, in[3] + K2,  5);
+	MD4_ROUND(G, c, d, a, b, in[5] + K2,  9);
+	MD4_ROUND(G, b, c, d, a, in[7] + K2, 13);
+	MD4_ROUND(G, a, b, c, d, in[0] + K2,  3);
+	MD4_ROUND(G, d, a, b, c, in[2] + K2,  5);
+	MD4_ROUND(G, c, d, a, b, in[4] + K2,  9);
+	MD4_ROUND(G, b, c, d, a, in[6] + K2, 13);
+
+	/* Round 3 */
+	MD4_ROUND(H, a, b, c, d, in[3] + K3,  3);
+	MD4_ROUND(H, d, a, b, c, in[7] + K3,  9);
+	MD4_ROUND(H, c, d, a, b, in[2] + K3, 11);
+	MD4_ROUND(H, b, c, d, a, in[6] + K3, 15);
+	MD4_ROUND(H, a, b, c, d, in[1] + K3,  3);
+	MD4_ROUND(H, d, a, b, c, in[5] + K3,  9);
+	MD4_ROUND(H, c, d, a, b, in[0] + K3, 11);
+	MD4_ROUND(H, b, c, d, a, in[4] + K3, 15);
+
+	buf[0] += a;
+	buf[1] += b;
+	buf[2] += c;
+	buf[3] += d;
+}
+
+/* The old legacy hash */
+static u32 dx_hack_hash(const char *name, int len, bool unsigned_char)
+{
+	u32 hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+	int c;
+
+	while (len--) {
+		if (unsigned_char)
+			c = (unsigned char)*name++;
+		else
+			c = (signed char)*name++;
+		hash = hash1 + (hash0 ^ (c * 7152373));
+
+		if (hash & 0x80000000)
+			hash -= 0x7fffffff;
+		hash1 = hash0;
+		hash0 = hash;
+	}
+
+	return hash0 << 1;
+}
+
+static void str2hashbuf(const char *msg, int len, u32 *buf, int num,
+			bool unsigned_char)
+{
+	u32 pad, val;
+	int i, c;
+
+	pad = (u32)len | ((u32)len << 8);
+	pad |= pad << 16;
+
+	val = pad;
+	if (len > num * 4)
+		len = num * 4;
+	for (i = 0; i < len; i++) {
+		if (unsigned_char)
+			c = (unsigned char)msg[i];
+		else
+			c = (signed char)msg[i];
+		val = c + (val << 8);
+		if ((i % 4) == 3) {
+			*buf++ = val;
+			val = pad;
+			num--;
+		}
+	}
+	if (--num >= 0)
+		*buf++ = val;
+	while (--num >= 0)
+		*buf++ = pad;
+}
+
+/*
+ * Compute the major hash of a name as stored in the directory index.
+ * Return 0 on success, -EOPNOTSUPP for an unknown hash version.
+ */
+static int ext4fs_dirhash(const char *name, int len, const __le32 *seed,
+			  int version, u32 *hashp)
+{
+	bool unsigned_char = false;
+	u32 in[8], buf[4];
+	u32 hash;
+	int i;
+
+	/* Initialize the default seed for the hash checksum functions */
+	buf[0] = 0x67452301;
+	buf[1] = 0xefcdab89;
+	buf[2] = 0x98badcfe;
+	buf[3] = 0x10325476;
+
+	/* Check to see if the seed is all zero's */
+	for (i = 0; i < 4; i++) {
+		if (seed[i]) {
+			for (i = 0; i < 4; i++)
+				buf[i] = le32_to_cpu(seed[i]);
+			break;
+		}
+	}
+
+	switch (version) {
+	case DX_HASH_LEGACY_UNSIGNED:
+		unsigned_char = true;
+		/* fall through */
+	case DX_HASH_LEGACY:
+		hash = dx_hack_hash(name, len, unsigned_char);
+		break;
+	case DX_HASH_HALF_MD4_UNSIGNED:
+		unsigned_char = true;
+		/* fall through */
+	case DX_HASH_HALF_MD4:
+		for (; len > 0; len -= 32, name += 32) {
+			str2hashbuf(name, len, in, 8, unsigned_char);
+			half_md4_transform(buf, in);
+		}
+		hash = buf[1];
+		break;
+	case DX_HASH_TEA_UNSIGNED:
+		unsigned_char = true;
+		/* fall through */
+	case DX_HASH_TEA:
+		for (; len > 0; len -= 16, name += 16) {
+			str2hashbuf(name, len, in, 4, unsigned_char);
+			tea_transform(buf, in);
+		}
+		hash = buf[0];
+		break;
+	default:
+		return -EOPNOTSUPP;
+	}
+
+	hash &= ~1;
+	if (hash == (EXT4_HTREE_EOF_32BIT << 1))
+		hash = (EXT4_HTREE_EOF_32BIT - 1) << 1;
+	*hashp = hash;
+
+	return 0;
+}
+
+static int dx_read_block(struct ext2fs_node *dir, u32 block, char *buf)
+{
+	int log2_blksz = LOG2_BLOCK_SIZE(dir->data);
+	int blksz = EXT2_BLOCK_SIZE(dir->data);
+	loff_t actread;
+
+	if (ext4fs_read_file(dir, (loff_t)block << log2_blksz, blksz, buf,
+			     &actread) || actread != blksz)
+		return -EIO;
+
+	return 0;
+}
+
+static u32 dx_get_block(struct dx_entry *entry)
+{
+	return le32_to_cpu(entry->block) & 0x0fffffff;
+}
+
+/*
+ * Set up 'frame' for the index block in 'frame->buf', whose entries start at
+ * 'offset', and find the entry covering 'hash'.
+ */
+static int dx_probe_block(struct dx_frame *frame, int offset, int blksz,
+			  u32 hash)
+{
+	struct dx_countlimit *cl;
+	struct dx_entry *p, *q, *m;
+	unsigned int limit;
+
+	frame->entries = (struct dx_entry *)(frame->buf + offset);
+	cl = (struct dx_countlimit *)frame->entries;
+	frame->count = le16_to_cpu(cl->count);
+	limit = le16_to_cpu(cl->limit);
+	if (!frame->count || frame->count > limit ||
+	    limit > (blksz - offset) / sizeof(struct dx_entry))
+		return -EINVAL;
+
+	/* the last entry whose hash is not above the one looked up */
+	p = frame->entries + 1;
+	q = frame->entries + frame->count - 1;
+	while (p <= q) {
+		m = p + (q - p) / 2;
+		if (le32_to_cpu(m->hash) > hash)
+			q = m - 1;
+		else
+			p = m + 1;
+	}
+	frame->at = p - 1;
+
+	return 0;
+}
+
+/*
+ * Move to the next leaf block if the names with 'hash' continue there.
+ * Return 1 if so, 0 if there are no more candidates, negative on error.
+ */
+static int dx_next_block(struct ext2fs_node *dir, struct dx_frame *frames,
+			 int levels, u32 hash)
+{
+	int blksz = EXT2_BLOCK_SIZE(dir->data);
+	struct dx_frame *p = &frames[levels];
+	u32 bhash;
+	int ret;
+
+	while (1) {
+		p->at++;
+		if (p->at < p->entries + p->count)
+			break;
+		if (p == frames)
+			return 0;
+		p--;
+	}
+
+	/* the low bit of the hash marks a collision continued here */
+	bhash = le32_to_cpu(p->at->hash);
+	if (!(bhash & 1) || (bhash & ~1) != hash)
+		return 0;
+
+	for (; p < &frames[levels]; p++) {
+		ret = dx_read_block(dir, dx_get_block(p->at), p[1].buf);
+		if (ret)
+			return ret;
+		ret = dx_probe_block(&p[1], DX_NODE_OFFSET, blksz, 0);
+		if (ret)
+			return ret;
+		p[1].at = p[1].entries;
+	}
+
+	return 1;
+}
+
+/* Look for 'name' in the directory block 'buf' */
+static int dx_search_leaf(char *buf, int blksz, const char *name, int len,
+			  struct ext2_dirent *dirent)
+{
+	struct ext2_dirent *de;
+	int offset = 0;
+	int direntlen;
+
+	while (offset + (int)sizeof(*de) <= blksz) {
+		de = (struct ext2_dirent *)(buf + offset);
+		direntlen = le16_to_cpu(de->direntlen);
+		if (direntlen < sizeof(*de) || (direntlen & 3) ||
+		    offset + direntlen > blksz ||
+		    de->namelen > direntlen - sizeof(*de))
+			return -EINVAL;
+
+		if (de->inode && de->namelen == len &&
+		    !memcmp(de + 1, name, len)) {
+			*dirent = *de;
+			return 1;
+		}
+		offset += direntlen;
+	}
+
+	return 0;
+}
+
+/**
+ * ext4fs_dx_lookup() - look up a name through the index of a directory
+ *
+ * @dir:	directory node, with its inode read
+ * @name:	name to look up
+ * @dirent:	returns the directory entry header of @name
+ * Return:	1 if found, 0 if not present, negative if the directory has no
+ *		usable index and must be scanned linearly
+ */
+int ext4fs_dx_lookup(struct ext2fs_node *dir, const char *name,
+		     struct ext2_dirent *dirent)
+{
+	struct ext2_sblock *sb = &dir->data->sblock;
+	struct dx_frame frames[EXT4_HTREE_LEVEL] = { };
+	int blksz = EXT2_BLOCK_SIZE(dir->data);
+	int len = strlen(name);
+	struct dx_root_info *info;
+	int levels, max_levels;
+	char *leaf;
+	int version;
+	u32 hash;
+	int i, ret;
+
+	if (!(le32_to_cpu(sb->feature_compatibility) &
+	      EXT4_FEATURE_COMPAT_DIR_INDEX) ||
+	    !(le32_to_cpu(dir->inode.flags) & EXT4_INDEX_FL) ||
+	    (le32_to_cpu(dir->inode.flags) & (EXT4_ENCRYPT_FL |
+					       EXT4_CASEFOLD_FL)))
+		return -EOPNOTSUPP;
+
+	if (!len || len > 255)
+		return 0;
+
+	leaf = malloc_cache_aligned(blksz);
+	if (!leaf)
+		return -ENOMEM;
+	for (i = 0; i < EXT4_HTREE_LEVEL; i++) {
+		frames[i].buf = malloc_cache_aligned(blksz);
+		if (!frames[i].buf) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	ret = dx_read_block(dir, 0, frames[0].buf);
+	if (ret)
+		goto out;
+
+	info = (struct dx_root_info *)(frames[0].buf + DX_ROOT_INFO_OFFSET);
+	max_levels = EXT4_HTREE_LEVEL - 1;
+	if (le32_to_cpu(sb->feature_incompat) & EXT4_FEATURE_INCOMPAT_LARGEDIR)
+		max_levels = EXT4_HTREE_LEVEL;
+	levels = info->indirect_levels;
+	if (info->reserved_zero || info->info_length != sizeof(*info) ||
+	    levels >= max_levels) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	version = info->hash_version;
+	if (version <= DX_HASH_TEA &&
+	    (le32_to_cpu(sb->flags) & EXT2_FLAGS_UNSIGNED_HASH))
+		version += DX_HASH_LEGACY_UNSIGNED;
+	ret = ext4fs_dirhash(name, len, sb->hash_seed, version, &hash);
+	if (ret)
+		goto out;
+
+	ret = dx_probe_block(&frames[0],
+			     DX_ROOT_INFO_OFFSET + info->info_length, blksz,
+			     hash);
+	for (i = 1; !ret && i <= levels; i++) {
+		ret = dx_read_block(dir, dx_get_block(frames[i - 1].at),
+				    frames[i].buf);
+		if (!ret)
+			ret = dx_probe_block(&frames[i], DX_NODE_OFFSET, blksz,
+					     hash);
+	}
+	if (ret)
+		goto out;
+
+	do {
+		ret = dx_read_block(dir, dx_get_block(frames[levels].at), leaf);
+		if (!ret)
+			ret = dx_search_leaf(leaf, blksz, name, len, dirent);
+		if (ret)
+			break;
+		ret = dx_next_block(dir, frames, levels, hash);
+	} while (ret > 0);
+
+out:
+	for (i = 0; i < EXT4_HTREE_LEVEL; i++)
+		free(frames[i].buf);
+	free(leaf);
+
+	return ret;
+}
@@ -44,6 +44,81 @@ void ext4fs_free_node(struct ext2fs_node *node, struct ext2fs_node *currroot)
 		free(node);
 }
 
+/*
+ * Read from an extent-mapped file, issuing a single device read for each run
+ * of physically contiguous blocks. Holes and uninitialized extents read as
+ * zeroes.
+ */
+static int ext4fs_read_extents(struct ext2fs_node *node, loff_t pos,
+			       loff_t len, char *buf)
+{
+	struct ext_filesystem *fs = get_fs();
+	int log2blksz = fs->dev_desc->log2blksz;
+	int log2_fs_blocksize = LOG2_BLOCK_SIZE(node->data) - log2blksz;
+	int bits = LOG2_BLOCK_SIZE(node->data);
+	loff_t blocksize = 1 << bits;
+	/* largest chunk ext4fs_devread() can take, in whole blocks */
+	loff_t maxchunk = INT_MAX & ~(blocksize - 1);
+	struct ext4_file_extent *ext;
+	loff_t end = pos + len;
+	int count, lo, hi;
+
+	count = ext4fs_get_extents(node, &ext);
+	if (count < 0)
+		return -1;
+
+	/* find the first extent ending after pos */
+	lo = 0;
+	hi = count;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (((loff_t)ext[mid].lblock + ext[mid].len) << bits <= pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	while (pos < end) {
+		loff_t estart, eend, n;
+
+		if (lo < count) {
+			estart = (loff_t)ext[lo].lblock << bits;
+			eend = ((loff_t)ext[lo].lblock + ext[lo].len) << bits;
+		} else {
+			estart = end;
+			eend = end;
+		}
+
+		if (pos < estart) {
+			/* hole before the next extent */
+			n = min(estart, end) - pos;
+			memset(buf, 0, n);
+		} else {
+			n = min(min(eend, end) - pos, maxchunk);
+			if (ext[lo].pblock) {
+				loff_t off = pos - estart;
+				lbaint_t sector;
+
+				sector = (ext[lo].pblock + (off >> bits)) <<
+					 log2_fs_blocksize;
+				if (!ext4fs_devread(sector,
+						    off & (blocksize - 1), n,
+						    buf))
+					return -1;
+			} else {
+				memset(buf, 0, n);
+			}
+			if (pos + n == eend)
+				lo++;
+		}
+		pos += n;
+		buf += n;
+	}
+
+	return 0;
+}
+
 /*
  * Taken from openmoko-kernel mailing list: By Andy green
  * Optimized read file API : collects and defers contiguous sector
@@ -69,17 +144,22 @@ int ext4fs_read_file(struct ext2fs_node *node, loff_t pos,
 	short status;
 	struct ext_block_cache cache;
 
-	ext_cache_init(&cache);
-
 	/* Adjust len so it we can't read past the end of the file. */
 	if (len + pos > filesize)
 		len = (filesize - pos);
 
-	if (blocksize <= 0 || len <= 0) {
-		ext_cache_fini(&cache);
+	if (blocksize <= 0 || len <= 0)
 		return -1;
+
+	if (le32_to_cpu(node->inode.flags) & EXT4_EXTENTS_FL) {
+		if (ext4fs_read_extents(node, pos, len, buf))
+			return -1;
+		*actread = len;
+		return 0;
 	}
 
+	ext_cache_init(&cache);
+
 	blockcnt = lldiv(((len + pos) + blocksize - 1), blocksize);
 
 	for (i = lldiv(pos, blocksize); i < blockcnt; i++) {
@@ -11,11 +11,13 @@
 #include <common.h>
 #include <blk.h>
 #include <config.h>
+#include <div64.h>
 #include <exports.h>
 #include <fat.h>
 #include <fs.h>
 #include <log.h>
 #include <asm/byteorder.h>
+#include <asm/unaligned.h>
 #include <part.h>
 #include <malloc.h>
 #include <memalign.h>
@@ -42,6 +44,45 @@ static struct disk_partition cur_part_info;
 #define DOS_BOOT_MAGIC_OFFSET	0x1fe
 #define DOS_FS_TYPE_OFFSET	0x36
 #define DOS_FS32_TYPE_OFFSET	0x52
+#define DOS_VOL_ID_OFFSET	0x27
+#define DOS_FS32_VOL_ID_OFFSET	0x43
+
+/*
+ * Cluster chain of the most recently read file, collapsed into runs of
+ * consecutive clusters.  The map is kept across file_fat_read_at() calls so
+ * that reads at increasing offsets do not walk the FAT from the start again.
+ */
+struct fat_extent {
+	__u32 lclust;	/* first cluster index within the file */
+	__u32 start;	/* first cluster on disk */
+	__u32 count;	/* number of consecutive clusters */
+};
+
+static struct {
+	struct blk_desc *dev;	/* device the map belongs to */
+	lbaint_t part_start;	/* partition the map belongs to */
+	__u32 vol_id;		/* volume ID of the filesystem */
+	__u32 first_clust;	/* first cluster of the mapped file */
+	__u32 nclust;		/* number of clusters mapped so far */
+	bool complete;		/* true if the end of the chain was reached */
+	int count;		/* number of entries used in ext */
+	int size;		/* number of entries allocated in ext */
+	struct fat_extent *ext;
+} fat_map;
+
+static __u32 cur_vol_id;
+
+/* Filesystem parameters of the current device, see get_fs_info() */
+static fsdata fat_mount_info;
+static int fat_mounted;
+
+static void fat_map_invalidate(void)
+{
+	fat_map.dev = NULL;
+	fat_map.nclust = 0;
+	fat_map.count = 0;
+	fat_map.complete = false;
+}
 
 static int disk_read(__u32 block, __u32 nr_blocks, void *buf)
 {
@@ -62,8 +103,17 @@ int fat_set_blk_dev(struct blk_desc *dev_desc, struct disk_partition *info)
 {
 	ALLOC_CACHE_ALIGN_BUFFER(unsigned char, buffer, dev_desc->blksz);
 
+	/*
+	 * Anything kept mounted through the fs layer is now out of date, and
+	 * the medium may have changed under the cluster map, even if it has
+	 * the same volume ID
+	 */
+	fs_mount_invalidate(NULL);
+	fat_map_invalidate();
+
 	cur_dev = dev_desc;
 	cur_part_info = *info;
+	fat_mounted = 0;
 
 	/* Make sure it has a valid FAT header */
 	if (disk_read(0, 1, buffer) != 1) {
@@ -78,10 +128,15 @@ int fat_set_blk_dev(struct blk_desc *dev_desc, struct disk_partition *info)
 	}
 
 	/* Check for FAT12/FAT16/FAT32 filesystem */
-	if (!memcmp(buffer + DOS_FS_TYPE_OFFSET, "FAT", 3))
+	if (!memcmp(buffer + DOS_FS_TYPE_OFFSET, "FAT", 3)) {
+		cur_vol_id = get_unaligned_le32(buffer + DOS_VOL_ID_OFFSET);
 		return 0;
-	if (!memcmp(buffer + DOS_FS32_TYPE_OFFSET, "FAT32", 5))
+	}
+	if (!memcmp(buffer + DOS_FS32_TYPE_OFFSET, "FAT32", 5)) {
+		cur_vol_id = get_unaligned_le32(buffer +
+						DOS_FS32_VOL_ID_OFFSET);
 		return 0;
+	}
 
 	cur_dev = NULL;
 	return -1;
@@ -93,6 +148,8 @@ int fat_register_device(struct blk_desc *dev_desc, int part_no)
 
 	/* First close any currently found FAT filesystem */
 	cur_dev = NULL;
+	fat_mounted = 0;
+	fat_map_invalidate();
 
 	/* Read the partition table, if present */
 	if (part_get_info(dev_desc, part_no, &info)) {
@@ -157,6 +214,86 @@ int flush_dirty_fat_buffer(fsdata *mydata)
 }
 #endif
 
+/*
+ * Allocate the FAT buffer and mark all of its windows unused.
+ * Return 0 on success, -1 otherwise.
+ */
+static int fat_cache_init(fsdata *mydata)
+{
+	int i;
+
+	mydata->fatbuf = malloc_cache_aligned(FATBUFSIZE * FATBUFWINDOWS);
+	if (!mydata->fatbuf)
+		return -1;
+
+	for (i = 0; i < FATBUFWINDOWS; i++) {
+		mydata->fatwin[i].bufnum = -1;
+		mydata->fatwin[i].dirty = 0;
+		mydata->fatwin[i].stamp = 0;
+	}
+	mydata->fat_dirty = 0;
+	mydata->fatstamp = 0;
+
+	return 0;
+}
+
+/*
+ * Return the window of fatbuf that holds FAT block 'bufnum', reading it from
+ * disk if needed. The least recently used window is replaced; if it has been
+ * modified, all dirty windows are written back first. If 'dirty' is set the
+ * window is marked as modified.
+ * Return NULL on error.
+ */
+static __u8 *get_fat_window(fsdata *mydata, __u32 bufnum, int dirty)
+{
+	struct fat_window *win = NULL;
+	int i, victim = 0;
+
+	for (i = 0; i < FATBUFWINDOWS; i++) {
+		if (mydata->fatwin[i].bufnum == bufnum) {
+			win = &mydata->fatwin[i];
+			break;
+		}
+		if (mydata->fatwin[i].stamp < mydata->fatwin[victim].stamp)
+			victim = i;
+	}
+
+	if (!win) {
+		__u32 getsize = FATBUFBLOCKS;
+		__u32 fatlength = mydata->fatlength;
+		__u32 startblock = bufnum * FATBUFBLOCKS;
+
+		i = victim;
+		win = &mydata->fatwin[i];
+
+		/* Cap length if fatlength is not a multiple of FATBUFBLOCKS */
+		if (startblock + getsize > fatlength)
+			getsize = fatlength - startblock;
+
+		startblock += mydata->fat_sect;	/* Offset from start of disk */
+
+		/* Write back the modified windows to the disk */
+		if (win->dirty && flush_dirty_fat_buffer(mydata) < 0)
+			return NULL;
+
+		win->bufnum = -1;
+		if (disk_read(startblock, getsize,
+			      mydata->fatbuf + i * FATBUFSIZE) < 0) {
+			debug("Error reading FAT blocks\n");
+			return NULL;
+		}
+		win->bufnum = bufnum;
+	}
+
+	win->stamp = ++mydata->fatstamp;
+	if (dirty) {
+		win->dirty = 1;
+		mydata->fat_dirty = 1;
+	}
+
+	return mydata->fatbuf + i * FATBUFSIZE;
+}
+
 /*
  * Get the entry at index 'entry' in a FAT (12/16/32) table.
  * On failure 0x00 is returned.
@@ -166,6 +303,7 @@ static __u32 get_fatent(fsdata *mydata, __u32 entry)
 	__u32 bufnum;
 	__u32 offset, off8;
 	__u32 ret = 0x00;
+	__u8 *fatbuf;
 
 	if (CHECK_CLUST(entry, mydata->fatsize)) {
 		printf("Error: Invalid FAT entry: 0x%08x\n", entry);
@@ -195,41 +333,22 @@ static __u32 get_fatent(fsdata *mydata, __u32 entry)
 	       mydata->fatsize, entry, entry, offset, offset);
 
 	/* Read a new block of FAT entries into the cache. */
-	if (bufnum != mydata->fatbufnum) {
-		__u32 getsize = FATBUFBLOCKS;
-		__u8 *bufptr = mydata->fatbuf;
-		__u32 fatlength = mydata->fatlength;
-		__u32 startblock = bufnum * FATBUFBLOCKS;
-
-		/* Cap length if fatlength is not a multiple of FATBUFBLOCKS */
-		if (startblock + getsize > fatlength)
-			getsize = fatlength - startblock;
-
-		startblock += mydata->fat_sect;	/* Offset from start of disk */
-
-		/* Write back the fatbuf to the disk */
-		if (flush_dirty_fat_buffer(mydata) < 0)
-			return -1;
-
-		if (disk_read(startblock, getsize, bufptr) < 0) {
-			debug("Error reading FAT blocks\n");
-			return ret;
-		}
-		mydata->fatbufnum = bufnum;
-	}
+	fatbuf = get_fat_window(mydata, bufnum, 0);
+	if (!fatbuf)
+		return ret;
 
 	/* Get the actual entry from the table */
 	switch (mydata->fatsize) {
 	case 32:
-		ret = FAT2CPU32(((__u32 *) mydata->fatbuf)[offset]);
+		ret = FAT2CPU32(((__u32 *)fatbuf)[offset]);
 		break;
 	case 16:
-		ret = FAT2CPU16(((__u16 *) mydata->fatbuf)[offset]);
+		ret = FAT2CPU16(((__u16 *)fatbuf)[offset]);
 		break;
 	case 12:
 		off8 = (offset * 3) / 2;
 		/* fatbut + off8 may be unaligned, read in byte granularity */
-		ret = mydata->fatbuf[off8] + (mydata->fatbuf[off8 + 1] << 8);
+		ret = fatbuf[off8] + (fatbuf[off8 + 1] << 8);
 
 		if (offset & 0x1)
 			ret >>= 4;
@@ -306,6 +425,84 @@ get_cluster(fsdata *mydata, __u32 clustnum, __u8 *buffer, unsigned long size)
 	return 0;
 }
 
+/**
+ * fat_map_extend() - extend the cluster map of a file
+ *
+ * Walk the cluster chain from the last mapped cluster until at least @nclust
+ * clusters are mapped or the end of the chain is reached. Runs of consecutive
+ * clusters are merged into a single extent.
+ *
+ * @mydata:	file system description
+ * @nclust:	number of clusters required
+ * Return:	0 on success, -1 on error
+ */
+static int fat_map_extend(fsdata *mydata, __u32 nclust)
+{
+	struct fat_extent *ext;
+	__u32 clust;
+
+	while (!fat_map.complete && fat_map.nclust < nclust) {
+		if (!fat_map.count) {
+			clust = fat_map.first_clust;
+		} else {
+			ext = &fat_map.ext[fat_map.count - 1];
+			clust = get_fatent(mydata, ext->start + ext->count - 1);
+			if (CHECK_CLUST(clust, mydata->fatsize)) {
+				debug("curclust: 0x%x\n", clust);
+				fat_map.complete = true;
+				break;
+			}
+			if (clust == ext->start + ext->count) {
+				ext->count++;
+				fat_map.nclust++;
+				continue;
+			}
+		}
+
+		if (fat_map.count == fat_map.size) {
+			int size = fat_map.size ? fat_map.size * 2 : 16;
+
+			ext = realloc(fat_map.ext, size * sizeof(*ext));
+			if (!ext) {
+				debug("Error: allocating cluster map\n");
+				fat_map_invalidate();
+				return -1;
+			}
+			fat_map.ext = ext;
+			fat_map.size = size;
+		}
+		ext = &fat_map.ext[fat_map.count++];
+		ext->lclust = fat_map.nclust;
+		ext->start = clust;
+		ext->count = 1;
+		fat_map.nclust++;
+	}
+
+	return 0;
+}
+
+/**
+ * fat_map_find() - find the extent holding a cluster of the mapped file
+ *
+ * @lclust:	cluster index within the file, must be below fat_map.nclust
+ * Return:	index of the extent in fat_map.ext
+ */
+static int fat_map_find(__u32 lclust)
+{
+	int lo = 0, hi = fat_map.count - 1;
+
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+
+		if (fat_map.ext[mid].lclust <= lclust)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return lo;
+}
+
 /**
  * get_contents() - read from file
  *
@@ -313,6 +510,9 @@ get_cluster(fsdata *mydata, __u32 clustnum, __u8 *buffer, unsigned long size)
  * into 'buffer'. Update the number of bytes read in *gotsize or return -1 on
  * fatal errors.
  *
+ * The cluster chain is collapsed into extents of consecutive clusters first,
+ * so that each extent is read with a single disk access.
+ *
  * @mydata:	file system description
  * @dentprt:	directory entry pointer
  * @pos:	position from where to read
@@ -326,9 +526,10 @@ static int get_contents(fsdata *mydata, dir_entry *dentptr, loff_t pos,
 {
 	loff_t filesize = FAT2CPU32(dentptr->size);
 	unsigned int bytesperclust = mydata->clust_size * mydata->sect_size;
-	__u32 curclust = START(dentptr);
-	__u32 endclust, newclust;
+	struct fat_extent *ext;
+	__u32 lclust, endclust, clust;
 	loff_t actsize;
+	int i;
 
 	*gotsize = 0;
 	debug("Filesize: %llu bytes\n", filesize);
@@ -343,23 +544,31 @@ static int get_contents(fsdata *mydata, dir_entry *dentptr, loff_t pos,
 
 	debug("%llu bytes\n", filesize);
 
-	actsize = bytesperclust;
+	if (fat_map.dev != cur_dev ||
+	    fat_map.part_start != cur_part_info.start ||
+	    fat_map.vol_id != cur_vol_id ||
+	    fat_map.first_clust != START(dentptr)) {
+		fat_map_invalidate();
+		fat_map.dev = cur_dev;
+		fat_map.part_start = cur_part_info.start;
+		fat_map.vol_id = cur_vol_id;
+		fat_map.first_clust = START(dentptr);
+	}
 
-	/* go to cluster at pos */
-	while (actsize <= pos) {
-		curclust = get_fatent(mydata, curclust);
-		if (CHECK_CLUST(curclust, mydata->fatsize)) {
-			debug("curclust: 0x%x\n", curclust);
-			printf("Invalid FAT entry\n");
-			return -1;
-		}
-		actsize += bytesperclust;
+	lclust = lldiv(pos, bytesperclust);
+	endclust = lldiv(filesize + bytesperclust - 1, bytesperclust);
+	if (fat_map_extend(mydata, endclust))
+		return -1;
+	if (fat_map.nclust < endclust) {
+		printf("Invalid FAT entry\n");
+		return -1;
 	}
 
-	/* actsize > pos */
-	actsize -= bytesperclust;
-	filesize -= actsize;
-	pos -= actsize;
+	filesize -= (loff_t)lclust * bytesperclust;
+	pos -= (loff_t)lclust * bytesperclust;
+	i = fat_map_find(lclust);
+	ext = &fat_map.ext[i];
+	clust = ext->start + lclust - ext->lclust;
 
 	/* align to beginning of next cluster if any */
 	if (pos) {
@@ -372,7 +581,7 @@ static int get_contents(fsdata *mydata, dir_entry *dentptr, loff_t pos,
 			return -1;
 		}
 
-		if (get_cluster(mydata, curclust, tmp_buffer, actsize) != 0) {
+		if (get_cluster(mydata, clust, tmp_buffer, actsize) != 0) {
 			printf("Error reading cluster\n");
 			free(tmp_buffer);
 			return -1;
@@ -386,58 +595,37 @@ static int get_contents(fsdata *mydata, dir_entry *dentptr, loff_t pos,
 			return 0;
 		buffer += actsize;
 
-		curclust = get_fatent(mydata, curclust);
-		if (CHECK_CLUST(curclust, mydata->fatsize)) {
-			debug("curclust: 0x%x\n", curclust);
-			printf("Invalid FAT entry\n");
-			return -1;
+		lclust++;
+		clust++;
+		if (lclust == ext->lclust + ext->count) {
+			ext = &fat_map.ext[++i];
+			clust = ext->start;
 		}
 	}
 
-	actsize = bytesperclust;
-	endclust = curclust;
-
-	do {
-		/* search for consecutive clusters */
-		while (actsize < filesize) {
-			newclust = get_fatent(mydata, endclust);
-			if ((newclust - 1) != endclust)
-				goto getit;
-			if (CHECK_CLUST(newclust, mydata->fatsize)) {
-				debug("curclust: 0x%x\n", newclust);
-				printf("Invalid FAT entry\n");
-				return -1;
-			}
-			endclust = newclust;
-			actsize += bytesperclust;
-		}
+	/* read the remaining clusters one extent at a time */
+	while (filesize) {
+		actsize = (loff_t)(ext->lclust + ext->count - lclust) *
+			  bytesperclust;
+		if (actsize > filesize)
+			actsize = filesize;
 
-		/* get remaining bytes */
-		actsize = filesize;
-		if (get_cluster(mydata, curclust, buffer, (int)actsize) != 0) {
+		if (get_cluster(mydata, clust, buffer, actsize) != 0) {
 			printf("Error reading cluster\n");
 			return -1;
 		}
 		*gotsize += actsize;
-		return 0;
-getit:
-		if (get_cluster(mydata, curclust, buffer, (int)actsize) != 0) {
-			printf("Error reading cluster\n");
-			return -1;
-		}
-		*gotsize += (int)actsize;
 		filesize -= actsize;
 		buffer += actsize;
 
-		curclust = get_fatent(mydata, endclust);
-		if (CHECK_CLUST(curclust, mydata->fatsize)) {
-			debug("curclust: 0x%x\n", curclust);
-			printf("Invalid FAT entry\n");
-			return -1;
+		if (filesize) {
+			ext = &fat_map.ext[++i];
+			lclust = ext->lclust;
+			clust = ext->start;
 		}
-		actsize = bytesperclust;
-		endclust = curclust;
-	} while (1);
+	}
+
+	return 0;
 }
 
 /*
@@ -557,7 +745,7 @@ exit:
 	return ret;
 }
 
-static int get_fs_info(fsdata *mydata)
+static int read_fs_info(fsdata *mydata)
 {
 	boot_sector bs;
 	volume_info volinfo;
@@ -626,14 +814,6 @@ static int get_fs_info(fsdata *mydata)
 		mydata->root_cluster = 0;
 	}
 
-	mydata->fatbufnum = -1;
-	mydata->fat_dirty = 0;
-	mydata->fatbuf = malloc_cache_aligned(FATBUFSIZE);
-	if (mydata->fatbuf == NULL) {
-		debug("Error: allocating memory\n");
-		return -1;
-	}
-
 	debug("FAT%d, fat_sect: %d, fatlength: %d\n",
 	       mydata->fatsize, mydata->fat_sect, mydata->fatlength);
 	debug("Rootdir begins at cluster: %d, sector: %d, offset: %x\n"
@@ -647,6 +827,31 @@ static int get_fs_info(fsdata *mydata)
 	return 0;
 }
 
+/*
+ * Fill 'mydata' with the filesystem parameters and allocate its FAT buffer.
+ * The boot sector is only parsed again after fat_set_blk_dev() or
+ * fat_close().
+ */
+static int get_fs_info(fsdata *mydata)
+{
+	int ret;
+
+	if (!fat_mounted) {
+		ret = read_fs_info(&fat_mount_info);
+		if (ret)
+			return ret;
+		fat_mounted = 1;
+	}
+	*mydata = fat_mount_info;
+
+	if (fat_cache_init(mydata)) {
+		debug("Error: allocating memory\n");
+		return -1;
+	}
+
+	return 0;
+}
+
 
 /*
  * Directory iterator, to simplify filesystem traversal
@@ -1138,6 +1343,35 @@ int file_fat_detectfs(void)
 	return 0;
 }
 
+/*
+ * Resolve the file 'path' into 'dent', using the lookups cached for the
+ * mounted filesystem if possible. On success the FAT buffer of 'mydata' is
+ * allocated.
+ */
+static int fat_resolve_file(fat_itr *itr, fsdata *mydata, const char *path,
+			    dir_entry *dent)
+{
+	int ret;
+
+	if (!fs_dcache_lookup(path, dent, sizeof(*dent)))
+		return get_fs_info(mydata) ? -ENXIO : 0;
+
+	ret = fat_itr_root(itr, mydata);
+	if (ret)
+		return ret;
+
+	ret = fat_itr_resolve(itr, path, TYPE_FILE);
+	if (ret) {
+		free(mydata->fatbuf);
+		return ret;
+	}
+
+	*dent = *itr->dent;
+	fs_dcache_add(path, dent, sizeof(*dent));
+
+	return 0;
+}
+
 int fat_exists(const char *filename)
 {
 	fsdata fsdata;
@@ -1161,23 +1395,22 @@ out:
 int fat_size(const char *filename, loff_t *size)
 {
 	fsdata fsdata;
+	dir_entry dent;
 	fat_itr *itr;
 	int ret;
 
 	itr = malloc_cache_aligned(sizeof(fat_itr));
 	if (!itr)
 		return -ENOMEM;
-	ret = fat_itr_root(itr, &fsdata);
-	if (ret)
-		goto out_free_itr;
 
-	ret = fat_itr_resolve(itr, filename, TYPE_FILE);
+	ret = fat_resolve_file(itr, &fsdata, filename, &dent);
+	if (ret == -ENXIO)
+		goto out_free_itr;
 	if (ret) {
 		/*
 		 * Directories don't have size, but fs_size() is not
 		 * expected to fail if passed a directory path:
 		 */
-		free(fsdata.fatbuf);
 		ret = fat_itr_root(itr, &fsdata);
 		if (ret)
 			goto out_free_itr;
@@ -1187,7 +1420,7 @@ int fat_size(const char *filename, loff_t *size)
 		goto out_free_both;
 	}
 
-	*size = FAT2CPU32(itr->dent->size);
+	*size = FAT2CPU32(dent.size);
 out_free_both:
 	free(fsdata.fatbuf);
 out_free_itr:
@@ -1199,28 +1432,22 @@ int file_fat_read_at(const char *filename, loff_t pos, void *buffer,
 		     loff_t maxsize, loff_t *actread)
 {
 	fsdata fsdata;
+	dir_entry dent;
 	fat_itr *itr;
 	int ret;
 
 	itr = malloc_cache_aligned(sizeof(fat_itr));
 	if (!itr)
 		return -ENOMEM;
-	ret = fat_itr_root(itr, &fsdata);
-	if (ret)
-		goto out_free_itr;
 
-	ret = fat_itr_resolve(itr, filename, TYPE_FILE);
+	ret = fat_resolve_file(itr, &fsdata, filename, &dent);
 	if (ret)
-		goto out_free_both;
+		goto out_free_itr;
 
 	debug("reading %s at pos %llu\n", filename, pos);
 
-	/* For saving default max clustersize memory allocated to malloc pool */
-	dir_entry *dentptr = itr->dent;
+	ret = get_contents(&fsdata, &dent, pos, buffer, maxsize, actread);
 
-	ret = get_contents(&fsdata, dentptr, pos, buffer, maxsize, actread);
-
-out_free_both:
 	free(fsdata.fatbuf);
 out_free_itr:
 	free(itr);
@@ -1318,4 +1545,11 @@ void fat_closedir(struct fs_dir_stream *dirs)
 
 void fat_close(void)
 {
+	fat_mounted = 0;
+	fat_map_invalidate();
+}
+
+void fat_release(void)
+{
+	/* Nothing per operation, the boot sector stays parsed */
 }
@@ -112,41 +112,67 @@ static void set_name(dir_entry *dirent, const char *filename)
 }
 
 /*
- * Write fat buffer into block device
+ * Write one window of the fat buffer into block device
  */
-static int flush_dirty_fat_buffer(fsdata *mydata)
+static int write_fat_window(fsdata *mydata, int idx, int copy)
 {
 	int getsize = FATBUFBLOCKS;
 	__u32 fatlength = mydata->fatlength;
-	__u8 *bufptr = mydata->fatbuf;
-	__u32 startblock = mydata->fatbufnum * FATBUFBLOCKS;
-
-	debug("debug: evicting %d, dirty: %d\n", mydata->fatbufnum,
-	      (int)mydata->fat_dirty);
-
-	if ((!mydata->fat_dirty) || (mydata->fatbufnum == -1))
-		return 0;
+	__u8 *bufptr = mydata->fatbuf + idx * FATBUFSIZE;
+	__u32 startblock = mydata->fatwin[idx].bufnum * FATBUFBLOCKS;
 
 	/* Cap length if fatlength is not a multiple of FATBUFBLOCKS */
 	if (startblock + getsize > fatlength)
 		getsize = fatlength - startblock;
 
-	startblock += mydata->fat_sect;
+	startblock += mydata->fat_sect + copy * fatlength;
 
-	/* Write FAT buf */
 	if (disk_write(startblock, getsize, bufptr) < 0) {
 		debug("error: writing FAT blocks\n");
 		return -1;
 	}
 
-	if (mydata->fats == 2) {
-		/* Update corresponding second FAT blocks */
-		startblock += mydata->fatlength;
-		if (disk_write(startblock, getsize, bufptr) < 0) {
-			debug("error: writing second FAT blocks\n");
-			return -1;
+	return 0;
+}
+
+/*
+ * Write all modified windows of the fat buffer into block device, in
+ * ascending order of their position in the FAT
+ */
+static int flush_dirty_fat_buffer(fsdata *mydata)
+{
+	int order[FATBUFWINDOWS];
+	int i, j, count = 0, copy, copies;
+
+	debug("debug: flushing FAT, dirty: %d\n", (int)mydata->fat_dirty);
+
+	if (!mydata->fat_dirty)
+		return 0;
+
+	for (i = 0; i < FATBUFWINDOWS; i++) {
+		if (!mydata->fatwin[i].dirty || mydata->fatwin[i].bufnum == -1)
+			continue;
+		for (j = count; j > 0; j--) {
+			if (mydata->fatwin[order[j - 1]].bufnum <
+			    mydata->fatwin[i].bufnum)
+				break;
+			order[j] = order[j - 1];
 		}
+		order[j] = i;
+		count++;
 	}
+
+	/* Update the second FAT too, if there is one */
+	copies = mydata->fats == 2 ? 2 : 1;
+	for (copy = 0; copy < copies; copy++) {
+		for (i = 0; i < count; i++) {
+			if (write_fat_window(mydata, order[i], copy) < 0)
+				return -1;
+		}
+	}
+
+	for (i = 0; i < count; i++)
+		mydata->fatwin[order[i]].dirty = 0;
 	mydata->fat_dirty = 0;
 
 	return 0;
@@ -277,6 +303,10 @@ static int set_fatent_value(fsdata *mydata, __u32 entry, __u32 entry_value)
 {
 	__u32 bufnum, offset, off16;
 	__u16 val1, val2;
+	__u8 *fatbuf;
+
+	/* The cached cluster chain may no longer be valid */
+	fat_map_invalidate();
 
 	switch (mydata->fatsize) {
 	case 32:
@@ -296,39 +326,18 @@ static int set_fatent_value(fsdata *mydata, __u32 entry, __u32 entry_value)
 		return -1;
 	}
 
-	/* Read a new block of FAT entries into the cache. */
-	if (bufnum != mydata->fatbufnum) {
-		int getsize = FATBUFBLOCKS;
-		__u8 *bufptr = mydata->fatbuf;
-		__u32 fatlength = mydata->fatlength;
-		__u32 startblock = bufnum * FATBUFBLOCKS;
-
-		/* Cap length if fatlength is not a multiple of FATBUFBLOCKS */
-		if (startblock + getsize > fatlength)
-			getsize = fatlength - startblock;
-
-		if (flush_dirty_fat_buffer(mydata) < 0)
-			return -1;
-
-		startblock += mydata->fat_sect;
-
-		if (disk_read(startblock, getsize, bufptr) < 0) {
-			debug("Error reading FAT blocks\n");
-			return -1;
-		}
-		mydata->fatbufnum = bufnum;
-	}
-
-	/* Mark as dirty */
-	mydata->fat_dirty = 1;
+	/* Read a new block of FAT entries into the cache, mark it dirty */
+	fatbuf = get_fat_window(mydata, bufnum, 1);
+	if (!fatbuf)
+		return -1;
 
 	/* Set the actual entry */
 	switch (mydata->fatsize) {
 	case 32:
-		((__u32 *) mydata->fatbuf)[offset] = cpu_to_le32(entry_value);
+		((__u32 *)fatbuf)[offset] = cpu_to_le32(entry_value);
 		break;
 	case 16:
-		((__u16 *) mydata->fatbuf)[offset] = cpu_to_le16(entry_value);
+		((__u16 *)fatbuf)[offset] = cpu_to_le16(entry_value);
 		break;
 	case 12:
 		off16 = (offset * 3) / 4;
@@ -336,33 +345,33 @@ static int set_fatent_value(fsdata *mydata, __u32 entry, __u32 entry_value)
 		switch (offset & 0x3) {
 		case 0:
 			val1 = cpu_to_le16(entry_value) & 0xfff;
-			((__u16 *)mydata->fatbuf)[off16] &= ~0xfff;
-			((__u16 *)mydata->fatbuf)[off16] |= val1;
+			((__u16 *)fatbuf)[off16] &= ~0xfff;
+			((__u16 *)fatbuf)[off16] |= val1;
 			break;
 		case 1:
 			val1 = cpu_to_le16(entry_value) & 0xf;
 			val2 = (cpu_to_le16(entry_value) >> 4) & 0xff;
 
-			((__u16 *)mydata->fatbuf)[off16] &= ~0xf000;
-			((__u16 *)mydata->fatbuf)[off16] |= (val1 << 12);
+			((__u16 *)fatbuf)[off16] &= ~0xf000;
+			((__u16 *)fatbuf)[off16] |= (val1 << 12);
 
-			((__u16 *)mydata->fatbuf)[off16 + 1] &= ~0xff;
-			((__u16 *)mydata->fatbuf)[off16 + 1] |= val2;
+			((__u16 *)fatbuf)[off16 + 1] &= ~0xff;
+			((__u16 *)fatbuf)[off16 + 1] |= val2;
 			break;
 		case 2:
 			val1 = cpu_to_le16(entry_value) & 0xff;
 			val2 = (cpu_to_le16(entry_value) >> 8) & 0xf;
 
-			((__u16 *)mydata->fatbuf)[off16] &= ~0xff00;
-			((__u16 *)mydata->fatbuf)[off16] |= (val1 << 8);
+			((__u16 *)fatbuf)[off16] &= ~0xff00;
+			((__u16 *)fatbuf)[off16] |= (val1 << 8);
 
-			((__u16 *)mydata->fatbuf)[off16 + 1] &= ~0xf;
-			((__u16 *)mydata->fatbuf)[off16 + 1] |= val2;
+			((__u16 *)fatbuf)[off16 + 1] &= ~0xf;
+			((__u16 *)fatbuf)[off16 + 1] |= val2;
 			break;
 		case 3:
 			val1 = cpu_to_le16(entry_value) & 0xfff;
-			((__u16 *)mydata->fatbuf)[off16] &= ~0xfff0;
-			((__u16 *)mydata->fatbuf)[off16] |= (val1 << 4);
+			((__u16 *)fatbuf)[off16] &= ~0xfff0;
+			((__u16 *)fatbuf)[off16] |= (val1 << 4);
 			break;
 		default:
 			break;
@@ -1236,8 +1245,7 @@ int file_fat_write(const char *filename, void *buffer, loff_t offset,
 static int fat_dir_entries(fat_itr *itr)
 {
 	fat_itr *dirs;
-	fsdata fsdata = { .fatbuf = NULL, }, *mydata = &fsdata;
-						/* for FATBUFSIZE */
+	fsdata fsdata = { .fatbuf = NULL, };
 	int count;
 
 	dirs = malloc_cache_aligned(sizeof(fat_itr));
@@ -1252,13 +1260,11 @@ static int fat_dir_entries(fat_itr *itr)
 	fsdata = *dirs->fsdata;
 
 	/* allocate local fat buffer */
-	fsdata.fatbuf = malloc_cache_aligned(FATBUFSIZE);
-	if (!fsdata.fatbuf) {
+	if (fat_cache_init(&fsdata)) {
 		debug("Error: allocating memory\n");
 		count = -ENOMEM;
 		goto exit;
 	}
-	fsdata.fatbufnum = -1;
 	dirs->fsdata = &fsdata;
 
 	for (count = 0; fat_itr_next(dirs); count++)
@@ -12,6 +12,7 @@
 #include <env.h>
 #include <lmb.h>
 #include <log.h>
+#include <malloc.h>
 #include <mapmem.h>
 #include <part.h>
 #include <ext4fs.h>
@@ -32,6 +33,7 @@ static struct blk_desc *fs_dev_desc;
 static int fs_dev_part;
 static struct disk_partition fs_partition;
 static int fs_type = FS_TYPE_ANY;
+static bool fs_writeback;
 
 static inline int fs_probe_unsupported(struct blk_desc *fs_dev_desc,
 				      struct disk_partition *fs_partition)
@@ -153,6 +155,12 @@ struct fstype_info {
 	int (*write)(const char *filename, void *buf, loff_t offset,
 		     loff_t len, loff_t *actwrite);
 	void (*close)(void);
+	/*
+	 * Drop the state of the current operation but keep the filesystem
+	 * mounted, see CONFIG_FS_MOUNT_CACHE. Filesystems which do not provide
+	 * this are closed after each operation.
+	 */
+	void (*release)(void);
 	int (*uuid)(char *uuid_str);
 	/*
 	 * Open a directory stream.  On success return 0 and directory
@@ -181,6 +189,7 @@ static struct fstype_info fstypes[] = {
 		.null_dev_desc_ok = false,
 		.probe = fat_set_blk_dev,
 		.close = fat_close,
+		.release = fat_release,
 		.ls = fs_ls_generic,
 		.exists = fat_exists,
 		.size = fat_size,
@@ -209,6 +218,7 @@ static struct fstype_info fstypes[] = {
 		.null_dev_desc_ok = false,
 		.probe = ext4fs_probe,
 		.close = ext4fs_close,
+		.release = ext4fs_release,
 		.ls = ext4fs_ls,
 		.exists = ext4fs_exists,
 		.size = ext4fs_size,
@@ -294,6 +304,7 @@ static struct fstype_info fstypes[] = {
 		.read = sqfs_read,
 		.size = sqfs_size,
 		.close = sqfs_close,
+		.release = sqfs_release,
 		.closedir = sqfs_closedir,
 	},
 #endif
@@ -356,6 +367,190 @@ const char *fs_get_type_name(void)
 	return fs_get_info(fs_type)->name;
 }
 
+#if CONFIG_IS_ENABLED(FS_MOUNT_CACHE)
+/*
+ * Filesystem kept mounted after fs_close(), so that the next operation on
+ * the same partition does not need to probe it again
+ */
+static struct {
+	struct blk_desc *desc;
+	int part;
+	lbaint_t start;
+	lbaint_t size;
+	int fstype;
+	bool mounted;	/* the filesystem driver holds the mount */
+	bool stale;	/* the device changed, drop the mount when idle */
+} fs_mount;
+
+/* Paths resolved on the mounted filesystem */
+static struct fs_dentry {
+	char *path;
+	void *data;
+	int size;
+	ulong stamp;
+} fs_dcache[CONFIG_FS_DCACHE_ENTRIES];
+static ulong fs_dcache_stamp;
+
+static void fs_dcache_clear(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(fs_dcache); i++) {
+		free(fs_dcache[i].path);
+		free(fs_dcache[i].data);
+		fs_dcache[i].path = NULL;
+		fs_dcache[i].data = NULL;
+	}
+}
+
+static bool fs_dcache_usable(void)
+{
+	return fs_type != FS_TYPE_ANY && fs_mount.mounted && !fs_mount.stale &&
+		fs_get_info(fs_type)->release;
+}
+
+int fs_dcache_lookup(const char *path, void *data, int size)
+{
+	struct fs_dentry *dent;
+	int i;
+
+	if (!fs_dcache_usable())
+		return -ENOENT;
+
+	for (i = 0, dent = fs_dcache; i < ARRAY_SIZE(fs_dcache); i++, dent++) {
+		if (dent->path && dent->size == size &&
+		    !strcmp(dent->path, path)) {
+			memcpy(data, dent->data, size);
+			dent->stamp = ++fs_dcache_stamp;
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+void fs_dcache_add(const char *path, const void *data, int size)
+{
+	struct fs_dentry *dent, *victim = fs_dcache;
+	int i;
+
+	if (!fs_dcache_usable())
+		return;
+
+	for (i = 0, dent = fs_dcache; i < ARRAY_SIZE(fs_dcache); i++, dent++) {
+		if (dent->path && !strcmp(dent->path, path)) {
+			victim = dent;
+			break;
+		}
+		if (!dent->path || dent->stamp < victim->stamp)
+			victim = dent;
+		if (!victim->path)
+			break;
+	}
+
+	free(victim->path);
+	free(victim->data);
+	victim->path = strdup(path);
+	victim->data = malloc(size);
+	if (!victim->path || !victim->data) {
+		free(victim->path);
+		free(victim->data);
+		victim->path = NULL;
+		victim->data = NULL;
+		return;
+	}
+	memcpy(victim->data, data, size);
+	victim->size = size;
+	victim->stamp = ++fs_dcache_stamp;
+}
+
+/* Close the filesystem kept mounted, if any */
+static void fs_mount_release(void)
+{
+	if (fs_mount.mounted)
+		fs_get_info(fs_mount.fstype)->close();
+	fs_mount.mounted = false;
+	fs_mount.stale = false;
+	fs_dcache_clear();
+}
+
+void fs_mount_invalidate(struct blk_desc *desc)
+{
+	if (!fs_mount.mounted || (desc && desc != fs_mount.desc))
+		return;
+
+	fs_mount.stale = true;
+	fs_dcache_clear();
+
+	/* Otherwise fs_close() releases it */
+	if (fs_type == FS_TYPE_ANY)
+		fs_mount_release();
+}
+
+/*
+ * Use the filesystem kept mounted if it is on the partition just selected.
+ * Otherwise close it, so that the partition can be probed.
+ */
+static bool fs_mount_reuse(int fstype, int part)
+{
+	if (fs_mount.mounted && !fs_mount.stale &&
+	    fs_mount.desc == fs_dev_desc && fs_mount.part == part &&
+	    fs_mount.start == fs_partition.start &&
+	    fs_mount.size == fs_partition.size &&
+	    (fstype == FS_TYPE_ANY || fstype == fs_mount.fstype)) {
+		fs_type = fs_mount.fstype;
+		fs_dev_part = part;
+		return true;
+	}
+
+	fs_mount_release();
+
+	return false;
+}
+
+static void fs_mount_set(void)
+{
+	fs_mount.desc = fs_dev_desc;
+	fs_mount.part = fs_dev_part;
+	fs_mount.start = fs_partition.start;
+	fs_mount.size = fs_partition.size;
+	fs_mount.fstype = fs_type;
+	fs_mount.mounted = true;
+	fs_mount.stale = false;
+}
+
+/* Return true if the filesystem should stay mounted after fs_close() */
+static bool fs_mount_keep(struct fstype_info *info)
+{
+	/* Nothing is open, e.g. fs_close() already ran from fs_ls_generic() */
+	if (info->fstype == FS_TYPE_ANY)
+		return false;
+
+	if (fs_mount.mounted && !fs_mount.stale && info->release)
+		return true;
+
+	fs_mount.mounted = false;
+	fs_mount.stale = false;
+	fs_dcache_clear();
+
+	return false;
+}
+#else
+static inline bool fs_mount_reuse(int fstype, int part)
+{
+	return false;
+}
+
+static inline void fs_mount_set(void)
+{
+}
+
+static inline bool fs_mount_keep(struct fstype_info *info)
+{
+	return false;
+}
+#endif
+
 int fs_set_blk_dev(const char *ifname, const char *dev_part_str, int fstype)
 {
 	struct fstype_info *info;
@@ -369,6 +564,8 @@ int fs_set_blk_dev(const char *ifname, const char *dev_part_str, int fstype)
 			info->name += gd->reloc_off;
 			info->probe += gd->reloc_off;
 			info->close += gd->reloc_off;
+			if (info->release)
+				info->release += gd->reloc_off;
 			info->ls += gd->reloc_off;
 			info->read += gd->reloc_off;
 			info->write += gd->reloc_off;
@@ -382,6 +579,9 @@ int fs_set_blk_dev(const char *ifname, const char *dev_part_str, int fstype)
 	if (part < 0)
 		return -1;
 
+	if (fs_mount_reuse(fstype, part))
+		return 0;
+
 	for (i = 0, info = fstypes; i < ARRAY_SIZE(fstypes); i++, info++) {
 		if (fstype != FS_TYPE_ANY && info->fstype != FS_TYPE_ANY &&
 				fstype != info->fstype)
@@ -393,6 +593,7 @@ int fs_set_blk_dev(const char *ifname, const char *dev_part_str, int fstype)
 		if (!info->probe(fs_dev_desc, &fs_partition)) {
 			fs_type = info->fstype;
 			fs_dev_part = part;
+			fs_mount_set();
 			return 0;
 		}
 	}
@@ -414,10 +615,14 @@ int fs_set_blk_dev_with_part(struct blk_desc *desc, int part)
 		return ret;
 	fs_dev_desc = desc;
 
+	if (fs_mount_reuse(FS_TYPE_ANY, part))
+		return 0;
+
 	for (i = 0, info = fstypes; i < ARRAY_SIZE(fstypes); i++, info++) {
 		if (!info->probe(fs_dev_desc, &fs_partition)) {
 			fs_type = info->fstype;
 			fs_dev_part = part;
+			fs_mount_set();
 			return 0;
 		}
 	}
@@ -425,13 +630,60 @@ int fs_set_blk_dev_with_part(struct blk_desc *desc, int part)
 	return -1;
 }
 
-void fs_close(void)
+/*
+ * Called before modifying the filesystem: the mount is not kept past this
+ * operation and metadata writes are held in the block cache until
+ * fs_write_end()
+ */
+static void fs_write_begin(void)
+{
+	fs_mount_invalidate(fs_dev_desc);
+
+	if (fs_dev_desc && !blkcache_set_writeback(fs_dev_desc->if_type,
+						   fs_dev_desc->devnum, true))
+		fs_writeback = true;
+}
+
+/* Like fs_close(), returning whether the held writes reached the device */
+static int fs_close_writeback(void)
 {
 	struct fstype_info *info = fs_get_info(fs_type);
+	int ret = 0;
+
+	if (fs_mount_keep(info))
+		info->release();
+	else
+		info->close();
 
-	info->close();
+	if (fs_writeback) {
+		ret = blkcache_set_writeback(fs_dev_desc->if_type,
+					     fs_dev_desc->devnum, false);
+		fs_writeback = false;
+	}
 
 	fs_type = FS_TYPE_ANY;
+
+	return ret;
+}
+
+void fs_close(void)
+{
+	fs_close_writeback();
+}
+
+/* Finish an operation started with fs_write_begin() */
+static int fs_write_end(int ret)
+{
+	int err;
+
+	err = fs_close_writeback();
+	if (err) {
+		log_err("** Unable to write back cached blocks **\n");
+		if (ret >= 0)
+			ret = -1;
+	}
+
+	return ret;
 }
 
 int fs_uuid(char *uuid_str)
@@ -559,6 +811,7 @@ int fs_write(const char *filename, ulong addr, loff_t offset, loff_t len,
 	void *buf;
 	int ret;
 
+	fs_write_begin();
 	buf = map_sysmem(addr, len);
 	ret = info->write(filename, buf, offset, len, actwrite);
 	unmap_sysmem(buf);
@@ -567,9 +820,8 @@ int fs_write(const char *filename, ulong addr, loff_t offset, loff_t len,
 		log_err("** Unable to write file %s **\n", filename);
 		ret = -1;
 	}
-	fs_close();
 
-	return ret;
+	return fs_write_end(ret);
 }
 
 struct fs_dir_stream *fs_opendir(const char *filename)
@@ -630,11 +882,10 @@ int fs_unlink(const char *filename)
 
 	struct fstype_info *info = fs_get_info(fs_type);
 
+	fs_write_begin();
 	ret = info->unlink(filename);
 
-	fs_close();
-
-	return ret;
+	return fs_write_end(ret);
 }
 
 int fs_mkdir(const char *dirname)
@@ -643,11 +894,10 @@ int fs_mkdir(const char *dirname)
 
 	struct fstype_info *info = fs_get_info(fs_type);
 
+	fs_write_begin();
 	ret = info->mkdir(dirname);
 
-	fs_close();
-
-	return ret;
+	return fs_write_end(ret);
 }
 
 int fs_ln(const char *fname, const char *target)
@@ -655,15 +905,15 @@ int fs_ln(const char *fname, const char *target)
 	struct fstype_info *info = fs_get_info(fs_type);
 	int ret;
 
+	fs_write_begin();
 	ret = info->ln(fname, target);
 
 	if (ret < 0) {
 		log_err("** Unable to create link %s -> %s **\n", fname, target);
 		ret = -1;
 	}
-	fs_close();
 
-	return ret;
+	return fs_write_end(ret);
 }
 
 int do_size(struct cmd_tbl *cmdtp, int flag, int argc, char *const argv[],
@@ -92,22 +92,74 @@ static int sqfs_calc_n_blks(__le64 start, __le64 end, u64 *offset)
 }
 
 /*
- * Retrieves fragment block entry and returns true if the fragment block is
- * compressed
+ * Reads the metadata block starting at byte 'pos' of the filesystem, which
+ * ends before 'end', and stores its decompressed contents into 'dest'. The
+ * size of this decompressed data is returned in 'dest_len'.
  */
-static int sqfs_frag_lookup(u32 inode_fragment_index,
-			    struct squashfs_fragment_block_entry *e)
+static int sqfs_read_metablock_at(u64 pos, u64 end, void *dest,
+				  unsigned long *dest_len)
+{
+	u64 start, n_blks, table_offset;
+	unsigned char *buffer;
+	bool compressed;
+	u32 src_len;
+	int ret;
+
+	end = min(end, pos + SQFS_HEADER_SIZE + SQFS_METADATA_BLOCK_SIZE);
+	if (end <= pos + SQFS_HEADER_SIZE)
+		return -EINVAL;
+
+	start = pos / ctxt.cur_dev->blksz;
+	n_blks = sqfs_calc_n_blks(cpu_to_le64(pos), cpu_to_le64(end),
+				  &table_offset);
+
+	buffer = malloc_cache_aligned(n_blks * ctxt.cur_dev->blksz);
+	if (!buffer)
+		return -ENOMEM;
+
+	if (sqfs_disk_read(start, n_blks, buffer) < 0) {
+		ret = -EINVAL;
+		goto free_buffer;
+	}
+
+	ret = sqfs_read_metablock(buffer, table_offset, &compressed, &src_len);
+	if (ret || src_len > end - pos - SQFS_HEADER_SIZE) {
+		ret = -EINVAL;
+		goto free_buffer;
+	}
+
+	if (compressed) {
+		*dest_len = SQFS_METADATA_BLOCK_SIZE;
+		ret = sqfs_decompress(&ctxt, dest, dest_len, buffer +
+				      table_offset + SQFS_HEADER_SIZE, src_len);
+		if (ret)
+			ret = -EINVAL;
+	} else {
+		memcpy(dest, buffer + table_offset + SQFS_HEADER_SIZE, src_len);
+		*dest_len = src_len;
+	}
+
+free_buffer:
+	free(buffer);
+
+	return ret;
+}
+
+/*
+ * Reads the fragment index table and the metadata blocks it points to, and
+ * keeps the fragment block entries in ctxt.frag_table.
+ */
+static int sqfs_read_fragment_table(void)
 {
-	u64 start, n_blks, src_len, table_offset, start_block;
-	unsigned char *metadata_buffer, *metadata, *table;
 	struct squashfs_fragment_block_entry *entries;
 	struct squashfs_super_block *sblk = ctxt.sblk;
+	u64 start, n_blks, table_offset, start_block, table_end;
+	int j, metablks_count, ret = 0;
 	unsigned long dest_len;
-	int block, offset, ret;
-	u16 header;
+	unsigned char *table;
 
-	if (inode_fragment_index >= get_unaligned_le32(&sblk->fragments))
-		return -EINVAL;
+	metablks_count = DIV_ROUND_UP(get_unaligned_le32(&sblk->fragments),
+				      SQFS_MAX_ENTRIES);
 
 	start = get_unaligned_le64(&sblk->fragment_table_start) /
 		ctxt.cur_dev->blksz;
@@ -121,72 +173,136 @@ static int sqfs_frag_lookup(u32 inode_fragment_index,
 		return -ENOMEM;
 
 	if (sqfs_disk_read(start, n_blks, table) < 0) {
-		free(table);
-		return -EINVAL;
+		ret = -EINVAL;
+		goto free_table;
 	}
 
-	block = SQFS_FRAGMENT_INDEX(inode_fragment_index);
-	offset = SQFS_FRAGMENT_INDEX_OFFSET(inode_fragment_index);
+	entries = malloc(metablks_count * SQFS_METADATA_BLOCK_SIZE);
+	if (!entries) {
+		ret = -ENOMEM;
+		goto free_table;
+	}
 
-	/*
-	 * Get the start offset of the metadata block that contains the right
-	 * fragment block entry
-	 */
-	start_block = get_unaligned_le64(table + table_offset + block *
-					 sizeof(u64));
+	/* Every metadata block but the last one holds SQFS_MAX_ENTRIES */
+	table_end = get_unaligned_le64(&sblk->fragment_table_start);
+	for (j = 0; j < metablks_count; j++) {
+		start_block = get_unaligned_le64(table + table_offset + j *
+						 sizeof(u64));
+		ret = sqfs_read_metablock_at(start_block, table_end,
+					     (void *)entries + j *
+					     SQFS_METADATA_BLOCK_SIZE, &dest_len);
+		if (ret) {
+			free(entries);
+			goto free_table;
+		}
+	}
 
-	start = start_block / ctxt.cur_dev->blksz;
-	n_blks = sqfs_calc_n_blks(cpu_to_le64(start_block),
-				  sblk->fragment_table_start, &table_offset);
+	ctxt.frag_table = entries;
 
-	metadata_buffer = malloc_cache_aligned(n_blks * ctxt.cur_dev->blksz);
-	if (!metadata_buffer) {
-		ret = -ENOMEM;
-		goto free_table;
+free_table:
+	free(table);
+
+	return ret;
+}
+
+/*
+ * Retrieves fragment block entry and returns true if the fragment block is
+ * compressed
+ */
+static int sqfs_frag_lookup(u32 inode_fragment_index,
+			    struct squashfs_fragment_block_entry *e)
+{
+	struct squashfs_super_block *sblk = ctxt.sblk;
+	int ret;
+
+	if (inode_fragment_index >= get_unaligned_le32(&sblk->fragments))
+		return -EINVAL;
+
+	if (!ctxt.frag_table) {
+		ret = sqfs_read_fragment_table();
+		if (ret)
+			return ret;
 	}
 
-	if (sqfs_disk_read(start, n_blks, metadata_buffer) < 0) {
-		ret = -EINVAL;
-		goto free_buffer;
+	*e = ctxt.frag_table[inode_fragment_index];
+
+	return SQFS_COMPRESSED_BLOCK(e->size);
+}
+
+/*
+ * Gets the decompressed contents of the data or fragment block starting at
+ * byte 'start' of the filesystem, 'size' being its on-disk size field. The
+ * blocks used last are kept in ctxt.cache, so the returned buffer is only
+ * valid until the next call.
+ */
+static int sqfs_get_cached_block(u64 start, u32 size, unsigned char **data,
+				 u32 *len)
+{
+	u32 block_size = get_unaligned_le32(&ctxt.sblk->block_size);
+	struct squashfs_cached_block *cblk, *victim = NULL;
+	u64 start_, n_blks, table_offset, src_len;
+	unsigned char *buffer;
+	unsigned long dest_len;
+	int j, ret;
+
+	for (j = 0; j < SQFS_CACHED_BLOCKS; j++) {
+		cblk = &ctxt.cache[j];
+		if (cblk->start && cblk->start == start) {
+			cblk->stamp = ++ctxt.cache_stamp;
+			*data = cblk->data;
+			*len = cblk->len;
+			return 0;
+		}
+
+		/* Replace an unused entry, or else the least recently used */
+		if (!victim || (victim->start && (!cblk->start ||
+						  cblk->stamp < victim->stamp)))
+			victim = cblk;
 	}
 
-	/* Every metadata block starts with a 16-bit header */
-	header = get_unaligned_le16(metadata_buffer + table_offset);
-	metadata = metadata_buffer + table_offset + SQFS_HEADER_SIZE;
+	src_len = SQFS_BLOCK_SIZE(size);
+	if (!src_len || src_len > block_size)
+		return -EINVAL;
 
-	if (!metadata || !header) {
-		ret = -ENOMEM;
-		goto free_buffer;
+	victim->start = 0;
+	if (!victim->data) {
+		victim->data = malloc(block_size);
+		if (!victim->data)
+			return -ENOMEM;
 	}
 
-	entries = malloc(SQFS_METADATA_BLOCK_SIZE);
-	if (!entries) {
-		ret = -ENOMEM;
+	start_ = start / ctxt.cur_dev->blksz;
+	table_offset = start - (start_ * ctxt.cur_dev->blksz);
+	n_blks = DIV_ROUND_UP(src_len + table_offset, ctxt.cur_dev->blksz);
+
+	buffer = malloc_cache_aligned(n_blks * ctxt.cur_dev->blksz);
+	if (!buffer)
+		return -ENOMEM;
+
+	ret = sqfs_disk_read(start_, n_blks, buffer);
+	if (ret < 0)
 		goto free_buffer;
-	}
 
-	if (SQFS_COMPRESSED_METADATA(header)) {
-		src_len = SQFS_METADATA_SIZE(header);
-		dest_len = SQFS_METADATA_BLOCK_SIZE;
-		ret = sqfs_decompress(&ctxt, entries, &dest_len, metadata,
-				      src_len);
-		if (ret) {
-			ret = -EINVAL;
-			goto free_entries;
-		}
+	if (SQFS_COMPRESSED_BLOCK(size)) {
+		dest_len = block_size;
+		ret = sqfs_decompress(&ctxt, victim->data, &dest_len,
+				      buffer + table_offset, src_len);
+		if (ret)
+			goto free_buffer;
 	} else {
-		memcpy(entries, metadata, SQFS_METADATA_SIZE(header));
+		memcpy(victim->data, buffer + table_offset, src_len);
+		dest_len = src_len;
 	}
 
-	*e = entries[offset];
-	ret = SQFS_COMPRESSED_BLOCK(e->size);
+	victim->start = start;
+	victim->len = dest_len;
+	victim->stamp = ++ctxt.cache_stamp;
+	*data = victim->data;
+	*len = victim->len;
+	ret = 0;
 
-free_entries:
-	free(entries);
 free_buffer:
-	free(metadata_buffer);
-free_table:
-	free(table);
+	free(buffer);
 
 	return ret;
 }
@@ -809,34 +925,63 @@ free_dtb:
 	return metablks_count;
 }
 
-int sqfs_opendir(const char *filename, struct fs_dir_stream **dirsp)
+/*
+ * The decompressed inode and directory tables are read on first use and then
+ * kept until the filesystem is closed.
+ */
+static int sqfs_read_tables(void)
 {
 	unsigned char *inode_table = NULL, *dir_table = NULL;
-	int j, token_count, ret = 0, metablks_count;
-	struct squashfs_dir_stream *dirs;
-	char **token_list, *path;
+	int ret, metablks_count;
 	u32 *pos_list = NULL;
 
-	dirs = malloc(sizeof(*dirs));
-	if (!dirs)
-		return -EINVAL;
+	if (ctxt.inode_table)
+		return 0;
 
 	ret = sqfs_read_inode_table(&inode_table);
 	if (ret)
 		return -EINVAL;
 
 	metablks_count = sqfs_read_directory_table(&dir_table, &pos_list);
-	if (metablks_count < 1)
+	if (metablks_count < 1) {
+		free(inode_table);
+		return -EINVAL;
+	}
+
+	ctxt.inode_table = inode_table;
+	ctxt.dir_table = dir_table;
+	ctxt.dir_pos_list = pos_list;
+	ctxt.dir_metablks = metablks_count;
+
+	return 0;
+}
+
+int sqfs_opendir(const char *filename, struct fs_dir_stream **dirsp)
+{
+	struct squashfs_dir_stream *dirs;
+	int j, token_count, ret = 0;
+	char **token_list, *path;
+
+	dirs = malloc(sizeof(*dirs));
+	if (!dirs)
 		return -EINVAL;
 
+	ret = sqfs_read_tables();
+	if (ret)
+		goto free_dirs;
+
 	/* Tokenize filename */
 	token_count = sqfs_count_tokens(filename);
-	if (token_count < 0)
-		return -EINVAL;
+	if (token_count < 0) {
+		ret = -EINVAL;
+		goto free_dirs;
+	}
 
 	path = strdup(filename);
-	if (!path)
-		return -ENOMEM;
+	if (!path) {
+		ret = -ENOMEM;
+		goto free_dirs;
+	}
 
 	token_list = malloc(token_count * sizeof(char *));
 	if (!token_list) {
@@ -852,10 +997,10 @@ int sqfs_opendir(const char *filename, struct fs_dir_stream **dirsp)
 	 * ldir's (extended directory) size is greater than dir, so it works as
 	 * a general solution for the malloc size, since 'i' is a union.
 	 */
-	dirs->inode_table = inode_table;
-	dirs->dir_table = dir_table;
-	ret = sqfs_search_dir(dirs, token_list, token_count, pos_list,
-			      metablks_count);
+	dirs->inode_table = ctxt.inode_table;
+	dirs->dir_table = ctxt.dir_table;
+	ret = sqfs_search_dir(dirs, token_list, token_count, ctxt.dir_pos_list,
+			      ctxt.dir_metablks);
 	if (ret)
 		goto free_tokens;
 
@@ -879,9 +1024,11 @@ free_tokens:
 	for (j = 0; j < token_count; j++)
 		free(token_list[j]);
 	free(token_list);
-	free(pos_list);
 free_path:
 	free(path);
+free_dirs:
+	if (ret)
+		free(dirs);
 
 	return ret;
 }
@@ -999,11 +1146,35 @@ int sqfs_readdir(struct fs_dir_stream *fs_dirs, struct fs_dirent **dentp)
 	return 0;
 }
 
+/* Frees the metadata tables and data blocks cached since sqfs_probe() */
+static void sqfs_free_cache(void)
+{
+	int j;
+
+	free(ctxt.inode_table);
+	free(ctxt.dir_table);
+	free(ctxt.dir_pos_list);
+	free(ctxt.frag_table);
+	ctxt.inode_table = NULL;
+	ctxt.dir_table = NULL;
+	ctxt.dir_pos_list = NULL;
+	ctxt.frag_table = NULL;
+
+	for (j = 0; j < SQFS_CACHED_BLOCKS; j++) {
+		free(ctxt.cache[j].data);
+		ctxt.cache[j].data = NULL;
+		ctxt.cache[j].start = 0;
+	}
+}
+
 int sqfs_probe(struct blk_desc *fs_dev_desc, struct disk_partition *fs_partition)
 {
 	struct squashfs_super_block *sblk;
 	int ret;
 
+	/* Never reuse what was cached from another filesystem */
+	sqfs_free_cache();
+
 	ctxt.cur_dev = fs_dev_desc;
 	ctxt.cur_part_info = *fs_partition;
 
@@ -1210,14 +1381,144 @@ static int sqfs_get_lregfile_info(struct squashfs_lreg_inode *lreg,
 	return datablk_count;
 }
 
+/*
+ * Reads the part of the data blocks of a file that falls in [offset, end) of
+ * the file into 'buf', which holds the file contents from 'offset' on.
+ *
+ * Blocks read in full are decompressed straight into 'buf', and runs of them
+ * that are consecutive on disk are read with a single disk access of up to
+ * SQFS_MAX_READ_SIZE bytes. The blocks at both ends of the range, which are
+ * only partially read, go through the block cache, so that nothing before
+ * 'offset' needs to be decompressed.
+ */
+static int sqfs_read_data_blocks(struct squashfs_file_info *finfo,
+				 int datablk_count, char *buf, u64 offset,
+				 u64 end, loff_t *actread)
+{
+	u32 block_size = get_unaligned_le32(&ctxt.sblk->block_size);
+	int block_log = get_unaligned_le16(&ctxt.sblk->block_log);
+	u64 data_offset, pos, blk_end, from, to, n_blks, table_offset;
+	u32 size, batch_len, batch_max, len;
+	unsigned char *batch = NULL, *src;
+	unsigned long dest_len;
+	int j, k, ret = 0;
+
+	batch_max = max_t(u32, block_size, SQFS_MAX_READ_SIZE);
+
+	/* Skip the blocks before the requested range */
+	data_offset = finfo->start;
+	for (j = 0; j < datablk_count && ((u64)(j + 1) << block_log) <= offset;
+	     j++)
+		data_offset += SQFS_BLOCK_SIZE(finfo->blk_sizes[j]);
+
+	while (j < datablk_count && ((u64)j << block_log) < end) {
+		pos = (u64)j << block_log;
+		blk_end = min_t(u64, pos + block_size, finfo->size);
+		size = SQFS_BLOCK_SIZE(finfo->blk_sizes[j]);
+
+		if (pos < offset || blk_end > end) {
+			from = max(pos, offset);
+			to = min(blk_end, end);
+			if (!size) {
+				/* Sparse block */
+				memset(buf + from - offset, 0, to - from);
+			} else {
+				ret = sqfs_get_cached_block(data_offset,
+							    finfo->blk_sizes[j],
+							    &src, &len);
+				if (ret)
+					goto free_batch;
+				if (to - pos > len) {
+					ret = -EINVAL;
+					goto free_batch;
+				}
+				memcpy(buf + from - offset, src + from - pos,
+				       to - from);
+			}
+
+			*actread += to - from;
+			data_offset += size;
+			j++;
+			continue;
+		}
+
+		/* Gather the following blocks which are read in full */
+		batch_len = size;
+		for (k = j + 1; k < datablk_count; k++) {
+			pos = (u64)k << block_log;
+			size = SQFS_BLOCK_SIZE(finfo->blk_sizes[k]);
+			if (min_t(u64, pos + block_size, finfo->size) > end ||
+			    batch_len + size > batch_max)
+				break;
+			batch_len += size;
+		}
+
+		src = NULL;
+		if (batch_len) {
+			if (!batch) {
+				batch = malloc_cache_aligned(batch_max + 2 *
+							     ctxt.cur_dev->blksz);
+				if (!batch) {
+					ret = -ENOMEM;
+					goto free_batch;
+				}
+			}
+
+			table_offset = data_offset % ctxt.cur_dev->blksz;
+			n_blks = DIV_ROUND_UP(batch_len + table_offset,
+					      ctxt.cur_dev->blksz);
+			if (sqfs_disk_read(data_offset / ctxt.cur_dev->blksz,
+					   n_blks, batch) < 0) {
+				ret = -EIO;
+				goto free_batch;
+			}
+			src = batch + table_offset;
+		}
+
+		for (; j < k; j++) {
+			pos = (u64)j << block_log;
+			len = min_t(u64, pos + block_size, finfo->size) - pos;
+			size = SQFS_BLOCK_SIZE(finfo->blk_sizes[j]);
+
+			if (!size) {
+				memset(buf + pos - offset, 0, len);
+			} else if (SQFS_COMPRESSED_BLOCK(finfo->blk_sizes[j])) {
+				dest_len = len;
+				ret = sqfs_decompress(&ctxt, buf + pos - offset,
+						      &dest_len, src, size);
+				if (ret || dest_len != len) {
+					ret = -EINVAL;
+					goto free_batch;
+				}
+			} else {
+				if (size != len) {
+					ret = -EINVAL;
+					goto free_batch;
+				}
+				memcpy(buf + pos - offset, src, len);
+			}
+
+			*actread += len;
+			src += size;
+		}
+		data_offset += batch_len;
+	}
+
+free_batch:
+	free(batch);
+
+	return ret;
+}
+
 int sqfs_read(const char *filename, void *buf, loff_t offset, loff_t len,
 	      loff_t *actread)
 {
-	char *dir, *fragment_block, *datablock = NULL, *data_buffer = NULL;
-	char *fragment, *file, *resolved, *data;
-	u64 start, n_blks, table_size, data_offset, table_offset;
-	int ret, j, i_number, datablk_count = 0;
 	struct squashfs_super_block *sblk = ctxt.sblk;
+	int ret, i_number, datablk_count = 0;
+	u64 start, end, tail_start;
+	unsigned char *fragment_block;
+	char *dir, *file, *resolved;
+	u32 frag_len;
 	struct squashfs_fragment_block_entry frag_entry;
 	struct squashfs_file_info finfo = {0};
 	struct squashfs_symlink_inode *symlink;
@@ -1226,7 +1527,6 @@ int sqfs_read(const char *filename, void *buf, loff_t offset, loff_t len,
 	struct squashfs_lreg_inode *lreg;
 	struct squashfs_base_inode *base;
 	struct squashfs_reg_inode *reg;
-	unsigned long dest_len;
 	struct fs_dirent *dent;
 	unsigned char *ipos;
 
@@ -1238,10 +1538,8 @@ int sqfs_read(const char *filename, void *buf, loff_t offset, loff_t len,
 	 */
 	sqfs_split_path(&file, &dir, filename);
 	ret = sqfs_opendir(dir, &dirsp);
-	if (ret) {
-		sqfs_closedir(dirsp);
+	if (ret)
 		goto free_paths;
-	}
 
 	dirs = (struct squashfs_dir_stream *)dirsp;
 
@@ -1257,7 +1555,6 @@ int sqfs_read(const char *filename, void *buf, loff_t offset, loff_t len,
 	if (ret) {
 		printf("File not found.\n");
 		*actread = 0;
-		sqfs_closedir(dirsp);
 		ret = -ENOENT;
 		goto free_paths;
 	}
@@ -1265,6 +1562,7 @@ int sqfs_read(const char *filename, void *buf, loff_t offset, loff_t len,
 	i_number = dirs->dir_header->inode_number + dirs->entry->inode_offset;
 	ipos = sqfs_find_inode(dirs->inode_table, i_number, sblk->inodes,
 			       sblk->block_size);
+	free(dirs->entry);
 
 	base = (struct squashfs_base_inode *)ipos;
 	switch (get_unaligned_le16(&base->inode_type)) {
@@ -1314,138 +1612,48 @@ int sqfs_read(const char *filename, void *buf, loff_t offset, loff_t len,
 		goto free_paths;
 	}
 
-	/* If the user specifies a length, check its sanity */
-	if (len) {
-		if (len > finfo.size) {
-			ret = -EINVAL;
-			goto free_paths;
-		}
-
-		finfo.size = len;
-	}
-
-	if (datablk_count) {
-		data_offset = finfo.start;
-		datablock = malloc(get_unaligned_le32(&sblk->block_size));
-		if (!datablock) {
-			ret = -ENOMEM;
-			goto free_paths;
-		}
+	/* Read up to the end of file if no length is given */
+	if (offset > finfo.size) {
+		ret = -EINVAL;
+		goto free_blk_sizes;
 	}
 
-	for (j = 0; j < datablk_count; j++) {
-		start = data_offset / ctxt.cur_dev->blksz;
-		table_size = SQFS_BLOCK_SIZE(finfo.blk_sizes[j]);
-		table_offset = data_offset - (start * ctxt.cur_dev->blksz);
-		n_blks = DIV_ROUND_UP(table_size + table_offset,
-				      ctxt.cur_dev->blksz);
+	end = finfo.size;
+	if (len && len < finfo.size - offset)
+		end = offset + len;
 
-		data_buffer = malloc_cache_aligned(n_blks * ctxt.cur_dev->blksz);
-
-		if (!data_buffer) {
-			ret = -ENOMEM;
-			goto free_datablk;
-		}
-
-		ret = sqfs_disk_read(start, n_blks, data_buffer);
-		if (ret < 0) {
-			/*
-			 * Possible causes: too many data blocks or too large
-			 * SquashFS block size. Tip: re-compile the SquashFS
-			 * image with mksquashfs's -b <block_size> option.
-			 */
-			printf("Error: too many data blocks to be read.\n");
-			goto free_buffer;
-		}
-
-		data = data_buffer + table_offset;
-
-		/* Load the data */
-		if (SQFS_COMPRESSED_BLOCK(finfo.blk_sizes[j])) {
-			dest_len = get_unaligned_le32(&sblk->block_size);
-			ret = sqfs_decompress(&ctxt, datablock, &dest_len,
-					      data, table_size);
-			if (ret)
-				goto free_buffer;
-
-			memcpy(buf + offset + *actread, datablock, dest_len);
-			*actread += dest_len;
-		} else {
-			memcpy(buf + offset + *actread, data, table_size);
-			*actread += table_size;
-		}
-
-		data_offset += table_size;
-	}
-
-	free(finfo.blk_sizes);
+	ret = sqfs_read_data_blocks(&finfo, datablk_count, buf, offset, end,
+				    actread);
+	if (ret)
+		goto free_blk_sizes;
 
 	/*
-	 * There is no need to continue if the file is not fragmented.
+	 * The tail end of a fragmented file is stored at finfo.offset in the
+	 * fragment block, after its datablk_count full blocks.
 	 */
-	if (!finfo.frag) {
-		ret = 0;
-		goto free_buffer;
-	}
+	tail_start = (u64)datablk_count << get_unaligned_le16(&sblk->block_log);
+	if (!finfo.frag || end <= tail_start)
+		goto free_blk_sizes;
 
-	start = frag_entry.start / ctxt.cur_dev->blksz;
-	table_size = SQFS_BLOCK_SIZE(frag_entry.size);
-	table_offset = frag_entry.start - (start * ctxt.cur_dev->blksz);
-	n_blks = DIV_ROUND_UP(table_size + table_offset, ctxt.cur_dev->blksz);
-
-	fragment = malloc_cache_aligned(n_blks * ctxt.cur_dev->blksz);
+	ret = sqfs_get_cached_block(frag_entry.start, frag_entry.size,
+				    &fragment_block, &frag_len);
+	if (ret)
+		goto free_blk_sizes;
 
-	if (!fragment) {
-		ret = -ENOMEM;
-		goto free_buffer;
+	start = max_t(u64, offset, tail_start);
+	if (finfo.offset + end - tail_start > frag_len) {
+		ret = -EINVAL;
+		goto free_blk_sizes;
 	}
 
-	ret = sqfs_disk_read(start, n_blks, fragment);
-	if (ret < 0)
-		goto free_fragment;
-
-	/* File compressed and fragmented */
-	if (finfo.frag && finfo.comp) {
-		dest_len = get_unaligned_le32(&sblk->block_size);
-		fragment_block = malloc(dest_len);
-		if (!fragment_block) {
-			ret = -ENOMEM;
-			goto free_fragment;
-		}
-
-		ret = sqfs_decompress(&ctxt, fragment_block, &dest_len,
-				      (void *)fragment  + table_offset,
-				      frag_entry.size);
-		if (ret) {
-			free(fragment_block);
-			goto free_fragment;
-		}
-
-		for (j = offset + *actread; j < finfo.size; j++) {
-			memcpy(buf + j, &fragment_block[finfo.offset + j], 1);
-			(*actread)++;
-		}
-
-		free(fragment_block);
+	memcpy(buf + start - offset,
+	       fragment_block + finfo.offset + start - tail_start, end - start);
+	*actread += end - start;
 
-	} else if (finfo.frag && !finfo.comp) {
-		fragment_block = (void *)fragment + table_offset;
-
-		for (j = offset + *actread; j < finfo.size; j++) {
-			memcpy(buf + j, &fragment_block[finfo.offset + j], 1);
-			(*actread)++;
-		}
-	}
-
-free_fragment:
-	free(fragment);
-free_buffer:
-	if (datablk_count)
-		free(data_buffer);
-free_datablk:
-	if (datablk_count)
-		free(datablock);
+free_blk_sizes:
+	free(finfo.blk_sizes);
 free_paths:
+	sqfs_closedir(dirsp);
 	free(file);
 	free(dir);
 
@@ -1542,17 +1750,28 @@ free_strings:
 
 void sqfs_close(void)
 {
+	sqfs_free_cache();
 	free(ctxt.sblk);
 	ctxt.cur_dev = NULL;
 	sqfs_decompressor_cleanup(&ctxt);
 }
 
+/*
+ * Called between operations while the filesystem stays mounted: the cached
+ * tables and blocks remain valid until sqfs_close().
+ */
+void sqfs_release(void)
+{
+}
+
 void sqfs_closedir(struct fs_dir_stream *dirs)
 {
 	struct squashfs_dir_stream *sqfs_dirs;
 
+	if (!dirs)
+		return;
+
 	sqfs_dirs = (struct squashfs_dir_stream *)dirs;
-	free(sqfs_dirs->inode_table);
-	free(sqfs_dirs->dir_table);
 	free(sqfs_dirs->dir_header);
+	free(sqfs_dirs);
 }
@@ -29,6 +29,10 @@
 #define SQFS_EMPTY_FILE_SIZE 3
 #define SQFS_STOP_READDIR 1
 #define SQFS_EMPTY_DIR -1
+/* Number of decompressed data and fragment blocks kept in the block cache */
+#define SQFS_CACHED_BLOCKS 4
+/* Largest disk read gathering consecutive data blocks of a file */
+#define SQFS_MAX_READ_SIZE (256 * 1024)
 /*
  * A directory entry object has a fixed length of 8 bytes, corresponding to its
  * first four members, plus the size of the entry name, which is equal to
@@ -73,6 +77,16 @@ struct squashfs_super_block {
 	__le64 export_table_start;
 };
 
+struct squashfs_cached_block {
+	/* Position of the block on disk, 0 if the entry is unused */
+	u64 start;
+	/* Decompressed contents and their length */
+	unsigned char *data;
+	u32 len;
+	/* Time of last use, for LRU replacement */
+	u32 stamp;
+};
+
 struct squashfs_ctxt {
 	struct disk_partition cur_part_info;
 	struct blk_desc *cur_dev;
@@ -80,6 +94,19 @@ struct squashfs_ctxt {
 #if IS_ENABLED(CONFIG_ZSTD)
 	void *zstd_workspace;
 #endif
+	/*
+	 * Decompressed metadata, read on first use and kept until
+	 * sqfs_close(). 'dir_pos_list' holds the position of each metadata
+	 * block of the directory table, see sqfs_get_metablk_pos().
+	 */
+	unsigned char *inode_table;
+	unsigned char *dir_table;
+	u32 *dir_pos_list;
+	int dir_metablks;
+	struct squashfs_fragment_block_entry *frag_table;
+	/* Recently used decompressed data and fragment blocks */
+	struct squashfs_cached_block cache[SQFS_CACHED_BLOCKS];
+	u32 cache_stamp;
 };
 
 struct squashfs_directory_index {
@@ -274,7 +301,7 @@ struct squashfs_dir_stream {
 	struct squashfs_ldir_inode i_ldir;
 	/*
 	 * References to the tables' beginnings. They are assigned in
-	 * sqfs_opendir() and freed in sqfs_closedir().
+	 * sqfs_opendir() and belong to the filesystem context.
 	 */
 	unsigned char *inode_table;
 	unsigned char *dir_table;
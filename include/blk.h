@@ -8,6 +8,8 @@
 #define BLK_H
 
 #include <efi.h>
+#include <errno.h>
+#include <linux/list.h>
 
 #ifdef CONFIG_SYS_64BIT_LBA
 typedef uint64_t lbaint_t;
@@ -113,6 +115,18 @@ struct blk_desc {
 #define PAD_TO_BLOCKSIZE(size, blk_desc) \
 	(PAD_SIZE(size, blk_desc->blksz))
 
+/**
+ * typedef blkcache_read_fn - raw read from a block device, bypassing the cache
+ */
+typedef ulong (*blkcache_read_fn)(struct blk_desc *block_dev, lbaint_t start,
+				  lbaint_t blkcnt, void *buffer);
+
+/**
+ * typedef blkcache_write_fn - raw write to a block device, bypassing the cache
+ */
+typedef ulong (*blkcache_write_fn)(struct blk_desc *block_dev, lbaint_t start,
+				   lbaint_t blkcnt, const void *buffer);
+
 #if CONFIG_IS_ENABLED(BLOCK_CACHE)
 
 /**
@@ -152,9 +166,82 @@ void blkcache_fill(int iftype, int dev,
 		   lbaint_t start, lbaint_t blkcnt,
 		   unsigned long blksz, void const *buffer);
 
+/**
+ * blkcache_dread() - read blocks through the block cache
+ *
+ * Serves the request from the cache when possible. Otherwise reads it with
+ * @read and adds it to the cache. When a device is being read sequentially
+ * in small requests, a larger readahead window is read into the cache
+ * instead, so that the following requests hit.
+ *
+ * @param block_dev - block device descriptor
+ * @param start - starting block number
+ * @param blkcnt - number of blocks to read
+ * @param buffer - buffer to contain the data
+ * @param read - function used to read from the device
+ *
+ * @return - number of blocks read
+ */
+ulong blkcache_dread(struct blk_desc *block_dev, lbaint_t start,
+		     lbaint_t blkcnt, void *buffer, blkcache_read_fn read);
+
+/**
+ * blkcache_dwrite() - write blocks through the block cache
+ *
+ * With write-back enabled for the device, small writes are only recorded
+ * in the cache and written by blkcache_flush(). Otherwise the data is
+ * written with @write and cached copies of the blocks are updated.
+ *
+ * @param block_dev - block device descriptor
+ * @param start - starting block number
+ * @param blkcnt - number of blocks to write
+ * @param buffer - data to write
+ * @param write - function used to write to the device
+ *
+ * @return - number of blocks written
+ */
+ulong blkcache_dwrite(struct blk_desc *block_dev, lbaint_t start,
+		      lbaint_t blkcnt, const void *buffer,
+		      blkcache_write_fn write);
+
+/**
+ * blkcache_set_writeback() - enable or disable write-back for a device
+ *
+ * Disabling write-back flushes the dirty blocks of the device. This does
+ * nothing unless CONFIG_BLOCK_CACHE_WRITEBACK is enabled.
+ *
+ * @param iftype - IF_TYPE_x for type of device
+ * @param dev - device index of particular type
+ * @param enable - true to hold writes in the cache
+ *
+ * @return - 0 on success, -ve on error
+ */
+int blkcache_set_writeback(int iftype, int dev, bool enable);
+
+/**
+ * blkcache_flush() - write back the dirty blocks of a device
+ *
+ * Dirty blocks are sorted and contiguous runs are merged into single
+ * writes.
+ *
+ * @param iftype - IF_TYPE_x for type of device
+ * @param dev - device index of particular type
+ *
+ * @return - 0 on success, -EIO if a write failed
+ */
+int blkcache_flush(int iftype, int dev);
+
+/**
+ * blkcache_flush_all() - write back the dirty blocks of all devices
+ *
+ * @return - 0 on success, -EIO if a write failed
+ */
+int blkcache_flush_all(void);
+
 /**
  * blkcache_invalidate() - discard the cache for a set of blocks
- * because of a write or device (re)initialization.
+ * because of a write or device (re)initialization. Dirty blocks are
+ * written back first.
  *
  * @param iftype - IF_TYPE_x for type of device
  * @param dev - device index of particular type
@@ -169,15 +256,40 @@ void blkcache_invalidate(int iftype, int dev);
  */
 void blkcache_configure(unsigned blocks, unsigned entries);
 
+/**
+ * blkcache_configure_size() - configure block cache memory and readahead
+ *
+ * @param bytes - maximum number of bytes of cached data
+ * @param readahead - maximum readahead window in blocks, 0 to disable
+ */
+void blkcache_configure_size(unsigned long bytes, unsigned readahead);
+
 /*
  * statistics of the block cache
  */
 struct block_cache_stats {
 	unsigned hits;
 	unsigned misses;
+	unsigned readaheads;
 	unsigned entries; /* current entry count */
+	unsigned long bytes; /* current size of cached data */
 	unsigned max_blocks_per_entry;
 	unsigned max_entries;
+	unsigned long max_bytes;
+	unsigned max_readahead;
+};
+
+/*
+ * statistics of the block cache for a single device
+ */
+struct block_cache_dev_stats {
+	int iftype;
+	int devnum;
+	unsigned hits;
+	unsigned misses;
+	unsigned readaheads;
+	unsigned writes; /* writes held for write-back */
+	unsigned flushes; /* writes issued by write-back */
 };
 
 /**
@@ -187,6 +299,16 @@ struct block_cache_stats {
  */
 void blkcache_stats(struct block_cache_stats *stats);
 
+/**
+ * blkcache_dev_stats() - return per-device statistics and reset
+ *
+ * @param stats - statistics for up to @count devices are copied here
+ * @param count - number of entries in @stats
+ *
+ * @return - number of devices the cache has seen
+ */
+int blkcache_dev_stats(struct block_cache_dev_stats *stats, int count);
+
 #else
 
 static inline int blkcache_read(int iftype, int dev,
@@ -200,11 +322,37 @@ static inline void blkcache_fill(int iftype, int dev,
 				 lbaint_t start, lbaint_t blkcnt,
 				 unsigned long blksz, void const *buffer) {}
 
+static inline ulong blkcache_dread(struct blk_desc *block_dev, lbaint_t start,
+				   lbaint_t blkcnt, void *buffer,
+				   blkcache_read_fn read)
+{
+	return read(block_dev, start, blkcnt, buffer);
+}
+
+static inline ulong blkcache_dwrite(struct blk_desc *block_dev,
+				    lbaint_t start, lbaint_t blkcnt,
+				    const void *buffer,
+				    blkcache_write_fn write)
+{
+	return write(block_dev, start, blkcnt, buffer);
+}
+
+static inline int blkcache_set_writeback(int iftype, int dev, bool enable)
+{
+	return 0;
+}
+
+static inline int blkcache_flush(int iftype, int dev)
+{
+	return 0;
+}
+
 static inline void blkcache_invalidate(int iftype, int dev) {}
 
 #endif
 
 #if CONFIG_IS_ENABLED(BLK)
+struct blk_req;
 struct udevice;
 
 /* Operations on block devices */
@@ -265,6 +413,34 @@ struct blk_ops {
 	 * @return 0 if OK, -ve on error
 	 */
 	int (*select_hwpart)(struct udevice *dev, int hwpart);
+
+	/**
+	 * submit() - start a queued request
+	 *
+	 * This is optional. Without it, queued requests are carried out with
+	 * read() and write() when they are waited for.
+	 *
+	 * The driver starts transferring @req->blkcnt blocks and returns. Once
+	 * the transfer has finished, it calls blk_req_done(), normally from
+	 * poll(). Requests may complete in any order.
+	 *
+	 * @dev:	Device to access
+	 * @req:	Request to start
+	 * @return 0 if started, -EBUSY if the driver cannot take another
+	 * request until one has completed, other -ve on error
+	 */
+	int (*submit)(struct udevice *dev, struct blk_req *req);
+
+	/**
+	 * poll() - check for completed requests
+	 *
+	 * This calls blk_req_done() for each submitted request which has
+	 * finished. It must be provided along with submit().
+	 *
+	 * @dev:	Device to check
+	 * @return 0 if OK, -ve on error
+	 */
+	int (*poll)(struct udevice *dev);
 };
 
 #define blk_get_ops(dev)	((struct blk_ops *)(dev)->driver->ops)
@@ -426,6 +602,7 @@ struct blk_desc *blk_get_by_device(struct udevice *dev);
 
 #else
 #include <errno.h>
+#include <fs.h>
 /*
  * These functions should take struct udevice instead of struct blk_desc,
  * but this is convenient for migration to driver model. Add a 'd' prefix
@@ -435,34 +612,27 @@ struct blk_desc *blk_get_by_device(struct udevice *dev);
 static inline ulong blk_dread(struct blk_desc *block_dev, lbaint_t start,
 			      lbaint_t blkcnt, void *buffer)
 {
-	ulong blks_read;
-	if (blkcache_read(block_dev->if_type, block_dev->devnum,
-			  start, blkcnt, block_dev->blksz, buffer))
-		return blkcnt;
-
 	/*
 	 * We could check if block_read is NULL and return -ENOSYS. But this
 	 * bloats the code slightly (cause some board to fail to build), and
 	 * it would be an error to try an operation that does not exist.
 	 */
-	blks_read = block_dev->block_read(block_dev, start, blkcnt, buffer);
-	if (blks_read == blkcnt)
-		blkcache_fill(block_dev->if_type, block_dev->devnum,
-			      start, blkcnt, block_dev->blksz, buffer);
-
-	return blks_read;
+	return blkcache_dread(block_dev, start, blkcnt, buffer,
+			      block_dev->block_read);
 }
 
 static inline ulong blk_dwrite(struct blk_desc *block_dev, lbaint_t start,
 			       lbaint_t blkcnt, const void *buffer)
 {
-	blkcache_invalidate(block_dev->if_type, block_dev->devnum);
-	return block_dev->block_write(block_dev, start, blkcnt, buffer);
+	fs_mount_invalidate(block_dev);
+	return blkcache_dwrite(block_dev, start, blkcnt, buffer,
+			       block_dev->block_write);
 }
 
 static inline ulong blk_derase(struct blk_desc *block_dev, lbaint_t start,
 			       lbaint_t blkcnt)
 {
+	fs_mount_invalidate(block_dev);
 	blkcache_invalidate(block_dev->if_type, block_dev->devnum);
 	return block_dev->block_erase(block_dev, start, blkcnt);
 }
@@ -533,6 +703,136 @@ struct blk_driver *blk_driver_lookup_type(int if_type);
 
 #endif /* !CONFIG_BLK */
 
+/**
+ * enum blk_req_op - Operation carried out by a queued request
+ *
+ * @BLK_REQ_READ:	Read blocks into the buffer
+ * @BLK_REQ_WRITE:	Write blocks from the buffer
+ */
+enum blk_req_op {
+	BLK_REQ_READ,
+	BLK_REQ_WRITE,
+};
+
+/**
+ * struct blk_req - A queued block request
+ *
+ * The caller fills in the fields up to @priv and passes the request to
+ * blk_dsubmit(). The request and its buffer then belong to the block layer
+ * until the request has completed. Requests in flight at the same time must
+ * not overlap.
+ *
+ * @op:		Operation to carry out
+ * @start:	First block to transfer
+ * @blkcnt:	Number of blocks to transfer
+ * @buffer:	Buffer to transfer to or from
+ * @complete:	Function to call once the request has completed, or NULL
+ * @priv:	Private data for the caller
+ * @status:	-EINPROGRESS until the request completes, then 0 if OK or
+ *		-ve on error
+ * @node:	Entry in the device's queue, private to the block layer
+ * @merged:	Requests carried out along with this one, private to the block
+ *		layer
+ * @orig_blkcnt: Value of @blkcnt when submitted, private to the block layer
+ */
+struct blk_req {
+	enum blk_req_op op;
+	lbaint_t start;
+	lbaint_t blkcnt;
+	void *buffer;
+	void (*complete)(struct blk_req *req);
+	void *priv;
+
+	int status;
+	struct list_head node;
+	struct list_head merged;
+	lbaint_t orig_blkcnt;
+};
+
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+/**
+ * blk_dsubmit() - Queue a block request
+ *
+ * The request is handed to the driver straight away if it can take it.
+ * Otherwise it waits in a queue, where a request which carries on from the
+ * previous one, on the device and in memory, is merged with it into a single
+ * transfer.
+ *
+ * @block_dev:	Block device to access
+ * @req:	Request to queue, see struct blk_req
+ * @return 0 if OK, -ve on error
+ */
+int blk_dsubmit(struct blk_desc *block_dev, struct blk_req *req);
+
+/**
+ * blk_dpoll() - Make progress on queued block requests
+ *
+ * This hands waiting requests to the driver and completes any which have
+ * finished. For drivers without their own queueing, all the waiting requests
+ * are carried out before this returns.
+ *
+ * @block_dev:	Block device to poll
+ * @return number of requests which have not completed yet, or -ve on error
+ */
+int blk_dpoll(struct blk_desc *block_dev);
+
+/**
+ * blk_dwait() - Wait for a block request to complete
+ *
+ * @block_dev:	Block device the request was submitted to
+ * @req:	Request to wait for
+ * @return status of the request: 0 if OK, -ve on error
+ */
+int blk_dwait(struct blk_desc *block_dev, struct blk_req *req);
+
+/**
+ * blk_req_done() - Complete a block request
+ *
+ * This is called by drivers implementing submit() once a request has
+ * finished. It completes any requests merged with it as well.
+ *
+ * @dev:	Device the request was submitted to
+ * @req:	Request which has finished
+ * @status:	0 if all blocks were transferred, else -ve error
+ */
+void blk_req_done(struct udevice *dev, struct blk_req *req, int status);
+#else
+/*
+ * Without queueing, a request is carried out when it is waited for, so
+ * that work done between submitting and waiting still comes first.
+ */
+static inline int blk_dsubmit(struct blk_desc *block_dev, struct blk_req *req)
+{
+	req->status = -EINPROGRESS;
+
+	return 0;
+}
+
+static inline int blk_dpoll(struct blk_desc *block_dev)
+{
+	return 0;
+}
+
+static inline int blk_dwait(struct blk_desc *block_dev, struct blk_req *req)
+{
+	ulong blks;
+
+	if (req->status != -EINPROGRESS)
+		return req->status;
+	if (req->op == BLK_REQ_WRITE)
+		blks = blk_dwrite(block_dev, req->start, req->blkcnt,
+				  req->buffer);
+	else
+		blks = blk_dread(block_dev, req->start, req->blkcnt,
+				 req->buffer);
+	req->status = blks == req->blkcnt ? 0 : -EIO;
+	if (req->complete)
+		req->complete(req);
+
+	return req->status;
+}
+#endif
+
 /**
  * blk_get_devnum_by_typename() - Get a block device by type and number
  *
@@ -32,11 +32,19 @@ struct disk_partition;
 
 #define EXT4_INDEX_FL		0x00001000 /* Inode uses hash tree index */
 #define EXT4_EXTENTS_FL		0x00080000 /* Inode uses extents */
+#define EXT4_ENCRYPT_FL		0x00000800 /* Encrypted inode */
+#define EXT4_CASEFOLD_FL	0x40000000 /* Casefolded directory */
 #define EXT4_EXT_MAGIC			0xf30a
+/* Deepest extent tree Linux accepts */
+#define EXT4_EXT_MAX_DEPTH		5
+/* Extents longer than this are uninitialized */
+#define EXT4_EXT_INIT_MAX_LEN		(1 << 15)
+#define EXT4_FEATURE_COMPAT_DIR_INDEX	0x0020
 #define EXT4_FEATURE_RO_COMPAT_GDT_CSUM	0x0010
 #define EXT4_FEATURE_RO_COMPAT_METADATA_CSUM 0x0400
 #define EXT4_FEATURE_INCOMPAT_EXTENTS	0x0040
 #define EXT4_FEATURE_INCOMPAT_64BIT	0x0080
+#define EXT4_FEATURE_INCOMPAT_LARGEDIR	0x4000
 #define EXT4_INDIRECT_BLOCKS		12
 
 #define EXT4_BG_INODE_UNINIT		0x0001
@@ -148,6 +156,7 @@ int ext4fs_open(const char *filename, loff_t *len);
 int ext4fs_read(char *buf, loff_t offset, loff_t len, loff_t *actread);
 int ext4fs_mount(unsigned part_length);
 void ext4fs_close(void);
+void ext4fs_release(void);
 void ext4fs_reinit_global(void);
 int ext4fs_ls(const char *dirname);
 int ext4fs_exists(const char *filename);
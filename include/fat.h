@@ -31,6 +31,13 @@ struct disk_partition;
 #define FAT16BUFSIZE	(FATBUFSIZE/2)
 #define FAT32BUFSIZE	(FATBUFSIZE/4)
 
+/* Number of FATBUFSIZE windows kept in fatbuf */
+#if CONFIG_IS_ENABLED(FAT_WRITE) && defined(CONFIG_FS_FAT_CACHE_WINDOWS)
+#define FATBUFWINDOWS	CONFIG_FS_FAT_CACHE_WINDOWS
+#else
+#define FATBUFWINDOWS	1
+#endif
+
 /* Maximum number of entry for long file name according to spec */
 #define MAX_LFN_SLOT	20
 
@@ -156,6 +163,15 @@ typedef struct dir_slot {
 	__u8	name11_12[4];	/* Last 2 characters in name */
 } dir_slot;
 
+/*
+ * Window of the FAT table held in fatbuf
+ */
+struct fat_window {
+	int	bufnum;		/* FAT block number held, -1 if unused */
+	__u8	dirty;		/* Set if the window has been modified */
+	__u32	stamp;		/* Time of last use, for LRU replacement */
+};
+
 /*
  * Private filesystem parameters
  *
@@ -163,16 +179,17 @@ typedef struct dir_slot {
  * (see FAT32 accesses)
  */
 typedef struct {
-	__u8	*fatbuf;	/* Current FAT buffer */
+	__u8	*fatbuf;	/* FAT buffer, FATBUFWINDOWS windows */
 	int	fatsize;	/* Size of FAT in bits */
 	__u32	fatlength;	/* Length of FAT in sectors */
 	__u16	fat_sect;	/* Starting sector of the FAT */
-	__u8	fat_dirty;      /* Set if fatbuf has been modified */
+	__u8	fat_dirty;      /* Set if any window has been modified */
 	__u32	rootdir_sect;	/* Start sector of root directory */
 	__u16	sect_size;	/* Size of sectors in bytes */
 	__u16	clust_size;	/* Size of clusters in sectors */
 	int	data_begin;	/* The sector of the first cluster, can be negative */
-	int	fatbufnum;	/* Used by get_fatent, init to -1 */
+	struct fat_window fatwin[FATBUFWINDOWS]; /* Used by get_fatent */
+	__u32	fatstamp;	/* Use counter for fatwin */
 	int	rootdir_size;	/* Size of root dir for non-FAT32 */
 	__u32	root_cluster;	/* First cluster of root dir for FAT32 */
 	u32	total_sect;	/* Number of sectors */
@@ -208,4 +225,5 @@ void fat_closedir(struct fs_dir_stream *dirs);
 int fat_unlink(const char *filename);
 int fat_mkdir(const char *dirname);
 void fat_close(void);
+void fat_release(void);
 #endif /* _FAT_H_ */
@@ -77,6 +77,59 @@ int fs_set_blk_dev_with_part(struct blk_desc *desc, int part);
  */
 void fs_close(void);
 
+#if CONFIG_IS_ENABLED(FS_MOUNT_CACHE)
+/**
+ * fs_mount_invalidate() - Drop the filesystem kept mounted on a device
+ *
+ * This must be called when the contents of a block device change behind the
+ * back of the filesystem, e.g. on writes or device removal. The mount and its
+ * cached lookups are released once the current operation, if any, completes.
+ *
+ * @desc:	block device being changed, or NULL for any device
+ */
+void fs_mount_invalidate(struct blk_desc *desc);
+
+/**
+ * fs_dcache_lookup() - Look up a path in the cache of the mounted filesystem
+ *
+ * Filesystems use this to skip walking directories for paths that were
+ * resolved before, by storing their own inode information with
+ * fs_dcache_add().
+ *
+ * @path:	path as passed to the filesystem
+ * @data:	returns the data stored for @path
+ * @size:	size of @data
+ * Return:	0 if found, -ENOENT otherwise
+ */
+int fs_dcache_lookup(const char *path, void *data, int size);
+
+/**
+ * fs_dcache_add() - Add a path to the cache of the mounted filesystem
+ *
+ * Nothing is stored unless the filesystem stays mounted after the current
+ * operation.
+ *
+ * @path:	path as passed to the filesystem
+ * @data:	data to store for @path
+ * @size:	size of @data
+ */
+void fs_dcache_add(const char *path, const void *data, int size);
+#else
+static inline void fs_mount_invalidate(struct blk_desc *desc)
+{
+}
+
+static inline int fs_dcache_lookup(const char *path, void *data, int size)
+{
+	return -ENOENT;
+}
+
+static inline void fs_dcache_add(const char *path, const void *data,
+				 int size)
+{
+}
+#endif
+
 /**
  * fs_get_type() - Get type of current filesystem
  *
@@ -40,6 +40,7 @@ struct fdt_region;
 #define CONFIG_SHA512
 
 #define IMAGE_ENABLE_IGNORE	0
+#define IMAGE_ENABLE_HASH_STREAM	0
 #define IMAGE_INDENT_STRING	""
 
 #else
@@ -50,6 +51,8 @@ struct fdt_region;
 
 /* Take notice of the 'ignore' property for hashes */
 #define IMAGE_ENABLE_IGNORE	1
+/* Hash images as they are loaded rather than in a separate pass */
+#define IMAGE_ENABLE_HASH_STREAM	CONFIG_IS_ENABLED(FIT_HASH_STREAM)
 #define IMAGE_INDENT_STRING	"   "
 
 #define IMAGE_ENABLE_FIT	CONFIG_IS_ENABLED(FIT)
@@ -1123,6 +1126,94 @@ int fit_add_verification_data(const char *keydir, void *keydest, void *fit,
 
 int fit_image_verify_with_data(const void *fit, int image_noffset,
 			       const void *data, size_t size);
+
+/* Most hash subnodes an image may have to be verified while streaming */
+#define FIT_HASH_STREAM_MAX	4
+/* Amount of data loaded or copied before it is fed to the hashes */
+#define FIT_HASH_STREAM_CHUNK	(256 << 10)
+
+/**
+ * struct fit_hash_stream - Hashes of an image computed as its data arrives
+ *
+ * This lets a loader hash each chunk of an image while it is still in the
+ * cache, instead of making a second pass over the whole image afterwards.
+ *
+ * @fit:		FIT containing the image
+ * @image_noffset:	Component image node
+ * @count:		Number of hash subnodes in @node
+ * @node:		Hash subnodes, with @ctx NULL for ignored ones
+ */
+struct fit_hash_stream {
+	const void *fit;
+	int image_noffset;
+	int count;
+	struct {
+		int noffset;
+		struct hash_algo *algo;
+		void *ctx;
+	} node[FIT_HASH_STREAM_MAX];
+};
+
+/**
+ * fit_image_hash_stream_start() - Start verifying an image while loading it
+ *
+ * This fails if the image cannot be checked this way, for example because
+ * it has signatures or an algorithm without progressive hashing. The caller
+ * should then load the image and call fit_image_verify_with_data().
+ *
+ * @st:			Stream state to set up
+ * @fit:		FIT containing the image
+ * @image_noffset:	Component image node
+ * @return 0 if OK, -ve on error
+ */
+int fit_image_hash_stream_start(struct fit_hash_stream *st, const void *fit,
+				int image_noffset);
+
+/**
+ * fit_image_hash_stream_update() - Add the next part of the image data
+ *
+ * On error the stream is aborted.
+ *
+ * @st:		Stream state
+ * @buf:	Image data
+ * @size:	Number of bytes at @buf
+ * @return 0 if OK, -ve on error
+ */
+int fit_image_hash_stream_update(struct fit_hash_stream *st, const void *buf,
+				 size_t size);
+
+/**
+ * fit_image_hash_stream_finish() - Check the hashes of a streamed image
+ *
+ * This prints the same progress and errors as fit_image_verify_with_data().
+ *
+ * @st:		Stream state
+ * @return 1 if all hashes are valid, 0 otherwise
+ */
+int fit_image_hash_stream_finish(struct fit_hash_stream *st);
+
+/**
+ * fit_image_hash_stream_abort() - Drop a stream without checking it
+ *
+ * @st:		Stream state
+ */
+void fit_image_hash_stream_abort(struct fit_hash_stream *st);
+
+/**
+ * fit_image_copy_verify() - Copy an image and verify its hashes on the way
+ *
+ * The data is hashed from @dst right after each chunk is copied, so it is
+ * read from memory only once.
+ *
+ * @st:		Stream state from fit_image_hash_stream_start()
+ * @dst:	Destination, which must not overlap @src
+ * @src:	Image data
+ * @size:	Number of bytes to copy
+ * @return 1 if all hashes are valid, 0 otherwise
+ */
+int fit_image_copy_verify(struct fit_hash_stream *st, void *dst,
+			  const void *src, size_t size);
+
 int fit_image_verify(const void *fit, int noffset);
 int fit_config_verify(const void *fit, int conf_noffset);
 int fit_all_image_verify(const void *fit);
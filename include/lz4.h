@@ -17,7 +17,8 @@
  *	not recognised or independent blocks are used, -EINVAL if the reserved
  *	fields are non-zero, or input is overrun, -EENOBUFS if the destination
  *	buffer is overrun, -EEPROTO if the compressed data causes an error in
- *	the decompression algorithm
+ *	the decompression algorithm, -EBADMSG if a block or content checksum
+ *	does not match (only checked with CONFIG_LZ4_CHECKSUM)
  */
 int ulz4fn(const void *src, size_t srcn, void *dst, size_t *dstn);
 
@@ -0,0 +1,150 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Minimal TCP client used for loading images over the network
+ */
+
+#ifndef __TCP_H__
+#define __TCP_H__
+
+#include <net.h>
+
+/*
+ *	Internet Protocol (IP) + Transmission Control Protocol (TCP) header.
+ */
+struct ip_tcp_hdr {
+	u8		ip_hl_v;	/* header length and version	*/
+	u8		ip_tos;		/* type of service		*/
+	u16		ip_len;		/* total length			*/
+	u16		ip_id;		/* identification		*/
+	u16		ip_off;		/* fragment offset field	*/
+	u8		ip_ttl;		/* time to live			*/
+	u8		ip_p;		/* protocol			*/
+	u16		ip_sum;		/* checksum			*/
+	struct in_addr	ip_src;		/* Source IP address		*/
+	struct in_addr	ip_dst;		/* Destination IP address	*/
+	u16		tcp_src;	/* TCP source port		*/
+	u16		tcp_dst;	/* TCP destination port		*/
+	u32		tcp_seq;	/* Sequence number		*/
+	u32		tcp_ack;	/* Acknowledgment number	*/
+	u8		tcp_hlen;	/* Header length in words << 4	*/
+	u8		tcp_flags;	/* Control bits			*/
+	u16		tcp_win;	/* Receive window		*/
+	u16		tcp_xsum;	/* Checksum			*/
+	u16		tcp_urg;	/* Urgent pointer		*/
+} __attribute__((packed));
+
+#define IP_TCP_HDR_SIZE		(sizeof(struct ip_tcp_hdr))
+#define TCP_HDR_SIZE		(IP_TCP_HDR_SIZE - IP_HDR_SIZE)
+
+/* Room for options after the fixed header */
+#define TCP_OPT_MAX		40
+
+/* Control bits */
+#define TCP_FIN			0x01
+#define TCP_SYN			0x02
+#define TCP_RST			0x04
+#define TCP_PSH			0x08
+#define TCP_ACK			0x10
+#define TCP_URG			0x20
+
+/* Option kinds */
+#define TCPOPT_EOL		0
+#define TCPOPT_NOP		1
+#define TCPOPT_MSS		2
+#define TCPOPT_WSCALE		3
+#define TCPOPT_SACK_PERM	4
+#define TCPOPT_SACK		5
+
+/**
+ * struct tcp_ops - callbacks from the TCP connection to its user
+ *
+ * Offsets are counted in bytes from the start of the received stream.
+ *
+ * @connected:	The connection is established and data can be sent
+ * @rx:		Store @len bytes received at stream offset @offset. Data may
+ *		arrive out of order but always lies within the space given by
+ *		@rx_space. Return 0 to accept the data or non-zero to have it
+ *		dropped, in which case the peer sends it again later.
+ * @rx_ready:	The first @len bytes of the stream have all been received
+ * @rx_space:	Return how many bytes past stream offset @len can be received
+ * @closed:	The connection is gone. @err is 0 when the peer finished
+ *		sending, or a negative error code when the connection failed.
+ *		No further callbacks are made after this one.
+ *
+ * The callbacks may close or abort the connection.
+ */
+struct tcp_ops {
+	void (*connected)(void);
+	int (*rx)(u32 offset, const uchar *data, unsigned int len);
+	void (*rx_ready)(u32 len);
+	u32 (*rx_space)(u32 len);
+	void (*closed)(int err);
+};
+
+/**
+ * tcp_connect() - open a connection to a remote port
+ *
+ * Only one connection exists at a time; opening a new one aborts the
+ * previous. The connection owns the net_loop() timeout handler until it is
+ * closed.
+ *
+ * @dest:	IP address of the server
+ * @port:	TCP port of the server
+ * @ops:	Callbacks receiving the events of the connection
+ * @return 0 if the connection is being opened, -ve on error
+ */
+int tcp_connect(struct in_addr dest, u16 port, const struct tcp_ops *ops);
+
+/**
+ * tcp_send() - queue data for sending
+ *
+ * @data:	Data to send
+ * @len:	Length of data
+ * @return 0 if OK, -ENOTCONN if not connected, -ENOBUFS if the send buffer
+ * is full
+ */
+int tcp_send(const void *data, unsigned int len);
+
+/**
+ * tcp_close() - send a FIN and forget about the connection
+ *
+ * The final handshake is not waited for, which is enough for a client that
+ * has received everything it wants.
+ */
+void tcp_close(void);
+
+/**
+ * tcp_abort() - reset the connection, if there is one
+ */
+void tcp_abort(void);
+
+/**
+ * tcp_set_tcp_header() - fill in the IP and TCP headers of a segment
+ *
+ * This is called by net_send_ip_packet() for IPPROTO_TCP. The options of the
+ * segment are written after the fixed header, so the payload must already be
+ * in place after them.
+ *
+ * @pkt:	Start of the IP header
+ * @dest:	Destination IP address
+ * @dport:	Destination port
+ * @sport:	Source port
+ * @payload_len: Length of the payload
+ * @action:	TCP control bits
+ * @tcp_seq_num: Sequence number
+ * @tcp_ack_num: Acknowledgment number
+ * @return size of the IP and TCP headers, including options
+ */
+int tcp_set_tcp_header(uchar *pkt, struct in_addr dest, int dport, int sport,
+		       int payload_len, u8 action, u32 tcp_seq_num,
+		       u32 tcp_ack_num);
+
+/**
+ * tcp_receive() - process a received TCP segment
+ *
+ * @ip:		IP and TCP headers followed by the payload
+ * @len:	Length of the IP datagram
+ */
+void tcp_receive(struct ip_tcp_hdr *ip, unsigned int len);
+
+#endif /* __TCP_H__ */
@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * HTTP/1.1 client loading files over TCP
+ */
+
+#ifndef __WGET_H__
+#define __WGET_H__
+
+/* wget.c */
+void wget_start(void);	/* Begin the HTTP GET */
+
+/**
+ * wget_set_file() - stream the next download into a file
+ *
+ * The body is collected in the memory at the load address and written out
+ * whenever that buffer fills up, so files larger than the memory can be
+ * loaded. The file is written at growing offsets, which the filesystem must
+ * support. The setting applies to the next wget_start() and is cleared by
+ * calling this with @filename set to NULL.
+ *
+ * @ifname:	Interface name of the block device (e.g. "mmc")
+ * @dev_part:	Device and partition (e.g. "0:1")
+ * @filename:	File to write, or NULL to load into memory
+ */
+void wget_set_file(const char *ifname, const char *dev_part,
+		   const char *filename);
+
+#endif /* __WGET_H__ */
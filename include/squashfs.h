@@ -20,6 +20,7 @@ int sqfs_read(const char *filename, void *buf, loff_t offset,
 	      loff_t len, loff_t *actread);
 int sqfs_size(const char *filename, loff_t *size);
 void sqfs_close(void);
+void sqfs_release(void);
 void sqfs_closedir(struct fs_dir_stream *dirs);
 
 #endif /* SQFS_H  */
@@ -0,0 +1,125 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Driver model for hash engines
+ */
+
+#ifndef _U_BOOT_HASH_H
+#define _U_BOOT_HASH_H
+
+struct udevice;
+
+/* Algorithms a hash engine may implement */
+enum hash_algo_id {
+	HASH_ALGO_CRC32,
+	HASH_ALGO_SHA1,
+	HASH_ALGO_SHA256,
+	HASH_ALGO_SHA384,
+	HASH_ALGO_SHA512,
+
+	HASH_ALGO_COUNT,
+};
+
+/**
+ * struct hash_ops - Operations of a hash engine
+ *
+ * The uclass interface is implemented by all hash engines which use driver
+ * model. The CRC32 digest is stored in big-endian byte order, as the crc32
+ * entry of common/hash.c does.
+ */
+struct hash_ops {
+	/**
+	 * @priority: Engines with a higher priority are used first, those
+	 * with the same priority in the order they were bound. Hardware
+	 * engines leave this at 0.
+	 */
+	int priority;
+
+	/**
+	 * supports() - Check whether the engine implements an algorithm
+	 *
+	 * @dev:	Hash engine
+	 * @algo:	Algorithm to check
+	 * @return true if @algo can be used with this engine
+	 */
+	bool (*supports)(struct udevice *dev, enum hash_algo_id algo);
+
+	/**
+	 * init() - Create the context for a progressive hash
+	 *
+	 * @dev:	Hash engine
+	 * @algo:	Algorithm to use
+	 * @ctxp:	Returns the context
+	 * @return 0 if OK, -ve on error
+	 */
+	int (*init)(struct udevice *dev, enum hash_algo_id algo, void **ctxp);
+
+	/**
+	 * update() - Add data to a progressive hash
+	 *
+	 * The context is freed if an error occurs.
+	 *
+	 * @dev:	Hash engine
+	 * @ctx:	Context from init()
+	 * @buf:	Data to hash
+	 * @size:	Number of bytes at @buf
+	 * @return 0 if OK, -ve on error
+	 */
+	int (*update)(struct udevice *dev, void *ctx, const void *buf,
+		      unsigned int size);
+
+	/**
+	 * finish() - Write the digest and free the context
+	 *
+	 * @dev:	Hash engine
+	 * @ctx:	Context from init()
+	 * @digest:	Buffer for the digest, large enough for the algorithm
+	 * @return 0 if OK, -ve on error
+	 */
+	int (*finish)(struct udevice *dev, void *ctx, void *digest);
+};
+
+/* Priority of the software engine, used only when no other engine can */
+#define HASH_PRIO_SOFTWARE	-100
+
+#define hash_get_ops(dev)	((struct hash_ops *)(dev)->driver->ops)
+
+/**
+ * hash_algo_id_by_name() - Look up the ID of a named algorithm
+ *
+ * @name:	Algorithm name as used by common/hash.c, e.g. "sha256"
+ * @return algorithm ID, or -EPROTONOSUPPORT if no engine can implement it
+ */
+int hash_algo_id_by_name(const char *name);
+
+/**
+ * dm_hash_get_engine() - Find a hash engine for an algorithm
+ *
+ * @algo:	Algorithm to use
+ * @devp:	Returns the engine with the highest priority which supports
+ *		@algo
+ * @return 0 if OK, -ENODEV if no engine supports @algo
+ */
+int dm_hash_get_engine(enum hash_algo_id algo, struct udevice **devp);
+
+/* See struct hash_ops */
+int dm_hash_init(struct udevice *dev, enum hash_algo_id algo, void **ctxp);
+int dm_hash_update(struct udevice *dev, void *ctx, const void *buf,
+		   unsigned int size);
+int dm_hash_finish(struct udevice *dev, void *ctx, void *digest);
+
+/**
+ * dm_hash_digest_wd() - Hash a buffer, resetting the watchdog as it goes
+ *
+ * @dev:	Hash engine
+ * @algo:	Algorithm to use
+ * @buf:	Data to hash
+ * @size:	Number of bytes at @buf
+ * @digest:	Buffer for the digest, large enough for the algorithm
+ * @chunk_sz:	Reset the watchdog after hashing this many bytes
+ * @return 0 if OK, -ve on error
+ */
+int dm_hash_digest_wd(struct udevice *dev, enum hash_algo_id algo,
+		      const void *buf, unsigned int size, void *digest,
+		      unsigned int chunk_sz);
+
+#endif /* _U_BOOT_HASH_H */
@@ -89,6 +89,7 @@ struct vring {
  * @index: the zero-based ordinal number for this queue
  * @num_free: number of elements we expect to be able to fit
  * @vring: actual memory layout for this queue
+ * @indirect: we can use indirect buffer descriptors
  * @event: host publishes avail event idx
  * @free_head: head of free buffer list
  * @num_added: number we've added since last sync
@@ -102,6 +103,7 @@ struct virtqueue {
 	unsigned int index;
 	unsigned int num_free;
 	struct vring vring;
+	bool indirect;
 	bool event;
 	unsigned int free_head;
 	unsigned int num_added;
@@ -170,6 +172,10 @@ struct virtio_sg;
  * @in_sgs:	the number of scatterlists which are writable
  *		(after readable ones)
  *
+ * If VIRTIO_RING_F_INDIRECT_DESC was negotiated, a chain of several
+ * scatterlists is put in a separate descriptor table so that it takes a
+ * single entry of the ring.
+ *
  * Caller must ensure we don't call this with other virtqueue operations
  * at the same time (except where noted).
  *
@@ -206,7 +212,7 @@ void virtqueue_kick(struct virtqueue *vq);
  * operations at the same time (except where noted).
  *
  * Returns NULL if there are no used buffers, or the memory buffer
- * handed to virtqueue_add_*().
+ * handed to virtqueue_add_*(), which is the first scatterlist of the chain.
  */
 void *virtqueue_get_buf(struct virtqueue *vq, unsigned int *len);
 
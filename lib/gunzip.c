@@ -116,6 +116,25 @@ void gzwrite_progress_finish(int returnval,
 	}
 }
 
+/* Inflating one write buffer */
+struct gzwrite_job {
+	z_stream *s;
+	unsigned char *buf;
+	unsigned long size;
+	unsigned long filled;
+	unsigned int crc;
+	int ret;
+};
+
+static void gzwrite_inflate(struct gzwrite_job *job)
+{
+	job->s->avail_out = job->size;
+	job->s->next_out = job->buf;
+	job->ret = inflate(job->s, Z_SYNC_FLUSH);
+	job->filled = job->size - job->s->avail_out;
+	job->crc = crc32(job->crc, job->buf, job->filled);
+}
+
 int gzwrite(unsigned char *src, int len,
 	    struct blk_desc *dev,
 	    unsigned long szwritebuf,
@@ -125,13 +144,15 @@ int gzwrite(unsigned char *src, int len,
 	int i, flags;
 	z_stream s;
 	int r = 0;
-	unsigned char *writebuf;
+	unsigned char *writebuf[2];
+	struct gzwrite_job job;
 	unsigned crc = 0;
 	u64 totalfilled = 0;
 	lbaint_t blksperbuf, outblock;
 	u32 expected_crc;
 	u32 payload_size;
 	int iteration = 0;
+	bool more;
 
 	if (!szwritebuf ||
 	    (szwritebuf % dev->blksz) ||
@@ -205,56 +226,91 @@ int gzwrite(unsigned char *src, int len,
 
 	s.next_in = src + i;
 	s.avail_in = payload_size+8;
-	writebuf = (unsigned char *)malloc_cache_aligned(szwritebuf);
+	writebuf[0] = (unsigned char *)malloc_cache_aligned(szwritebuf);
+	writebuf[1] = (unsigned char *)malloc_cache_aligned(szwritebuf);
+	if (!writebuf[0] || !writebuf[1]) {
+		printf("%s: cannot allocate write buffers\n", __func__);
+		r = -1;
+		goto out;
+	}
+
+	job.s = &s;
+	job.buf = writebuf[0];
+	job.size = szwritebuf;
+	job.crc = 0;
+	gzwrite_inflate(&job);
 
 	/* decompress until deflate stream ends or end of file */
 	do {
-		if (s.avail_in == 0) {
+		unsigned char *buf = job.buf;
+		unsigned long numfilled;
+		lbaint_t writeblocks;
+		struct blk_req req;
+		int ret;
+
+		r = job.ret;
+		if ((r != Z_OK) &&
+		    (r != Z_STREAM_END)) {
+			printf("Error: inflate() returned %d\n", r);
+			goto out;
+		}
+		numfilled = job.filled;
+		crc = job.crc;
+		totalfilled += numfilled;
+
+		more = r != Z_STREAM_END;
+		if (more && s.avail_in == 0) {
 			printf("%s: weird termination with result %d\n",
 			       __func__, r);
-			break;
+			more = false;
+		}
+
+		if (numfilled < szwritebuf) {
+			writeblocks = (numfilled+dev->blksz-1)
+					/ dev->blksz;
+			memset(buf+numfilled, 0,
+			       dev->blksz-(numfilled%dev->blksz));
+		} else {
+			writeblocks = blksperbuf;
 		}
 
-		/* run inflate() on input until output buffer not full */
-		do {
-			unsigned long blocks_written;
-			int numfilled;
-			lbaint_t writeblocks;
-
-			s.avail_out = szwritebuf;
-			s.next_out = writebuf;
-			r = inflate(&s, Z_SYNC_FLUSH);
-			if ((r != Z_OK) &&
-			    (r != Z_STREAM_END)) {
-				printf("Error: inflate() returned %d\n", r);
-				goto out;
-			}
-			numfilled = szwritebuf - s.avail_out;
-			crc = crc32(crc, writebuf, numfilled);
-			totalfilled += numfilled;
-			if (numfilled < szwritebuf) {
-				writeblocks = (numfilled+dev->blksz-1)
-						/ dev->blksz;
-				memset(writebuf+numfilled, 0,
-				       dev->blksz-(numfilled%dev->blksz));
-			} else {
-				writeblocks = blksperbuf;
-			}
-
-			gzwrite_progress(iteration++,
-					 totalfilled,
-					 szexpected);
-			blocks_written = blk_dwrite(dev, outblock,
-						    writeblocks, writebuf);
-			outblock += blocks_written;
-			if (ctrlc()) {
-				puts("abort\n");
-				goto out;
-			}
-			WATCHDOG_RESET();
-		} while (s.avail_out == 0);
+		/*
+		 * Queue the write before inflating the next buffer into the
+		 * other one, so that a device which writes in the background
+		 * (see blk_dsubmit()) is busy meanwhile. Other devices write
+		 * the buffer when it is waited for, one step after the other.
+		 */
+		req.op = BLK_REQ_WRITE;
+		req.start = outblock;
+		req.blkcnt = writeblocks;
+		req.buffer = buf;
+		req.complete = NULL;
+		ret = blk_dsubmit(dev, &req);
+		if (!ret && more) {
+			job.buf = writebuf[buf == writebuf[0]];
+			gzwrite_inflate(&job);
+		}
+
+		gzwrite_progress(iteration++,
+				 totalfilled,
+				 szexpected);
+		if (!ret)
+			ret = blk_dwait(dev, &req);
+		if (ret) {
+			printf("%s: write failed at block " LBAFU "\n",
+			       __func__, outblock);
+			r = -1;
+			goto out;
+		}
+		outblock += writeblocks;
+		if (ctrlc()) {
+			puts("abort\n");
+			r = -1;
+			goto out;
+		}
+		WATCHDOG_RESET();
 		/* done when inflate() says it's done */
-	} while (r != Z_STREAM_END);
+	} while (more);
 
 	if ((szexpected != totalfilled) ||
 	    (crc != expected_crc))
@@ -265,7 +321,8 @@ int gzwrite(unsigned char *src, int len,
 out:
 	gzwrite_progress_finish(r, totalfilled, szexpected,
 				expected_crc, crc);
-	free(writebuf);
+	free(writebuf[0]);
+	free(writebuf[1]);
 	inflateEnd(&s);
 
 	return r;
@@ -49,26 +49,150 @@
 
 static void default_log(const char *ignored, char *response) {}
 
+/*
+ * Chunks are not written one by one. Small RAW and FILL chunks which follow
+ * each other on the device are gathered in a buffer and written together,
+ * and runs of DONT_CARE chunks are reserved in one go. The same buffer holds
+ * the pattern for FILL chunks too large to gather, and is only refilled when
+ * the pattern changes.
+ */
+struct sparse_writer {
+	struct sparse_storage *info;
+	char *response;
+	u32 *buf;
+	lbaint_t buf_blks;	/* size of @buf in storage blocks */
+	lbaint_t blk;		/* where the blocks in @buf go */
+	lbaint_t staged;	/* number of blocks in @buf to write */
+	lbaint_t skip;		/* number of blocks to reserve before @blk */
+	bool fill_valid;	/* @buf is full of @fill_val */
+	u32 fill_val;
+};
+
+static void sparse_fill(u32 *buf, u32 fill_val, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len / sizeof(fill_val); i++)
+		buf[i] = fill_val;
+}
+
+static int sparse_write(struct sparse_writer *w, lbaint_t blkcnt,
+			const void *buffer)
+{
+	struct sparse_storage *info = w->info;
+	lbaint_t blks;
+
+	blks = info->write(info, w->blk, blkcnt, buffer);
+	/* blks might be > blkcnt (eg. NAND bad-blocks) */
+	if (blks < blkcnt) {
+		printf("%s: %s" LBAFU " [" LBAFU "]\n",
+		       __func__, "Write failed, block #", w->blk, blks);
+		info->mssg("flash write failure", w->response);
+		return -1;
+	}
+	w->blk += blks;
+
+	return 0;
+}
+
+static int sparse_flush(struct sparse_writer *w)
+{
+	lbaint_t staged = w->staged;
+
+	if (!staged)
+		return 0;
+	w->staged = 0;
+
+	return sparse_write(w, staged, w->buf);
+}
+
+/*
+ * Find room for @blkcnt more blocks in the buffer. @ptrp is set to NULL if
+ * the blocks are better written straight from where they are.
+ */
+static int sparse_stage(struct sparse_writer *w, lbaint_t blkcnt,
+			void **ptrp)
+{
+	struct sparse_storage *info = w->info;
+
+	*ptrp = NULL;
+	if (w->skip) {
+		w->blk += info->reserve(info, w->blk, w->skip);
+		w->skip = 0;
+	}
+	if (blkcnt >= w->buf_blks || w->staged + blkcnt > w->buf_blks) {
+		if (sparse_flush(w))
+			return -1;
+		if (blkcnt >= w->buf_blks)
+			return 0;
+	}
+	*ptrp = (void *)w->buf + w->staged * info->blksz;
+	w->staged += blkcnt;
+	w->fill_valid = false;
+
+	return 0;
+}
+
+static int sparse_write_raw(struct sparse_writer *w, const void *data,
+			    lbaint_t blkcnt)
+{
+	void *ptr;
+
+	if (sparse_stage(w, blkcnt, &ptr))
+		return -1;
+	if (ptr) {
+		memcpy(ptr, data, blkcnt * w->info->blksz);
+		return 0;
+	}
+
+	return sparse_write(w, blkcnt, data);
+}
+
+static int sparse_write_fill(struct sparse_writer *w, u32 fill_val,
+			     lbaint_t blkcnt)
+{
+	lbaint_t blksz = w->info->blksz;
+	lbaint_t i, j;
+	void *ptr;
+
+	if (sparse_stage(w, blkcnt, &ptr))
+		return -1;
+	if (ptr) {
+		sparse_fill(ptr, fill_val, blkcnt * blksz);
+		return 0;
+	}
+
+	if (!w->fill_valid || w->fill_val != fill_val) {
+		sparse_fill(w->buf, fill_val, w->buf_blks * blksz);
+		w->fill_val = fill_val;
+		w->fill_valid = true;
+	}
+	for (i = 0; i < blkcnt; i += j) {
+		j = min(blkcnt - i, w->buf_blks);
+		if (sparse_write(w, j, w->buf))
+			return -1;
+	}
+
+	return 0;
+}
+
 int write_sparse_image(struct sparse_storage *info,
 		       const char *part_name, void *data, char *response)
 {
-	lbaint_t blk;
+	struct sparse_writer w = {
+		.info = info,
+		.response = response,
+	};
 	lbaint_t blkcnt;
-	lbaint_t blks;
 	uint32_t bytes_written = 0;
 	unsigned int chunk;
 	unsigned int offset;
 	unsigned int chunk_data_sz;
-	uint32_t *fill_buf = NULL;
 	uint32_t fill_val;
 	sparse_header_t *sparse_header;
 	chunk_header_t *chunk_header;
 	uint32_t total_blocks = 0;
-	int fill_buf_num_blks;
-	int i;
-	int j;
-
-	fill_buf_num_blks = CONFIG_IMAGE_SPARSE_FILLBUF_SIZE / info->blksz;
+	int ret = -1;
 
 	/* Read and skip over sparse image header */
 	sparse_header = (sparse_header_t *)data;
@@ -107,10 +231,19 @@ int write_sparse_image(struct sparse_storage *info,
 		return -1;
 	}
 
+	w.buf_blks = max(CONFIG_IMAGE_SPARSE_FILLBUF_SIZE / info->blksz,
+			 (lbaint_t)1);
+	w.buf = memalign(ARCH_DMA_MINALIGN,
+			 ROUNDUP(info->blksz * w.buf_blks, ARCH_DMA_MINALIGN));
+	if (!w.buf) {
+		info->mssg("Malloc failed for sparse buffer", response);
+		return -1;
+	}
+
 	puts("Flashing Sparse Image\n");
 
 	/* Start processing chunks */
-	blk = info->start;
+	w.blk = info->start;
 	for (chunk = 0; chunk < sparse_header->total_chunks; chunk++) {
 		/* Read and skip over chunk header */
 		chunk_header = (chunk_header_t *)data;
@@ -140,28 +273,21 @@ int write_sparse_image(struct sparse_storage *info,
 			    (sparse_header->chunk_hdr_sz + chunk_data_sz)) {
 				info->mssg("Bogus chunk size for chunk type Raw",
 					   response);
-				return -1;
+				goto out;
 			}
 
-			if (blk + blkcnt > info->start + info->size) {
+			if (w.blk + w.skip + w.staged + blkcnt >
+			    info->start + info->size) {
 				printf(
 				    "%s: Request would exceed partition size!\n",
 				    __func__);
 				info->mssg("Request would exceed partition size!",
 					   response);
-				return -1;
+				goto out;
 			}
 
-			blks = info->write(info, blk, blkcnt, data);
-			/* blks might be > blkcnt (eg. NAND bad-blocks) */
-			if (blks < blkcnt) {
-				printf("%s: %s" LBAFU " [" LBAFU "]\n",
-				       __func__, "Write failed, block #",
-				       blk, blks);
-				info->mssg("flash write failure", response);
-				return -1;
-			}
-			blk += blks;
+			if (sparse_write_raw(&w, data, blkcnt))
+				goto out;
 			bytes_written += blkcnt * info->blksz;
 			total_blocks += chunk_header->chunk_sz;
 			data += chunk_data_sz;
@@ -171,64 +297,32 @@ int write_sparse_image(struct sparse_storage *info,
 			if (chunk_header->total_sz !=
 			    (sparse_header->chunk_hdr_sz + sizeof(uint32_t))) {
 				info->mssg("Bogus chunk size for chunk type FILL", response);
-				return -1;
-			}
-
-			fill_buf = (uint32_t *)
-				   memalign(ARCH_DMA_MINALIGN,
-					    ROUNDUP(
-						info->blksz * fill_buf_num_blks,
-						ARCH_DMA_MINALIGN));
-			if (!fill_buf) {
-				info->mssg("Malloc failed for: CHUNK_TYPE_FILL",
-					   response);
-				return -1;
+				goto out;
 			}
 
 			fill_val = *(uint32_t *)data;
 			data = (char *)data + sizeof(uint32_t);
 
-			for (i = 0;
-			     i < (info->blksz * fill_buf_num_blks /
-				  sizeof(fill_val));
-			     i++)
-				fill_buf[i] = fill_val;
-
-			if (blk + blkcnt > info->start + info->size) {
+			if (w.blk + w.skip + w.staged + blkcnt >
+			    info->start + info->size) {
 				printf(
 				    "%s: Request would exceed partition size!\n",
 				    __func__);
 				info->mssg("Request would exceed partition size!",
 					   response);
-				return -1;
+				goto out;
 			}
 
-			for (i = 0; i < blkcnt;) {
-				j = blkcnt - i;
-				if (j > fill_buf_num_blks)
-					j = fill_buf_num_blks;
-				blks = info->write(info, blk, j, fill_buf);
-				/* blks might be > j (eg. NAND bad-blocks) */
-				if (blks < j) {
-					printf("%s: %s " LBAFU " [%d]\n",
-					       __func__,
-					       "Write failed, block #",
-					       blk, j);
-					info->mssg("flash write failure",
-						   response);
-					free(fill_buf);
-					return -1;
-				}
-				blk += blks;
-				i += j;
-			}
+			if (sparse_write_fill(&w, fill_val, blkcnt))
+				goto out;
 			bytes_written += blkcnt * info->blksz;
 			total_blocks += chunk_data_sz / sparse_header->blk_sz;
-			free(fill_buf);
 			break;
 
 		case CHUNK_TYPE_DONT_CARE:
-			blk += info->reserve(info, blk, blkcnt);
+			if (sparse_flush(&w))
+				goto out;
+			w.skip += blkcnt;
 			total_blocks += chunk_header->chunk_sz;
 			break;
 
@@ -237,7 +331,7 @@ int write_sparse_image(struct sparse_storage *info,
 			    sparse_header->chunk_hdr_sz) {
 				info->mssg("Bogus chunk size for chunk type Dont Care",
 					   response);
-				return -1;
+				goto out;
 			}
 			total_blocks += chunk_header->chunk_sz;
 			data += chunk_data_sz;
@@ -247,9 +341,13 @@ int write_sparse_image(struct sparse_storage *info,
 			printf("%s: Unknown chunk type: %x\n", __func__,
 			       chunk_header->chunk_type);
 			info->mssg("Unknown chunk type", response);
-			return -1;
+			goto out;
 		}
 	}
+	if (sparse_flush(&w))
+		goto out;
+	if (w.skip)
+		info->reserve(info, w.blk, w.skip);
 
 	debug("Wrote %d blocks, expected to write %d blocks\n",
 	      total_blocks, sparse_header->total_blks);
@@ -257,8 +355,12 @@ int write_sparse_image(struct sparse_storage *info,
 
 	if (total_blocks != sparse_header->total_blks) {
 		info->mssg("sparse image write failure", response);
-		return -1;
+		goto out;
 	}
+	ret = 0;
 
-	return 0;
+out:
+	free(w.buf);
+
+	return ret;
 }
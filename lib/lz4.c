@@ -14,7 +14,7 @@
 **************************************/
 
 /* customized version of memcpy, which may overwrite up to 7 bytes beyond dstEnd */
-static void LZ4_wildCopy(void* dstPtr, const void* srcPtr, void* dstEnd)
+static void LZ4_wildCopy8(void* dstPtr, const void* srcPtr, void* dstEnd)
 {
     BYTE* d = (BYTE*)dstPtr;
     const BYTE* s = (const BYTE*)srcPtr;
@@ -22,23 +22,78 @@ static void LZ4_wildCopy(void* dstPtr, const void* srcPtr, void* dstEnd)
     do { LZ4_copy8(d,s); d+=8; s+=8; } while (d<e);
 }
 
+/* customized version of memcpy, which may overwrite up to 31 bytes beyond dstEnd.
+ * Chunks are copied in order, so this is safe for matches with an offset of 16 or more */
+static void LZ4_wildCopy32(void* dstPtr, const void* srcPtr, void* dstEnd)
+{
+    BYTE* d = (BYTE*)dstPtr;
+    const BYTE* s = (const BYTE*)srcPtr;
+    BYTE* e = (BYTE*)dstEnd;
+    do { LZ4_copy16(d,s); LZ4_copy16(d+16,s+16); d+=32; s+=32; } while (d<e);
+}
+
+static const unsigned inc32table[8] = {0, 1, 2,  1,  0,  4, 4, 4};
+static const int      dec64table[8] = {0, 0, 0, -1, -4,  1, 2, 3};
+
+/* copy a match with an offset below 8, turning it into one with an offset of 8 or more */
+FORCE_INLINE void LZ4_memcpy_using_offset_base(BYTE* dstPtr, const BYTE* srcPtr, BYTE* dstEnd, const size_t offset)
+{
+    if (offset < 8) {
+        dstPtr[0] = srcPtr[0];
+        dstPtr[1] = srcPtr[1];
+        dstPtr[2] = srcPtr[2];
+        dstPtr[3] = srcPtr[3];
+        srcPtr += inc32table[offset];
+        LZ4_copy4(dstPtr+4, srcPtr);
+        srcPtr -= dec64table[offset];
+        dstPtr += 8;
+    } else {
+        LZ4_copy8(dstPtr, srcPtr);
+        dstPtr += 8;
+        srcPtr += 8;
+    }
+
+    LZ4_wildCopy8(dstPtr, srcPtr, dstEnd);
+}
+
+/* customized version of memcpy for matches with an offset below 16, which may
+ * overwrite up to 7 bytes beyond dstEnd. Offsets 1, 2 and 4 repeat an 8-byte pattern */
+FORCE_INLINE void LZ4_memcpy_using_offset(BYTE* dstPtr, const BYTE* srcPtr, BYTE* dstEnd, const size_t offset)
+{
+    BYTE v[8];
+
+    switch(offset) {
+    case 1:
+        memset(v, *srcPtr, 8);
+        break;
+    case 2:
+        v[0] = srcPtr[0]; v[1] = srcPtr[1];
+        v[2] = srcPtr[0]; v[3] = srcPtr[1];
+        LZ4_copy4(&v[4], v);
+        break;
+    case 4:
+        LZ4_copy4(v, srcPtr);
+        LZ4_copy4(&v[4], srcPtr);
+        break;
+    default:
+        LZ4_memcpy_using_offset_base(dstPtr, srcPtr, dstEnd, offset);
+        return;
+    }
+
+    do { LZ4_copy8(dstPtr, v); dstPtr += 8; } while (dstPtr < dstEnd);
+}
+
 
 /**************************************
 *  Common Constants
 **************************************/
 #define MINMATCH 4
 
-#define COPYLENGTH 8
+#define WILDCOPYLENGTH 8
 #define LASTLITERALS 5
-#define MFLIMIT (COPYLENGTH+MINMATCH)
-static const int LZ4_minLength = (MFLIMIT+1);
-
-#define KB *(1 <<10)
-#define MB *(1 <<20)
-#define GB *(1U<<30)
-
-#define MAXD_LOG 16
-#define MAX_DISTANCE ((1 << MAXD_LOG) - 1)
+#define MFLIMIT 12
+#define MATCH_SAFEGUARD_DISTANCE ((2*WILDCOPYLENGTH) - MINMATCH)   /* ensure it's possible to write 2 x wildcopyLength without overflowing output buffer */
+#define FASTLOOP_SAFE_DISTANCE 64
 
 #define ML_BITS  4
 #define ML_MASK  ((1U<<ML_BITS)-1)
@@ -46,195 +101,267 @@ static const int LZ4_minLength = (MFLIMIT+1);
 #define RUN_MASK ((1U<<RUN_BITS)-1)
 
 
-/**************************************
-*  Local Structures and types
-**************************************/
-typedef enum { noDict = 0, withPrefix64k, usingExtDict } dict_directive;
-typedef enum { endOnOutputSize = 0, endOnInputSize = 1 } endCondition_directive;
-typedef enum { full = 0, partial = 1 } earlyEnd_directive;
-
-
-
 /*******************************
 *  Decompression functions
 *******************************/
+
+#define rvl_error ((size_t)-1)
+
+/* Read the extra bytes of a literal or match length. Returns rvl_error if
+ * they run past ilimit */
+FORCE_INLINE size_t read_variable_length(const BYTE** ip, const BYTE* ilimit, int initial_check)
+{
+    size_t s, length = 0;
+
+    if (initial_check && unlikely((*ip) >= ilimit))   /* read limit reached */
+        return rvl_error;
+    do {
+        s = **ip;
+        (*ip)++;
+        length += s;
+        if (unlikely((*ip) > ilimit))   /* read limit reached */
+            return rvl_error;
+    } while (s == 255);
+
+    return length;
+}
+
 /*
- * This generic decompression function cover all use cases.
- * It shall be instantiated several times, using different sets of directives
- * Note that it is essential this generic function is really inlined,
- * in order to remove useless branches during compilation optimization.
+ * Decode a single block of compressed data, which must make up the whole
+ * block (in the way the frame format stores blocks) and reference no
+ * dictionary. The output is never written beyond dest + outputSize, and the
+ * input never read beyond source + inputSize.
+ *
+ * Long stretches are decoded in a fast loop while there are at least
+ * FASTLOOP_SAFE_DISTANCE bytes of room left in the output, so that literal
+ * runs and matches can be copied 16 or 32 bytes at a time without checking
+ * for the end of the buffer. The rest is decoded in the careful loop, which
+ * still has a shortcut for short literal runs followed by short matches.
+ *
+ * Returns the number of bytes decoded, or a negative value if the input is
+ * malformed.
  */
-FORCE_INLINE int LZ4_decompress_generic(
-                 const char* const source,
-                 char* const dest,
-                 int inputSize,
-                 int outputSize,         /* If endOnInput==endOnInputSize, this value is the max size of Output Buffer. */
-
-                 int endOnInput,         /* endOnOutputSize, endOnInputSize */
-                 int partialDecoding,    /* full, partial */
-                 int targetOutputSize,   /* only used if partialDecoding==partial */
-                 int dict,               /* noDict, withPrefix64k, usingExtDict */
-                 const BYTE* const lowPrefix,  /* == dest if dict == noDict */
-                 const BYTE* const dictStart,  /* only if dict==usingExtDict */
-                 const size_t dictSize         /* note : = 0 if noDict */
-                 )
+static int LZ4_decompress_safe(const char* const source, char* const dest, int inputSize, int outputSize)
 {
-    /* Local Variables */
     const BYTE* ip = (const BYTE*) source;
     const BYTE* const iend = ip + inputSize;
 
     BYTE* op = (BYTE*) dest;
     BYTE* const oend = op + outputSize;
     BYTE* cpy;
-    BYTE* oexit = op + targetOutputSize;
-    const BYTE* const lowLimit = lowPrefix - dictSize;
 
-    const BYTE* const dictEnd = (const BYTE*)dictStart + dictSize;
-    const size_t dec32table[] = {4, 1, 2, 1, 4, 4, 4, 4};
-    const size_t dec64table[] = {0, 0, 0, (size_t)-1, 0, 1, 2, 3};
+    const BYTE* const lowPrefix = (const BYTE*) dest;
+
+    /* Set up the "end" pointers for the shortcut. */
+    const BYTE* const shortiend = iend - 14 /*maxLL*/ - 2 /*offset*/;
+    const BYTE* const shortoend = oend - 14 /*maxLL*/ - 18 /*maxML*/;
 
-    const int safeDecode = (endOnInput==endOnInputSize);
-    const int checkOffset = ((safeDecode) && (dictSize < (int)(64 KB)));
+    const BYTE* match;
+    size_t offset;
+    unsigned token;
+    size_t length;
 
 
     /* Special cases */
-    if ((partialDecoding) && (oexit> oend-MFLIMIT)) oexit = oend-MFLIMIT;                         /* targetOutputSize too high => decode everything */
-    if ((endOnInput) && (unlikely(outputSize==0))) return ((inputSize==1) && (*ip==0)) ? 0 : -1;  /* Empty output buffer */
-    if ((!endOnInput) && (unlikely(outputSize==0))) return (*ip==0?1:-1);
+    if (unlikely(inputSize <= 0)) return -1;
+    if (unlikely(outputSize == 0)) return ((inputSize==1) && (*ip==0)) ? 0 : -1;   /* Empty output buffer */
 
+    /* Fast loop : decode sequences as long as output < oend-FASTLOOP_SAFE_DISTANCE */
+    if ((oend - op) < FASTLOOP_SAFE_DISTANCE)
+        goto safe_decode;
 
-    /* Main Loop */
-    while (1)
-    {
-        unsigned token;
-        size_t length;
-        const BYTE* match;
+    while (1) {
+        /* Main fastloop assertion: We can always wildcopy FASTLOOP_SAFE_DISTANCE */
+        token = *ip++;
+        length = token >> ML_BITS;   /* literal length */
+
+        /* decode literal length */
+        if (length == RUN_MASK) {
+            size_t const addl = read_variable_length(&ip, iend-RUN_MASK, 1);
+            if (addl == rvl_error) goto _output_error;
+            length += addl;
+            if (unlikely((size_t)(op+length)<(size_t)(op))) goto _output_error;   /* overflow detection */
+            if (unlikely((size_t)(ip+length)<(size_t)(ip))) goto _output_error;   /* overflow detection */
+
+            /* copy literals */
+            cpy = op+length;
+            if ((cpy>oend-32) || (ip+length>iend-32)) goto safe_literal_copy;
+            LZ4_wildCopy32(op, ip, cpy);
+            ip += length; op = cpy;
+        } else {
+            cpy = op+length;
+            /* We don't need to check oend, since we check it once for each loop below */
+            if (ip > iend-(16 + 1/*max lit + offset + nextToken*/)) goto safe_literal_copy;
+            /* Literals can only be <= 14, but copying 16 is one move */
+            LZ4_copy16(op, ip);
+            ip += length; op = cpy;
+        }
+
+        /* get offset */
+        offset = LZ4_readLE16(ip); ip+=2;
+        match = op - offset;
+
+        /* get matchlength */
+        length = token & ML_MASK;
+
+        if (length == ML_MASK) {
+            size_t const addl = read_variable_length(&ip, iend - LASTLITERALS + 1, 0);
+            if (addl == rvl_error) goto _output_error;
+            length += addl;
+            length += MINMATCH;
+            if (unlikely((size_t)(op+length)<(size_t)op)) goto _output_error;   /* overflow detection */
+            if (unlikely(match < lowPrefix)) goto _output_error;   /* Error : offset outside buffers */
+            if (op + length >= oend - FASTLOOP_SAFE_DISTANCE) goto safe_match_copy;
+        } else {
+            length += MINMATCH;
+            if (op + length >= oend - FASTLOOP_SAFE_DISTANCE) goto safe_match_copy;
+
+            /* Fastpath check: a match of up to 18 bytes that does not overlap 8-byte moves */
+            if ((match >= lowPrefix) && (offset >= 8)) {
+                LZ4_copy8(op, match);
+                LZ4_copy8(op+8, match+8);
+                LZ4_copy2(op+16, match+16);
+                op += length;
+                continue;
+            }
+        }
+
+        if (unlikely(match < lowPrefix)) goto _output_error;   /* Error : offset outside buffers */
+
+        /* copy match within block */
+        cpy = op + length;
+
+        if (unlikely(offset<16)) {
+            LZ4_memcpy_using_offset(op, match, cpy, offset);
+        } else {
+            LZ4_wildCopy32(op, match, cpy);
+        }
 
-        /* get literal length */
+        op = cpy;   /* wildcopy correction */
+    }
+safe_decode:
+
+    /* Main Loop : decode remaining sequences where output < FASTLOOP_SAFE_DISTANCE */
+    while (1) {
         token = *ip++;
-        if ((length=(token>>ML_BITS)) == RUN_MASK)
-        {
-            unsigned s;
-            do
-            {
-                s = *ip++;
-                length += s;
+        length = token >> ML_BITS;   /* literal length */
+
+        /* A two-stage shortcut for the most common case:
+         * 1) If the literal length is 0..14, and there is enough space,
+         * enter the shortcut and copy 16 bytes on behalf of the literals.
+         * 2) Further if the match length is 4..18, copy 18 bytes in a similar
+         * manner; but we ensure that there's enough space in the output for
+         * those 18 bytes earlier, upon entering the shortcut (in other words,
+         * there is a combined check for both stages).
+         */
+        if ((length != RUN_MASK)
+            /* strictly "less than" on input, to re-enter the loop with at least one byte */
+            && likely((ip < shortiend) & (op <= shortoend))) {
+            /* Copy the literals */
+            LZ4_copy16(op, ip);
+            op += length; ip += length;
+
+            /* The second stage: prepare for match copying, decode full info.
+             * If it doesn't work out, the info won't be wasted. */
+            length = token & ML_MASK;   /* match length */
+            offset = LZ4_readLE16(ip); ip += 2;
+            match = op - offset;
+
+            /* Do not deal with overlapping matches. */
+            if ((length != ML_MASK) && (offset >= 8) && (match >= lowPrefix)) {
+                /* Copy the match. */
+                LZ4_copy8(op, match);
+                LZ4_copy8(op+8, match+8);
+                LZ4_copy2(op+16, match+16);
+                op += length + MINMATCH;
+                /* Both stages worked, load the next token. */
+                continue;
             }
-            while (likely((endOnInput)?ip<iend-RUN_MASK:1) && (s==255));
-            if ((safeDecode) && unlikely((size_t)(op+length)<(size_t)(op))) goto _output_error;   /* overflow detection */
-            if ((safeDecode) && unlikely((size_t)(ip+length)<(size_t)(ip))) goto _output_error;   /* overflow detection */
+
+            /* The second stage didn't work out, but the info is ready.
+             * Propel it right to the point of match copying. */
+            goto _copy_match;
+        }
+
+        /* decode literal length */
+        if (length == RUN_MASK) {
+            size_t const addl = read_variable_length(&ip, iend-RUN_MASK, 1);
+            if (addl == rvl_error) goto _output_error;
+            length += addl;
+            if (unlikely((size_t)(op+length)<(size_t)(op))) goto _output_error;   /* overflow detection */
+            if (unlikely((size_t)(ip+length)<(size_t)(ip))) goto _output_error;   /* overflow detection */
         }
 
+safe_literal_copy:
         /* copy literals */
         cpy = op+length;
-        if (((endOnInput) && ((cpy>(partialDecoding?oexit:oend-MFLIMIT)) || (ip+length>iend-(2+1+LASTLITERALS))) )
-            || ((!endOnInput) && (cpy>oend-COPYLENGTH)))
-        {
-            if (partialDecoding)
-            {
-                if (cpy > oend) goto _output_error;                           /* Error : write attempt beyond end of output buffer */
-                if ((endOnInput) && (ip+length > iend)) goto _output_error;   /* Error : read attempt beyond end of input buffer */
-            }
-            else
-            {
-                if ((!endOnInput) && (cpy != oend)) goto _output_error;       /* Error : block decoding must stop exactly there */
-                if ((endOnInput) && ((ip+length != iend) || (cpy > oend))) goto _output_error;   /* Error : input must be consumed */
-            }
-            memcpy(op, ip, length);
+
+        if ((cpy>oend-MFLIMIT) || (ip+length>iend-(2+1+LASTLITERALS))) {
+            /* We must be on the last sequence (or invalid) because of the parsing limitations
+             * so check that we exactly consume the input and don't overrun the output buffer. */
+            if ((ip+length != iend) || (cpy > oend)) goto _output_error;
+            memmove(op, ip, length);   /* supports overlapping memory regions, for in-place decompression */
             ip += length;
             op += length;
             break;     /* Necessarily EOF, due to parsing restrictions */
         }
-        LZ4_wildCopy(op, ip, cpy);
+        LZ4_wildCopy8(op, ip, cpy);   /* can overwrite up to 8 bytes beyond cpy */
         ip += length; op = cpy;
 
         /* get offset */
-        match = cpy - LZ4_readLE16(ip); ip+=2;
-        if ((checkOffset) && (unlikely(match < lowLimit))) goto _output_error;   /* Error : offset outside destination buffer */
+        offset = LZ4_readLE16(ip); ip+=2;
+        match = op - offset;
 
         /* get matchlength */
         length = token & ML_MASK;
-        if (length == ML_MASK)
-        {
-            unsigned s;
-            do
-            {
-                if ((endOnInput) && (ip > iend-LASTLITERALS)) goto _output_error;
-                s = *ip++;
-                length += s;
-            } while (s==255);
-            if ((safeDecode) && unlikely((size_t)(op+length)<(size_t)op)) goto _output_error;   /* overflow detection */
+
+_copy_match:
+        if (length == ML_MASK) {
+            size_t const addl = read_variable_length(&ip, iend - LASTLITERALS + 1, 0);
+            if (addl == rvl_error) goto _output_error;
+            length += addl;
+            if (unlikely((size_t)(op+length)<(size_t)op)) goto _output_error;   /* overflow detection */
         }
         length += MINMATCH;
 
-        /* check external dictionary */
-        if ((dict==usingExtDict) && (match < lowPrefix))
-        {
-            if (unlikely(op+length > oend-LASTLITERALS)) goto _output_error;   /* doesn't respect parsing restriction */
+safe_match_copy:
+        if (unlikely(match < lowPrefix)) goto _output_error;   /* Error : offset outside buffers */
 
-            if (length <= (size_t)(lowPrefix-match))
-            {
-                /* match can be copied as a single segment from external dictionary */
-                match = dictEnd - (lowPrefix-match);
-                memmove(op, match, length); op += length;
-            }
-            else
-            {
-                /* match encompass external dictionary and current segment */
-                size_t copySize = (size_t)(lowPrefix-match);
-                memcpy(op, dictEnd - copySize, copySize);
-                op += copySize;
-                copySize = length - copySize;
-                if (copySize > (size_t)(op-lowPrefix))   /* overlap within current segment */
-                {
-                    BYTE* const endOfMatch = op + copySize;
-                    const BYTE* copyFrom = lowPrefix;
-                    while (op < endOfMatch) *op++ = *copyFrom++;
-                }
-                else
-                {
-                    memcpy(op, lowPrefix, copySize);
-                    op += copySize;
-                }
-            }
-            continue;
-        }
-
-        /* copy repeated sequence */
+        /* copy match within block */
         cpy = op + length;
-        if (unlikely((op-match)<8))
-        {
-            const size_t dec64 = dec64table[op-match];
+
+        if (unlikely(offset<8)) {
             op[0] = match[0];
             op[1] = match[1];
             op[2] = match[2];
             op[3] = match[3];
-            match += dec32table[op-match];
+            match += inc32table[offset];
             LZ4_copy4(op+4, match);
-            op += 8; match -= dec64;
-        } else { LZ4_copy8(op, match); op+=8; match+=8; }
-
-        if (unlikely(cpy>oend-12))
-        {
-            if (cpy > oend-LASTLITERALS) goto _output_error;    /* Error : last LASTLITERALS bytes must be literals */
-            if (op < oend-8)
-            {
-                LZ4_wildCopy(op, match, oend-8);
-                match += (oend-8) - op;
-                op = oend-8;
+            match -= dec64table[offset];
+        } else {
+            LZ4_copy8(op, match);
+            match += 8;
+        }
+        op += 8;
+
+        if (unlikely(cpy > oend-MATCH_SAFEGUARD_DISTANCE)) {
+            BYTE* const oCopyLimit = oend - (WILDCOPYLENGTH-1);
+            if (cpy > oend-LASTLITERALS) goto _output_error;   /* Error : last LASTLITERALS bytes must be literals (uncompressed) */
+            if (op < oCopyLimit) {
+                LZ4_wildCopy8(op, match, oCopyLimit);
+                match += oCopyLimit - op;
+                op = oCopyLimit;
             }
-            while (op<cpy) *op++ = *match++;
+            while (op < cpy) *op++ = *match++;
+        } else {
+            LZ4_copy8(op, match);
+            if (length > 16) LZ4_wildCopy8(op+8, match+8, cpy);
         }
-        else
-            LZ4_wildCopy(op, match, cpy);
-        op=cpy;   /* correction */
+        op = cpy;   /* wildcopy correction */
     }
 
     /* end of decoding */
-    if (endOnInput)
-       return (int) (((char*)op)-dest);     /* Nb of output bytes decoded */
-    else
-       return (int) (((const char*)ip)-source);   /* Nb of input bytes read */
+    return (int) (((char*)op)-dest);     /* Nb of output bytes decoded */
 
     /* Overflow error detected */
 _output_error:
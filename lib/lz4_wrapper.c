@@ -9,12 +9,28 @@
 #include <lz4.h>
 #include <linux/kernel.h>
 #include <linux/types.h>
+#include <linux/xxhash.h>
 #include <asm/unaligned.h>
 
 static u16 LZ4_readLE16(const void *src) { return le16_to_cpu(*(u16 *)src); }
+static void LZ4_copy2(void *dst, const void *src) { *(u16 *)dst = *(u16 *)src; }
 static void LZ4_copy4(void *dst, const void *src) { *(u32 *)dst = *(u32 *)src; }
 static void LZ4_copy8(void *dst, const void *src) { *(u64 *)dst = *(u64 *)src; }
 
+static inline __attribute__((always_inline))
+void LZ4_copy16(void *dst, const void *src)
+{
+#ifdef CONFIG_ARM64
+	/* One NEON load/store pair instead of two with the general registers */
+	asm("ldr q16, %1\n"
+	    "str q16, %0\n"
+	    : "=Q" (*(u8 (*)[16])dst) : "Q" (*(const u8 (*)[16])src) : "v16");
+#else
+	LZ4_copy8(dst, src);
+	LZ4_copy8(dst + 8, src + 8);
+#endif
+}
+
 typedef  uint8_t BYTE;
 typedef uint16_t U16;
 typedef uint32_t U32;
@@ -23,7 +39,10 @@ typedef uint64_t U64;
 
 #define FORCE_INLINE static inline __attribute__((always_inline))
 
-/* lz4.c is unaltered (except removing unrelated code) from github.com/Cyan4973/lz4. */
+/*
+ * lz4.c is the decoder from github.com/Cyan4973/lz4 (v1.9), cut down to
+ * the single case of a whole block without a dictionary.
+ */
 #include "lz4.c"	/* #include for inlining, do not link! */
 
 #define LZ4F_BLOCKUNCOMPRESSED_FLAG 0x80000000U
@@ -33,7 +52,8 @@ int ulz4fn(const void *src, size_t srcn, void *dst, size_t *dstn)
 	const void *end = dst + *dstn;
 	const void *in = src;
 	void *out = dst;
-	int has_block_checksum;
+	int has_block_checksum, has_content_checksum;
+	struct xxh32_state xxh;
 	int ret;
 	*dstn = 0;
 
@@ -56,6 +76,7 @@ int ulz4fn(const void *src, size_t srcn, void *dst, size_t *dstn)
 		independent_blocks = (flags >> 5) & 0x1;
 		has_block_checksum = (flags >> 4) & 0x1;
 		has_content_size = (flags >> 3) & 0x1;
+		has_content_checksum = (flags >> 2) & 0x1;
 
 		/* We assume there's always only a single, standard frame. */
 		if (magic != LZ4F_MAGIC || version != 1)
@@ -74,6 +95,9 @@ int ulz4fn(const void *src, size_t srcn, void *dst, size_t *dstn)
 		in += sizeof(u8);
 	}
 
+	if (CONFIG_IS_ENABLED(LZ4_CHECKSUM) && has_content_checksum)
+		xxh32_reset(&xxh, 0);
+
 	while (1) {
 		u32 block_header, block_size;
 
@@ -88,28 +112,49 @@ int ulz4fn(const void *src, size_t srcn, void *dst, size_t *dstn)
 
 		if (!block_size) {
 			ret = 0;	/* decompression successful */
+			if (!CONFIG_IS_ENABLED(LZ4_CHECKSUM) ||
+			    !has_content_checksum)
+				break;
+			/* Read before the output can reach it when in-place */
+			if (in - src + sizeof(u32) > srcn)
+				ret = -EINVAL;	/* input overrun */
+			else if (get_unaligned_le32(in) != xxh32_digest(&xxh))
+				ret = -EBADMSG;	/* content checksum mismatch */
 			break;
 		}
 
+		if (CONFIG_IS_ENABLED(LZ4_CHECKSUM) && has_block_checksum) {
+			if (in - src + block_size + sizeof(u32) > srcn) {
+				ret = -EINVAL;	/* input overrun */
+				break;
+			}
+			if (get_unaligned_le32(in + block_size) !=
+			    xxh32(in, block_size, 0)) {
+				ret = -EBADMSG;	/* block checksum mismatch */
+				break;
+			}
+		}
+
 		if (block_header & LZ4F_BLOCKUNCOMPRESSED_FLAG) {
 			size_t size = min((ptrdiff_t)block_size, end - out);
 			memcpy(out, in, size);
-			out += size;
+			ret = size;
 			if (size < block_size) {
+				out += size;
 				ret = -ENOBUFS;	/* output overrun */
 				break;
 			}
 		} else {
-			/* constant folding essential, do not touch params! */
-			ret = LZ4_decompress_generic(in, out, block_size,
-					end - out, endOnInputSize,
-					full, 0, noDict, out, NULL, 0);
+			ret = LZ4_decompress_safe(in, out, block_size, end - out);
 			if (ret < 0) {
 				ret = -EPROTO;	/* decompression error */
 				break;
 			}
-			out += ret;
 		}
+		/* Hash the block while it is still in the cache */
+		if (CONFIG_IS_ENABLED(LZ4_CHECKSUM) && has_content_checksum)
+			xxh32_update(&xxh, out, ret);
+		out += ret;
 
 		in += block_size;
 		if (has_block_checksum)
@@ -31,6 +31,113 @@
 #  define PUP(a) *++(a)
 #endif
 
+#ifdef INFLATE_FAST_64
+/*
+   U-Boot: unaligned 8 and 16 byte loads and stores. arm64 is built with
+   -mstrict-align, which would split a plain access into single bytes, so the
+   instructions are used directly there. They fault while the MMU is off,
+   which fast64_ok() checks for at run time.
+ */
+local inline int fast64_ok(void)
+{
+#ifdef CONFIG_ARM64
+    return dcache_status();
+#else
+    return 1;
+#endif
+}
+
+local inline u64 load64(const unsigned char FAR *src)
+{
+    u64 val;
+
+#ifdef CONFIG_ARM64
+    asm("ldr %0, %1" : "=r" (val) : "Q" (*(const u8 (*)[8])src));
+#else
+    memcpy(&val, src, sizeof(val));
+#endif
+    return val;
+}
+
+local inline void store64(unsigned char FAR *dst, u64 val)
+{
+#ifdef CONFIG_ARM64
+    asm("str %1, %0" : "=Q" (*(u8 (*)[8])dst) : "r" (val));
+#else
+    memcpy(dst, &val, sizeof(val));
+#endif
+}
+
+/*
+   U-Boot: bring hold up to at least 56 bits with one unaligned load. All
+   (63 - bits) / 8 whole bytes which fit are consumed; the bits of the next
+   byte that land above bits are loaded again, in the same place, by the next
+   refill. A literal/length code, its extra bits, a distance code and its
+   extra bits need at most 48 bits, so one refill covers a whole match.
+ */
+#  define REFILL() \
+    do { \
+        hold |= (unsigned long)le64_to_cpu(load64(in + OFF)) << bits; \
+        in += (63 - bits) >> 3; \
+        bits |= 56; \
+    } while (0)
+
+local inline void copy16(unsigned char FAR *dst, const unsigned char FAR *src)
+{
+#ifdef CONFIG_ARM64
+    asm("ldr q16, %1\n"
+        "str q16, %0\n"
+        : "=Q" (*(u8 (*)[16])dst) : "Q" (*(const u8 (*)[16])src) : "v16");
+#else
+    memcpy(dst, src, 16);
+#endif
+}
+
+/*
+   U-Boot: copy a match of len bytes at distance dist in 8 or 16 byte chunks,
+   writing up to 15 bytes beyond it. Below a distance of 8 the pattern is
+   kept in a register and rotated for each next word instead of being read
+   back from the output just written.
+ */
+local inline void chunk_copy(unsigned char FAR *out,
+                             const unsigned char FAR *from,
+                             unsigned dist, unsigned len)
+{
+    static const unsigned char rot[8] = {0, 0, 0, 2, 0, 3, 2, 1};
+    unsigned char FAR *end = out + len;
+    unsigned n, r;
+    u64 pat;
+
+    if (dist < 8) {
+        pat = load64(from) & ((1ULL << (8 * dist)) - 1);
+        for (n = dist; n < 8; n *= 2)
+            pat |= pat << (8 * n);
+        r = rot[dist];                  /* 8 % dist */
+        do {
+            store64(out, pat);
+            out += 8;
+            if (r)
+                pat = (pat >> (8 * r)) |
+                      ((pat << (8 * (dist - r))) & (~0ULL << (8 * (8 - r))));
+        } while (out < end);
+    }
+    else if (dist < 16) {
+        do {
+            store64(out, load64(from));
+            out += 8;
+            from += 8;
+        } while (out < end);
+    }
+    else {
+        do {
+            copy16(out, from);
+            out += 16;
+            from += 16;
+        } while (out < end);
+    }
+}
+#endif
+
 /*
    Decode literal, length, and distance codes and write out the resulting
    literal and match bytes until either not enough input or output is
@@ -42,7 +149,7 @@
    Entry assumptions:
 
         state->mode == LEN
-        strm->avail_in >= 6
+        strm->avail_in >= INFLATE_FAST_MIN_INPUT
         strm->avail_out >= 258
         start >= strm->avail_out
         state->bits < 8
@@ -59,7 +166,9 @@
       length code, 5 bits for the length extra, 15 bits for the distance code,
       and 13 bits for the distance extra.  This totals 48 bits, or six bytes.
       Therefore if strm->avail_in >= 6, then there is enough input to avoid
-      checking for available input while decoding.
+      checking for available input while decoding. With INFLATE_FAST_64
+      hold is refilled with an eight-byte load instead, so eight bytes must
+      be available.
 
     - The maximum bytes that a single length/distance pair can output is 258
       bytes, which is the maximum length that can be coded.  inflate_fast()
@@ -75,6 +184,10 @@ void inflate_fast(z_streamp strm, unsigned start)
     unsigned char FAR *out;     /* local strm->next_out */
     unsigned char FAR *beg;     /* inflate()'s initial strm->next_out */
     unsigned char FAR *end;     /* while out < end, enough space available */
+#ifdef INFLATE_FAST_64
+    unsigned char FAR *safe;    /* limit for chunked match copies */
+    int fast64;                 /* unaligned refills and copies allowed */
+#endif
 #ifdef INFLATE_STRICT
     unsigned dmax;              /* maximum distance from zlib header */
 #endif
@@ -98,18 +211,22 @@ void inflate_fast(z_streamp strm, unsigned start)
     /* copy state to local variables */
     state = (struct inflate_state FAR *)strm->state;
     in = strm->next_in - OFF;
-    last = in + (strm->avail_in - 5);
-    if (in > last && strm->avail_in > 5) {
+    last = in + (strm->avail_in - (INFLATE_FAST_MIN_INPUT - 1));
+    if (in > last && strm->avail_in > INFLATE_FAST_MIN_INPUT - 1) {
         /*
          * overflow detected, limit strm->avail_in to the
          * max. possible size and recalculate last
          */
 	strm->avail_in = 0xffffffff - (uintptr_t)in;
-        last = in + (strm->avail_in - 5);
+        last = in + (strm->avail_in - (INFLATE_FAST_MIN_INPUT - 1));
     }
     out = strm->next_out - OFF;
     beg = out - (start - strm->avail_out);
     end = out + (strm->avail_out - 257);
+#ifdef INFLATE_FAST_64
+    safe = out + strm->avail_out;
+    fast64 = fast64_ok();
+#endif
 #ifdef INFLATE_STRICT
     dmax = state->dmax;
 #endif
@@ -127,6 +244,12 @@ void inflate_fast(z_streamp strm, unsigned start)
     /* decode literals and length/distances until end-of-block or not enough
        input data or output space */
     do {
+#ifdef INFLATE_FAST_64
+        if (fast64) {
+            REFILL();
+        }
+        else
+#endif
         if (bits < 15) {
             hold += (unsigned long)(PUP(in)) << bits;
             bits += 8;
@@ -144,6 +267,15 @@ void inflate_fast(z_streamp strm, unsigned start)
                     "inflate:         literal '%c'\n" :
                     "inflate:         literal 0x%02x\n", this.val));
             PUP(out) = (unsigned char)(this.val);
+#ifdef INFLATE_FAST_64
+            /* a second literal still fits in hold and in the output */
+            this = lcode[hold & lmask];
+            if (fast64 && this.op == 0) {
+                hold >>= this.bits;
+                bits -= this.bits;
+                PUP(out) = (unsigned char)(this.val);
+            }
+#endif
         }
         else if (op & 16) {                     /* length base */
             len = (unsigned)(this.val);
@@ -252,6 +384,20 @@ void inflate_fast(z_streamp strm, unsigned start)
                             PUP(out) = PUP(from);
                     }
                 }
+#ifdef INFLATE_FAST_64
+                else {
+                    from = out - dist;          /* copy direct from output */
+                    if (fast64 && out + OFF + len + 15 < safe) {
+                        chunk_copy(out + OFF, from + OFF, dist, len);
+                        out += len;
+                    }
+                    else {
+                        do {
+                            PUP(out) = PUP(from);
+                        } while (--len);
+                    }
+                }
+#else
                 else {
 		    unsigned short *sout;
 		    unsigned long loops;
@@ -295,6 +441,7 @@ void inflate_fast(z_streamp strm, unsigned start)
 		    if (len & 1)
 			PUP(out) = PUP(from);
                 }
+#endif
             }
             else if ((op & 64) == 0) {          /* 2nd level distance code */
                 this = dcode[this.val + (hold & ((1U << op) - 1))];
@@ -331,7 +478,9 @@ void inflate_fast(z_streamp strm, unsigned start)
     /* update state and return */
     strm->next_in = in + OFF;
     strm->next_out = out + OFF;
-    strm->avail_in = (unsigned)(in < last ? 5 + (last - in) : 5 - (in - last));
+    strm->avail_in = (unsigned)(in < last ?
+                                (INFLATE_FAST_MIN_INPUT - 1) + (last - in) :
+                                (INFLATE_FAST_MIN_INPUT - 1) - (in - last));
     strm->avail_out = (unsigned)(out < end ?
                                  257 + (end - out) : 257 - (out - end));
     state->hold = hold;
@@ -8,4 +8,19 @@
    subject to change. Applications should only use zlib.h.
  */
 
+/*
+ * U-Boot: on little-endian 64-bit CPUs which handle unaligned loads and
+ * stores themselves, inflate_fast() refills its bit buffer eight bytes at a
+ * time and copies matches in chunks. On arm64 this is only done while the
+ * MMU is on, see fast64_ok(). SPL keeps the smaller code.
+ */
+#if !defined(CONFIG_SPL_BUILD) && defined(__LITTLE_ENDIAN) && \
+    (defined(CONFIG_ARM64) || defined(CONFIG_X86_64) || \
+     (defined(CONFIG_SANDBOX) && CONFIG_SANDBOX_BITS_PER_LONG == 64))
+#  define INFLATE_FAST_64
+#  define INFLATE_FAST_MIN_INPUT 8
+#else
+#  define INFLATE_FAST_MIN_INPUT 6
+#endif
+
 void inflate_fast OF((z_streamp strm, unsigned start));
@@ -378,9 +378,12 @@ int eth_rx(void)
 	if (!eth_is_active(current))
 		return -EINVAL;
 
-	/* Process up to 32 packets at one time */
+	/*
+	 * Drain the whole receive ring at one time, or at least 32 packets
+	 * for drivers which queue them elsewhere
+	 */
 	flags = ETH_RECV_CHECK_DEVICE;
-	for (i = 0; i < 32; i++) {
+	for (i = 0; i < max(PKTBUFSRX, 32); i++) {
 		ret = eth_get_ops(current)->recv(current, flags, &packet);
 		flags = 0;
 		if (ret > 0)
@@ -84,6 +84,15 @@
  *	Prerequisites:	- own ethernet address
  *	We want:	- magic packet or timeout
  *	Next step:	none
+ *
+ * WGET:
+ *
+ *	Prerequisites:	- own ethernet address
+ *			- own IP address
+ *			- HTTP server IP address
+ *			- path of the file on the server
+ *	We want:	- load the file
+ *	Next step:	none
  */
 
 
@@ -98,7 +107,9 @@
 #include <log.h>
 #include <net.h>
 #include <net/fastboot.h>
+#include <net/tcp.h>
 #include <net/tftp.h>
+#include <net/wget.h>
 #if defined(CONFIG_CMD_PCAP)
 #include <net/pcap.h>
 #endif
@@ -371,6 +382,9 @@ static void net_clear_handlers(void)
 static void net_cleanup_loop(void)
 {
 	net_clear_handlers();
+#if defined(CONFIG_PROT_TCP)
+	tcp_abort();
+#endif
 }
 
 void net_init(void)
@@ -539,6 +553,11 @@ restart:
 		case WOL:
 			wol_start();
 			break;
+#endif
+#if defined(CONFIG_CMD_WGET)
+		case WGET:
+			wget_start();
+			break;
 #endif
 		default:
 			break;
@@ -857,6 +876,14 @@ int net_send_ip_packet(uchar *ether, struct in_addr dest, int dport, int sport,
 				   payload_len);
 		pkt_hdr_size = eth_hdr_size + IP_UDP_HDR_SIZE;
 		break;
+#if defined(CONFIG_PROT_TCP)
+	case IPPROTO_TCP:
+		pkt_hdr_size = eth_hdr_size +
+			tcp_set_tcp_header(pkt + eth_hdr_size, dest, dport,
+					   sport, payload_len, action,
+					   tcp_seq_num, tcp_ack_num);
+		break;
+#endif
 	default:
 		return -EINVAL;
 	}
@@ -1263,6 +1290,11 @@ void net_process_received_packet(uchar *in_packet, int len)
 		if (ip->ip_p == IPPROTO_ICMP) {
 			receive_icmp(ip, len, src_ip, et);
 			return;
+#if defined(CONFIG_PROT_TCP)
+		} else if (ip->ip_p == IPPROTO_TCP) {
+			tcp_receive((struct ip_tcp_hdr *)ip, len);
+			return;
+#endif
 		} else if (ip->ip_p != IPPROTO_UDP) {	/* Only UDP packets */
 			return;
 		}
@@ -1366,6 +1398,9 @@ static int net_check_prereq(enum proto_t protocol)
 #endif
 #if defined(CONFIG_CMD_NFS)
 	case NFS:
+#endif
+#if defined(CONFIG_CMD_WGET)
+	case WGET:
 #endif
 		/* Fall through */
 	case TFTPGET:
@@ -28,6 +28,7 @@
 
 #include <common.h>
 #include <command.h>
+#include <env.h>
 #include <flash.h>
 #include <image.h>
 #include <log.h>
@@ -37,6 +38,7 @@
 #include "nfs.h"
 #include "bootp.h"
 #include <time.h>
+#include <linux/log2.h>
 
 #define HASHES_PER_LINE 65	/* Number of "loading" hashes per line	*/
 #define NFS_RETRY_COUNT 30
@@ -46,15 +48,39 @@
 # define NFS_TIMEOUT CONFIG_NFS_TIMEOUT
 #endif
 
+#ifndef CONFIG_NFS_WINDOWSIZE
+# define NFS_WINDOWSIZE 1
+#else
+# define NFS_WINDOWSIZE CONFIG_NFS_WINDOWSIZE
+#endif
+#define NFS_WINDOWSIZE_MAX 64
+
 #define NFS_RPC_ERR	1
 #define NFS_RPC_DROP	124
 
 static int fs_mounted;
 static unsigned long rpc_id;
-static int nfs_offset = -1;
-static int nfs_len;
+static uint nfs_offset;		/* next file offset to ask for */
+static int nfs_len;		/* number of bytes asked for by each READ */
 static ulong nfs_timeout = NFS_TIMEOUT;
 
+/*
+ * READ requests in flight. Each one has its own XID, which is kept when the
+ * request is sent again so that a late reply to the first copy still counts.
+ */
+struct nfs_read_slot {
+	unsigned long id;	/* XID of the request, 0 if the slot is free */
+	uint offset;		/* file offset asked for */
+	uint len;		/* number of bytes asked for */
+	ulong sent;		/* get_timer() value when last sent */
+	int retries;		/* times sent again after a timeout */
+};
+
+static struct nfs_read_slot nfs_read_slots[NFS_WINDOWSIZE_MAX];
+static int nfs_windowsize = NFS_WINDOWSIZE;
+static uint nfs_read_end;	/* file size once known, else UINT_MAX */
+static ulong nfs_read_bytes;	/* bytes received, for the progress hashes */
+
 static char dirfh[NFS_FHSIZE];	/* NFSv2 / NFSv3 file handle of directory */
 static char filefh[NFS3_FHSIZE]; /* NFSv2 / NFSv3 file handle */
 static int filefh3_length;	/* (variable) length of filefh when NFSv3 */
@@ -73,6 +99,7 @@ static int nfs_state;
 #define STATE_LOOKUP_REQ		5
 #define STATE_READ_REQ			6
 #define STATE_READLINK_REQ		7
+#define STATE_FSINFO_REQ		8
 
 static char *nfs_filename;
 static char *nfs_path;
@@ -173,17 +200,16 @@ static uint32_t *rpc_add_credentials(uint32_t *p)
 }
 
 /**************************************************************************
-RPC_LOOKUP - Lookup RPC Port numbers
+RPC_SEND - Send an RPC call with a given XID
 **************************************************************************/
-static void rpc_req(int rpc_prog, int rpc_proc, uint32_t *data, int datalen)
+static void rpc_send(unsigned long id, int rpc_prog, int rpc_proc,
+		     uint32_t *data, int datalen)
 {
 	struct rpc_t rpc_pkt;
-	unsigned long id;
 	uint32_t *p;
 	int pktlen;
 	int sport;
 
-	id = ++rpc_id;
 	rpc_pkt.u.call.id = htonl(id);
 	rpc_pkt.u.call.type = htonl(MSG_CALL);
 	rpc_pkt.u.call.rpcvers = htonl(2);	/* use RPC version 2 */
@@ -222,6 +248,14 @@ static void rpc_req(int rpc_prog, int rpc_proc, uint32_t *data, int datalen)
 			    nfs_our_port, pktlen);
 }
 
+/**************************************************************************
+RPC_LOOKUP - Lookup RPC Port numbers
+**************************************************************************/
+static void rpc_req(int rpc_prog, int rpc_proc, uint32_t *data, int datalen)
+{
+	rpc_send(++rpc_id, rpc_prog, rpc_proc, data, datalen);
+}
+
 /**************************************************************************
 RPC_LOOKUP - Lookup RPC Port numbers
 **************************************************************************/
@@ -361,7 +395,7 @@ static void nfs_lookup_req(char *fname)
 /**************************************************************************
 NFS_READ - Read File on NFS Server
 **************************************************************************/
-static void nfs_read_req(int offset, int readlen)
+static void nfs_read_req(struct nfs_read_slot *slot)
 {
 	uint32_t data[1024];
 	uint32_t *p;
@@ -373,22 +407,66 @@ static void nfs_read_req(int offset, int readlen)
 	if (supported_nfs_versions & NFSV2_FLAG) {
 		memcpy(p, filefh, NFS_FHSIZE);
 		p += (NFS_FHSIZE / 4);
-		*p++ = htonl(offset);
-		*p++ = htonl(readlen);
+		*p++ = htonl(slot->offset);
+		*p++ = htonl(slot->len);
 		*p++ = 0;
 	} else { /* NFSV3_FLAG */
 		*p++ = htonl(filefh3_length);
 		memcpy(p, filefh, filefh3_length);
 		p += (filefh3_length / 4);
 		*p++ = htonl(0); /* offset is 64-bit long, so fill with 0 */
-		*p++ = htonl(offset);
-		*p++ = htonl(readlen);
+		*p++ = htonl(slot->offset);
+		*p++ = htonl(slot->len);
 		*p++ = 0;
 	}
 
 	len = (uint32_t *)p - (uint32_t *)&(data[0]);
 
-	rpc_req(PROG_NFS, NFS_READ, data, len);
+	slot->sent = get_timer(0);
+	rpc_send(slot->id, PROG_NFS, NFS_READ, data, len);
+}
+
+/*
+ * Fill the free slots of the window with requests for the next blocks of the
+ * file, up to its end once that is known.
+ */
+static void nfs_read_fill(void)
+{
+	struct nfs_read_slot *slot;
+	int i;
+
+	for (i = 0; i < nfs_windowsize && nfs_offset < nfs_read_end; i++) {
+		slot = &nfs_read_slots[i];
+		if (slot->id)
+			continue;
+		slot->id = ++rpc_id;
+		slot->offset = nfs_offset;
+		slot->len = nfs_len;
+		slot->retries = 0;
+		nfs_offset += nfs_len;
+		nfs_read_req(slot);
+	}
+}
+
+/**************************************************************************
+NFS3_FSINFO - Get the transfer sizes supported by the server
+**************************************************************************/
+static void nfs3_fsinfo_req(void)
+{
+	uint32_t data[1024];
+	uint32_t *p;
+	int len;
+
+	p = &(data[0]);
+	p = rpc_add_credentials(p);
+
+	*p++ = htonl(filefh3_length);
+	memcpy(p, filefh, filefh3_length);
+	p += (filefh3_length / 4);
+
+	len = (uint32_t *)p - (uint32_t *)&(data[0]);
+
+	rpc_req(PROG_NFS, NFS3PROC_FSINFO, data, len);
 }
 
 /**************************************************************************
@@ -421,11 +499,14 @@ static void nfs_send(void)
 		nfs_lookup_req(nfs_filename);
 		break;
 	case STATE_READ_REQ:
-		nfs_read_req(nfs_offset, nfs_len);
+		nfs_read_fill();
 		break;
 	case STATE_READLINK_REQ:
 		nfs_readlink_req();
 		break;
+	case STATE_FSINFO_REQ:
+		nfs3_fsinfo_req();
+		break;
 	}
 }
 
@@ -664,21 +745,96 @@ static int nfs_readlink_reply(uchar *pkt, unsigned len)
 	return 0;
 }
 
-static int nfs_read_reply(uchar *pkt, unsigned len)
+/*
+ * Largest NFSv3 READ whose reply fits in one datagram: a single Ethernet frame,
+ * or the reassembly buffer when IP fragments are put back together.
+ */
+static int nfs3_read_size_max(void)
+{
+#ifdef CONFIG_IP_DEFRAG
+	int room = CONFIG_NET_MAXDEFRAG - IP_UDP_HDR_SIZE -
+		   (6 + NFS_MAX_ATTRS) * sizeof(uint32_t);
+
+	if (room > NFS_READ_SIZE)
+		return rounddown_pow_of_two(room);
+#endif
+	return NFS_READ_SIZE;
+}
+
+static int nfs3_fsinfo_reply(uchar *pkt, unsigned len)
 {
 	struct rpc_t rpc_pkt;
-	int rlen;
-	uchar *data_ptr;
+	int nfsv3_data_offset;
+	uint rtmax;
 
 	debug("%s\n", __func__);
 
-	memcpy(&rpc_pkt.u.data[0], pkt, sizeof(rpc_pkt.u.reply));
+	memcpy(&rpc_pkt.u.data[0], pkt, len);
 
 	if (ntohl(rpc_pkt.u.reply.id) > rpc_id)
 		return -NFS_RPC_ERR;
 	else if (ntohl(rpc_pkt.u.reply.id) < rpc_id)
 		return -NFS_RPC_DROP;
 
+	if (rpc_pkt.u.reply.rstatus  ||
+	    rpc_pkt.u.reply.verifier ||
+	    rpc_pkt.u.reply.astatus  ||
+	    rpc_pkt.u.reply.data[0])
+		return -NFS_RPC_ERR;
+
+	nfsv3_data_offset = nfs3_get_attributes_offset(rpc_pkt.u.reply.data);
+	/* rtmax, followed by rtpref, rtmult, wtmax, ... */
+	rtmax = ntohl(rpc_pkt.u.reply.data[1 + nfsv3_data_offset]);
+	if (rtmax)
+		nfs_len = min_t(uint, nfs_len, rtmax);
+
+	return 0;
+}
+
+static struct nfs_read_slot *nfs_read_slot(unsigned long id)
+{
+	int i;
+
+	for (i = 0; i < nfs_windowsize; i++) {
+		if (nfs_read_slots[i].id && nfs_read_slots[i].id == id)
+			return &nfs_read_slots[i];
+	}
+
+	return NULL;
+}
+
+static void nfs_read_progress(uint rlen)
+{
+	ulong step = NFS_READ_SIZE / 2 * 10;
+	ulong n;
+
+	for (n = nfs_read_bytes / step; n < (nfs_read_bytes + rlen) / step;
+	     n++) {
+		if (n && !(n % HASHES_PER_LINE))
+			puts("\n\t ");
+		putc('#');
+	}
+	nfs_read_bytes += rlen;
+}
+
+static int nfs_read_reply(uchar *pkt, unsigned len)
+{
+	struct rpc_t rpc_pkt;
+	struct nfs_read_slot *slot;
+	uint rlen;
+	uint end;
+	int eof;
+	uchar *data_ptr;
+
+	debug("%s\n", __func__);
+
+	/* Only the headers are copied, the data is stored from the packet */
+	memcpy(&rpc_pkt.u.data[0], pkt, min_t(uint, len, sizeof(rpc_pkt)));
+
+	slot = nfs_read_slot(ntohl(rpc_pkt.u.reply.id));
+	if (!slot)
+		return -NFS_RPC_DROP;
+
 	if (rpc_pkt.u.reply.rstatus  ||
 	    rpc_pkt.u.reply.verifier ||
 	    rpc_pkt.u.reply.astatus  ||
@@ -690,21 +846,19 @@ static int nfs_read_reply(uchar *pkt, unsigned len)
 		return -ntohl(rpc_pkt.u.reply.data[0]);
 	}
 
-	if ((nfs_offset != 0) && !((nfs_offset) %
-			(NFS_READ_SIZE / 2 * 10 * HASHES_PER_LINE)))
-		puts("\n\t ");
-	if (!(nfs_offset % ((NFS_READ_SIZE / 2) * 10)))
-		putc('#');
-
 	if (supported_nfs_versions & NFSV2_FLAG) {
 		rlen = ntohl(rpc_pkt.u.reply.data[18]);
 		data_ptr = (uchar *)&(rpc_pkt.u.reply.data[19]);
+		/* NFSv2 has no EOF flag, compare with the size attribute */
+		eof = !rlen || slot->offset + rlen >=
+			ntohl(rpc_pkt.u.reply.data[6]);
 	} else {  /* NFSV3_FLAG */
 		int nfsv3_data_offset =
 			nfs3_get_attributes_offset(rpc_pkt.u.reply.data);
 
 		/* count value */
 		rlen = ntohl(rpc_pkt.u.reply.data[1 + nfsv3_data_offset]);
+		eof = !rlen || rpc_pkt.u.reply.data[2 + nfsv3_data_offset];
 		/* Skip unused values :
 			EOF:		32 bits value,
 			data_size:	32 bits value,
@@ -713,21 +867,120 @@ static int nfs_read_reply(uchar *pkt, unsigned len)
 			&(rpc_pkt.u.reply.data[4 + nfsv3_data_offset]);
 	}
 
-	if (((uchar *)&(rpc_pkt.u.reply.data[0]) - (uchar *)(&rpc_pkt) + rlen) > len)
-			return -9999;
-
-	if (store_block(data_ptr, nfs_offset, rlen))
-			return -9999;
+	if (rlen > slot->len ||
+	    data_ptr - (uchar *)&rpc_pkt + rlen > len)
+		return -9999;
+
+	/* Replies past the end are empty and must not extend the file size */
+	if (rlen && store_block(pkt + (data_ptr - (uchar *)&rpc_pkt),
+				slot->offset, rlen))
+		return -9999;
+
+	nfs_read_progress(rlen);
+
+	if (eof) {
+		end = slot->offset + rlen;
+		if (end < nfs_read_end)
+			nfs_read_end = end;
+	} else if (rlen < slot->len) {
+		/* Short read, ask for the rest of the block again */
+		slot->id = ++rpc_id;
+		slot->offset += rlen;
+		slot->len -= rlen;
+		slot->retries = 0;
+		nfs_read_req(slot);
+		return rlen;
+	}
+	slot->id = 0;
 
 	return rlen;
 }
 
+/* Check whether all the blocks up to the end of the file are in */
+static bool nfs_read_done(void)
+{
+	int i;
+
+	if (nfs_read_end == UINT_MAX)
+		return false;
+
+	for (i = 0; i < nfs_windowsize; i++) {
+		if (!nfs_read_slots[i].id)
+			continue;
+		/* Requests past the end are not waited for */
+		if (nfs_read_slots[i].offset >= nfs_read_end)
+			nfs_read_slots[i].id = 0;
+		else
+			return false;
+	}
+
+	return true;
+}
+
+static ulong nfs_read_timeout(struct nfs_read_slot *slot)
+{
+	return nfs_timeout + NFS_TIMEOUT * slot->retries;
+}
+
+/* Time left until the first request in flight times out */
+static ulong nfs_read_next_timeout(void)
+{
+	ulong now = get_timer(0);
+	ulong left = nfs_timeout;
+	ulong age;
+	int i;
+
+	for (i = 0; i < nfs_windowsize; i++) {
+		struct nfs_read_slot *slot = &nfs_read_slots[i];
+
+		if (!slot->id)
+			continue;
+		age = now - slot->sent;
+		if (age >= nfs_read_timeout(slot))
+			return 1;
+		left = min(left, nfs_read_timeout(slot) - age);
+	}
+
+	return left;
+}
+
+/* Send again the requests that timed out, leaving the others alone */
+static int nfs_read_resend(void)
+{
+	ulong now = get_timer(0);
+	bool resent = false;
+	int i;
+
+	for (i = 0; i < nfs_windowsize; i++) {
+		struct nfs_read_slot *slot = &nfs_read_slots[i];
+
+		if (!slot->id || now - slot->sent < nfs_read_timeout(slot))
+			continue;
+		if (++slot->retries > NFS_RETRY_COUNT)
+			return -ETIMEDOUT;
+		nfs_read_req(slot);
+		resent = true;
+	}
+	if (resent)
+		puts("T ");
+
+	return 0;
+}
+
 /**************************************************************************
 Interfaces of U-BOOT
 **************************************************************************/
 static void nfs_timeout_handler(void)
 {
-	if (++nfs_timeout_count > NFS_RETRY_COUNT) {
+	if (nfs_state == STATE_READ_REQ) {
+		if (nfs_read_resend()) {
+			puts("\nRetry count exceeded; starting again\n");
+			net_start_again();
+			return;
+		}
+		net_set_timeout_handler(nfs_read_next_timeout(),
+					nfs_timeout_handler);
+	} else if (++nfs_timeout_count > NFS_RETRY_COUNT) {
 		puts("\nRetry count exceeded; starting again\n");
 		net_start_again();
 	} else {
@@ -739,6 +992,17 @@ static void nfs_timeout_handler(void)
 	}
 }
 
+static void nfs_read_start(void)
+{
+	nfs_state = STATE_READ_REQ;
+	memset(nfs_read_slots, 0, sizeof(nfs_read_slots));
+	nfs_offset = 0;
+	nfs_read_end = UINT_MAX;
+	nfs_read_bytes = 0;
+	nfs_send();
+	net_set_timeout_handler(nfs_read_next_timeout(), nfs_timeout_handler);
+}
+
 static void nfs_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 			unsigned src, unsigned len)
 {
@@ -747,7 +1011,8 @@ static void nfs_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 
 	debug("%s\n", __func__);
 
-	if (len > sizeof(struct rpc_t))
+	/* READ replies may be larger when IP fragments are reassembled */
+	if (len > sizeof(struct rpc_t) && nfs_state != STATE_READ_REQ)
 		return;
 
 	if (dest != nfs_our_port)
@@ -813,13 +1078,29 @@ static void nfs_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 			nfs_state = STATE_PRCLOOKUP_PROG_MOUNT_REQ;
 			nfs_send();
 		} else {
-			nfs_state = STATE_READ_REQ;
-			nfs_offset = 0;
 			nfs_len = NFS_READ_SIZE;
-			nfs_send();
+			if (!(supported_nfs_versions & NFSV2_FLAG) &&
+			    nfs3_read_size_max() > NFS_READ_SIZE) {
+				/* Ask for the largest READ the server takes */
+				nfs_len = nfs3_read_size_max();
+				nfs_state = STATE_FSINFO_REQ;
+				nfs_send();
+			} else {
+				nfs_read_start();
+			}
 		}
 		break;
 
+	case STATE_FSINFO_REQ:
+		reply = nfs3_fsinfo_reply(pkt, len);
+		if (reply == -NFS_RPC_DROP)
+			break;
+		if (reply)
+			nfs_len = NFS_READ_SIZE;
+		debug("NFS READ size %d\n", nfs_len);
+		nfs_read_start();
+		break;
+
 	case STATE_READLINK_REQ:
 		reply = nfs_readlink_reply(pkt, len);
 		if (reply == -NFS_RPC_DROP) {
@@ -842,16 +1123,19 @@ static void nfs_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 		rlen = nfs_read_reply(pkt, len);
 		if (rlen == -NFS_RPC_DROP)
 			break;
-		net_set_timeout_handler(nfs_timeout, nfs_timeout_handler);
-		if (rlen > 0) {
-			nfs_offset += rlen;
+		if (rlen >= 0 && !nfs_read_done()) {
 			nfs_send();
-		} else if ((rlen == -NFSERR_ISDIR) || (rlen == -NFSERR_INVAL)) {
+			net_set_timeout_handler(nfs_read_next_timeout(),
+						nfs_timeout_handler);
+			break;
+		}
+		net_set_timeout_handler(nfs_timeout, nfs_timeout_handler);
+		if ((rlen == -NFSERR_ISDIR) || (rlen == -NFSERR_INVAL)) {
 			/* symbolic link */
 			nfs_state = STATE_READLINK_REQ;
 			nfs_send();
 		} else {
-			if (!rlen)
+			if (rlen >= 0)
 				nfs_download_state = NETLOOP_SUCCESS;
 			if (rlen < 0)
 				debug("NFS READ error (%d)\n", rlen);
@@ -865,6 +1149,8 @@ static void nfs_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 
 void nfs_start(void)
 {
+	char *ep;
+
 	debug("%s\n", __func__);
 	nfs_download_state = NETLOOP_FAIL;
 
@@ -923,6 +1209,13 @@ void nfs_start(void)
 	nfs_timeout_count = 0;
 	nfs_state = STATE_PRCLOOKUP_PROG_MOUNT_REQ;
 
+	ep = env_get("nfswindowsize");
+	if (ep)
+		nfs_windowsize = simple_strtol(ep, NULL, 10);
+	else
+		nfs_windowsize = NFS_WINDOWSIZE;
+	nfs_windowsize = clamp(nfs_windowsize, 1, NFS_WINDOWSIZE_MAX);
+
 	/*nfs_our_port = 4096 + (get_ticks() % 3072);*/
 	/*FIX ME !!!*/
 	nfs_our_port = 1000;
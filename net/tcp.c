@@ -0,0 +1,799 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Minimal TCP client used for loading images over the network
+ *
+ * A single active connection is supported. The receive side is built for
+ * bulk transfers: it advertises a large scaled window (RFC 7323), accepts
+ * segments out of order and reports them with selective acknowledgments
+ * (RFC 2018) so that a lost segment costs one retransmission instead of
+ * stalling the stream. The send side only has to carry short requests, but
+ * still follows RFC 5681 and RFC 6298 for congestion control and
+ * retransmission timing.
+ */
+
+#include <common.h>
+#include <log.h>
+#include <net.h>
+#include <rand.h>
+#include <time.h>
+#include <net/tcp.h>
+#include <asm/unaligned.h>
+#include <linux/if_ether.h>
+#include <linux/kernel.h>
+#include "net_rand.h"
+
+/* Largest payload of a segment in an ethernet frame */
+#define TCP_MSS			(ETH_DATA_LEN - IP_TCP_HDR_SIZE)
+/* Segment size assumed when the peer does not announce one */
+#define TCP_DEFAULT_MSS		536
+/* Window scale we announce, giving windows up to 8MiB */
+#define TCP_RCV_WSCALE		7
+/* Largest receive window we advertise */
+#define TCP_RCV_WND_MAX		(4 << 20)
+/* Retransmission timeout bounds in ms (RFC 6298) */
+#define TCP_RTO_INIT		1000
+#define TCP_RTO_MIN		200
+#define TCP_RTO_MAX		10000
+/* Retransmissions of the SYN and of data before giving up */
+#define TCP_SYN_RETRIES		5
+#define TCP_RETRIES		10
+/* Give up when nothing has been heard from the peer for this long (ms) */
+#define TCP_IDLE_TIMEOUT	30000
+/* Longest delay of an acknowledgment (ms) */
+#define TCP_DELACK_MS		20
+/* Period of the timer driving retransmissions and delayed ACKs (ms) */
+#define TCP_TICK_MS		10
+/* Out-of-order ranges kept, and how many of them fit in a SACK option */
+#define TCP_OOO_RANGES		16
+#define TCP_SACK_BLOCKS		4
+/* Space for data queued for sending */
+#define TCP_TX_BUF_SIZE		2048
+/* First local port used; connections pick one at random above it */
+#define TCP_PORT_BASE		49152
+
+enum tcp_state {
+	TCP_CLOSED,
+	TCP_SYN_SENT,
+	TCP_ESTABLISHED,
+};
+
+/* Received data beyond a hole in the stream */
+struct tcp_range {
+	u32 start;
+	u32 end;
+};
+
+static struct tcp_conn {
+	enum tcp_state state;
+	const struct tcp_ops *ops;
+	struct in_addr remote_ip;
+	u16 remote_port;
+	u16 local_port;
+	uchar ethaddr[ARP_HLEN];
+
+	/* Send side */
+	u32 iss;
+	u32 snd_una;		/* Oldest unacknowledged sequence number */
+	u32 snd_nxt;		/* Next sequence number to send */
+	u32 snd_wnd;		/* Window of the peer, scaled */
+	u32 snd_mss;
+	u8 snd_wscale;
+	u32 cwnd;
+	u32 ssthresh;
+	int dupacks;
+	uchar tx_buf[TCP_TX_BUF_SIZE];	/* Data from snd_una onwards */
+	u32 tx_len;
+
+	/* Retransmission timer */
+	u32 srtt;		/* Smoothed round trip time, 0 until measured */
+	u32 rttvar;
+	u32 rto;
+	bool rtt_timing;	/* A segment is being timed */
+	u32 rtt_seq;		/* Sequence number that ends the sample */
+	ulong rtt_start;
+	bool rto_armed;
+	ulong rto_due;
+	int retries;
+
+	/* Receive side */
+	u32 irs;
+	u32 rcv_nxt;		/* Next sequence number expected */
+	u8 rcv_wscale;
+	bool sack_ok;
+	struct tcp_range ooo[TCP_OOO_RANGES];	/* Sorted by sequence */
+	int ooo_count;
+	int ooo_last;		/* Range changed last, reported first */
+	int unacked;		/* Segments received since our last ACK */
+	bool delack;
+	ulong delack_due;
+	ulong last_rx;
+} tcp;
+
+/* Options of the segment being sent, picked up by tcp_set_tcp_header() */
+static uchar tcp_opts[TCP_OPT_MAX];
+static int tcp_opts_len;
+
+static inline bool seq_before(u32 a, u32 b)
+{
+	return (s32)(a - b) < 0;
+}
+
+static inline bool seq_after(u32 a, u32 b)
+{
+	return (s32)(a - b) > 0;
+}
+
+static inline bool time_reached(ulong due)
+{
+	return (long)(get_timer(0) - due) >= 0;
+}
+
+/* Bytes of the received stream before sequence number @seq */
+static inline u32 tcp_rx_offset(u32 seq)
+{
+	return seq - tcp.irs - 1;
+}
+
+static u32 tcp_rcv_space(void)
+{
+	u32 space = tcp.ops->rx_space(tcp_rx_offset(tcp.rcv_nxt));
+
+	return min_t(u32, space, TCP_RCV_WND_MAX);
+}
+
+static u16 tcp_checksum(struct ip_tcp_hdr *ip, unsigned int tcp_len)
+{
+	uchar pseudo[12];
+	unsigned int sum;
+
+	memcpy(pseudo, &ip->ip_src, 4);
+	memcpy(pseudo + 4, &ip->ip_dst, 4);
+	pseudo[8] = 0;
+	pseudo[9] = IPPROTO_TCP;
+	put_unaligned_be16(tcp_len, pseudo + 10);
+
+	sum = compute_ip_checksum(pseudo, sizeof(pseudo));
+
+	return add_ip_checksums(sizeof(pseudo), sum,
+				compute_ip_checksum(&ip->tcp_src, tcp_len));
+}
+
+static int tcp_build_syn_options(uchar *opt)
+{
+	opt[0] = TCPOPT_MSS;
+	opt[1] = 4;
+	put_unaligned_be16(TCP_MSS, opt + 2);
+	opt[4] = TCPOPT_NOP;
+	opt[5] = TCPOPT_WSCALE;
+	opt[6] = 3;
+	opt[7] = TCP_RCV_WSCALE;
+	opt[8] = TCPOPT_NOP;
+	opt[9] = TCPOPT_NOP;
+	opt[10] = TCPOPT_SACK_PERM;
+	opt[11] = 2;
+
+	return 12;
+}
+
+/*
+ * Report the out-of-order ranges, starting with the one that changed last
+ * as RFC 2018 asks, followed by the others in sequence order.
+ */
+static int tcp_build_sack_option(uchar *opt)
+{
+	int i, n = 0;
+	int blocks = min(tcp.ooo_count, TCP_SACK_BLOCKS);
+	uchar *p = opt + 4;
+
+	for (i = -1; i < tcp.ooo_count && n < blocks; i++) {
+		int r = i < 0 ? tcp.ooo_last : i;
+
+		if (i == tcp.ooo_last)
+			continue;
+		put_unaligned_be32(tcp.ooo[r].start, p);
+		put_unaligned_be32(tcp.ooo[r].end, p + 4);
+		p += 8;
+		n++;
+	}
+
+	opt[0] = TCPOPT_NOP;
+	opt[1] = TCPOPT_NOP;
+	opt[2] = TCPOPT_SACK;
+	opt[3] = 2 + 8 * n;
+
+	return 4 + 8 * n;
+}
+
+static void tcp_xmit(u8 flags, u32 seq, const void *data, unsigned int len)
+{
+	uchar *pkt;
+
+	/* The packet waiting for ARP still sits in the transmit buffer */
+	if (arp_is_waiting())
+		return;
+
+	if (flags & TCP_SYN)
+		tcp_opts_len = tcp_build_syn_options(tcp_opts);
+	else if (tcp.sack_ok && tcp.ooo_count && !(flags & TCP_RST))
+		tcp_opts_len = tcp_build_sack_option(tcp_opts);
+	else
+		tcp_opts_len = 0;
+
+	pkt = net_tx_packet + net_eth_hdr_size() + IP_TCP_HDR_SIZE +
+	      tcp_opts_len;
+	if (len)
+		memcpy(pkt, data, len);
+
+	net_send_ip_packet(tcp.ethaddr, tcp.remote_ip, tcp.remote_port,
+			   tcp.local_port, len, IPPROTO_TCP, flags, seq,
+			   (flags & TCP_ACK) ? tcp.rcv_nxt : 0);
+
+	if (flags & TCP_ACK) {
+		tcp.unacked = 0;
+		tcp.delack = false;
+	}
+}
+
+int tcp_set_tcp_header(uchar *pkt, struct in_addr dest, int dport, int sport,
+		       int payload_len, u8 action, u32 tcp_seq_num,
+		       u32 tcp_ack_num)
+{
+	struct ip_tcp_hdr *ip = (struct ip_tcp_hdr *)pkt;
+	int hdr_len = IP_TCP_HDR_SIZE + tcp_opts_len;
+	u32 win;
+
+	net_set_ip_header(pkt, dest, net_ip, hdr_len + payload_len,
+			  IPPROTO_TCP);
+
+	if (action & TCP_SYN)
+		win = min_t(u32, tcp_rcv_space(), 0xffff);
+	else if (action & TCP_RST)
+		win = 0;
+	else
+		/*
+		 * Round up so that the last few bytes of the space can still
+		 * be filled; anything sent past them is trimmed on receipt.
+		 */
+		win = min_t(u32, DIV_ROUND_UP(tcp_rcv_space(),
+					      1 << tcp.rcv_wscale), 0xffff);
+
+	ip->tcp_src = htons(sport);
+	ip->tcp_dst = htons(dport);
+	ip->tcp_seq = htonl(tcp_seq_num);
+	ip->tcp_ack = htonl(tcp_ack_num);
+	ip->tcp_hlen = ((TCP_HDR_SIZE + tcp_opts_len) / 4) << 4;
+	ip->tcp_flags = action;
+	ip->tcp_win = htons(win);
+	ip->tcp_xsum = 0;
+	ip->tcp_urg = 0;
+	memcpy(pkt + IP_TCP_HDR_SIZE, tcp_opts, tcp_opts_len);
+
+	ip->tcp_xsum = tcp_checksum(ip, hdr_len - IP_HDR_SIZE + payload_len);
+
+	return hdr_len;
+}
+
+static void tcp_send_ack(void)
+{
+	tcp_xmit(TCP_ACK, tcp.snd_nxt, NULL, 0);
+}
+
+static void tcp_finish(int err)
+{
+	const struct tcp_ops *ops = tcp.ops;
+
+	tcp.state = TCP_CLOSED;
+	net_set_timeout_handler(0, NULL);
+	ops->closed(err);
+}
+
+static void tcp_arm_rto(void)
+{
+	tcp.rto_armed = true;
+	tcp.rto_due = get_timer(0) + tcp.rto;
+}
+
+/* Update the retransmission timeout with a new RTT sample (RFC 6298) */
+static void tcp_rtt_sample(u32 rtt)
+{
+	u32 delta;
+
+	if (!tcp.srtt) {
+		tcp.srtt = rtt ? rtt : 1;
+		tcp.rttvar = rtt / 2;
+	} else {
+		delta = tcp.srtt > rtt ? tcp.srtt - rtt : rtt - tcp.srtt;
+		tcp.rttvar = (3 * tcp.rttvar + delta) / 4;
+		tcp.srtt = (7 * tcp.srtt + rtt) / 8;
+	}
+	tcp.rto = tcp.srtt + max_t(u32, 4 * tcp.rttvar, TCP_TICK_MS);
+	tcp.rto = clamp_t(u32, tcp.rto, TCP_RTO_MIN, TCP_RTO_MAX);
+}
+
+/* Send what the congestion window and the peer's window allow */
+static void tcp_output(void)
+{
+	u32 off, wnd, len;
+
+	for (;;) {
+		off = tcp.snd_nxt - tcp.snd_una;
+		wnd = min(tcp.cwnd, tcp.snd_wnd);
+		if (off >= tcp.tx_len || off >= wnd)
+			break;
+
+		len = min3(tcp.tx_len - off, tcp.snd_mss, wnd - off);
+		tcp_xmit(TCP_ACK | TCP_PSH, tcp.snd_nxt, tcp.tx_buf + off, len);
+		if (!tcp.rtt_timing) {
+			tcp.rtt_timing = true;
+			tcp.rtt_seq = tcp.snd_nxt + len;
+			tcp.rtt_start = get_timer(0);
+		}
+		tcp.snd_nxt += len;
+		if (!tcp.rto_armed)
+			tcp_arm_rto();
+	}
+}
+
+static void tcp_retransmit_timeout(void)
+{
+	u32 flight = tcp.snd_nxt - tcp.snd_una;
+
+	if (++tcp.retries > (tcp.state == TCP_SYN_SENT ? TCP_SYN_RETRIES :
+			     TCP_RETRIES)) {
+		debug("TCP: too many retransmissions\n");
+		if (tcp.state != TCP_SYN_SENT)
+			tcp_xmit(TCP_RST | TCP_ACK, tcp.snd_nxt, NULL, 0);
+		tcp_finish(-ETIMEDOUT);
+		return;
+	}
+
+	/* Back off and give up on the sample (Karn's algorithm) */
+	tcp.rto = min(tcp.rto * 2, (u32)TCP_RTO_MAX);
+	tcp.rtt_timing = false;
+
+	if (tcp.state == TCP_SYN_SENT) {
+		tcp_xmit(TCP_SYN, tcp.iss, NULL, 0);
+		tcp_arm_rto();
+		return;
+	}
+
+	/* Go back to the oldest unacknowledged byte with a single segment */
+	tcp.ssthresh = max(flight / 2, 2 * tcp.snd_mss);
+	tcp.cwnd = tcp.snd_mss;
+	tcp.dupacks = 0;
+	tcp.snd_nxt = tcp.snd_una;
+	tcp.rto_armed = false;
+	tcp_output();
+}
+
+static void tcp_set_timer(void);
+
+static void tcp_timer(void)
+{
+	if (tcp.state == TCP_CLOSED)
+		return;
+	tcp_set_timer();
+
+	if (tcp.delack && time_reached(tcp.delack_due))
+		tcp_send_ack();
+
+	if (tcp.rto_armed && time_reached(tcp.rto_due)) {
+		tcp_retransmit_timeout();
+		return;
+	}
+
+	if (tcp.state != TCP_SYN_SENT &&
+	    get_timer(tcp.last_rx) > TCP_IDLE_TIMEOUT) {
+		debug("TCP: connection idle for too long\n");
+		tcp_xmit(TCP_RST | TCP_ACK, tcp.snd_nxt, NULL, 0);
+		tcp_finish(-ETIMEDOUT);
+	}
+}
+
+static void tcp_set_timer(void)
+{
+	net_set_timeout_handler(TCP_TICK_MS, tcp_timer);
+}
+
+int tcp_connect(struct in_addr dest, u16 port, const struct tcp_ops *ops)
+{
+	tcp_abort();
+
+	memset(&tcp, '\0', sizeof(tcp));
+	srand(seed_mac() ^ (unsigned int)get_ticks());
+
+	tcp.ops = ops;
+	tcp.remote_ip = dest;
+	tcp.remote_port = port;
+	tcp.local_port = TCP_PORT_BASE + rand() % (65536 - TCP_PORT_BASE);
+	tcp.iss = rand();
+	tcp.snd_una = tcp.iss;
+	tcp.snd_nxt = tcp.iss + 1;
+	tcp.snd_mss = TCP_DEFAULT_MSS;
+	tcp.rto = TCP_RTO_INIT;
+	tcp.state = TCP_SYN_SENT;
+
+	tcp.rtt_timing = true;
+	tcp.rtt_seq = tcp.snd_nxt;
+	tcp.rtt_start = get_timer(0);
+	tcp_arm_rto();
+	tcp_set_timer();
+
+	tcp_xmit(TCP_SYN, tcp.iss, NULL, 0);
+
+	return 0;
+}
+
+int tcp_send(const void *data, unsigned int len)
+{
+	if (tcp.state != TCP_ESTABLISHED)
+		return -ENOTCONN;
+	if (len > TCP_TX_BUF_SIZE - tcp.tx_len)
+		return -ENOBUFS;
+
+	memcpy(tcp.tx_buf + tcp.tx_len, data, len);
+	tcp.tx_len += len;
+	tcp_output();
+
+	return 0;
+}
+
+void tcp_close(void)
+{
+	if (tcp.state != TCP_ESTABLISHED)
+		return;
+
+	tcp_xmit(TCP_FIN | TCP_ACK, tcp.snd_una + tcp.tx_len, NULL, 0);
+	tcp.state = TCP_CLOSED;
+	net_set_timeout_handler(0, NULL);
+}
+
+void tcp_abort(void)
+{
+	if (tcp.state == TCP_CLOSED)
+		return;
+
+	if (tcp.state != TCP_SYN_SENT)
+		tcp_xmit(TCP_RST | TCP_ACK, tcp.snd_nxt, NULL, 0);
+	tcp.state = TCP_CLOSED;
+	net_set_timeout_handler(0, NULL);
+}
+
+static void tcp_parse_options(const uchar *opt, int len)
+{
+	while (len > 0) {
+		if (opt[0] == TCPOPT_EOL)
+			break;
+		if (opt[0] == TCPOPT_NOP) {
+			opt++;
+			len--;
+			continue;
+		}
+		if (len < 2 || opt[1] < 2 || opt[1] > len)
+			break;
+
+		switch (opt[0]) {
+		case TCPOPT_MSS:
+			if (opt[1] == 4)
+				tcp.snd_mss = clamp_t(u32,
+						      get_unaligned_be16(opt + 2),
+						      64, TCP_MSS);
+			break;
+		case TCPOPT_WSCALE:
+			if (opt[1] == 3) {
+				tcp.snd_wscale = min_t(u8, opt[2], 14);
+				tcp.rcv_wscale = TCP_RCV_WSCALE;
+			}
+			break;
+		case TCPOPT_SACK_PERM:
+			if (opt[1] == 2)
+				tcp.sack_ok = true;
+			break;
+		}
+		len -= opt[1];
+		opt += opt[1];
+	}
+}
+
+static void tcp_rcv_synsent(u8 flags, u32 seq, u32 ack, u16 win,
+			    const uchar *opt, int opt_len)
+{
+	if ((flags & TCP_ACK) && ack != tcp.iss + 1)
+		return;
+	if (flags & TCP_RST) {
+		if (flags & TCP_ACK)
+			tcp_finish(-ECONNREFUSED);
+		return;
+	}
+	if ((flags & (TCP_SYN | TCP_ACK)) != (TCP_SYN | TCP_ACK))
+		return;
+
+	tcp_parse_options(opt, opt_len);
+	tcp.irs = seq;
+	tcp.rcv_nxt = seq + 1;
+	tcp.snd_una = ack;
+	tcp.snd_wnd = win;
+	/* Initial window of RFC 6928 */
+	tcp.cwnd = min(10 * tcp.snd_mss, max(2 * tcp.snd_mss, 14600U));
+	tcp.ssthresh = ~0U;
+	if (!tcp.retries)
+		tcp_rtt_sample(get_timer(tcp.rtt_start));
+	tcp.rtt_timing = false;
+	tcp.rto_armed = false;
+	tcp.retries = 0;
+	tcp.state = TCP_ESTABLISHED;
+
+	tcp_send_ack();
+	tcp.ops->connected();
+}
+
+static void tcp_rcv_ack(u32 ack, u32 win, bool has_data)
+{
+	u32 acked, flight;
+
+	if (seq_after(ack, tcp.snd_nxt))
+		return;
+
+	if (seq_after(ack, tcp.snd_una)) {
+		acked = ack - tcp.snd_una;
+		if (acked > tcp.tx_len)
+			acked = tcp.tx_len;
+		memmove(tcp.tx_buf, tcp.tx_buf + acked, tcp.tx_len - acked);
+		tcp.tx_len -= acked;
+		tcp.snd_una = ack;
+
+		if (tcp.rtt_timing && !seq_before(ack, tcp.rtt_seq)) {
+			tcp_rtt_sample(get_timer(tcp.rtt_start));
+			tcp.rtt_timing = false;
+		}
+
+		if (tcp.dupacks >= 3)
+			tcp.cwnd = tcp.ssthresh;	/* Leave fast recovery */
+		else if (tcp.cwnd < tcp.ssthresh)
+			tcp.cwnd += min(acked, tcp.snd_mss);
+		else
+			tcp.cwnd += max(tcp.snd_mss * tcp.snd_mss / tcp.cwnd,
+					1U);
+		tcp.dupacks = 0;
+		tcp.retries = 0;
+
+		if (tcp.snd_una == tcp.snd_nxt)
+			tcp.rto_armed = false;
+		else
+			tcp_arm_rto();
+	} else if (ack == tcp.snd_una && tcp.snd_nxt != tcp.snd_una &&
+		   !has_data && win == tcp.snd_wnd) {
+		/* Fast retransmit and recovery (RFC 5681) */
+		if (++tcp.dupacks == 3) {
+			flight = tcp.snd_nxt - tcp.snd_una;
+			tcp.ssthresh = max(flight / 2, 2 * tcp.snd_mss);
+			tcp.rtt_timing = false;
+			tcp_xmit(TCP_ACK | TCP_PSH, tcp.snd_una, tcp.tx_buf,
+				 min(tcp.tx_len, tcp.snd_mss));
+			tcp.cwnd = tcp.ssthresh + 3 * tcp.snd_mss;
+		} else if (tcp.dupacks > 3) {
+			tcp.cwnd += tcp.snd_mss;
+		}
+	}
+
+	tcp.snd_wnd = win;
+	tcp_output();
+}
+
+/* Check that [start, end) can be recorded as out-of-order data */
+static bool tcp_ooo_fits(u32 start, u32 end)
+{
+	int i;
+
+	if (tcp.ooo_count < TCP_OOO_RANGES)
+		return true;
+	for (i = 0; i < tcp.ooo_count; i++) {
+		if (!seq_after(start, tcp.ooo[i].end) &&
+		    !seq_before(end, tcp.ooo[i].start))
+			return true;
+	}
+
+	return false;
+}
+
+static void tcp_ooo_add(u32 start, u32 end)
+{
+	int i, j;
+
+	/* Find the first range that ends at or after our start */
+	for (i = 0; i < tcp.ooo_count; i++) {
+		if (!seq_before(tcp.ooo[i].end, start))
+			break;
+	}
+
+	if (i == tcp.ooo_count || seq_before(end, tcp.ooo[i].start)) {
+		/* No overlap: insert a new range */
+		memmove(&tcp.ooo[i + 1], &tcp.ooo[i],
+			(tcp.ooo_count - i) * sizeof(tcp.ooo[0]));
+		tcp.ooo[i].start = start;
+		tcp.ooo[i].end = end;
+		tcp.ooo_count++;
+		tcp.ooo_last = i;
+		return;
+	}
+
+	/* Merge with range i and every following range we reach */
+	if (seq_before(start, tcp.ooo[i].start))
+		tcp.ooo[i].start = start;
+	if (seq_after(end, tcp.ooo[i].end))
+		tcp.ooo[i].end = end;
+	for (j = i + 1; j < tcp.ooo_count &&
+	     !seq_before(tcp.ooo[i].end, tcp.ooo[j].start); j++) {
+		if (seq_after(tcp.ooo[j].end, tcp.ooo[i].end))
+			tcp.ooo[i].end = tcp.ooo[j].end;
+	}
+	memmove(&tcp.ooo[i + 1], &tcp.ooo[j],
+		(tcp.ooo_count - j) * sizeof(tcp.ooo[0]));
+	tcp.ooo_count -= j - i - 1;
+	tcp.ooo_last = i;
+}
+
+/* Move rcv_nxt over the out-of-order ranges the stream has reached */
+static void tcp_ooo_advance(void)
+{
+	int n = 0;
+
+	while (n < tcp.ooo_count && !seq_after(tcp.ooo[n].start, tcp.rcv_nxt)) {
+		if (seq_after(tcp.ooo[n].end, tcp.rcv_nxt))
+			tcp.rcv_nxt = tcp.ooo[n].end;
+		n++;
+	}
+	if (!n)
+		return;
+
+	memmove(&tcp.ooo[0], &tcp.ooo[n],
+		(tcp.ooo_count - n) * sizeof(tcp.ooo[0]));
+	tcp.ooo_count -= n;
+	tcp.ooo_last = 0;
+}
+
+static void tcp_rcv_data(u32 seq, const uchar *data, unsigned int len,
+			 bool fin)
+{
+	u32 space, off;
+	bool in_order, had_gap;
+	int ret;
+
+	/* Drop what we already have */
+	if (seq_before(seq, tcp.rcv_nxt)) {
+		off = tcp.rcv_nxt - seq;
+		if (off >= len + fin) {
+			tcp_send_ack();
+			return;
+		}
+		if (off > len) {
+			/* Only the FIN is new */
+			off = len;
+		}
+		seq += off;
+		data += off;
+		len -= off;
+	}
+
+	/* ... and what does not fit in the window */
+	space = tcp_rcv_space();
+	off = seq - tcp.rcv_nxt;
+	if (off + len > space) {
+		len = off < space ? space - off : 0;
+		fin = false;
+	}
+	if (!len && !fin) {
+		tcp_send_ack();
+		return;
+	}
+
+	in_order = seq == tcp.rcv_nxt;
+	had_gap = tcp.ooo_count != 0;
+	if (len) {
+		if (!in_order && !tcp_ooo_fits(seq, seq + len)) {
+			tcp_send_ack();
+			return;
+		}
+		ret = tcp.ops->rx(tcp_rx_offset(seq), data, len);
+		if (tcp.state != TCP_ESTABLISHED)
+			return;
+		if (ret) {
+			tcp_send_ack();
+			return;
+		}
+		if (in_order) {
+			tcp.rcv_nxt += len;
+			tcp_ooo_advance();
+			tcp.ops->rx_ready(tcp_rx_offset(tcp.rcv_nxt));
+			if (tcp.state != TCP_ESTABLISHED)
+				return;
+		} else {
+			tcp_ooo_add(seq, seq + len);
+		}
+	}
+
+	if (fin && seq + len == tcp.rcv_nxt) {
+		/* The peer is done, and so are we */
+		tcp.rcv_nxt++;
+		tcp_xmit(TCP_FIN | TCP_ACK, tcp.snd_una + tcp.tx_len, NULL, 0);
+		tcp_finish(0);
+		return;
+	}
+
+	/*
+	 * Acknowledge every other segment (RFC 5681), and at once when data
+	 * arrives out of order or fills a hole, so the sender learns quickly
+	 * what to resend.
+	 */
+	if (!in_order || had_gap || ++tcp.unacked >= 2) {
+		tcp_send_ack();
+	} else if (!tcp.delack) {
+		tcp.delack = true;
+		tcp.delack_due = get_timer(0) + TCP_DELACK_MS;
+	}
+}
+
+void tcp_receive(struct ip_tcp_hdr *ip, unsigned int len)
+{
+	unsigned int hlen, dlen;
+	const uchar *data;
+	struct in_addr src;
+	u32 seq, ack;
+	u16 win;
+	u8 flags;
+
+	if (tcp.state == TCP_CLOSED || len < IP_TCP_HDR_SIZE)
+		return;
+
+	hlen = (ip->tcp_hlen >> 4) * 4;
+	if (hlen < TCP_HDR_SIZE || IP_HDR_SIZE + hlen > len)
+		return;
+
+	src = net_read_ip(&ip->ip_src);
+	if (src.s_addr != tcp.remote_ip.s_addr ||
+	    ntohs(ip->tcp_src) != tcp.remote_port ||
+	    ntohs(ip->tcp_dst) != tcp.local_port)
+		return;
+
+	if (tcp_checksum(ip, len - IP_HDR_SIZE)) {
+		debug("TCP: bad checksum\n");
+		return;
+	}
+
+	seq = ntohl(ip->tcp_seq);
+	ack = ntohl(ip->tcp_ack);
+	flags = ip->tcp_flags;
+	win = ntohs(ip->tcp_win);
+	data = (uchar *)ip + IP_HDR_SIZE + hlen;
+	dlen = len - IP_HDR_SIZE - hlen;
+	tcp.last_rx = get_timer(0);
+
+	if (tcp.state == TCP_SYN_SENT) {
+		tcp_rcv_synsent(flags, seq, ack, win,
+				(uchar *)ip + IP_TCP_HDR_SIZE,
+				hlen - TCP_HDR_SIZE);
+		return;
+	}
+
+	if (flags & TCP_RST) {
+		if (!seq_before(seq, tcp.rcv_nxt) &&
+		    seq - tcp.rcv_nxt <= max(tcp_rcv_space(), 1U))
+			tcp_finish(-ECONNRESET);
+		return;
+	}
+	if (flags & TCP_SYN) {
+		/* Our ACK of the SYN was lost */
+		tcp_send_ack();
+		return;
+	}
+	if (!(flags & TCP_ACK))
+		return;
+
+	tcp_rcv_ack(ack, (u32)win << tcp.snd_wscale,
+		    dlen || (flags & TCP_FIN));
+	if (tcp.state != TCP_ESTABLISHED)
+		return;
+
+	if (dlen || (flags & TCP_FIN))
+		tcp_rcv_data(seq, data, dlen, flags & TCP_FIN);
+}
@@ -34,6 +34,15 @@ DECLARE_GLOBAL_DATA_PTR;
 #endif
 /* Number of "loading" hashes per line (for checking the image size) */
 #define HASHES_PER_LINE	65
+/*
+ * Number of blocks past the expected one that are kept when packets of a
+ * window arrive out of order. Must be a power of two no larger than 65536.
+ */
+#define TFTP_REORDER_BLOCKS	256
+/* Number of blocks past a gap before it is taken as a loss */
+#define TFTP_NACK_THRESHOLD	3
+/* Millisecs to wait at least for the rest of a window */
+#define TFTP_STALL_MIN_MS	10
 
 /*
  *	TFTP operations.
@@ -103,6 +112,20 @@ static ushort	tftp_windowsize;
 static ushort	tftp_next_ack;
 /* Last nack block we send */
 static ushort	tftp_last_nack;
+/* Unexpected blocks received since the last progress or nack */
+static ushort	tftp_nack_count;
+/* Blocks received ahead of tftp_cur_block, one bit per block */
+static u8	tftp_ooo_map[TFTP_REORDER_BLOCKS / 8];
+/* Number of the short block ending the file, -1 if not seen yet */
+static int	tftp_final_block;
+/* Blocks received and loss events (nacks, timeouts) in this transfer */
+static ulong	tftp_rx_blocks;
+static ulong	tftp_loss_events;
+/* Time our last window ack was sent, to measure the round trip */
+static ulong	tftp_ack_time;
+static bool	tftp_ack_timed;
+/* Smoothed round trip time from window ack to next block, in ms */
+static ulong	tftp_rtt_ms;
 #ifdef CONFIG_CMD_TFTPPUT
 /* 1 if writing, else 0 */
 static int	tftp_put_active;
@@ -156,6 +179,13 @@ static char tftp_filename[MAX_LEN];
 static unsigned short tftp_block_size = TFTP_BLOCK_SIZE;
 static unsigned short tftp_block_size_option = CONFIG_TFTP_BLOCKSIZE;
 static unsigned short tftp_window_size_option = TFTP_WINDOWSIZE;
+/*
+ * Window size requested from the server. It starts at the configured one and
+ * is adapted to the loss seen by earlier transfers, see tftp_adapt_window().
+ */
+static unsigned short tftp_window_size_req;
+/* The tftp_window_size_option that tftp_window_size_req was adapted from */
+static unsigned short tftp_window_size_base;
 
 static inline int store_block(int block, uchar *src, unsigned int len)
 {
@@ -216,11 +246,126 @@ static void new_transfer(void)
 	tftp_prev_block = 0;
 	tftp_block_wrap = 0;
 	tftp_block_wrap_offset = 0;
+	tftp_nack_count = 0;
+	tftp_final_block = -1;
+	memset(tftp_ooo_map, 0, sizeof(tftp_ooo_map));
 #ifdef CONFIG_CMD_TFTPPUT
 	tftp_put_final_block_sent = 0;
 #endif
 }
 
+static inline bool ooo_test(ushort block)
+{
+	block %= TFTP_REORDER_BLOCKS;
+
+	return tftp_ooo_map[block / 8] & (1 << (block % 8));
+}
+
+static inline void ooo_set(ushort block)
+{
+	block %= TFTP_REORDER_BLOCKS;
+	tftp_ooo_map[block / 8] |= 1 << (block % 8);
+}
+
+static inline void ooo_clear(ushort block)
+{
+	block %= TFTP_REORDER_BLOCKS;
+	tftp_ooo_map[block / 8] &= ~(1 << (block % 8));
+}
+
+/**
+ * Store a block that arrived ahead of the one we are waiting for
+ *
+ * The block is written straight to its place in memory and remembered, so
+ * that it does not need to be sent again once the missing ones arrive.
+ * Blocks too far ahead, already stored or behind tftp_cur_block are ignored.
+ *
+ * @param block	Sequence number of the block received
+ * @param src	Block data
+ * @param len	Number of bytes in the block
+ * @return 0 if OK, non-zero if the block could not be stored
+ */
+static int store_block_ahead(ushort block, uchar *src, unsigned int len)
+{
+	ushort dist = block - (ushort)tftp_cur_block;
+
+	if (tftp_state != STATE_DATA || dist < 2 || dist > TFTP_REORDER_BLOCKS)
+		return 0;
+	if (tftp_final_block >= 0 &&
+	    (ushort)(tftp_final_block - tftp_cur_block) < dist)
+		return 0;
+	if (ooo_test(block))
+		return 0;
+
+	if (store_block(tftp_cur_block + dist - 1, src, len))
+		return -1;
+
+	ooo_set(block);
+	if (len < tftp_block_size)
+		tftp_final_block = block;
+	tftp_rx_blocks++;
+
+	return 0;
+}
+
+/**
+ * Check whether an unexpected block should be answered with a nack
+ *
+ * If one packet is dropped most likely all other buffers in the window that
+ * will arrive would cause sending a NACK. This just overwhelms the server, so
+ * send one per missing block, and only once a few blocks have come after the
+ * gap (it may just be reordered) or the remote has reached the end of its
+ * window. Send another one if a whole window goes by without progress, e.g.
+ * because the retransmitted block got lost as well.
+ *
+ * @param block	Sequence number of the block received
+ * @param len	Number of bytes in the block
+ * @return true to send a nack
+ */
+static bool tftp_nack_due(ushort block, unsigned int len)
+{
+	ushort dist = block - (ushort)tftp_cur_block;
+
+	if (++tftp_nack_count >= tftp_windowsize)
+		return true;
+	/* An old block sent again, wait for the rest of the window */
+	if (tftp_last_nack == tftp_cur_block || !dist || dist >= 0x8000)
+		return false;
+
+	return tftp_nack_count >= TFTP_NACK_THRESHOLD ||
+	       (short)(block - tftp_next_ack) >= 0 || len < tftp_block_size;
+}
+
+/**
+ * Adapt the window size asked for by the next transfer
+ *
+ * RFC 7440 fixes the window size for the whole transfer, so the loss seen by
+ * this one is used for the next. Every nack or timeout costs about a window
+ * of blocks sent again: halve the window when that is more than an eighth of
+ * the blocks received, and double it back towards tftpwindowsize when it is
+ * below 1/32 over at least eight windows.
+ */
+static void tftp_adapt_window(void)
+{
+	ulong resent = tftp_loss_events * tftp_window_size_req;
+
+	if (tftp_put_active || tftp_window_size_option <= 1)
+		return;
+
+	if (resent * 8 > tftp_rx_blocks && tftp_window_size_req > 1)
+		tftp_window_size_req /= 2;
+	else if (resent * 32 < tftp_rx_blocks &&
+		 tftp_rx_blocks >= 8 * tftp_window_size_req &&
+		 tftp_window_size_req < tftp_window_size_option)
+		tftp_window_size_req = min_t(ulong, tftp_window_size_req * 2,
+					     tftp_window_size_option);
+	else
+		return;
+
+	debug("TFTP %lu loss events in %lu blocks, next windowsize = %d\n",
+	      tftp_loss_events, tftp_rx_blocks, tftp_window_size_req);
+}
+
 #ifdef CONFIG_CMD_TFTPPUT
 /**
  * Load the next block from memory to be sent over tftp.
@@ -246,6 +391,7 @@ static int load_block(unsigned block, uchar *dst, unsigned len)
 
 static void tftp_send(void);
 static void tftp_timeout_handler(void);
+static void tftp_stall_handler(void);
 
 /**********************************************************************/
 
@@ -320,6 +466,7 @@ static void tftp_complete(void)
 	puts("  ");
 	print_size(tftp_tsize, "");
 #endif
+	tftp_adapt_window();
 	time_start = get_timer(time_start);
 	if (time_start > 0) {
 		puts("\n\t ");	/* Line up with "Loading: " */
@@ -377,9 +524,9 @@ static void tftp_send(void)
 		 * Implemented only for tftp get.
 		 * Don't bother sending if it's 1
 		 */
-		if (tftp_state == STATE_SEND_RRQ && tftp_window_size_option > 1)
+		if (tftp_state == STATE_SEND_RRQ && tftp_window_size_req > 1)
 			pkt += sprintf((char *)pkt, "windowsize%c%d%c",
-					0, tftp_window_size_option, 0);
+					0, tftp_window_size_req, 0);
 		len = pkt - xp;
 		break;
 
@@ -451,6 +598,34 @@ static void tftp_send(void)
 		net_set_state(NETLOOP_FAIL);
 }
 
+/* Ask the remote to send the window following tftp_cur_block again */
+static void tftp_send_nack(void)
+{
+	tftp_send();
+	tftp_last_nack = tftp_cur_block;
+	tftp_nack_count = 0;
+	tftp_loss_events++;
+	tftp_next_ack = (ushort)(tftp_cur_block + tftp_windowsize);
+}
+
+/*
+ * Check if part of the window has arrived but not its end. The remote waits
+ * for our ack after the last block of a window, so if that block was lost
+ * nothing more comes until its timeout: don't wait as long as that.
+ */
+static bool tftp_window_stalled(void)
+{
+	return tftp_windowsize > 1 &&
+	       (ushort)(tftp_next_ack - tftp_cur_block) < tftp_windowsize;
+}
+
+/* Time to wait for the rest of a window before nacking it */
+static ulong tftp_stall_timeout(void)
+{
+	return clamp(4 * tftp_rtt_ms, (ulong)TFTP_STALL_MIN_MS,
+		     timeout_ms / 8);
+}
+
 #ifdef CONFIG_CMD_TFTPPUT
 static void icmp_handler(unsigned type, unsigned code, unsigned dest,
 			 struct in_addr sip, unsigned src, uchar *pkt,
@@ -603,18 +778,18 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 			debug("Received unexpected block: %d, expected: %d\n",
 			      ntohs(*(__be16 *)pkt),
 			      (ushort)(tftp_cur_block + 1));
-			/*
-			 * If one packet is dropped most likely
-			 * all other buffers in the window
-			 * that will arrive will cause a sending NACK.
-			 * This just overwellms the server, let's just send one.
-			 */
-			if (tftp_last_nack != tftp_cur_block) {
-				tftp_send();
-				tftp_last_nack = tftp_cur_block;
-				tftp_next_ack = (ushort)(tftp_cur_block +
-							 tftp_windowsize);
+			if (store_block_ahead(ntohs(*(__be16 *)pkt), pkt + 2,
+					      len)) {
+				eth_halt();
+				net_set_state(NETLOOP_FAIL);
+				break;
 			}
+			if (tftp_nack_due(ntohs(*(__be16 *)pkt), len))
+				tftp_send_nack();
+			/* Part of a window came, see tftp_window_stalled() */
+			if (tftp_windowsize > 1)
+				net_set_timeout_handler(tftp_stall_timeout(),
+							tftp_stall_handler);
 			break;
 		}
 
@@ -649,27 +824,57 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 		update_block_number();
 		tftp_prev_block = tftp_cur_block;
 		timeout_count_max = tftp_timeout_count_max;
-		net_set_timeout_handler(timeout_ms, tftp_timeout_handler);
 
 		if (store_block(tftp_cur_block - 1, pkt + 2, len)) {
 			eth_halt();
 			net_set_state(NETLOOP_FAIL);
 			break;
 		}
+		tftp_rx_blocks++;
+		if (len < tftp_block_size)
+			tftp_final_block = tftp_cur_block;
+		if (tftp_ack_timed) {
+			tftp_rtt_ms = (3 * tftp_rtt_ms +
+				       get_timer(tftp_ack_time)) / 4;
+			tftp_ack_timed = false;
+		}
+
+		tftp_nack_count = 0;
+
+		/* Move over the blocks that already arrived out of order */
+		while (ooo_test(tftp_cur_block + 1)) {
+			ooo_clear(tftp_cur_block + 1);
+			tftp_cur_block++;
+			tftp_cur_block %= TFTP_SEQUENCE_SIZE;
+			update_block_number();
+			tftp_prev_block = tftp_cur_block;
+		}
+
+		if (tftp_final_block == (int)tftp_cur_block) {
+			tftp_send();
+			tftp_complete();
+			break;
+		}
 
 		/*
 		 *	Acknowledge the block just received, which will prompt
-		 *	the remote for the next one.
+		 *	the remote for the next one. Filling a gap may have
+		 *	taken us past the end of the window.
 		 */
-		if (tftp_cur_block == tftp_next_ack) {
+		if ((short)((ushort)tftp_cur_block - tftp_next_ack) >= 0) {
 			tftp_send();
-			tftp_next_ack += tftp_windowsize;
+			tftp_next_ack = (ushort)(tftp_cur_block +
+						 tftp_windowsize);
+			tftp_ack_time = get_timer(0);
+			tftp_ack_timed = true;
 		}
 
-		if (len < tftp_block_size) {
-			tftp_send();
-			tftp_complete();
-		}
+		if (tftp_window_stalled())
+			net_set_timeout_handler(tftp_stall_timeout(),
+						tftp_stall_handler);
+		else
+			net_set_timeout_handler(timeout_ms,
+						tftp_timeout_handler);
 		break;
 
 	case TFTP_ERROR:
@@ -700,16 +905,29 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 
 static void tftp_timeout_handler(void)
 {
+	tftp_loss_events++;
 	if (++timeout_count > timeout_count_max) {
+		tftp_adapt_window();
 		restart("Retry count exceeded");
 	} else {
 		puts("T ");
 		net_set_timeout_handler(timeout_ms, tftp_timeout_handler);
 		if (tftp_state != STATE_RECV_WRQ)
 			tftp_send();
+		/* The remote sends the whole window again after our ack */
+		if (tftp_state == STATE_DATA)
+			tftp_next_ack = (ushort)(tftp_cur_block +
+						 tftp_windowsize);
 	}
 }
 
+static void tftp_stall_handler(void)
+{
+	debug("TFTP window stalled after block %lu\n", tftp_cur_block);
+	net_set_timeout_handler(timeout_ms, tftp_timeout_handler);
+	tftp_send_nack();
+}
+
 /* Initialize tftp_load_addr and tftp_load_size from image_load_addr and lmb */
 static int tftp_init_load_addr(void)
 {
@@ -768,8 +986,14 @@ void tftp_start(enum proto_t protocol)
 	}
 #endif
 
+	/* Start adapting again whenever the configured window size changes */
+	if (tftp_window_size_base != tftp_window_size_option) {
+		tftp_window_size_base = tftp_window_size_option;
+		tftp_window_size_req = tftp_window_size_option;
+	}
+
 	debug("TFTP blocksize = %i, TFTP windowsize = %d timeout = %ld ms\n",
-	      tftp_block_size_option, tftp_window_size_option, timeout_ms);
+	      tftp_block_size_option, tftp_window_size_req, timeout_ms);
 
 	tftp_remote_ip = net_server_ip;
 	if (!net_parse_bootfile(&tftp_remote_ip, tftp_filename, MAX_LEN)) {
@@ -867,6 +1091,10 @@ void tftp_start(enum proto_t protocol)
 	tftp_cur_block = 0;
 	tftp_windowsize = 1;
 	tftp_last_nack = 0;
+	tftp_rx_blocks = 0;
+	tftp_loss_events = 0;
+	tftp_ack_timed = false;
+	tftp_rtt_ms = timeout_ms / 32;
 	/* zero out server ether in case the server ip has changed */
 	memset(net_server_ethaddr, 0, 6);
 	/* Revert tftp_block_size to dflt */
@@ -904,6 +1132,9 @@ void tftp_start_server(void)
 	/* Revert tftp_block_size to dflt */
 	tftp_block_size = TFTP_BLOCK_SIZE;
 	tftp_cur_block = 0;
+	tftp_windowsize = 1;
+	tftp_next_ack = 1;
+	tftp_last_nack = 0;
 	tftp_our_port = WELL_KNOWN_PORT;
 
 #ifdef CONFIG_TFTP_TSIZE
@@ -0,0 +1,513 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * HTTP/1.1 client loading files over TCP
+ *
+ * The body of the response is stored at its final place as soon as a
+ * segment arrives, in order or not, so the TCP window can span as much of
+ * the load area as the stack allows. A chunked body is received the same
+ * way and decoded in place once it is contiguous: the decoded data is never
+ * longer than the encoded data, so it only ever moves down. When streaming
+ * into a file, the load area is a bounce buffer that is written out
+ * whenever it fills up.
+ */
+
+#include <common.h>
+#include <env.h>
+#include <fs.h>
+#include <image.h>
+#include <lmb.h>
+#include <log.h>
+#include <mapmem.h>
+#include <net.h>
+#include <time.h>
+#include <net/tcp.h>
+#include <net/wget.h>
+#include <linux/ctype.h>
+#include <linux/kernel.h>
+
+DECLARE_GLOBAL_DATA_PTR;
+
+#define WGET_PORT		80
+/* Largest response header accepted */
+#define WGET_HDR_MAX		4096
+/* Largest bounce buffer used when streaming into a file */
+#define WGET_FILE_BUF_MAX	(16 << 20)
+/* Body bytes per '#' progress mark */
+#define WGET_HASH_BYTES		(64 << 10)
+#define HASHES_PER_LINE		65
+
+enum wget_state {
+	WGET_HEADER,		/* Collecting the response header */
+	WGET_BODY,		/* Body sent as is */
+	WGET_CHUNK_SIZE,	/* Chunked body: reading a chunk size line */
+	WGET_CHUNK_DATA,	/* Chunked body: reading chunk data */
+	WGET_CHUNK_END,		/* Chunked body: CRLF after chunk data */
+	WGET_CHUNK_TRAILER,	/* Chunked body: trailer after the last chunk */
+	WGET_DONE,
+};
+
+static enum wget_state wget_state;
+static struct in_addr wget_server_ip;
+static u16 wget_server_port;
+static char wget_path[sizeof(net_boot_file_name)];
+static char wget_hdr[WGET_HDR_MAX + 1];
+static u32 wget_hdr_rcvd;		/* Header bytes received so far */
+static u32 wget_hdr_len;		/* Header length, once complete */
+static ulong wget_load_addr;		/* Memory receiving the body */
+static ulong wget_load_size;
+static ulong wget_raw_base;		/* Received body byte at wget_load_addr */
+static ulong wget_raw_len;		/* Received body bytes in order */
+static ulong wget_raw_decoded;		/* Chunked body bytes decoded */
+static ulong wget_body_len;		/* Decoded body bytes */
+static ulong wget_content_len;
+static bool wget_content_len_known;
+static ulong wget_flushed;		/* Body bytes written to the file */
+static ulong wget_chunk_left;
+static char wget_line[32];		/* Chunk size or trailer line */
+static int wget_line_len;
+static int wget_hashes;
+static ulong wget_time_start;
+
+/* File receiving the body, if not loading into memory */
+static const char *wget_ifname;
+static const char *wget_dev_part;
+static const char *wget_filename;
+
+void wget_set_file(const char *ifname, const char *dev_part,
+		   const char *filename)
+{
+	wget_ifname = ifname;
+	wget_dev_part = dev_part;
+	wget_filename = filename;
+}
+
+static void wget_fail(const char *msg)
+{
+	printf("\nHTTP error: %s\n", msg);
+	tcp_abort();
+	net_set_state(NETLOOP_FAIL);
+}
+
+static void wget_show_progress(void)
+{
+	while (wget_hashes < wget_body_len / WGET_HASH_BYTES) {
+		putc('#');
+		if (++wget_hashes % HASHES_PER_LINE == 0)
+			puts("\n\t ");
+	}
+}
+
+/* Write the buffered part of the body to the file */
+static int wget_flush(void)
+{
+	ulong len = wget_body_len - wget_flushed;
+	loff_t actwrite;
+	int ret;
+
+	if (!len && wget_flushed)
+		return 0;
+
+	if (fs_set_blk_dev(wget_ifname, wget_dev_part, FS_TYPE_ANY))
+		return -ENODEV;
+	ret = fs_write(wget_filename, wget_load_addr, wget_flushed, len,
+		       &actwrite);
+	if (ret || actwrite != len)
+		return -EIO;
+	wget_flushed += len;
+
+	return 0;
+}
+
+/* Append decoded chunk data, which always lies at or after its target */
+static void wget_put(const uchar *data, ulong len)
+{
+	void *ptr = map_sysmem(wget_load_addr + wget_body_len - wget_flushed,
+			       len);
+
+	memmove(ptr, data, len);
+	unmap_sysmem(ptr);
+	wget_body_len += len;
+}
+
+static int wget_chunk_line(const char *line)
+{
+	switch (wget_state) {
+	case WGET_CHUNK_SIZE:
+		if (!isxdigit(line[0]))
+			return -EPROTO;
+		wget_chunk_left = simple_strtoul(line, NULL, 16);
+		wget_state = wget_chunk_left ? WGET_CHUNK_DATA :
+			     WGET_CHUNK_TRAILER;
+		break;
+	case WGET_CHUNK_END:
+		if (line[0])
+			return -EPROTO;
+		wget_state = WGET_CHUNK_SIZE;
+		break;
+	case WGET_CHUNK_TRAILER:
+		if (!line[0])
+			wget_state = WGET_DONE;
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+/* Decode the next piece of a chunked body */
+static int wget_chunked_rx(const uchar *data, ulong len)
+{
+	ulong n;
+	int ret;
+
+	while (len && wget_state != WGET_DONE) {
+		if (wget_state == WGET_CHUNK_DATA) {
+			n = min(len, wget_chunk_left);
+			wget_put(data, n);
+			data += n;
+			len -= n;
+			wget_chunk_left -= n;
+			if (!wget_chunk_left)
+				wget_state = WGET_CHUNK_END;
+			continue;
+		}
+
+		/* Framing is line based; only the start of a line matters */
+		if (*data != '\n') {
+			if (wget_line_len < sizeof(wget_line) - 1)
+				wget_line[wget_line_len++] = *data;
+			data++;
+			len--;
+			continue;
+		}
+		data++;
+		len--;
+		if (wget_line_len && wget_line[wget_line_len - 1] == '\r')
+			wget_line_len--;
+		wget_line[wget_line_len] = '\0';
+		wget_line_len = 0;
+		ret = wget_chunk_line(wget_line);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* Store received body bytes at body stream position @pos */
+static int wget_store(ulong pos, const uchar *data, ulong len)
+{
+	void *ptr;
+
+	if (wget_state == WGET_BODY && wget_content_len_known) {
+		if (pos >= wget_content_len)
+			return 0;
+		len = min(len, wget_content_len - pos);
+	}
+	if (pos - wget_raw_base + len > wget_load_size)
+		return -EFBIG;
+
+	ptr = map_sysmem(wget_load_addr + pos - wget_raw_base, len);
+	memcpy(ptr, data, len);
+	unmap_sysmem(ptr);
+
+	return 0;
+}
+
+/*
+ * Parse the response header once it is complete. Return 1 if it was parsed,
+ * 0 if more of it is needed, or -ve on error.
+ */
+static int wget_parse_header(u32 len)
+{
+	char *end, *line, *next, *p;
+	ulong status;
+	int eol;
+
+	wget_hdr[len] = '\0';
+	end = strstr(wget_hdr, "\r\n\r\n");
+	if (!end) {
+		if (len >= WGET_HDR_MAX) {
+			wget_fail("response header too long");
+			return -E2BIG;
+		}
+		return 0;
+	}
+	wget_hdr_len = end + 4 - wget_hdr;
+	*end = '\0';
+
+	eol = strcspn(wget_hdr, "\r");
+	p = strchr(wget_hdr, ' ');
+	if (strncmp(wget_hdr, "HTTP/1.", 7) || !p) {
+		wget_fail("bad response");
+		return -EPROTO;
+	}
+	status = simple_strtoul(p + 1, NULL, 10);
+	if (status != 200) {
+		printf("\nHTTP error: %.*s\n", eol, wget_hdr);
+		tcp_abort();
+		net_set_state(NETLOOP_FAIL);
+		return -ENOENT;
+	}
+
+	wget_state = WGET_BODY;
+	for (line = strstr(wget_hdr, "\r\n"); line; line = next) {
+		line += 2;
+		next = strstr(line, "\r\n");
+		if (next)
+			*next = '\0';
+		p = strchr(line, ':');
+		if (!p)
+			continue;
+		for (p++; *p == ' ' || *p == '\t'; p++)
+			;
+		if (!strncasecmp(line, "Content-Length:", 15)) {
+			wget_content_len = simple_strtoul(p, NULL, 10);
+			wget_content_len_known = true;
+		} else if (!strncasecmp(line, "Transfer-Encoding:", 18) &&
+			   strstr(p, "chunked")) {
+			wget_state = WGET_CHUNK_SIZE;
+		}
+	}
+	if (wget_state != WGET_BODY)
+		wget_content_len_known = false;
+
+	if (wget_content_len_known && !wget_filename &&
+	    wget_content_len > wget_load_size) {
+		wget_fail("file too large for the load area");
+		return -EFBIG;
+	}
+
+	if (len > wget_hdr_len &&
+	    wget_store(0, (uchar *)wget_hdr + wget_hdr_len,
+		       len - wget_hdr_len)) {
+		wget_fail("file too large for the load area");
+		return -EFBIG;
+	}
+
+	return 1;
+}
+
+static void wget_done(void)
+{
+	ulong elapsed;
+
+	wget_state = WGET_DONE;
+	tcp_close();
+	if (wget_filename && wget_flush()) {
+		printf("\nHTTP error: cannot write '%s'\n", wget_filename);
+		net_set_state(NETLOOP_FAIL);
+		return;
+	}
+
+	net_boot_file_size = wget_body_len;
+	wget_show_progress();
+	elapsed = get_timer(wget_time_start);
+	if (elapsed > 0) {
+		puts("\n\t ");	/* Line up with "Loading: " */
+		print_size(wget_body_len / elapsed * 1000, "/s");
+	}
+	puts("\ndone\n");
+	net_set_state(NETLOOP_SUCCESS);
+}
+
+static void wget_connected(void)
+{
+	char req[sizeof(wget_path) + 128];
+	int len;
+
+	len = snprintf(req, sizeof(req),
+		       "GET %s%s HTTP/1.1\r\n"
+		       "Host: %pI4:%u\r\n"
+		       "User-Agent: U-Boot\r\n"
+		       "Connection: close\r\n\r\n",
+		       wget_path[0] == '/' ? "" : "/", wget_path,
+		       &wget_server_ip, wget_server_port);
+	if (tcp_send(req, len))
+		wget_fail("request too long");
+}
+
+static u32 wget_rx_space(u32 len)
+{
+	/* The header has to arrive in order so it is known where data goes */
+	if (wget_state == WGET_HEADER)
+		return WGET_HDR_MAX - len;
+
+	return min_t(ulong, wget_raw_base + wget_load_size -
+			    (len - wget_hdr_len), ~0U);
+}
+
+static int wget_rx(u32 offset, const uchar *data, unsigned int len)
+{
+	u32 skip;
+
+	if (wget_state == WGET_HEADER) {
+		if (offset != wget_hdr_rcvd)
+			return -EAGAIN;
+		memcpy(wget_hdr + offset, data, len);
+		wget_hdr_rcvd += len;
+		return 0;
+	}
+
+	if (offset < wget_hdr_len) {
+		skip = wget_hdr_len - offset;
+		if (skip >= len)
+			return 0;
+		offset += skip;
+		data += skip;
+		len -= skip;
+	}
+
+	return wget_store(offset - wget_hdr_len, data, len);
+}
+
+static void wget_rx_ready(u32 len)
+{
+	const uchar *ptr;
+	ulong n;
+	int ret;
+
+	if (wget_state == WGET_HEADER && wget_parse_header(len) <= 0)
+		return;
+
+	wget_raw_len = len - wget_hdr_len;
+	if (wget_state == WGET_BODY) {
+		wget_body_len = wget_raw_len;
+		if (wget_content_len_known)
+			wget_body_len = min(wget_body_len, wget_content_len);
+	} else if (wget_state != WGET_DONE) {
+		n = wget_raw_len - wget_raw_decoded;
+		ptr = map_sysmem(wget_load_addr + wget_raw_decoded -
+				 wget_raw_base, n);
+		ret = wget_chunked_rx(ptr, n);
+		unmap_sysmem(ptr);
+		wget_raw_decoded = wget_raw_len;
+		if (ret) {
+			wget_fail("bad chunked encoding");
+			return;
+		}
+	}
+	wget_show_progress();
+
+	if (wget_state == WGET_DONE ||
+	    (wget_state == WGET_BODY && wget_content_len_known &&
+	     wget_body_len == wget_content_len)) {
+		wget_done();
+		return;
+	}
+
+	/* Once the buffer is full it is written out and used again */
+	if (wget_raw_len - wget_raw_base == wget_load_size) {
+		if (!wget_filename)
+			wget_fail("file too large for the load area");
+		else if (wget_flush())
+			wget_fail("cannot write the file");
+		else
+			wget_raw_base = wget_raw_len;
+	}
+}
+
+static void wget_closed(int err)
+{
+	if (err) {
+		printf("\nHTTP error: connection %s\n",
+		       err == -ECONNREFUSED ? "refused" :
+		       err == -ECONNRESET ? "reset" : "timed out");
+		net_set_state(NETLOOP_FAIL);
+		return;
+	}
+
+	/* Without a length the body ends with the connection */
+	if (wget_state == WGET_BODY && !wget_content_len_known) {
+		wget_done();
+		return;
+	}
+	if (wget_state != WGET_DONE) {
+		puts("\nHTTP error: connection closed early\n");
+		net_set_state(NETLOOP_FAIL);
+	}
+}
+
+static const struct tcp_ops wget_tcp_ops = {
+	.connected	= wget_connected,
+	.rx		= wget_rx,
+	.rx_ready	= wget_rx_ready,
+	.rx_space	= wget_rx_space,
+	.closed		= wget_closed,
+};
+
+static int wget_init_load_addr(void)
+{
+#ifdef CONFIG_LMB
+	struct lmb lmb;
+	phys_size_t max_size;
+
+	lmb_init_and_reserve(&lmb, gd->bd, (void *)gd->fdt_blob);
+
+	max_size = lmb_get_free_size(&lmb, image_load_addr);
+	if (!max_size)
+		return -1;
+
+	wget_load_size = max_size;
+#else
+	wget_load_size = ~0UL - image_load_addr;
+#endif
+	if (wget_filename)
+		wget_load_size = min_t(ulong, wget_load_size,
+				       WGET_FILE_BUF_MAX);
+	wget_load_addr = image_load_addr;
+
+	return 0;
+}
+
+void wget_start(void)
+{
+	char *ep;
+
+	wget_server_ip = net_server_ip;
+	if (!net_parse_bootfile(&wget_server_ip, wget_path,
+				sizeof(wget_path))) {
+		puts("HTTP error: no file name given\n");
+		net_set_state(NETLOOP_FAIL);
+		return;
+	}
+
+	wget_server_port = WGET_PORT;
+	ep = env_get("httpdstp");
+	if (ep)
+		wget_server_port = simple_strtoul(ep, NULL, 10);
+
+	printf("Using %s device\n", eth_get_name());
+	printf("HTTP from server %pI4; our IP address is %pI4\n",
+	       &wget_server_ip, &net_ip);
+	printf("Filename '%s'.", wget_path);
+	if (wget_filename)
+		printf(" Writing to '%s' on %s %s.", wget_filename,
+		       wget_ifname, wget_dev_part);
+	putc('\n');
+
+	if (wget_init_load_addr()) {
+		puts("\nHTTP error: trying to overwrite reserved memory...\n");
+		net_set_state(NETLOOP_FAIL);
+		return;
+	}
+	printf("Load address: 0x%lx\n", wget_load_addr);
+	puts("Loading: *\b");
+
+	wget_state = WGET_HEADER;
+	wget_hdr_rcvd = 0;
+	wget_hdr_len = 0;
+	wget_raw_base = 0;
+	wget_raw_len = 0;
+	wget_raw_decoded = 0;
+	wget_body_len = 0;
+	wget_content_len = 0;
+	wget_content_len_known = false;
+	wget_flushed = 0;
+	wget_line_len = 0;
+	wget_hashes = 0;
+	wget_time_start = get_timer(0);
+
+	tcp_connect(wget_server_ip, wget_server_port, &wget_tcp_ops);
+}
@@ -4,6 +4,7 @@
  */
 
 #include <common.h>
+#include <blk.h>
 #include <bootm.h>
 #include <command.h>
 #include <gzip.h>
@@ -12,7 +13,10 @@
 #include <lz4.h>
 #include <malloc.h>
 #include <mapmem.h>
+#include <os.h>
+#include <sandboxblockdev.h>
 #include <asm/io.h>
+#include <asm/unaligned.h>
 
 #include <u-boot/zlib.h>
 #include <bzlib.h>
@@ -22,6 +26,9 @@
 #include <lzma/LzmaTools.h>
 
 #include <linux/lzo.h>
+#include <linux/sizes.h>
+#include <linux/xxhash.h>
+#include <linux/zstd.h>
 #include <test/compression.h>
 #include <test/suites.h>
 #include <test/ut.h>
@@ -414,6 +421,112 @@ static int compression_test_gzip(struct unit_test_state *uts)
 }
 COMPRESSION_TEST(compression_test_gzip, 0);
 
+#define INFLATE_TEST_SIZE	SZ_16K
+#define INFLATE_TEST_GUARD	16
+
+/*
+ * Fill @data with long matches at each distance below 16, where inflate
+ * copies in chunks with a rotating pattern or 8-byte moves, then repeats of a
+ * longer block, copied 16 bytes at a time
+ */
+static void inflate_test_fill(u8 *data, int size)
+{
+	uint seed = 1;
+	int pos = 0;
+	int dist, i;
+
+	while (pos < size) {
+		for (dist = 1; dist < 16 && pos < size; dist++) {
+			for (i = 0; i < dist + 300 && pos < size; i++, pos++) {
+				seed = seed * 1103515245 + 12345;
+				data[pos] = i < dist ? seed >> 16 : data[pos - dist];
+			}
+		}
+		for (i = 0; i < 3 * 200 && pos < size; i++, pos++) {
+			seed = seed * 1103515245 + 12345;
+			data[pos] = i < 200 ? seed >> 16 : data[pos - 200];
+		}
+	}
+}
+
+/* Inflate matches near the ends of the input and output buffers */
+static int compression_test_inflate_fast(struct unit_test_state *uts)
+{
+	unsigned long gz_size = INFLATE_TEST_SIZE;
+	unsigned long len, raw_size;
+	u8 *data, *gz, *raw, *out;
+	u8 piece[9 + INFLATE_TEST_GUARD];
+	int offset, chunk, pos, n, ret;
+	z_stream s;
+
+	data = malloc(INFLATE_TEST_SIZE);
+	gz = malloc(INFLATE_TEST_SIZE);
+	out = malloc(INFLATE_TEST_SIZE + INFLATE_TEST_GUARD);
+	ut_assertnonnull(data);
+	ut_assertnonnull(gz);
+	ut_assertnonnull(out);
+	inflate_test_fill(data, INFLATE_TEST_SIZE);
+	ut_assertok(gzip(gz, &gz_size, data, INFLATE_TEST_SIZE));
+
+	/* The output buffer is just large enough */
+	memset(out, 0xa5, INFLATE_TEST_SIZE + INFLATE_TEST_GUARD);
+	len = gz_size;
+	ut_assertok(gunzip(out, INFLATE_TEST_SIZE, gz, &len));
+	ut_asserteq(INFLATE_TEST_SIZE, len);
+	ut_asserteq_mem(data, out, INFLATE_TEST_SIZE);
+	for (n = 0; n < INFLATE_TEST_GUARD; n++)
+		ut_asserteq(0xa5, out[INFLATE_TEST_SIZE + n]);
+
+	/* Raw deflate data ends at the end of the input, no gzip trailer */
+	offset = gzip_parse_header(gz, gz_size);
+	ut_assert(offset > 0);
+	raw_size = gz_size - offset - 8;
+	raw = malloc(raw_size + INFLATE_TEST_GUARD);
+	ut_assertnonnull(raw);
+	memcpy(raw, gz + offset, raw_size);
+	memset(raw + raw_size, 0xff, INFLATE_TEST_GUARD);
+	memset(out, 0, INFLATE_TEST_SIZE);
+	len = raw_size;
+	ut_assertok(zunzip(out, INFLATE_TEST_SIZE, raw, &len, 1, 0));
+	ut_asserteq(INFLATE_TEST_SIZE, len);
+	ut_asserteq_mem(data, out, INFLATE_TEST_SIZE);
+
+	/*
+	 * Input in small pieces, each followed by garbage, so that inflate
+	 * often has fewer than 8 bytes left
+	 */
+	for (chunk = 1; chunk <= 9; chunk++) {
+		memset(&s, '\0', sizeof(s));
+		ut_asserteq(Z_OK, inflateInit2(&s, -MAX_WBITS));
+		memset(out, 0, INFLATE_TEST_SIZE);
+		s.next_out = out;
+		s.avail_out = INFLATE_TEST_SIZE;
+		pos = 0;
+		do {
+			n = min_t(int, chunk, raw_size - pos);
+			memcpy(piece, raw + pos, n);
+			memset(piece + n, 0xff, INFLATE_TEST_GUARD);
+			s.next_in = piece;
+			s.avail_in = n;
+			ret = inflate(&s, Z_NO_FLUSH);
+			pos += n - s.avail_in;
+		} while (ret == Z_OK);
+		inflateEnd(&s);
+		ut_asserteq(Z_STREAM_END, ret);
+		ut_asserteq(raw_size, pos);
+		ut_asserteq(INFLATE_TEST_SIZE, s.total_out);
+		ut_asserteq_mem(data, out, INFLATE_TEST_SIZE);
+	}
+
+	free(raw);
+	free(out);
+	free(gz);
+	free(data);
+
+	return 0;
+}
+COMPRESSION_TEST(compression_test_inflate_fast, 0);
+
 static int compression_test_bzip2(struct unit_test_state *uts)
 {
 	return run_test(uts, "bzip2", compress_using_bzip2,
@@ -440,6 +553,49 @@ static int compression_test_lz4(struct unit_test_state *uts)
 }
 COMPRESSION_TEST(compression_test_lz4, 0);
 
+#ifdef CONFIG_LZ4_CHECKSUM
+static int compression_test_lz4_checksum(struct unit_test_state *uts)
+{
+	/* The single block of lz4_compressed, after a 7-byte frame header */
+	const int block = 7 + 4, block_size = 257;
+	size_t plain_size = strlen(plain);
+	u8 image[TEST_BUFFER_SIZE];
+	char out[TEST_BUFFER_SIZE];
+	size_t size;
+
+	/* lz4_compressed has a content checksum */
+	memcpy(image, lz4_compressed, lz4_compressed_size);
+	image[block + 20] ^= 1;
+	size = sizeof(out);
+	ut_asserteq(-EBADMSG, ulz4fn(image, lz4_compressed_size, out, &size));
+
+	memcpy(image, lz4_compressed, lz4_compressed_size);
+	image[lz4_compressed_size - 1] ^= 1;
+	size = sizeof(out);
+	ut_asserteq(-EBADMSG, ulz4fn(image, lz4_compressed_size, out, &size));
+
+	/* Add a block checksum */
+	memcpy(image, lz4_compressed, block + block_size);
+	image[4] |= 0x10;
+	put_unaligned_le32(xxh32(image + block, block_size, 0),
+			   image + block + block_size);
+	memcpy(image + block + block_size + 4,
+	       lz4_compressed + block + block_size, 8);
+	size = sizeof(out);
+	ut_assertok(ulz4fn(image, lz4_compressed_size + 4, out, &size));
+	ut_asserteq(plain_size, size);
+	ut_asserteq_mem(plain, out, plain_size);
+
+	image[block + block_size - 1] ^= 1;
+	size = sizeof(out);
+	ut_asserteq(-EBADMSG, ulz4fn(image, lz4_compressed_size + 4, out,
+				     &size));
+
+	return 0;
+}
+COMPRESSION_TEST(compression_test_lz4_checksum, 0);
+#endif
+
 static int compress_using_none(struct unit_test_state *uts,
 			       void *in, unsigned long in_size,
 			       void *out, unsigned long out_max,
@@ -536,6 +692,150 @@ static int compression_test_bootm_none(struct unit_test_state *uts)
 }
 COMPRESSION_TEST(compression_test_bootm_none, 0);
 
+#ifdef CONFIG_CMD_UNZIP
+#define GZWRITE_TEST_FILE	"gzwrite-test.img"
+#define GZWRITE_TEST_SIZE	(SZ_64K + 1000)
+#define GZWRITE_TEST_DEV_SIZE	(SZ_128K)
+
+/* Write a gzip image to a block device in small pieces and read it back */
+static int compression_test_gzwrite(struct unit_test_state *uts)
+{
+	unsigned long gz_size = GZWRITE_TEST_SIZE;
+	struct blk_desc *desc;
+	u8 *data, *gz, *back;
+	int fd, i;
+
+	data = malloc(GZWRITE_TEST_SIZE);
+	gz = malloc(GZWRITE_TEST_SIZE);
+	back = calloc(1, GZWRITE_TEST_DEV_SIZE);
+	ut_assertnonnull(data);
+	ut_assertnonnull(gz);
+	ut_assertnonnull(back);
+	for (i = 0; i < GZWRITE_TEST_SIZE; i++)
+		data[i] = plain[i % strlen(plain)] ^ (i >> 12);
+	ut_assertok(gzip(gz, &gz_size, data, GZWRITE_TEST_SIZE));
+
+	fd = os_open(GZWRITE_TEST_FILE, OS_O_RDWR | OS_O_CREAT | OS_O_TRUNC);
+	ut_assert(fd >= 0);
+	ut_asserteq(GZWRITE_TEST_DEV_SIZE,
+		    os_write(fd, back, GZWRITE_TEST_DEV_SIZE));
+	os_close(fd);
+	ut_assertok(host_dev_bind(0, GZWRITE_TEST_FILE));
+	desc = blk_get_devnum_by_type(IF_TYPE_HOST, 0);
+	ut_assertnonnull(desc);
+
+	/* Many write buffers, so that each one overlaps the next inflate */
+	ut_assertok(gzwrite(gz, gz_size, desc, 2 * desc->blksz, desc->blksz,
+			    0));
+	ut_asserteq(GZWRITE_TEST_DEV_SIZE / desc->blksz,
+		    blk_dread(desc, 0, GZWRITE_TEST_DEV_SIZE / desc->blksz,
+			      back));
+	ut_asserteq_mem(data, back + desc->blksz, GZWRITE_TEST_SIZE);
+
+	ut_assertok(host_dev_bind(0, NULL));
+	os_unlink(GZWRITE_TEST_FILE);
+	free(back);
+	free(gz);
+	free(data);
+
+	return 0;
+}
+COMPRESSION_TEST(compression_test_gzwrite, 0);
+#endif
+
+#ifdef CONFIG_ZSTD
+#define ZSTD_TEST_SIZE		242346
+#define ZSTD_TEST_BUF_SIZE	(ZSTD_TEST_SIZE + SZ_64K)
+
+static void zstd_test_fill(u8 *buf, int size)
+{
+	u32 seed = 0x12345678;
+	int i;
+
+	for (i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+}
+
+/* Make a Zstandard frame using raw blocks, or a single RLE block if @rle */
+static int zstd_test_frame(u8 *out, const u8 *in, int size, bool rle)
+{
+	u8 *p = out;
+	int pos, len;
+
+	put_unaligned_le32(ZSTD_MAGICNUMBER, p);
+	p += 4;
+	*p++ = 0xa0;
+	put_unaligned_le32(size, p);
+	p += 4;
+	if (rle) {
+		put_unaligned_le32(size << 3 | 1 << 1 | 1, p);
+		p[3] = in[0];
+		return p + 4 - out;
+	}
+	for (pos = 0; pos < size; pos += len) {
+		len = min(size - pos, 100000);
+		put_unaligned_le32(len << 3 | (pos + len == size), p);
+		memcpy(p + 3, in + pos, len);
+		p += 3 + len;
+	}
+
+	return p - out;
+}
+
+/* Make a Zstandard image from several frames and a skippable frame */
+static int zstd_test_image(u8 *out, u8 *in)
+{
+	static const int sizes[] = { 70000, 1, 150000, 12345, 10000 };
+	u8 *p = out;
+	int pos, i;
+
+	for (i = 0, pos = 0; i < ARRAY_SIZE(sizes); pos += sizes[i++]) {
+		if (i == 2) {
+			put_unaligned_le32(ZSTD_MAGIC_SKIPPABLE_START, p);
+			put_unaligned_le32(4, p + 4);
+			p += 12;
+		}
+		if (i == 4)
+			memset(in + pos, in[pos], sizes[i]);
+		p += zstd_test_frame(p, in + pos, sizes[i], i == 4);
+	}
+
+	return p - out;
+}
+
+/* bootm decodes every frame of an image made of several */
+static int compression_test_zstd_frames(struct unit_test_state *uts)
+{
+	const ulong load_addr = 0x100000;
+	size_t image_len;
+	u8 *plain, *image, *out;
+	ulong load_end;
+
+	plain = malloc(ZSTD_TEST_BUF_SIZE);
+	ut_assertnonnull(plain);
+	image = map_sysmem(0, ZSTD_TEST_BUF_SIZE);
+	out = map_sysmem(load_addr, ZSTD_TEST_BUF_SIZE);
+
+	zstd_test_fill(plain, ZSTD_TEST_SIZE);
+	image_len = zstd_test_image(image, plain);
+	memset(out, '\0', ZSTD_TEST_BUF_SIZE);
+	ut_assertok(image_decomp(IH_COMP_ZSTD, load_addr, 0, IH_TYPE_KERNEL,
+				 out, image, image_len, ZSTD_TEST_BUF_SIZE,
+				 &load_end));
+	ut_asserteq(load_addr + ZSTD_TEST_SIZE, load_end);
+	ut_asserteq_mem(plain, out, ZSTD_TEST_SIZE);
+
+	unmap_sysmem(out);
+	unmap_sysmem(image);
+	free(plain);
+
+	return 0;
+}
+COMPRESSION_TEST(compression_test_zstd_frames, 0);
+#endif
+
 int do_ut_compression(struct cmd_tbl *cmdtp, int flag, int argc,
 		      char *const argv[])
 {
@@ -5,7 +5,9 @@
 
 #include <common.h>
 #include <dm.h>
+#include <os.h>
 #include <part.h>
+#include <sandboxblockdev.h>
 #include <usb.h>
 #include <asm/state.h>
 #include <dm/test.h>
@@ -164,3 +166,292 @@ static int dm_test_blk_get_from_parent(struct unit_test_state *uts)
 	return 0;
 }
 DM_TEST(dm_test_blk_get_from_parent, UT_TESTF_SCAN_PDATA | UT_TESTF_SCAN_FDT);
+
+static int blkcache_test_reads;
+
+/* Fill each block with its own block number */
+static ulong blkcache_test_read(struct blk_desc *desc, lbaint_t start,
+				lbaint_t blkcnt, void *buffer)
+{
+	lbaint_t i;
+
+	blkcache_test_reads++;
+	for (i = 0; i < blkcnt; i++)
+		memset(buffer + i * desc->blksz, (start + i) & 0xff,
+		       desc->blksz);
+
+	return blkcnt;
+}
+
+/* Test that sequential small reads are served by cache readahead */
+static int dm_test_blk_cache_readahead(struct unit_test_state *uts)
+{
+	struct blk_desc desc = {
+		.if_type = IF_TYPE_HOST,
+		.devnum = 7,
+		.blksz = 512,
+		.lba = 1024,
+	};
+	struct block_cache_stats stats;
+	char buf[1024];
+	int i;
+
+	blkcache_invalidate(desc.if_type, desc.devnum);
+	blkcache_stats(&stats);
+	blkcache_test_reads = 0;
+
+	/* The window grows 4, 8, 16, 32, 64 blocks */
+	for (i = 0; i < 64; i++) {
+		ut_asserteq(1, blkcache_dread(&desc, i, 1, buf,
+					      blkcache_test_read));
+		ut_asserteq(i, buf[0]);
+		ut_asserteq(i, buf[511]);
+	}
+	ut_asserteq(5, blkcache_test_reads);
+
+	blkcache_stats(&stats);
+	ut_asserteq(5, stats.readaheads);
+	ut_asserteq(5, stats.misses);
+	ut_asserteq(59, stats.hits);
+
+	/* A read spanning two readahead entries is still a hit */
+	ut_asserteq(2, blkcache_dread(&desc, 27, 2, buf, blkcache_test_read));
+	ut_asserteq(27, buf[0]);
+	ut_asserteq(28, buf[512]);
+	ut_asserteq(5, blkcache_test_reads);
+
+	/* Random access does not trigger readahead */
+	blkcache_invalidate(desc.if_type, desc.devnum);
+	ut_asserteq(1, blkcache_dread(&desc, 500, 1, buf, blkcache_test_read));
+	ut_asserteq(1, blkcache_dread(&desc, 300, 1, buf, blkcache_test_read));
+	ut_asserteq(7, blkcache_test_reads);
+	blkcache_stats(&stats);
+	ut_asserteq(0, stats.readaheads);
+	blkcache_invalidate(desc.if_type, desc.devnum);
+
+	return 0;
+}
+DM_TEST(dm_test_blk_cache_readahead, 0);
+
+static char blkcache_test_disk[64 * 512];
+static int blkcache_test_writes;
+static bool blkcache_test_fail;
+
+static ulong blkcache_test_disk_read(struct blk_desc *desc, lbaint_t start,
+				     lbaint_t blkcnt, void *buffer)
+{
+	blkcache_test_reads++;
+	memcpy(buffer, blkcache_test_disk + start * desc->blksz,
+	       blkcnt * desc->blksz);
+
+	return blkcnt;
+}
+
+static ulong blkcache_test_disk_write(struct blk_desc *desc, lbaint_t start,
+				      lbaint_t blkcnt, const void *buffer)
+{
+	blkcache_test_writes++;
+	if (blkcache_test_fail)
+		return 0;
+	memcpy(blkcache_test_disk + start * desc->blksz, buffer,
+	       blkcnt * desc->blksz);
+
+	return blkcnt;
+}
+
+/* Test that write-back holds writes and merges them when flushing */
+static int dm_test_blk_cache_writeback(struct unit_test_state *uts)
+{
+	struct blk_desc desc = {
+		.if_type = IF_TYPE_HOST,
+		.devnum = 8,
+		.blksz = 512,
+		.lba = 64,
+	};
+	char buf[4 * 512];
+
+	memset(blkcache_test_disk, '\0', sizeof(blkcache_test_disk));
+	blkcache_test_reads = 0;
+	blkcache_test_writes = 0;
+	ut_assertok(blkcache_set_writeback(desc.if_type, desc.devnum, true));
+
+	/* Blocks 3-5 are adjacent, block 10 is on its own */
+	memset(buf, 'a', sizeof(buf));
+	ut_asserteq(2, blkcache_dwrite(&desc, 3, 2, buf,
+				       blkcache_test_disk_write));
+	memset(buf, 'b', sizeof(buf));
+	ut_asserteq(1, blkcache_dwrite(&desc, 5, 1, buf,
+				       blkcache_test_disk_write));
+	ut_asserteq(1, blkcache_dwrite(&desc, 10, 1, buf,
+				       blkcache_test_disk_write));
+	ut_asserteq(0, blkcache_test_writes);
+
+	/* Reads see the dirty data, whether cached or read from the disk */
+	ut_asserteq(1, blkcache_dread(&desc, 4, 1, buf,
+				      blkcache_test_disk_read));
+	ut_asserteq('a', buf[0]);
+	ut_asserteq(0, blkcache_test_reads);
+	ut_asserteq(3, blkcache_dread(&desc, 9, 3, buf,
+				      blkcache_test_disk_read));
+	ut_asserteq(1, blkcache_test_reads);
+	ut_asserteq('\0', buf[0]);
+	ut_asserteq('b', buf[512]);
+	ut_asserteq('\0', buf[1024]);
+
+	/* Disabling write-back flushes, with the adjacent blocks merged */
+	ut_assertok(blkcache_set_writeback(desc.if_type, desc.devnum, false));
+	ut_asserteq(2, blkcache_test_writes);
+	ut_asserteq('\0', blkcache_test_disk[2 * 512]);
+	ut_asserteq('a', blkcache_test_disk[3 * 512]);
+	ut_asserteq('a', blkcache_test_disk[4 * 512 + 511]);
+	ut_asserteq('b', blkcache_test_disk[5 * 512]);
+	ut_asserteq('\0', blkcache_test_disk[6 * 512]);
+	ut_asserteq('b', blkcache_test_disk[10 * 512]);
+
+	/* Nothing is left to write */
+	ut_assertok(blkcache_flush(desc.if_type, desc.devnum));
+	ut_asserteq(2, blkcache_test_writes);
+
+	/* Without write-back, writes go straight to the disk */
+	memset(buf, 'c', sizeof(buf));
+	ut_asserteq(1, blkcache_dwrite(&desc, 4, 1, buf,
+				       blkcache_test_disk_write));
+	ut_asserteq(3, blkcache_test_writes);
+	ut_asserteq('c', blkcache_test_disk[4 * 512]);
+	ut_asserteq(1, blkcache_dread(&desc, 4, 1, buf,
+				      blkcache_test_disk_read));
+	ut_asserteq('c', buf[0]);
+	blkcache_invalidate(desc.if_type, desc.devnum);
+
+	return 0;
+}
+DM_TEST(dm_test_blk_cache_writeback, 0);
+
+/* Test that dirty blocks which cannot be written back are not lost */
+static int dm_test_blk_cache_writeback_fail(struct unit_test_state *uts)
+{
+	struct blk_desc desc = {
+		.if_type = IF_TYPE_HOST,
+		.devnum = 9,
+		.blksz = 512,
+		.lba = 64,
+	};
+	struct block_cache_stats stats;
+	char buf[512];
+
+	memset(blkcache_test_disk, '\0', sizeof(blkcache_test_disk));
+	blkcache_stats(&stats);
+	blkcache_configure(stats.max_blocks_per_entry, 2);
+	ut_assertok(blkcache_set_writeback(desc.if_type, desc.devnum, true));
+
+	memset(buf, 'd', sizeof(buf));
+	ut_asserteq(1, blkcache_dwrite(&desc, 1, 1, buf,
+				       blkcache_test_disk_write));
+	memset(buf, 'e', sizeof(buf));
+	ut_asserteq(1, blkcache_dwrite(&desc, 20, 1, buf,
+				       blkcache_test_disk_write));
+
+	/* The cache is full and the oldest entry cannot be evicted */
+	blkcache_test_fail = true;
+	ut_asserteq(0, blkcache_dwrite(&desc, 40, 1, buf,
+				       blkcache_test_disk_write));
+
+	/* Both dirty entries are still there once the device recovers */
+	blkcache_test_fail = false;
+	ut_assertok(blkcache_set_writeback(desc.if_type, desc.devnum, false));
+	ut_asserteq('d', blkcache_test_disk[1 * 512]);
+	ut_asserteq('e', blkcache_test_disk[20 * 512]);
+
+	/* A failed flush is reported */
+	ut_assertok(blkcache_set_writeback(desc.if_type, desc.devnum, true));
+	ut_asserteq(1, blkcache_dwrite(&desc, 2, 1, buf,
+				       blkcache_test_disk_write));
+	blkcache_test_fail = true;
+	ut_asserteq(-EIO, blkcache_set_writeback(desc.if_type, desc.devnum,
+						 false));
+	blkcache_test_fail = false;
+
+	blkcache_invalidate(desc.if_type, desc.devnum);
+	blkcache_configure(stats.max_blocks_per_entry, stats.max_entries);
+
+	return 0;
+}
+DM_TEST(dm_test_blk_cache_writeback_fail, 0);
+
+#define BLK_QUEUE_TEST_FILE	"blk-queue-test.img"
+
+static void dm_test_blk_queue_done(struct blk_req *req)
+{
+	int *count = req->priv;
+
+	(*count)++;
+}
+
+/* Test queued block requests */
+static int dm_test_blk_queue(struct unit_test_state *uts)
+{
+	u8 buf[8 * 512], back[8 * 512], disk[16 * 512];
+	struct blk_desc *desc;
+	struct blk_req req[4];
+	int count = 0;
+	int fd, i;
+
+	memset(disk, '\0', sizeof(disk));
+	fd = os_open(BLK_QUEUE_TEST_FILE, OS_O_RDWR | OS_O_CREAT | OS_O_TRUNC);
+	ut_assert(fd >= 0);
+	ut_asserteq(sizeof(disk), os_write(fd, disk, sizeof(disk)));
+	os_close(fd);
+	ut_assertok(host_dev_bind(0, BLK_QUEUE_TEST_FILE));
+	desc = blk_get_devnum_by_type(IF_TYPE_HOST, 0);
+	ut_assertnonnull(desc);
+
+	/* Three writes which carry on from each other, and one elsewhere */
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i / 512 + 'a';
+	memset(req, '\0', sizeof(req));
+	for (i = 0; i < 4; i++) {
+		req[i].op = BLK_REQ_WRITE;
+		req[i].start = i < 3 ? 1 + 2 * i : 10;
+		req[i].blkcnt = 2;
+		req[i].buffer = buf + i * 2 * 512;
+		req[i].complete = dm_test_blk_queue_done;
+		req[i].priv = &count;
+		ut_assertok(blk_dsubmit(desc, &req[i]));
+	}
+	ut_asserteq(-EINPROGRESS, req[0].status);
+	if (CONFIG_IS_ENABLED(BLK_ASYNC))
+		ut_asserteq(6, req[0].blkcnt);
+
+	for (i = 0; i < 4; i++)
+		ut_assertok(blk_dwait(desc, &req[i]));
+	ut_asserteq(4, count);
+	ut_asserteq(2, req[0].blkcnt);
+
+	/* Read it all back */
+	memset(back, '\0', sizeof(back));
+	ut_asserteq(6, blk_dread(desc, 1, 6, back));
+	ut_asserteq(2, blk_dread(desc, 10, 2, back + 6 * 512));
+	ut_asserteq_mem(buf, back, sizeof(buf));
+	ut_asserteq(1, blk_dread(desc, 0, 1, back));
+	ut_asserteq('\0', back[0]);
+
+	/* Queued reads */
+	memset(back, '\0', sizeof(back));
+	memset(req, '\0', sizeof(req));
+	for (i = 0; i < 2; i++) {
+		req[i].op = BLK_REQ_READ;
+		req[i].start = i ? 10 : 1;
+		req[i].blkcnt = i ? 2 : 6;
+		req[i].buffer = back + i * 6 * 512;
+		ut_assertok(blk_dsubmit(desc, &req[i]));
+	}
+	ut_assertok(blk_dwait(desc, &req[1]));
+	ut_assertok(blk_dwait(desc, &req[0]));
+	ut_asserteq_mem(buf, back, sizeof(buf));
+
+	ut_assertok(host_dev_bind(0, NULL));
+	os_unlink(BLK_QUEUE_TEST_FILE);
+
+	return 0;
+}
+DM_TEST(dm_test_blk_queue, UT_TESTF_SCAN_PDATA | UT_TESTF_SCAN_FDT);
@@ -0,0 +1,105 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Tests for the hash engine uclass
+ */
+
+#include <common.h>
+#include <dm.h>
+#include <hash.h>
+#include <asm/test.h>
+#include <dm/test.h>
+#include <test/ut.h>
+#include <u-boot/hash.h>
+#include <u-boot/sha256.h>
+
+static const u8 sha256_abc[SHA256_SUM_LEN] = {
+	0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea,
+	0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+	0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c,
+	0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad,
+};
+
+/* Basic test of the hash uclass */
+static int dm_test_hash_engine(struct unit_test_state *uts)
+{
+	u8 digest[SHA256_SUM_LEN];
+	struct udevice *dev;
+	void *ctx;
+
+	ut_asserteq(HASH_ALGO_SHA256, hash_algo_id_by_name("sha256"));
+	ut_asserteq(-EPROTONOSUPPORT, hash_algo_id_by_name("md5"));
+
+	ut_assertok(dm_hash_get_engine(HASH_ALGO_SHA256, &dev));
+	ut_assertok(dm_hash_digest_wd(dev, HASH_ALGO_SHA256, "abc", 3, digest,
+				      1));
+	ut_asserteq_mem(sha256_abc, digest, sizeof(digest));
+
+	/* Split across calls */
+	ut_assertok(dm_hash_init(dev, HASH_ALGO_SHA256, &ctx));
+	ut_assertok(dm_hash_update(dev, ctx, "a", 1));
+	ut_assertok(dm_hash_update(dev, ctx, "bc", 2));
+	ut_assertok(dm_hash_finish(dev, ctx, digest));
+	ut_asserteq_mem(sha256_abc, digest, sizeof(digest));
+
+	/* crc32 digests are big-endian */
+	ut_assertok(dm_hash_get_engine(HASH_ALGO_CRC32, &dev));
+	ut_assertok(dm_hash_digest_wd(dev, HASH_ALGO_CRC32, "abc", 3, digest,
+				      0));
+	ut_asserteq(0x35, digest[0]);
+	ut_asserteq(0x24, digest[1]);
+	ut_asserteq(0x41, digest[2]);
+	ut_asserteq(0xc2, digest[3]);
+
+	return 0;
+}
+DM_TEST(dm_test_hash_engine, UT_TESTF_SCAN_PDATA | UT_TESTF_SCAN_FDT);
+
+/* hash_block() and the progressive API go through the engine */
+static int dm_test_hash_lookup(struct unit_test_state *uts)
+{
+	u8 digest[SHA256_SUM_LEN];
+	struct hash_algo *algo;
+	int len = sizeof(digest);
+	void *ctx;
+
+	ut_assertok(hash_block("sha256", "abc", 3, digest, &len));
+	ut_asserteq(SHA256_SUM_LEN, len);
+	ut_asserteq_mem(sha256_abc, digest, sizeof(digest));
+
+	ut_assertok(hash_progressive_lookup_algo("sha256", &algo));
+	ut_assertok(algo->hash_init(algo, &ctx));
+	ut_assertok(algo->hash_update(algo, ctx, "ab", 2, 0));
+	ut_assertok(algo->hash_update(algo, ctx, "c", 1, 1));
+	ut_assertok(algo->hash_finish(algo, ctx, digest, sizeof(digest)));
+	ut_asserteq_mem(sha256_abc, digest, sizeof(digest));
+
+	return 0;
+}
+DM_TEST(dm_test_hash_lookup, UT_TESTF_SCAN_PDATA | UT_TESTF_SCAN_FDT);
+
+/* Other engines are used ahead of the software one */
+static int dm_test_hash_priority(struct unit_test_state *uts)
+{
+	u8 digest[SHA256_SUM_LEN];
+	int len = sizeof(digest);
+	struct udevice *dev, *sw;
+
+	/* hash_sw is bound first, from platform data */
+	ut_assertok(uclass_first_device_err(UCLASS_HASH, &sw));
+	ut_asserteq_ptr(DM_GET_DRIVER(hash_sw), sw->driver);
+
+	ut_assertok(dm_hash_get_engine(HASH_ALGO_SHA256, &dev));
+	ut_asserteq_ptr(DM_GET_DRIVER(hash_sandbox), dev->driver);
+	sandbox_hash_get_count(dev);
+
+	ut_assertok(hash_block("sha256", "abc", 3, digest, &len));
+	ut_asserteq_mem(sha256_abc, digest, sizeof(digest));
+	ut_asserteq(1, sandbox_hash_get_count(dev));
+
+	/* The software engine is the fallback */
+	ut_assertok(dm_hash_get_engine(HASH_ALGO_SHA1, &dev));
+	ut_asserteq_ptr(sw, dev);
+
+	return 0;
+}
+DM_TEST(dm_test_hash_priority, UT_TESTF_SCAN_PDATA | UT_TESTF_SCAN_FDT);
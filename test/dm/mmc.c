@@ -7,6 +7,7 @@
 #include <dm.h>
 #include <mmc.h>
 #include <part.h>
+#include <asm/test.h>
 #include <dm/test.h>
 #include <test/test.h>
 #include <test/ut.h>
@@ -29,10 +30,17 @@ static int dm_test_mmc_blk(struct unit_test_state *uts)
 {
 	struct udevice *dev;
 	struct blk_desc *dev_desc;
+	uint set_block_counts, stops;
+	struct mmc *mmc;
 	char cmp[1024];
 
 	ut_assertok(uclass_get_device(UCLASS_MMC, 0, &dev));
 	ut_assertok(blk_get_device_by_str("mmc", "0", &dev_desc));
+	dev = dev_get_parent(dev_desc->bdev);
+
+	/* Read from the card rather than blocks cached by the partition scan */
+	blkcache_invalidate(dev_desc->if_type, dev_desc->devnum);
+	sandbox_mmc_get_cmd_counts(dev, &set_block_counts, &stops);
 
 	/* Read a few blocks and look for the string we expect */
 	ut_asserteq(512, dev_desc->blksz);
@@ -40,6 +48,13 @@ static int dm_test_mmc_blk(struct unit_test_state *uts)
 	ut_asserteq(2, blk_dread(dev_desc, 0, 2, cmp));
 	ut_assertok(strcmp(cmp, "this is a test"));
 
+	/* The emulated card takes a block count, so that read used one */
+	mmc = mmc_get_mmc_dev(dev);
+	ut_assert(mmc->card_caps & mmc->host_caps & MMC_CAP_CMD23);
+	sandbox_mmc_get_cmd_counts(dev, &set_block_counts, &stops);
+	ut_asserteq(1, set_block_counts);
+	ut_asserteq(0, stops);
+
 	return 0;
 }
 DM_TEST(dm_test_mmc_blk, UT_TESTF_SCAN_PDATA | UT_TESTF_SCAN_FDT);
@@ -0,0 +1,377 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Tests for windowed NFS READs, against a fake server on the sandbox Ethernet
+ */
+
+#include <common.h>
+#include <command.h>
+#include <dm.h>
+#include <env.h>
+#include <malloc.h>
+#include <mapmem.h>
+#include <net.h>
+#include <asm/eth.h>
+#include <dm/test.h>
+#include <test/ut.h>
+#include "../../net/nfs.h"
+
+#define NFS_TEST_MOUNT_PORT	635
+#define NFS_TEST_NFS_PORT	2049
+#define NFS_TEST_ADDR		0x1000000
+#define NFS_TEST_MAX_SIZE	0x8000
+#define NFS_TEST_MAX_READS	64
+
+/* How the fake server answers READ calls */
+enum nfs_test_mode {
+	NFS_TEST_IN_ORDER,	/* answer each call as it comes */
+	NFS_TEST_REVERSE,	/* hold a batch of replies, send it reversed */
+	NFS_TEST_DROP,		/* lose the first reply for one offset */
+};
+
+struct nfs_test_server {
+	struct unit_test_state *uts;
+	const u8 *file;
+	uint size;
+	enum nfs_test_mode mode;
+	bool no_v2;		/* refuse NFSv2, so that the client uses v3 */
+	uint rtmax;		/* rtmax answered to FSINFO */
+	uint batch;		/* replies held back in NFS_TEST_REVERSE */
+	uint drop_offset;	/* offset whose reply is lost in NFS_TEST_DROP */
+	ulong dropped_xid;
+
+	/* READ replies held back */
+	uchar held[NFS_TEST_MAX_READS][PKTSIZE_ALIGN];
+	int held_len[NFS_TEST_MAX_READS];
+	uint held_count;
+
+	/* READ calls seen */
+	ulong xids[NFS_TEST_MAX_READS];
+	uint reads;
+	uint resends;
+	ulong resent_xid;
+	uint past_end;
+	uint max_count;
+	uint vers;
+};
+
+static int sb_nfs_queue(struct udevice *dev, const uchar *pkt, int len)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct nfs_test_server *srv = priv->priv;
+	/* Used by all of the ut_assert macros */
+	struct unit_test_state *uts = srv->uts;
+
+	ut_assert(priv->recv_packets < PKTBUFSRX);
+	memcpy(priv->recv_packet_buffer[priv->recv_packets], pkt, len);
+	priv->recv_packet_length[priv->recv_packets] = len;
+	++priv->recv_packets;
+
+	return 0;
+}
+
+/*
+ * Build the reply to the RPC call in 'packet', with 'astatus' and the 'words'
+ * words of 'data' as results. READ replies may be held back.
+ */
+static int sb_nfs_reply(struct udevice *dev, void *packet, uint32_t id,
+			uint32_t astatus, uint32_t *data, int words, bool read)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct nfs_test_server *srv = priv->priv;
+	struct ethernet_hdr *eth = packet;
+	struct ip_udp_hdr *ip = packet + ETHER_HDR_SIZE;
+	uchar pkt[PKTSIZE_ALIGN];
+	struct ethernet_hdr *eth_recv = (void *)pkt;
+	struct ip_udp_hdr *ipr = (void *)pkt + ETHER_HDR_SIZE;
+	uint32_t *p = (void *)ipr + IP_UDP_HDR_SIZE;
+	int len;
+	int i;
+
+	*p++ = id;
+	*p++ = htonl(MSG_REPLY);
+	*p++ = 0;			/* accepted */
+	*p++ = 0;			/* AUTH_NONE verifier */
+	*p++ = 0;
+	*p++ = htonl(astatus);
+	memcpy(p, data, words * sizeof(uint32_t));
+	len = (6 + words) * sizeof(uint32_t);
+
+	memcpy(eth_recv->et_dest, eth->et_src, ARP_HLEN);
+	memcpy(eth_recv->et_src, priv->fake_host_hwaddr, ARP_HLEN);
+	eth_recv->et_protlen = htons(PROT_IP);
+	net_set_udp_header((uchar *)ipr, net_read_ip(&ip->ip_src),
+			   ntohs(ip->udp_src), ntohs(ip->udp_dst), len);
+	net_set_ip_header((uchar *)ipr, net_read_ip(&ip->ip_src),
+			  net_read_ip(&ip->ip_dst), IP_UDP_HDR_SIZE + len,
+			  IPPROTO_UDP);
+	len += ETHER_HDR_SIZE + IP_UDP_HDR_SIZE;
+
+	if (!read || srv->mode != NFS_TEST_REVERSE)
+		return sb_nfs_queue(dev, pkt, len);
+
+	memcpy(srv->held[srv->held_count], pkt, len);
+	srv->held_len[srv->held_count] = len;
+	if (++srv->held_count < srv->batch)
+		return 0;
+	for (i = srv->held_count - 1; i >= 0; i--) {
+		if (sb_nfs_queue(dev, srv->held[i], srv->held_len[i]))
+			return -EINVAL;
+	}
+	srv->held_count = 0;
+
+	return 0;
+}
+
+static int sb_nfs_read(struct udevice *dev, void *packet, struct rpc_t *call,
+		       uint32_t *args)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct nfs_test_server *srv = priv->priv;
+	/* Used by all of the ut_assert macros */
+	struct unit_test_state *uts = srv->uts;
+	uint32_t data[NFS_READ_SIZE / sizeof(uint32_t) + NFS_MAX_ATTRS];
+	uint offset, count, n;
+	ulong xid = ntohl(call->u.call.id);
+	uint i;
+
+	srv->vers = ntohl(call->u.call.vers);
+	if (srv->vers == 2) {
+		offset = ntohl(args[NFS_FHSIZE / 4]);
+		count = ntohl(args[NFS_FHSIZE / 4 + 1]);
+	} else {
+		args += 1 + ntohl(args[0]) / 4;
+		offset = ntohl(args[1]);
+		count = ntohl(args[2]);
+	}
+	ut_assert(count <= NFS_READ_SIZE);
+	srv->max_count = max(srv->max_count, count);
+
+	for (i = 0; i < srv->reads; i++) {
+		if (srv->xids[i] == xid) {
+			srv->resends++;
+			srv->resent_xid = xid;
+			break;
+		}
+	}
+	if (i == srv->reads) {
+		ut_assert(srv->reads < NFS_TEST_MAX_READS);
+		srv->xids[srv->reads++] = xid;
+	}
+
+	if (srv->mode == NFS_TEST_DROP && offset == srv->drop_offset &&
+	    !srv->dropped_xid) {
+		srv->dropped_xid = xid;
+		/* Time out at the next receive rather than waiting for it */
+		sandbox_eth_skip_timeout();
+		return 0;
+	}
+
+	n = offset < srv->size ? min(count, srv->size - offset) : 0;
+	if (!n)
+		srv->past_end++;
+
+	memset(data, '\0', sizeof(data));
+	if (srv->vers == 2) {
+		/* status, fattr (with the size) and the data */
+		data[6] = htonl(srv->size);
+		data[18] = htonl(n);
+		memcpy(&data[19], srv->file + offset, n);
+		return sb_nfs_reply(dev, packet, call->u.call.id, 0, data,
+				    19 + DIV_ROUND_UP(n, 4), true);
+	}
+
+	/* status, no attributes, count, EOF and the data */
+	data[2] = htonl(n);
+	data[3] = htonl(offset + n >= srv->size);
+	data[4] = htonl(n);
+	memcpy(&data[5], srv->file + offset, n);
+
+	return sb_nfs_reply(dev, packet, call->u.call.id, 0, data,
+			    5 + DIV_ROUND_UP(n, 4), true);
+}
+
+/* Answer the portmap, mount and NFS calls of the client */
+static int sb_nfs_handler(struct udevice *dev, void *packet, unsigned int len)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct nfs_test_server *srv = priv->priv;
+	struct ethernet_hdr *eth = packet;
+	struct ip_udp_hdr *ip = packet + ETHER_HDR_SIZE;
+	uint32_t data[16];
+	struct rpc_t call;
+	uint32_t *args;
+	uint prog, proc;
+
+	if (!sandbox_eth_arp_req_to_reply(dev, packet, len))
+		return 0;
+	if (ntohs(eth->et_protlen) != PROT_IP || ip->ip_p != IPPROTO_UDP)
+		return 0;
+
+	len -= ETHER_HDR_SIZE + IP_UDP_HDR_SIZE;
+	memset(&call, '\0', sizeof(call));
+	memcpy(&call, (void *)ip + IP_UDP_HDR_SIZE, min_t(uint, len, sizeof(call)));
+	prog = ntohl(call.u.call.prog);
+	proc = ntohl(call.u.call.proc);
+
+	/* Skip the credential and the verifier */
+	args = call.u.call.data;
+	args += 2 + ntohl(args[1]) / 4;
+	args += 2 + ntohl(args[1]) / 4;
+
+	memset(data, '\0', sizeof(data));
+	memset(&data[1], 0x5a, NFS_FHSIZE);
+	switch (prog) {
+	case PROG_PORTMAP:
+		data[0] = htonl(ntohl(args[0]) == PROG_MOUNT ?
+				NFS_TEST_MOUNT_PORT : NFS_TEST_NFS_PORT);
+		return sb_nfs_reply(dev, packet, call.u.call.id, 0, data, 1,
+				    false);
+	case PROG_MOUNT:
+		if (proc == MOUNT_UMOUNTALL)
+			return sb_nfs_reply(dev, packet, call.u.call.id, 0,
+					    data, 0, false);
+		/* status and the handle of the directory */
+		return sb_nfs_reply(dev, packet, call.u.call.id, 0, data,
+				    1 + NFS_FHSIZE / 4, false);
+	case PROG_NFS:
+		break;
+	default:
+		return 0;
+	}
+
+	if (ntohl(call.u.call.vers) == 2 && srv->no_v2) {
+		data[0] = htonl(3);	/* lowest and highest versions */
+		data[1] = htonl(3);
+		return sb_nfs_reply(dev, packet, call.u.call.id,
+				    NFS_RPC_PROG_MISMATCH, data, 2, false);
+	}
+
+	switch (proc) {
+	case NFS_LOOKUP:
+		/* status and the handle of the file */
+		return sb_nfs_reply(dev, packet, call.u.call.id, 0, data,
+				    1 + NFS_FHSIZE / 4, false);
+	case NFS3PROC_LOOKUP:
+		/* status, handle length and handle */
+		memmove(&data[2], &data[1], NFS_FHSIZE);
+		data[1] = htonl(NFS_FHSIZE);
+		return sb_nfs_reply(dev, packet, call.u.call.id, 0, data,
+				    2 + NFS_FHSIZE / 4, false);
+	case NFS3PROC_FSINFO:
+		/* status, no attributes, rtmax and rtpref */
+		memset(data, '\0', sizeof(data));
+		data[2] = htonl(srv->rtmax);
+		data[3] = htonl(srv->rtmax);
+		return sb_nfs_reply(dev, packet, call.u.call.id, 0, data, 12,
+				    false);
+	case NFS_READ:
+		return sb_nfs_read(dev, packet, &call, args);
+	}
+
+	return 0;
+}
+
+/* Load a file of 'size' bytes from 'srv' with the given window */
+static int nfs_test_load(struct unit_test_state *uts,
+			 struct nfs_test_server *srv, uint size,
+			 const char *window)
+{
+	u8 *file, *buf;
+	uint i;
+
+	file = malloc(size);
+	ut_assertnonnull(file);
+	for (i = 0; i < size; i++)
+		file[i] = i * 13 + (i >> 8);
+	srv->uts = uts;
+	srv->file = file;
+	srv->size = size;
+	if (!srv->rtmax)
+		srv->rtmax = NFS_READ_SIZE;
+
+	buf = map_sysmem(NFS_TEST_ADDR, NFS_TEST_MAX_SIZE);
+	memset(buf, '\0', NFS_TEST_MAX_SIZE);
+
+	sandbox_eth_set_tx_handler(0, sb_nfs_handler);
+	/* Used by all of the ut_assert macros in the tx_handler */
+	sandbox_eth_set_priv(0, srv);
+	env_set("ethact", "eth@10002000");
+	env_set("nfswindowsize", window);
+	ut_assertok(run_command("nfs 1000000 1.2.3.5:/export/file", 0));
+	env_set("nfswindowsize", NULL);
+	sandbox_eth_set_tx_handler(0, NULL);
+
+	ut_asserteq(size, env_get_hex("filesize", 0));
+	ut_asserteq_mem(file, buf, size);
+	ut_asserteq(0, srv->held_count);
+	unmap_sysmem(buf);
+	free(file);
+
+	return 0;
+}
+
+/* Test that READ replies are used whatever order they come in */
+static int dm_test_nfs_window_reorder(struct unit_test_state *uts)
+{
+	struct nfs_test_server *srv;
+
+	srv = calloc(1, sizeof(*srv));
+	ut_assertnonnull(srv);
+	srv->mode = NFS_TEST_REVERSE;
+	srv->batch = 8;
+	/* 20 blocks: three batches, the last one partly past the end */
+	ut_assertok(nfs_test_load(uts, srv, 20000, "8"));
+	ut_asserteq(24, srv->reads);
+	ut_asserteq(0, srv->resends);
+	ut_asserteq(4, srv->past_end);
+	free(srv);
+
+	return 0;
+}
+DM_TEST(dm_test_nfs_window_reorder, UT_TESTF_SCAN_FDT);
+
+/* Test that a lost READ reply is asked for again, with the same XID */
+static int dm_test_nfs_window_resend(struct unit_test_state *uts)
+{
+	struct nfs_test_server *srv;
+
+	srv = calloc(1, sizeof(*srv));
+	ut_assertnonnull(srv);
+	srv->mode = NFS_TEST_DROP;
+	srv->drop_offset = 3 * NFS_READ_SIZE;
+	ut_assertok(nfs_test_load(uts, srv, 10000, "4"));
+	ut_assert(srv->dropped_xid);
+	ut_asserteq(1, srv->resends);
+	ut_asserteq(srv->dropped_xid, srv->resent_xid);
+	free(srv);
+
+	return 0;
+}
+DM_TEST(dm_test_nfs_window_resend, UT_TESTF_SCAN_FDT);
+
+/*
+ * Test NFSv3 with a server rtmax below the READ size the client would use,
+ * and a window holding more READs than the file has blocks of that size
+ */
+static int dm_test_nfs_window_rtmax(struct unit_test_state *uts)
+{
+	struct nfs_test_server *srv;
+
+	srv = calloc(1, sizeof(*srv));
+	ut_assertnonnull(srv);
+	srv->mode = NFS_TEST_IN_ORDER;
+	srv->no_v2 = true;
+	srv->rtmax = 512;
+	/* 6 blocks of 512 bytes, the last one short */
+	ut_assertok(nfs_test_load(uts, srv, 3000, "12"));
+	ut_asserteq(3, srv->vers);
+	ut_asserteq(512, srv->max_count);
+	/* Blocks 1-5 are answered before the EOF and each frees a slot */
+	ut_asserteq(12 + 5, srv->reads);
+	ut_asserteq(11, srv->past_end);
+	ut_asserteq(0, srv->resends);
+	free(srv);
+
+	return 0;
+}
+DM_TEST(dm_test_nfs_window_rtmax, UT_TESTF_SCAN_FDT);
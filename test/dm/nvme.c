@@ -0,0 +1,235 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Tests for the NVMe I/O queue, driven by a fake controller
+ */
+
+#include <common.h>
+#include <dm.h>
+#include <malloc.h>
+#include <time.h>
+#include <asm/io.h>
+#include <asm/test.h>
+#include <dm/test.h>
+#include <test/ut.h>
+#include "../../drivers/nvme/nvme.h"
+
+#define NVME_TEST_DEPTH		4	/* three commands in flight */
+#define NVME_TEST_BLKS		8	/* blocks per command */
+
+/* Queues of the driver, and the position of the fake controller in them */
+struct nvme_test {
+	struct nvme_dev dev;
+	struct nvme_ns ns;
+	struct nvme_queue admin;
+	struct nvme_queue io;
+	struct nvme_queue *queues[NVME_Q_NUM];
+	u32 dbs[4];
+	u16 sq_head;
+	u16 cq_tail;
+	u8 cq_phase;
+};
+
+static int nvme_test_init_queue(struct nvme_test *test,
+				struct nvme_queue *nvmeq, int qid, int depth)
+{
+	nvmeq->dev = &test->dev;
+	nvmeq->sq_cmds = memalign(4096, depth * sizeof(struct nvme_command));
+	nvmeq->cqes = memalign(4096, depth * sizeof(struct nvme_completion));
+	if (!nvmeq->sq_cmds || !nvmeq->cqes)
+		return -ENOMEM;
+	memset(nvmeq->sq_cmds, '\0', depth * sizeof(struct nvme_command));
+	memset(nvmeq->cqes, '\0', depth * sizeof(struct nvme_completion));
+	nvmeq->q_db = &test->dbs[qid * 2];
+	nvmeq->q_depth = depth;
+	nvmeq->qid = qid;
+	nvmeq->cq_phase = 1;
+	test->queues[qid] = nvmeq;
+
+	return 0;
+}
+
+static int nvme_test_init(struct nvme_test *test)
+{
+	memset(test, '\0', sizeof(*test));
+	test->dev.queues = test->queues;
+	test->dev.dbs = test->dbs;
+	test->dev.db_stride = 1;
+	test->dev.page_size = 4096;
+	test->dev.max_transfer_shift = 12;
+	test->ns.dev = &test->dev;
+	test->ns.ns_id = 1;
+	test->ns.lba_shift = 9;
+	test->cq_phase = 1;
+
+	if (nvme_test_init_queue(test, &test->admin, NVME_ADMIN_Q, 2) ||
+	    nvme_test_init_queue(test, &test->io, NVME_IO_Q, NVME_TEST_DEPTH))
+		return -ENOMEM;
+
+	return nvme_alloc_io_cmds(&test->dev, &test->io);
+}
+
+static void nvme_test_free(struct nvme_test *test)
+{
+	free(test->io.prp_pool);
+	free(test->io.ios);
+	free(test->io.cmds);
+	free(test->io.cqes);
+	free(test->io.sq_cmds);
+	free(test->admin.cqes);
+	free(test->admin.sq_cmds);
+}
+
+/* Fetch the next I/O command, returning its ID and first block */
+static int nvme_test_fetch(struct nvme_test *test, u64 *slbap)
+{
+	struct nvme_rw_command *rw;
+
+	if (test->sq_head == test->io.sq_tail)
+		return -ENOENT;
+	rw = &test->io.sq_cmds[test->sq_head].rw;
+	if (++test->sq_head == test->io.q_depth)
+		test->sq_head = 0;
+	*slbap = le64_to_cpu(rw->slba);
+
+	return le16_to_cpu(rw->command_id);
+}
+
+/* Post the completion of I/O command @id */
+static void nvme_test_complete(struct nvme_test *test, u16 id, u16 status)
+{
+	struct nvme_completion *cqe = &test->io.cqes[test->cq_tail];
+
+	cqe->command_id = cpu_to_le16(id);
+	cqe->status = cpu_to_le16(status << 1 | test->cq_phase);
+	if (++test->cq_tail == test->io.q_depth) {
+		test->cq_tail = 0;
+		test->cq_phase = !test->cq_phase;
+	}
+}
+
+static void nvme_test_io(struct nvme_test *test, struct nvme_io *io,
+			 void *buffer, lbaint_t blknr, lbaint_t blkcnt)
+{
+	memset(io, '\0', sizeof(*io));
+	io->ns = &test->ns;
+	io->blknr = blknr;
+	io->blkcnt = blkcnt;
+	io->buffer = buffer;
+	io->read = true;
+	nvme_io_start(&test->io, io);
+}
+
+/* Commands complete out of order and their IDs are reused once free */
+static int dm_test_nvme_io_order(struct unit_test_state *uts)
+{
+	struct nvme_test test;
+	struct nvme_io io;
+	void *buffer;
+	u64 slba;
+
+	sandbox_set_enable_memio(true);
+	ut_assertok(nvme_test_init(&test));
+	buffer = memalign(4096, 4 * NVME_TEST_BLKS * 512);
+	ut_assertnonnull(buffer);
+
+	/* Four commands, only three of which fit in the queue */
+	nvme_test_io(&test, &io, buffer, 100, 4 * NVME_TEST_BLKS);
+	ut_asserteq(0, nvme_test_fetch(&test, &slba));
+	ut_asserteq(100, slba);
+	ut_asserteq(1, nvme_test_fetch(&test, &slba));
+	ut_asserteq(108, slba);
+	ut_asserteq(2, nvme_test_fetch(&test, &slba));
+	ut_asserteq(116, slba);
+	ut_asserteq(-ENOENT, nvme_test_fetch(&test, &slba));
+
+	/* The last one goes out in the first free slot */
+	nvme_test_complete(&test, 2, 0);
+	nvme_test_complete(&test, 0, 0);
+	ut_assertok(nvme_io_progress(&test.io));
+	ut_asserteq(-EINPROGRESS, io.status);
+	ut_asserteq(0, nvme_test_fetch(&test, &slba));
+	ut_asserteq(124, slba);
+	ut_asserteq(-ENOENT, nvme_test_fetch(&test, &slba));
+
+	nvme_test_complete(&test, 1, 0);
+	ut_assertok(nvme_io_progress(&test.io));
+	ut_asserteq(-EINPROGRESS, io.status);
+	nvme_test_complete(&test, 0, 0);
+	ut_assertok(nvme_io_progress(&test.io));
+	ut_assertok(io.status);
+	ut_asserteq(4 * NVME_TEST_BLKS, io.failed);
+	ut_asserteq(0, test.io.inflight);
+
+	/* An error fails the transfer from that command on */
+	nvme_test_io(&test, &io, buffer, 200, 2 * NVME_TEST_BLKS);
+	ut_asserteq(0, nvme_test_fetch(&test, &slba));
+	ut_asserteq(1, nvme_test_fetch(&test, &slba));
+	nvme_test_complete(&test, 1, 2);
+	nvme_test_complete(&test, 0, 0);
+	ut_assertok(nvme_io_progress(&test.io));
+	ut_asserteq(-EIO, io.status);
+	ut_asserteq(NVME_TEST_BLKS, io.failed);
+
+	free(buffer);
+	nvme_test_free(&test);
+	sandbox_set_enable_memio(false);
+
+	return 0;
+}
+DM_TEST(dm_test_nvme_io_order, 0);
+
+/* The IDs of timed-out commands are not reused until they complete */
+static int dm_test_nvme_io_timeout(struct unit_test_state *uts)
+{
+	struct nvme_io io, io2;
+	struct nvme_test test;
+	void *buffer;
+	u64 slba;
+
+	sandbox_set_enable_memio(true);
+	ut_assertok(nvme_test_init(&test));
+	buffer = memalign(4096, 2 * NVME_TEST_BLKS * 512);
+	ut_assertnonnull(buffer);
+
+	nvme_test_io(&test, &io, buffer, 100, 2 * NVME_TEST_BLKS);
+	ut_asserteq(0, nvme_test_fetch(&test, &slba));
+	ut_asserteq(1, nvme_test_fetch(&test, &slba));
+
+	/* The controller fails the queue reset too */
+	test.admin.cqes[0].status = cpu_to_le16(2 << 1 | 1);
+	timer_test_add_offset(IO_TIMEOUT * 1000);
+	ut_asserteq(-ETIMEDOUT, nvme_io_progress(&test.io));
+	ut_asserteq(-EIO, io.status);
+	ut_asserteq(0, io.failed);
+
+	/* A new command does not reuse the IDs still held by the controller */
+	nvme_test_io(&test, &io2, buffer, 200, NVME_TEST_BLKS);
+	ut_asserteq(2, nvme_test_fetch(&test, &slba));
+	ut_asserteq(200, slba);
+
+	/* A late completion frees its ID but does not complete the new one */
+	nvme_test_complete(&test, 0, 0);
+	ut_assertok(nvme_io_progress(&test.io));
+	ut_asserteq(-EINPROGRESS, io2.status);
+	nvme_test_complete(&test, 2, 0);
+	ut_assertok(nvme_io_progress(&test.io));
+	ut_assertok(io2.status);
+
+	/* ID 1 is still held */
+	nvme_test_io(&test, &io2, buffer, 300, 2 * NVME_TEST_BLKS);
+	ut_asserteq(0, nvme_test_fetch(&test, &slba));
+	ut_asserteq(2, nvme_test_fetch(&test, &slba));
+	ut_asserteq(-ENOENT, nvme_test_fetch(&test, &slba));
+	nvme_test_complete(&test, 2, 0);
+	nvme_test_complete(&test, 0, 0);
+	ut_assertok(nvme_io_progress(&test.io));
+	ut_assertok(io2.status);
+	ut_asserteq(1, test.io.inflight);
+
+	free(buffer);
+	nvme_test_free(&test);
+	sandbox_set_enable_memio(false);
+
+	return 0;
+}
+DM_TEST(dm_test_nvme_io_timeout, 0);
@@ -10,6 +10,7 @@
 #include <mapmem.h>
 #include <os.h>
 #include <spi.h>
+#include <spi-mem.h>
 #include <spi_flash.h>
 #include <asm/state.h>
 #include <asm/test.h>
@@ -67,6 +68,60 @@ static int dm_test_spi_flash(struct unit_test_state *uts)
 }
 DM_TEST(dm_test_spi_flash, UT_TESTF_SCAN_PDATA | UT_TESTF_SCAN_FDT);
 
+/* Test reading sandbox SPI flash through a spi-mem direct mapping */
+static int dm_test_spi_flash_dirmap(struct unit_test_state *uts)
+{
+	struct spi_mem_op op = SPI_MEM_OP(SPI_MEM_OP_CMD(0x0b, 1),
+					  SPI_MEM_OP_ADDR(3, 0, 1),
+					  SPI_MEM_OP_DUMMY(1, 1),
+					  SPI_MEM_OP_DATA_IN(0, NULL, 1));
+	struct spi_flash *flash;
+	struct udevice *dev;
+	int full_size = 0x200000;
+	int size = 0x10000;
+	u8 *src, *dst;
+	int i;
+
+	src = map_sysmem(0x20000, full_size);
+	for (i = 0; i < full_size; i++)
+		src[i] = i * 7;
+	ut_assertok(os_write_file("spi.bin", src, full_size));
+	ut_assertok(uclass_first_device_err(UCLASS_SPI_FLASH, &dev));
+	dst = map_sysmem(0x20000 + full_size, full_size);
+
+	/* The sandbox controller has no window, so this uses regular ops */
+	flash = dev_get_uclass_priv(dev);
+	ut_assertnonnull(flash->dirmap.rdesc);
+	ut_asserteq(size, spi_mem_dirmap_read(flash->dirmap.rdesc, 0x1234,
+					      size, dst));
+	ut_asserteq_mem(src + 0x1234, dst, size);
+	ut_asserteq(-EINVAL, spi_mem_dirmap_read(flash->dirmap.rdesc,
+						 full_size, 1, dst));
+
+	/* spi_flash_read_dm() goes through the same mapping */
+	memset(dst, '\0', size);
+	ut_assertok(spi_flash_read_dm(dev, full_size - size, size, dst));
+	ut_asserteq_mem(src + full_size - size, dst, size);
+
+	/* The controller cannot do DTR */
+	ut_assert(spi_mem_supports_op(flash->spi, &op));
+	op.data.dtr = true;
+	ut_assert(!spi_mem_supports_op(flash->spi, &op));
+
+	/* Removing the flash drops the mapping */
+	ut_assertok(spi_nor_remove(flash));
+	ut_assertnull(flash->dirmap.rdesc);
+
+	/*
+	 * Since we are about to destroy all devices, we must tell sandbox
+	 * to forget the emulation device
+	 */
+	sandbox_sf_unbind_emul(state_get_current(), 0, 0);
+
+	return 0;
+}
+DM_TEST(dm_test_spi_flash_dirmap, UT_TESTF_SCAN_PDATA | UT_TESTF_SCAN_FDT);
+
 /* Functional test that sandbox SPI flash works correctly */
 static int dm_test_spi_flash_func(struct unit_test_state *uts)
 {
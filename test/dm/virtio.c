@@ -87,6 +87,66 @@ static int dm_test_virtio_all_ops(struct unit_test_state *uts)
 }
 DM_TEST(dm_test_virtio_all_ops, UT_TESTF_SCAN_PDATA | UT_TESTF_SCAN_FDT);
 
+/* Test that a chain of buffers takes one ring entry when it is indirect */
+static int dm_test_virtio_ring_indirect(struct unit_test_state *uts)
+{
+	struct udevice *bus, *dev;
+	struct virtio_dev_priv *uc_priv;
+	struct vring_desc *desc, *table;
+	struct virtqueue *vq;
+	u8 hdr[16], data[512], status;
+	struct virtio_sg hdr_sg = { hdr, sizeof(hdr) };
+	struct virtio_sg data_sg = { data, sizeof(data) };
+	struct virtio_sg status_sg = { &status, sizeof(status) };
+	struct virtio_sg *sgs[] = { &hdr_sg, &data_sg, &status_sg };
+
+	ut_assertok(uclass_first_device(UCLASS_VIRTIO, &bus));
+	ut_assertok(device_find_first_child(bus, &dev));
+	uc_priv = dev_get_uclass_priv(bus);
+	uc_priv->vdev = dev;
+	ut_assertok(virtio_find_vqs(dev, 1, &vq));
+	desc = vq->vring.desc;
+
+	/* Without indirect descriptors each buffer takes an entry */
+	ut_asserteq(4, vq->num_free);
+	ut_assertok(virtqueue_add(vq, sgs, 2, 1));
+	ut_asserteq(1, vq->num_free);
+	ut_asserteq(VRING_DESC_F_NEXT, desc[0].flags);
+	ut_asserteq(VRING_DESC_F_WRITE, desc[2].flags);
+
+	/* Complete the chain as the device would */
+	vq->vring.used->ring[0].id = 0;
+	vq->vring.used->idx = 1;
+	ut_asserteq_ptr(hdr, virtqueue_get_buf(vq, NULL));
+	ut_asserteq(4, vq->num_free);
+
+	/* With them the chain moves to a table of its own */
+	vq->indirect = true;
+	ut_assertok(virtqueue_add(vq, sgs, 2, 1));
+	ut_asserteq(3, vq->num_free);
+	ut_asserteq(VRING_DESC_F_INDIRECT, desc[0].flags);
+	ut_asserteq(3 * sizeof(*table), desc[0].len);
+	table = (struct vring_desc *)(uintptr_t)desc[0].addr;
+	ut_asserteq_ptr(hdr, (void *)(uintptr_t)table[0].addr);
+	ut_asserteq_ptr(data, (void *)(uintptr_t)table[1].addr);
+	ut_asserteq_ptr(&status, (void *)(uintptr_t)table[2].addr);
+	ut_asserteq(VRING_DESC_F_NEXT, table[0].flags);
+	ut_asserteq(2, table[1].next);
+	ut_asserteq(VRING_DESC_F_WRITE, table[2].flags);
+
+	/* The first buffer is still returned once the table is freed */
+	vq->vring.used->ring[1].id = 0;
+	vq->vring.used->idx = 2;
+	ut_asserteq_ptr(hdr, virtqueue_get_buf(vq, NULL));
+	ut_asserteq(4, vq->num_free);
+	ut_assertnull(virtqueue_get_buf(vq, NULL));
+
+	ut_assertok(virtio_del_vqs(dev));
+
+	return 0;
+}
+DM_TEST(dm_test_virtio_ring_indirect, UT_TESTF_SCAN_PDATA | UT_TESTF_SCAN_FDT);
+
 /* Test of the virtio driver that does not have required driver ops */
 static int dm_test_virtio_missing_ops(struct unit_test_state *uts)
 {
@@ -0,0 +1,192 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Tests for write_sparse_image()
+ */
+
+#include <common.h>
+#include <image-sparse.h>
+#include <malloc.h>
+#include <linux/sizes.h>
+#include <test/lib.h>
+#include <test/test.h>
+#include <test/ut.h>
+
+#define SPARSE_TEST_BLK_SZ	4096
+#define SPARSE_TEST_STORAGE_BLKSZ	512
+#define SPARSE_TEST_START	16
+#define SPARSE_TEST_MAX_CALLS	16
+
+struct sparse_test_call {
+	lbaint_t blk;
+	lbaint_t blkcnt;
+};
+
+struct sparse_test_priv {
+	u8 *mem;
+	int writes;
+	int reserves;
+	struct sparse_test_call write[SPARSE_TEST_MAX_CALLS];
+	struct sparse_test_call reserve[SPARSE_TEST_MAX_CALLS];
+};
+
+static lbaint_t sparse_test_write(struct sparse_storage *info, lbaint_t blk,
+				  lbaint_t blkcnt, const void *buffer)
+{
+	struct sparse_test_priv *priv = info->priv;
+
+	if (priv->writes < SPARSE_TEST_MAX_CALLS) {
+		priv->write[priv->writes].blk = blk - info->start;
+		priv->write[priv->writes].blkcnt = blkcnt;
+	}
+	priv->writes++;
+	memcpy(priv->mem + (blk - info->start) * info->blksz, buffer,
+	       blkcnt * info->blksz);
+
+	return blkcnt;
+}
+
+static lbaint_t sparse_test_reserve(struct sparse_storage *info,
+				    lbaint_t blk, lbaint_t blkcnt)
+{
+	struct sparse_test_priv *priv = info->priv;
+
+	if (priv->reserves < SPARSE_TEST_MAX_CALLS) {
+		priv->reserve[priv->reserves].blk = blk - info->start;
+		priv->reserve[priv->reserves].blkcnt = blkcnt;
+	}
+	priv->reserves++;
+
+	return blkcnt;
+}
+
+/* Add a chunk to the image at @p, returning the end of the chunk */
+static void *sparse_test_chunk(void *p, u16 type, u32 blocks, u32 val)
+{
+	chunk_header_t *hdr = p;
+	u32 *data = p + sizeof(*hdr);
+	u32 i, size = 0;
+
+	if (type == CHUNK_TYPE_RAW) {
+		size = blocks * SPARSE_TEST_BLK_SZ;
+		for (i = 0; i < size / sizeof(u32); i++)
+			data[i] = val + i;
+	} else if (type == CHUNK_TYPE_FILL) {
+		size = sizeof(u32);
+		data[0] = val;
+	}
+	hdr->chunk_type = type;
+	hdr->reserved1 = 0;
+	hdr->chunk_sz = blocks;
+	hdr->total_sz = sizeof(*hdr) + size;
+
+	return p + hdr->total_sz;
+}
+
+/* Check that sparse block @blk onwards holds @blocks blocks made by @type */
+static int sparse_test_check(struct unit_test_state *uts, u8 *mem, u32 blk,
+			     u16 type, u32 blocks, u32 val)
+{
+	u32 *data = (u32 *)(mem + blk * SPARSE_TEST_BLK_SZ);
+	u32 i;
+
+	for (i = 0; i < blocks * SPARSE_TEST_BLK_SZ / sizeof(u32); i++)
+		ut_asserteq(type == CHUNK_TYPE_RAW ? val + i : val, data[i]);
+
+	return 0;
+}
+
+static int lib_test_sparse_image(struct unit_test_state *uts)
+{
+	struct sparse_test_priv priv = {};
+	struct sparse_storage info = {};
+	sparse_header_t *hdr;
+	u32 total_blks = 511;
+	void *image, *p;
+	size_t mem_size;
+
+	mem_size = total_blks * SPARSE_TEST_BLK_SZ;
+	image = malloc(SZ_1M);
+	priv.mem = malloc(mem_size);
+	ut_assertnonnull(image);
+	ut_assertnonnull(priv.mem);
+	memset(priv.mem, 0xa5, mem_size);
+
+	hdr = image;
+	memset(hdr, '\0', sizeof(*hdr));
+	hdr->magic = SPARSE_HEADER_MAGIC;
+	hdr->major_version = 1;
+	hdr->file_hdr_sz = sizeof(*hdr);
+	hdr->chunk_hdr_sz = sizeof(chunk_header_t);
+	hdr->blk_sz = SPARSE_TEST_BLK_SZ;
+	hdr->total_blks = total_blks;
+	hdr->total_chunks = 9;
+	p = image + sizeof(*hdr);
+	p = sparse_test_chunk(p, CHUNK_TYPE_RAW, 1, 0x1000);
+	p = sparse_test_chunk(p, CHUNK_TYPE_RAW, 2, 0x2000);
+	p = sparse_test_chunk(p, CHUNK_TYPE_FILL, 1, 0x11223344);
+	p = sparse_test_chunk(p, CHUNK_TYPE_DONT_CARE, 3, 0);
+	p = sparse_test_chunk(p, CHUNK_TYPE_DONT_CARE, 2, 0);
+	p = sparse_test_chunk(p, CHUNK_TYPE_FILL, 300, 0xdeadbeef);
+	p = sparse_test_chunk(p, CHUNK_TYPE_RAW, 200, 0x3000);
+	p = sparse_test_chunk(p, CHUNK_TYPE_RAW, 1, 0x4000);
+	p = sparse_test_chunk(p, CHUNK_TYPE_DONT_CARE, 1, 0);
+	ut_assert(p - image <= SZ_1M);
+	ut_assert(is_sparse_image(image));
+
+	info.blksz = SPARSE_TEST_STORAGE_BLKSZ;
+	info.start = SPARSE_TEST_START;
+	info.size = mem_size / info.blksz;
+	info.priv = &priv;
+	info.write = sparse_test_write;
+	info.reserve = sparse_test_reserve;
+	ut_assertok(write_sparse_image(&info, "test", image, NULL));
+
+	ut_assertok(sparse_test_check(uts, priv.mem, 0, CHUNK_TYPE_RAW, 1,
+				      0x1000));
+	ut_assertok(sparse_test_check(uts, priv.mem, 1, CHUNK_TYPE_RAW, 2,
+				      0x2000));
+	ut_assertok(sparse_test_check(uts, priv.mem, 3, CHUNK_TYPE_FILL, 1,
+				      0x11223344));
+	ut_assertok(sparse_test_check(uts, priv.mem, 4, CHUNK_TYPE_FILL, 5,
+				      0xa5a5a5a5));
+	ut_assertok(sparse_test_check(uts, priv.mem, 9, CHUNK_TYPE_FILL, 300,
+				      0xdeadbeef));
+	ut_assertok(sparse_test_check(uts, priv.mem, 309, CHUNK_TYPE_RAW, 200,
+				      0x3000));
+	ut_assertok(sparse_test_check(uts, priv.mem, 509, CHUNK_TYPE_RAW, 1,
+				      0x4000));
+	ut_assertok(sparse_test_check(uts, priv.mem, 510, CHUNK_TYPE_FILL, 1,
+				      0xa5a5a5a5));
+
+	/*
+	 * The first three chunks go out together, the long fill in pieces of
+	 * the buffer size and the long raw chunk straight from the image
+	 */
+	ut_asserteq(6, priv.writes);
+	ut_asserteq(0, priv.write[0].blk);
+	ut_asserteq(4 * 8, priv.write[0].blkcnt);
+	ut_asserteq(9 * 8, priv.write[1].blk);
+	ut_asserteq(CONFIG_IMAGE_SPARSE_FILLBUF_SIZE / info.blksz,
+		    priv.write[1].blkcnt);
+	ut_asserteq(309 * 8, priv.write[4].blk);
+	ut_asserteq(200 * 8, priv.write[4].blkcnt);
+	ut_asserteq(509 * 8, priv.write[5].blk);
+	ut_asserteq(1 * 8, priv.write[5].blkcnt);
+
+	/* Neighbouring DONT_CARE chunks are reserved together */
+	ut_asserteq(2, priv.reserves);
+	ut_asserteq(4 * 8, priv.reserve[0].blk);
+	ut_asserteq(5 * 8, priv.reserve[0].blkcnt);
+	ut_asserteq(510 * 8, priv.reserve[1].blk);
+	ut_asserteq(1 * 8, priv.reserve[1].blkcnt);
+
+	/* An image which does not fit is refused */
+	info.size = 509 * 8;
+	ut_asserteq(-1, write_sparse_image(&info, "test", image, NULL));
+
+	free(priv.mem);
+	free(image);
+
+	return 0;
+}
+LIB_TEST(lib_test_sparse_image, 0);
@@ -2,10 +2,14 @@
 # Copyright (c) 2018, Linaro Limited
 # Author: Takahiro Akashi <takahiro.akashi@linaro.org>
 
+import collections
+import itertools
 import os
 import os.path
 import pytest
 import re
+import shutil
+import string
 from subprocess import call, check_call, check_output, CalledProcessError
 from fstest_defs import *
 
@@ -14,6 +18,8 @@ supported_fs_ext = ['fat16', 'fat32']
 supported_fs_mkdir = ['fat16', 'fat32']
 supported_fs_unlink = ['fat16', 'fat32']
 supported_fs_symlink = ['ext4']
+supported_fs_remount = ['fat16', 'fat32', 'ext4']
+supported_fs_htree = ['ext4']
 
 #
 # Filesystem test specific setup
@@ -50,6 +56,8 @@ def pytest_configure(config):
     global supported_fs_mkdir
     global supported_fs_unlink
     global supported_fs_symlink
+    global supported_fs_remount
+    global supported_fs_htree
 
     def intersect(listA, listB):
         return  [x for x in listA if x in listB]
@@ -62,6 +70,8 @@ def pytest_configure(config):
         supported_fs_mkdir =  intersect(supported_fs, supported_fs_mkdir)
         supported_fs_unlink =  intersect(supported_fs, supported_fs_unlink)
         supported_fs_symlink =  intersect(supported_fs, supported_fs_symlink)
+        supported_fs_remount =  intersect(supported_fs, supported_fs_remount)
+        supported_fs_htree =  intersect(supported_fs, supported_fs_htree)
 
 def pytest_generate_tests(metafunc):
     """Parametrize fixtures, fs_obj_xxx
@@ -90,6 +100,12 @@ def pytest_generate_tests(metafunc):
     if 'fs_obj_symlink' in metafunc.fixturenames:
         metafunc.parametrize('fs_obj_symlink', supported_fs_symlink,
             indirect=True, scope='module')
+    if 'fs_obj_remount' in metafunc.fixturenames:
+        metafunc.parametrize('fs_obj_remount', supported_fs_remount,
+            indirect=True, scope='module')
+    if 'fs_obj_htree' in metafunc.fixturenames:
+        metafunc.parametrize('fs_obj_htree', supported_fs_htree,
+            indirect=True, scope='module')
 
 #
 # Helper functions
@@ -131,13 +147,14 @@ def check_ubconfig(config, fs_type):
         pytest.skip('.config feature "%s_WRITE" not enabled'
         % fs_type.upper())
 
-def mk_fs(config, fs_type, size, id):
+def mk_fs(config, fs_type, size, id, fs_opt=''):
     """Create a file system volume.
 
     Args:
         fs_type: File system type.
         size: Size of file system in MiB.
         id: Prefix string of volume's file name.
+        fs_opt: Extra options for mkfs.
 
     Return:
         Nothing.
@@ -163,8 +180,8 @@ def mk_fs(config, fs_type, size, id):
         check_call('rm -f %s' % fs_img, shell=True)
         check_call('dd if=/dev/zero of=%s bs=1M count=%d'
             % (fs_img, count), shell=True)
-        check_call('mkfs.%s %s %s'
-            % (fs_lnxtype, mkfs_opt, fs_img), shell=True)
+        check_call('mkfs.%s %s %s %s'
+            % (fs_lnxtype, mkfs_opt, fs_opt, fs_img), shell=True)
         if fs_type == 'ext4':
             sb_content = check_output('tune2fs -l %s' % fs_img, shell=True).decode()
             if 'metadata_csum' in sb_content:
@@ -603,3 +620,169 @@ def fs_obj_symlink(request, u_boot_config):
         call('rmdir %s' % mount_dir, shell=True)
         if fs_img:
             call('rm -f %s' % fs_img, shell=True)
+
+#
+# Fixture for remount test
+#
+# NOTE: yield_fixture was deprecated since pytest-3.0
+@pytest.yield_fixture()
+def fs_obj_remount(request, u_boot_config):
+    """Set up file systems to be used in remount test.
+
+    Two volumes of the same size are created, holding the same file name
+    with different contents.
+
+    Args:
+        request: Pytest request object.
+        u_boot_config: U-boot configuration.
+
+    Return:
+        A fixture for remount test, i.e. a triplet of file system type,
+        a list of volume file names and a list of MD5 hashes.
+    """
+    fs_type = request.param
+    fs_imgs = []
+
+    fs_ubtype = fstype_to_ubname(fs_type)
+    check_ubconfig(u_boot_config, fs_ubtype)
+
+    mount_dir = u_boot_config.persistent_data_dir + '/mnt'
+
+    remount_file = mount_dir + '/' + REMOUNT_FILE
+
+    try:
+        check_call('mkdir -p %s' % mount_dir, shell=True)
+        md5val = []
+        for id in ['64MBa', '64MBb']:
+            # 64MiB volume
+            fs_img = mk_fs(u_boot_config, fs_type, 0x4000000, id)
+            fs_imgs.append(fs_img)
+
+            # Mount the image so we can populate it.
+            mount_fs(fs_type, fs_img, mount_dir)
+
+            # Create a file with different contents in each image.
+            check_call('dd if=/dev/urandom of=%s bs=64K count=1'
+                       % remount_file, shell=True)
+            out = check_output(
+                'dd if=%s bs=64K 2> /dev/null | md5sum'
+                % remount_file, shell=True).decode()
+            md5val.append(out.split()[0])
+
+            umount_fs(mount_dir)
+    except CalledProcessError:
+        pytest.skip('Setup failed for filesystem: ' + fs_type)
+        return
+    else:
+        yield [fs_ubtype, fs_imgs, md5val]
+    finally:
+        umount_fs(mount_dir)
+        call('rmdir %s' % mount_dir, shell=True)
+        for fs_img in fs_imgs:
+            call('rm -f %s' % fs_img, shell=True)
+
+#
+# Fixture for htree test
+#
+def dx_hack_hash_names(prefix, count):
+    """Make names colliding in pairs under the legacy ext4 directory hash.
+
+    Args:
+        prefix: Common prefix of the names.
+        count: Number of colliding names wanted.
+
+    Return:
+        A list of colliding names and a list of the other names tried.
+    """
+    def step(state, c):
+        hash0, hash1 = state
+        hash = (hash1 + (hash0 ^ (c * 7152373))) & 0xffffffff
+        if hash & 0x80000000:
+            hash = (hash - 0x7fffffff) & 0xffffffff
+        return (hash, hash0)
+
+    state = (0x12a3fe2d, 0x37abe8f9)
+    for c in prefix.encode():
+        state = step(state, c)
+
+    # The hash is weak enough that four letters give plenty of pairs.
+    names = collections.defaultdict(list)
+    for tail in itertools.product(string.ascii_lowercase, repeat=4):
+        tail = ''.join(tail)
+        hash = state
+        for c in tail.encode():
+            hash = step(hash, c)
+        names[hash[0]].append(prefix + tail)
+
+    colliding = [name for group in names.values() if len(group) > 1
+                 for name in group]
+    others = [group[0] for group in names.values() if len(group) == 1]
+    return colliding[:count], others
+
+# NOTE: yield_fixture was deprecated since pytest-3.0
+@pytest.yield_fixture()
+def fs_obj_htree(request, u_boot_config):
+    """Set up file systems to be used in htree test.
+
+    A directory with enough long names to need a two-level hash tree
+    index is created on a volume with 1KiB blocks. Names colliding under
+    the legacy hash are included, so that some of them are continued in
+    the next leaf block. A copy of the volume has a corrupt index root.
+
+    Args:
+        request: Pytest request object.
+        u_boot_config: U-boot configuration.
+
+    Return:
+        A fixture for htree test, i.e. a triplet of file system type,
+        a list of the good and corrupt volume file names and a list of
+        the file names in HTREE_DIR. The n-th file holds n + 1 bytes.
+    """
+    fs_type = request.param
+    fs_imgs = []
+
+    fs_ubtype = fstype_to_ubname(fs_type)
+    check_ubconfig(u_boot_config, fs_ubtype)
+
+    src_dir = u_boot_config.persistent_data_dir + '/htree'
+    htree_dir = src_dir + '/' + HTREE_DIR
+
+    try:
+        # 4 entries of 248 bytes fit in a leaf, one root holds 124 leaves
+        colliding, others = dx_hack_hash_names('htree_' + 'x' * 228, 200)
+        names = colliding + others[:700 - len(colliding)]
+
+        check_call('rm -rf %s' % src_dir, shell=True)
+        os.makedirs(htree_dir)
+        for i, name in enumerate(names):
+            with open(htree_dir + '/' + name, 'w') as f:
+                f.write('x' * (i + 1))
+
+        fs_img = mk_fs(u_boot_config, fs_type, 0x4000000, '64MBhtree',
+                       '-b 1024 -d %s' % src_dir)
+        fs_imgs.append(fs_img)
+
+        # Rebuild the directory with an index, using the legacy hash.
+        check_call('tune2fs -E hash_alg=legacy %s' % fs_img, shell=True)
+        if call('e2fsck -fyD %s' % fs_img, shell=True) & ~1:
+            raise CalledProcessError(1, 'e2fsck')
+        out = check_output('debugfs -R "htree_dump /%s" %s'
+                           % (HTREE_DIR, fs_img), shell=True).decode()
+        assert('Indirect levels: 1' in out)
+
+        # Make the info_length of dx_root_info invalid.
+        fs_img = '%s/64MBhtree_bad.%s.img' % (
+            u_boot_config.persistent_data_dir, fs_type)
+        shutil.copyfile(fs_imgs[0], fs_img)
+        fs_imgs.append(fs_img)
+        check_call('debugfs -w -R "zap_block -f /%s -o 29 -l 1 -p 0x10 0" %s'
+                   % (HTREE_DIR, fs_img), shell=True)
+    except CalledProcessError:
+        pytest.skip('Setup failed for filesystem: ' + fs_type)
+        return
+    else:
+        yield [fs_ubtype, fs_imgs, names]
+    finally:
+        call('rm -rf %s' % src_dir, shell=True)
+        for fs_img in fs_imgs:
+            call('rm -f %s' % fs_img, shell=True)
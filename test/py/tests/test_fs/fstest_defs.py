@@ -9,6 +9,12 @@ SMALL_FILE='1MB.file'
 # $MEDIUM_FILE is the name of the 10MB file in the file system image
 MEDIUM_FILE='10MB.file'
 
+# $REMOUNT_FILE is the name of the 64KB file in the remount test images
+REMOUNT_FILE='remount.file'
+
+# $HTREE_DIR is the name of the directory with a hash tree index
+HTREE_DIR='htree'
+
 # $BIG_FILE is the name of the 2.5GB file in the file system image
 BIG_FILE='2.5GB.file'
 
@@ -0,0 +1,56 @@
+# SPDX-License-Identifier:      GPL-2.0+
+#
+# U-Boot File System:Htree Test
+
+"""
+This test verifies that names in an ext4 directory with a hash tree index
+are found through the index, and by a linear scan if the index is corrupt.
+"""
+
+import pytest
+from fstest_defs import *
+
+def check_lookup(u_boot_console, fs_type, fs_img, names):
+    """List the directory and load each of its files by name."""
+    output = u_boot_console.run_command_list([
+        'host bind 0 %s' % fs_img,
+        '%sls host 0:0 /%s' % (fs_type, HTREE_DIR)])
+    listing = ''.join(output)
+    for name in names:
+        assert(name in listing)
+
+    for i, name in enumerate(names):
+        output = u_boot_console.run_command(
+            'load host 0:0 %x /%s/%s' % (ADDR, HTREE_DIR, name))
+        assert('%d bytes read' % (i + 1) in output)
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.slow
+class TestHtree(object):
+    def test_htree1(self, u_boot_console, fs_obj_htree):
+        """
+        Test Case 1 - look up every name through a two-level index
+        """
+        fs_type, fs_imgs, names = fs_obj_htree
+        with u_boot_console.log.section('Test Case 1 - index lookup'):
+            check_lookup(u_boot_console, fs_type, fs_imgs[0], names)
+
+    def test_htree2(self, u_boot_console, fs_obj_htree):
+        """
+        Test Case 2 - fall back to a linear scan on a corrupt index
+        """
+        fs_type, fs_imgs, names = fs_obj_htree
+        with u_boot_console.log.section('Test Case 2 - corrupt index'):
+            check_lookup(u_boot_console, fs_type, fs_imgs[1], names)
+
+    def test_htree3(self, u_boot_console, fs_obj_htree):
+        """
+        Test Case 3 - a missing name is not found
+        """
+        fs_type, fs_imgs, names = fs_obj_htree
+        with u_boot_console.log.section('Test Case 3 - missing name'):
+            output = u_boot_console.run_command_list([
+                'host bind 0 %s' % fs_imgs[0],
+                'load host 0:0 %x /%s/%s' % (ADDR, HTREE_DIR,
+                                             names[0][:-1] + '_')])
+            assert('bytes read' not in ''.join(output))
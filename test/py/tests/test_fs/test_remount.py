@@ -0,0 +1,65 @@
+# SPDX-License-Identifier:      GPL-2.0+
+#
+# U-Boot File System:Remount Test
+
+"""
+This test verifies that a filesystem kept mounted between commands is
+dropped when the medium changes, so that a new volume is seen.
+"""
+
+import pytest
+import os
+import shutil
+from fstest_defs import *
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.slow
+class TestRemount(object):
+    def test_remount1(self, u_boot_console, fs_obj_remount):
+        """
+        Test Case 1 - re-bind the host device to another volume
+        """
+        fs_type, fs_imgs, md5val = fs_obj_remount
+        with u_boot_console.log.section('Test Case 1 - re-bind'):
+            output = u_boot_console.run_command_list([
+                'host bind 0 %s' % fs_imgs[0],
+                '%sload host 0:0 %x /%s' % (fs_type, ADDR, REMOUNT_FILE),
+                'md5sum %x $filesize' % ADDR,
+                'setenv filesize'])
+            assert(md5val[0] in ''.join(output))
+
+            output = u_boot_console.run_command_list([
+                'host bind 0 %s' % fs_imgs[1],
+                '%sls host 0:0 /' % fs_type,
+                '%sload host 0:0 %x /%s' % (fs_type, ADDR, REMOUNT_FILE),
+                'md5sum %x $filesize' % ADDR,
+                'setenv filesize'])
+            assert(REMOUNT_FILE in ''.join(output))
+            assert(md5val[1] in ''.join(output))
+
+    def test_remount2(self, u_boot_console, fs_obj_remount, u_boot_config):
+        """
+        Test Case 2 - write the medium behind the back of the mount
+        """
+        fs_type, fs_imgs, md5val = fs_obj_remount
+        fs_img = u_boot_config.persistent_data_dir + '/remount.img'
+        with u_boot_console.log.section('Test Case 2 - write behind'):
+            shutil.copyfile(fs_imgs[0], fs_img)
+            output = u_boot_console.run_command_list([
+                'host bind 0 %s' % fs_img,
+                'load host 0:0 %x /%s' % (ADDR, REMOUNT_FILE),
+                'md5sum %x $filesize' % ADDR,
+                'setenv filesize'])
+            assert(md5val[0] in ''.join(output))
+
+            # Same device, partition and size: only the contents change
+            shutil.copyfile(fs_imgs[1], fs_img)
+            output = u_boot_console.run_command_list([
+                'host bind 0 %s' % fs_img,
+                'ls host 0:0 /',
+                'load host 0:0 %x /%s' % (ADDR, REMOUNT_FILE),
+                'md5sum %x $filesize' % ADDR,
+                'setenv filesize'])
+            assert(REMOUNT_FILE in ''.join(output))
+            assert(md5val[1] in ''.join(output))
+            os.remove(fs_img)
@@ -55,6 +55,30 @@ env__net_nfs_readable_file = {
     'size': 5058624,
     'crc32': 'c2244b26',
 }
+
+# Details regarding a file that may be read from an HTTP server. This variable
+# may be omitted or set to None if HTTP testing is not possible or desired.
+env__net_http_readable_file = {
+    'fn': 'ubtest-readable.bin',
+    'addr': 0x10000000,
+    'size': 5058624,
+    'crc32': 'c2244b26',
+}
+
+# Details regarding a file that may be read from an HTTP server and streamed
+# into a file on a FAT filesystem. The file should be larger than 16MiB, or
+# than the free memory at 'addr', so that it is written out in several
+# pieces. This variable may be omitted or set to None if such testing is not
+# possible or desired.
+env__net_http_fat_file = {
+    'fn': 'ubtest-readable-big.bin',
+    'addr': 0x10000000,
+    'size': 20971520,
+    'crc32': '6ddc0ccd',
+    'interface': 'mmc',
+    'dev': '0:1',
+    'dst': 'ubtest-wget.bin',
+}
 """
 
 net_set_up = False
@@ -206,3 +230,124 @@ def test_net_nfs(u_boot_console):
 
     output = u_boot_console.run_command('crc32 %x $filesize' % addr)
     assert expected_crc in output
+
+@pytest.mark.buildconfigspec('cmd_wget')
+def test_net_wget(u_boot_console):
+    """Test the wget command.
+
+    A file is downloaded from the HTTP server, its size and optionally its
+    CRC32 are validated.
+
+    The details of the file to download are provided by the boardenv_* file;
+    see the comment at the beginning of this file.
+    """
+
+    if not net_set_up:
+        pytest.skip('Network not initialized')
+
+    f = u_boot_console.config.env.get('env__net_http_readable_file', None)
+    if not f:
+        pytest.skip('No HTTP readable file to read')
+
+    addr = f.get('addr', None)
+    if not addr:
+        addr = u_boot_utils.find_ram_base(u_boot_console)
+
+    fn = f['fn']
+    output = u_boot_console.run_command('wget %x %s' % (addr, fn))
+    expected_text = 'Bytes transferred = '
+    sz = f.get('size', None)
+    if sz:
+        expected_text += '%d' % sz
+    assert expected_text in output
+
+    expected_crc = f.get('crc32', None)
+    if not expected_crc:
+        return
+
+    if u_boot_console.config.buildconfig.get('config_cmd_crc32', 'n') != 'y':
+        return
+
+    output = u_boot_console.run_command('crc32 %x $filesize' % addr)
+    assert expected_crc in output
+
+@pytest.mark.buildconfigspec('cmd_wget')
+@pytest.mark.buildconfigspec('fat_write')
+def test_net_wget_fat(u_boot_console):
+    """Test the wget command streaming a file to a FAT filesystem.
+
+    A file is downloaded from the HTTP server and written to a FAT
+    filesystem through the memory at the load address. Its size, and
+    optionally its CRC32, are validated on the filesystem.
+
+    The details of the file to download are provided by the boardenv_* file;
+    see the comment at the beginning of this file.
+    """
+
+    if not net_set_up:
+        pytest.skip('Network not initialized')
+
+    f = u_boot_console.config.env.get('env__net_http_fat_file', None)
+    if not f:
+        pytest.skip('No HTTP readable file to stream to FAT')
+
+    addr = f.get('addr', None)
+    if not addr:
+        addr = u_boot_utils.find_ram_base(u_boot_console)
+
+    fs = '%s %s' % (f['interface'], f['dev'])
+    output = u_boot_console.run_command('wget %x %s %s %s' %
+                                        (addr, f['fn'], fs, f['dst']))
+    expected_text = 'Bytes transferred = '
+    sz = f.get('size', None)
+    if sz:
+        expected_text += '%d' % sz
+    assert expected_text in output
+
+    output = u_boot_console.run_command_list([
+        'setenv filesize',
+        'size %s %s' % (fs, f['dst']),
+        'printenv filesize'])
+    if sz:
+        assert 'filesize=%x' % sz in ''.join(output)
+
+    expected_crc = f.get('crc32', None)
+    if not expected_crc:
+        return
+
+    if u_boot_console.config.buildconfig.get('config_cmd_crc32', 'n') != 'y':
+        return
+
+    output = u_boot_console.run_command_list([
+        'load %s %x %s' % (fs, addr, f['dst']),
+        'crc32 %x $filesize' % addr])
+    assert expected_crc in ''.join(output)
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.buildconfigspec('cmd_wget')
+@pytest.mark.buildconfigspec('cmd_ext4')
+def test_net_wget_refused(u_boot_console):
+    """Test that wget refuses to stream to a filesystem without offset writes.
+
+    The file would be written in pieces at growing offsets, which ext4 does
+    not support, so the command must fail before anything is fetched. No
+    network is needed for that.
+    """
+
+    c = u_boot_console
+    fs_img = c.config.persistent_data_dir + '/wget.ext4.img'
+    u_boot_utils.run_and_log(c, 'dd if=/dev/zero of=%s bs=1M count=16' %
+                             fs_img)
+    u_boot_utils.run_and_log(c, 'mkfs.ext4 -q %s' % fs_img)
+
+    addr = u_boot_utils.find_ram_base(c)
+    output = c.run_command_list([
+        'host bind 0 %s' % fs_img,
+        'wget %x ubtest-readable.bin host 0 wget.bin || echo refused' % addr,
+        'ext4ls host 0 /'])
+    assert 'Cannot write a file in pieces to ext4' in output[1]
+    assert 'refused' in output[1]
+    assert 'Bytes transferred' not in output[1]
+    assert 'wget.bin' not in output[2]
+
+    u_boot_utils.run_and_log(c, 'rm -f %s' % fs_img)